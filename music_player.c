@@ -1,12 +1,26 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE // accept4, pipe2 and posix_spawn_file_actions_addclosefrom_np
+#endif
 #include "music_player.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <time.h>
 
 // Platform-specific audio headers
 #ifdef _WIN32
     #include <windows.h>
     #include <mmsystem.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
     #include <unistd.h>
+    #define strcasecmp _stricmp
+    #define strncasecmp _strnicmp
     #pragma comment(lib, "winmm.lib")
     
 #elif __APPLE__
@@ -16,459 +30,7939 @@
     #include <unistd.h>
 #endif
 
-int isPlaying = 0; // Global variable to track audio state
-int autoPlayEnabled = 1; // NEW: Global flag for auto-play feature
-int manualStop = 0; // NEW: Flag to indicate user manually stopped playback
-pthread_t playbackThread; // NEW: Thread for monitoring playback
-int stopPlaybackThread = 0; // NEW: Flag to stop the monitoring thread
-MusicPlayer* globalPlayer = NULL; // NEW: Global player reference for thread
-pthread_mutex_t playbackMutex = PTHREAD_MUTEX_INITIALIZER; // NEW: Mutex for thread safety
-time_t songStartTime = 0; // NEW: Track when current song started
-int currentSongDuration = 0; // NEW: Store duration of current song
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <spawn.h>
+    #include <strings.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+#endif
+#ifndef O_CLOEXEC
+    #define O_CLOEXEC 0
+#endif
+
+// Clock the monitor's deadlines are measured on; macOS condition variables
+// can only time out against the wall clock
+#ifdef __APPLE__
+    #define MONITOR_CLOCK CLOCK_REALTIME
+#else
+    #define MONITOR_CLOCK CLOCK_MONOTONIC
+#endif
+#define WINDOWS_STATUS_POLL_MS 250 // MCI has no end event without a window
+
+#ifndef _WIN32
+extern char** environ;
+#endif
+
+// Locking: player->catalog->playlistLock is taken before player->playbackMutex,
+// which is taken before the event loop's mutex. Playback state lives in each
+// MusicPlayer; the audio backend's latency figures are process-wide.
+AudioLatencyStats audioLatency; // Time spent starting and stopping players
+pthread_mutex_t audioLatencyMutex = PTHREAD_MUTEX_INITIALIZER;
 
 // ============================================================================
-// AUTO-PLAY MONITORING THREAD (NEW)
+// METRICS (PER-THREAD COUNTERS AND HISTOGRAMS)
 // ============================================================================
+// Each thread records into a shard of its own that only it writes, so a
+// sample costs a few plain stores: no lock, no shared cache line. Readers
+// add the shards up; a thread's shard is folded into metricsRetired when
+// the thread exits. While metrics are off, recording is one relaxed load
+// and a branch and no clock is read. AUDIORA_METRICS=1 turns them on.
+typedef struct MetricsShard {
+    atomic_llong counters[METRIC_COUNTER_COUNT];
+    struct {
+        atomic_llong buckets[METRIC_BUCKETS + 1];
+        atomic_llong count;
+        atomic_llong sumNs;
+    } histograms[METRIC_HISTOGRAM_COUNT];
+    struct MetricsShard* prev;
+    struct MetricsShard* next;
+} MetricsShard;
 
-// NEW: Thread function - simple time-based approach
-void* monitorPlaybackThread(void* arg) {
-    MusicPlayer* player = (MusicPlayer*)arg;
-    int checkInterval = 2; // Check every 2 seconds
+static atomic_int metricsOn;
+static pthread_mutex_t metricsMutex = PTHREAD_MUTEX_INITIALIZER; // Guards the shard list and metricsRetired
+static MetricsShard* metricsShards;
+static MetricsSnapshot metricsRetired;  // Threads that have exited
+static pthread_key_t metricsKey;
+static pthread_once_t metricsKeyOnce = PTHREAD_ONCE_INIT;
+static _Thread_local MetricsShard* metricsLocal;
+
+static void retireMetricsShard(void* arg) {
+    MetricsShard* shard = (MetricsShard*)arg;
+    pthread_mutex_lock(&metricsMutex);
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) metricsRetired.counters[i] += shard->counters[i];
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        MetricHistogramData* into = &metricsRetired.histograms[h];
+        for (int b = 0; b <= METRIC_BUCKETS; b++) into->buckets[b] += shard->histograms[h].buckets[b];
+        into->count += shard->histograms[h].count;
+        into->sumNs += shard->histograms[h].sumNs;
+    }
+    if (shard->prev) shard->prev->next = shard->next;
+    else metricsShards = shard->next;
+    if (shard->next) shard->next->prev = shard->prev;
+    pthread_mutex_unlock(&metricsMutex);
+    free(shard);
+}
 
-    while (!stopPlaybackThread) {
-        sleep(checkInterval);
+static void createMetricsKey() {
+    pthread_key_create(&metricsKey, retireMetricsShard);
+}
 
-        pthread_mutex_lock(&playbackMutex);
-        
-        // NEW: Don't auto-play if user manually stopped
-        if (autoPlayEnabled && isPlaying && !manualStop && player->currentSong && currentSongDuration > 0) {
-            time_t elapsed = time(NULL) - songStartTime;
-            
-            // If elapsed time exceeds song duration + 1 second buffer, play next
-            if (elapsed >= (currentSongDuration + 1)) {
-                printf("\n[Auto-Play Monitor] Song finished! Playing next...\n");
-                isPlaying = 0; // Reset flag before calling playNext
-                pthread_mutex_unlock(&playbackMutex);
-                playNext(player);
-                pthread_mutex_lock(&playbackMutex);
-            }
+static MetricsShard* metricsShard() {
+    if (metricsLocal) return metricsLocal;
+    MetricsShard* shard = (MetricsShard*)calloc(1, sizeof(MetricsShard));
+    if (!shard) exit(1);
+    pthread_once(&metricsKeyOnce, createMetricsKey);
+    pthread_mutex_lock(&metricsMutex);
+    shard->next = metricsShards;
+    if (metricsShards) metricsShards->prev = shard;
+    metricsShards = shard;
+    pthread_mutex_unlock(&metricsMutex);
+    pthread_setspecific(metricsKey, shard);
+    metricsLocal = shard;
+    return shard;
+}
+
+static inline int metricsActive() {
+    return atomic_load_explicit(&metricsOn, memory_order_relaxed);
+}
+
+// Only the owning thread writes a shard, so a load and a store will do
+static inline void metricAdd(atomic_llong* value, long long amount) {
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static long long metricsNowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void countMetric(MetricCounter counter, long long amount) {
+    if (!metricsActive()) return;
+    metricAdd(&metricsShard()->counters[counter], amount);
+}
+
+static void observeMetricNs(MetricHistogram histogram, long long ns) {
+    if (!metricsActive()) return;
+    if (ns < 0) ns = 0;
+    unsigned long long us = (unsigned long long)(ns + 999) / 1000;
+    int bucket = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    if (us > 1) bucket = 64 - __builtin_clzll(us - 1);
+#else
+    while (bucket < METRIC_BUCKETS && (1ULL << bucket) < us) bucket++;
+#endif
+    if (bucket > METRIC_BUCKETS) bucket = METRIC_BUCKETS;
+    MetricsShard* shard = metricsShard();
+    metricAdd(&shard->histograms[histogram].buckets[bucket], 1);
+    metricAdd(&shard->histograms[histogram].count, 1);
+    metricAdd(&shard->histograms[histogram].sumNs, ns);
+}
+
+// Start a timed section: 0 while metrics are off, which observeMetricSince
+// then ignores
+static long long metricStart() {
+    return metricsActive() ? metricsNowNs() : 0;
+}
+
+static void observeMetricSince(MetricHistogram histogram, long long started) {
+    if (started) observeMetricNs(histogram, metricsNowNs() - started);
+}
+
+// Take player->playbackMutex, timing the wait when another thread holds it
+static void lockPlayback(MusicPlayer* player) {
+    if (!metricsActive()) {
+        pthread_mutex_lock(&player->playbackMutex);
+        return;
+    }
+    countMetric(METRIC_LOCK_ACQUIRES, 1);
+    if (pthread_mutex_trylock(&player->playbackMutex) == 0) return;
+    long long started = metricsNowNs();
+    pthread_mutex_lock(&player->playbackMutex);
+    countMetric(METRIC_LOCK_CONTENDED, 1);
+    observeMetricSince(METRIC_LOCK_WAIT, started);
+}
+
+void setMetricsEnabled(int enabled) {
+    atomic_store(&metricsOn, enabled ? 1 : 0);
+}
+
+int getMetricsEnabled() {
+    return metricsActive();
+}
+
+void getMetricsSnapshot(MetricsSnapshot* snapshot) {
+    pthread_mutex_lock(&metricsMutex);
+    *snapshot = metricsRetired;
+    for (MetricsShard* shard = metricsShards; shard; shard = shard->next) {
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+            snapshot->counters[i] += atomic_load_explicit(&shard->counters[i], memory_order_relaxed);
+        for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+            MetricHistogramData* into = &snapshot->histograms[h];
+            for (int b = 0; b <= METRIC_BUCKETS; b++)
+                into->buckets[b] += atomic_load_explicit(&shard->histograms[h].buckets[b], memory_order_relaxed);
+            into->count += atomic_load_explicit(&shard->histograms[h].count, memory_order_relaxed);
+            into->sumNs += atomic_load_explicit(&shard->histograms[h].sumNs, memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&metricsMutex);
+}
+
+// Upper bound of the bucket holding the given percentile (0-100), in ms;
+// buckets are read as they are, so a shard updated mid-read may be a sample
+// off
+double metricPercentileMs(const MetricHistogramData* histogram, double percentile) {
+    long long total = 0;
+    for (int b = 0; b <= METRIC_BUCKETS; b++) total += histogram->buckets[b];
+    if (total == 0) return 0;
+    long long rank = (long long)(percentile / 100.0 * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    long long seen = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= rank) return (double)(1LL << b) / 1000.0;
+    }
+    return (double)(1LL << METRIC_BUCKETS) / 1000.0;
+}
+
+// ============================================================================
+// PLAYBACK EVENT LOOP (SHARED TIMER HEAP)
+// ============================================================================
+// Every session is driven by one loop: a min-heap of end-of-track deadlines
+// plus a list of sessions with something to handle (a player exited, the
+// queue changed, a track started). A few threads take turns on the loop so
+// one session launching a player or reading ahead from disk does not hold
+// up the rest; a session is only ever serviced by one of them at a time.
+#define PLAYBACK_LOOP_MAX_THREADS 4
+
+// MusicPlayer.loopState
+#define LOOP_IDLE 0
+#define LOOP_READY 1                     // In the ready list
+#define LOOP_RUNNING 2                   // Being serviced
+#define LOOP_RERUN 3                     // Woken while being serviced
+#define LOOP_DETACHED 4                  // Being freed
+
+typedef struct PlaybackLoop {
+    pthread_mutex_t mutex;           // Guards the loop and every session's loop fields
+    pthread_cond_t wake;             // A session became ready or the first timer changed
+    pthread_cond_t serviced;         // A session finished being serviced
+    MusicPlayer** timers;            // Min-heap on wakeAt
+    int timerCount;
+    int timerCapacity;
+    MusicPlayer* readyHead;          // Sessions waiting to be serviced, FIFO
+    MusicPlayer* readyTail;
+    int sessions;                    // Sessions attached
+    int nextSessionId;
+    int threadCount;
+    pthread_t threads[PLAYBACK_LOOP_MAX_THREADS];
+    int stopping;
+    PlaybackLoopStats stats;
+} PlaybackLoop;
+
+static PlaybackLoop playbackLoop = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+static pthread_mutex_t playbackLoopStartMutex = PTHREAD_MUTEX_INITIALIZER; // Starts and stops the threads
+
+#ifdef _WIN32
+int isAudioPlayingWindows(MusicPlayer* player);
+#endif
+static int getWorkerCount();
+static void refreshReadAhead(MusicPlayer* player);
+
+// Whether the running player reports its own exit; if so the duration
+// deadline is ignored so a wrong duration cannot cut the track short
+static int hasEndEvent(MusicPlayer* player) {
+    if (audioEngineActive(player)) return 1;
+#ifdef _WIN32
+    return 0;
+#else
+    pthread_mutex_lock(&player->playerProcessMutex);
+    int tracked = player->playerPid > 0;
+    pthread_mutex_unlock(&player->playerProcessMutex);
+    return tracked;
+#endif
+}
+
+static double elapsedMs(const struct timespec* from, const struct timespec* to) {
+    return (double)(to->tv_sec - from->tv_sec) * 1000.0 + (double)(to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+static int timeBefore(const struct timespec* a, const struct timespec* b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static int deadlinePassed(const struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(MONITOR_CLOCK, &now);
+    return !timeBefore(&now, deadline);
+}
+
+static void timerPlace(int slot, MusicPlayer* player) {
+    playbackLoop.timers[slot] = player;
+    player->timerSlot = slot;
+}
+
+static void timerSiftUp(int slot) {
+    MusicPlayer* player = playbackLoop.timers[slot];
+    while (slot > 0) {
+        int parent = (slot - 1) / 2;
+        if (!timeBefore(&player->wakeAt, &playbackLoop.timers[parent]->wakeAt)) break;
+        timerPlace(slot, playbackLoop.timers[parent]);
+        slot = parent;
+    }
+    timerPlace(slot, player);
+}
+
+static void timerSiftDown(int slot) {
+    MusicPlayer* player = playbackLoop.timers[slot];
+    for (;;) {
+        int child = slot * 2 + 1;
+        if (child >= playbackLoop.timerCount) break;
+        if (child + 1 < playbackLoop.timerCount &&
+            timeBefore(&playbackLoop.timers[child + 1]->wakeAt, &playbackLoop.timers[child]->wakeAt))
+            child++;
+        if (!timeBefore(&playbackLoop.timers[child]->wakeAt, &player->wakeAt)) break;
+        timerPlace(slot, playbackLoop.timers[child]);
+        slot = child;
+    }
+    timerPlace(slot, player);
+}
+
+// Caller holds playbackLoop.mutex
+static void timerCancel(MusicPlayer* player) {
+    int slot = player->timerSlot;
+    if (slot < 0) return;
+    player->timerSlot = -1;
+    MusicPlayer* last = playbackLoop.timers[--playbackLoop.timerCount];
+    if (last == player) return;
+    timerPlace(slot, last);
+    timerSiftDown(slot);
+    timerSiftUp(last->timerSlot);
+}
+
+// Caller holds playbackLoop.mutex
+static void timerArm(MusicPlayer* player, const struct timespec* at) {
+    timerCancel(player);
+    if (playbackLoop.timerCount == playbackLoop.timerCapacity) {
+        int capacity = playbackLoop.timerCapacity ? playbackLoop.timerCapacity * 2 : 64;
+        MusicPlayer** timers = (MusicPlayer**)realloc(playbackLoop.timers, (size_t)capacity * sizeof(MusicPlayer*));
+        if (!timers) exit(1);
+        playbackLoop.timers = timers;
+        playbackLoop.timerCapacity = capacity;
+    }
+    player->wakeAt = *at;
+    timerPlace(playbackLoop.timerCount++, player);
+    timerSiftUp(player->timerSlot);
+    if (player->timerSlot == 0) pthread_cond_signal(&playbackLoop.wake); // Sleepers wait for the old first timer
+}
+
+// Caller holds playbackLoop.mutex
+static void markReady(MusicPlayer* player) {
+    if (player->loopState == LOOP_RUNNING) {
+        player->loopState = LOOP_RERUN;
+        return;
+    }
+    if (player->loopState != LOOP_IDLE) return;
+    player->loopState = LOOP_READY;
+    player->nextReady = NULL;
+    if (playbackLoop.readyTail) playbackLoop.readyTail->nextReady = player;
+    else playbackLoop.readyHead = player;
+    playbackLoop.readyTail = player;
+    pthread_cond_signal(&playbackLoop.wake);
+}
+
+// Have the loop look at a session again: its playback state changed. Safe
+// with or without playbackMutex held.
+static void wakePlayback(MusicPlayer* player) {
+    pthread_mutex_lock(&playbackLoop.mutex);
+    markReady(player);
+    pthread_mutex_unlock(&playbackLoop.mutex);
+}
+
+// Set (at != NULL) or clear the session's timer (caller holds playbackMutex)
+static void schedulePlayback(MusicPlayer* player, const struct timespec* at) {
+    pthread_mutex_lock(&playbackLoop.mutex);
+    if (at) timerArm(player, at);
+    else timerCancel(player);
+    pthread_mutex_unlock(&playbackLoop.mutex);
+}
+
+// Start the fallback end-of-song deadline (caller holds playbackMutex)
+static void startPlaybackClock(MusicPlayer* player, int duration) {
+    player->songStartTime = time(NULL);
+    player->currentSongDuration = duration;
+    clock_gettime(MONITOR_CLOCK, &player->songDeadline);
+    player->songDeadline.tv_sec += duration;
+    player->deadlineArmed = duration > 0;
+    player->isPaused = 0;
+    player->playbackFinished = 0;
+    wakePlayback(player);
+}
+
+// One pass of the auto-play monitor for a session: move on if the track
+// ended, pre-buffer the next one, then sleep until the deadline or the
+// next event
+static void servicePlayback(MusicPlayer* player) {
+    lockPlayback(player);
+    int endEvent = hasEndEvent(player);
+    int finished = player->playbackFinished;
+    if (!finished && player->deadlineArmed && !endEvent) finished = deadlinePassed(&player->songDeadline);
+#ifdef _WIN32
+    if (!finished && player->isPlaying && !player->isPaused) finished = !isAudioPlayingWindows(player);
+#endif
+    player->playbackFinished = 0;
+
+    // NEW: Don't auto-play if user manually stopped. A track the engine
+    // already moved on to is playing regardless, so follow it.
+    int advance = (player->autoPlayEnabled && !player->manualStop) || player->engineAdvancedTo;
+    if (finished && advance && player->isPlaying && player->currentSong) {
+        printf("\n[Auto-Play Monitor] Song finished! Playing next...\n");
+        if (!player->trackEndedAtValid) {
+            clock_gettime(MONITOR_CLOCK, &player->trackEndedAt);
+            player->trackEndedAtValid = 1;
+        }
+        player->isPlaying = 0; // Reset flag before calling playNext
+        player->deadlineArmed = 0;
+        pthread_mutex_unlock(&player->playbackMutex);
+        playNext(player);
+        wakePlayback(player); // Look again once the next track runs
+        return;
+    }
+
+    // Use the idle time while a track plays to read ahead the tracks after
+    // it and load the next one
+    if (player->isPlaying && player->currentSong) {
+        int gapless = player->gaplessEnabled;
+        pthread_mutex_unlock(&player->playbackMutex);
+        refreshReadAhead(player);
+        if (gapless) prebufferNextTrack(player);
+        lockPlayback(player);
+        if (player->playbackFinished) {
+            pthread_mutex_unlock(&player->playbackMutex);
+            wakePlayback(player);
+            return;
         }
+    }
 
-        pthread_mutex_unlock(&playbackMutex);
+    struct timespec wakeAt = player->songDeadline;
+    int timed = player->deadlineArmed && !endEvent;
+#ifdef _WIN32
+    // Poll MCI status while playing; MCI cannot signal the end itself
+    if (player->isPlaying && !player->isPaused) {
+        struct timespec poll;
+        clock_gettime(MONITOR_CLOCK, &poll);
+        poll.tv_nsec += WINDOWS_STATUS_POLL_MS * 1000000L;
+        if (poll.tv_nsec >= 1000000000L) {
+            poll.tv_sec++;
+            poll.tv_nsec -= 1000000000L;
+        }
+        if (!timed || timeBefore(&poll, &wakeAt)) wakeAt = poll;
+        timed = 1;
     }
+#endif
+    schedulePlayback(player, timed ? &wakeAt : NULL);
+    pthread_mutex_unlock(&player->playbackMutex);
+}
 
+// Loop thread: service ready sessions first, then sleep until the earliest
+// timer or the next wake-up
+static void* playbackLoopThread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&playbackLoop.mutex);
+    while (!playbackLoop.stopping) {
+        MusicPlayer* player = playbackLoop.readyHead;
+        if (player) {
+            playbackLoop.readyHead = player->nextReady;
+            if (!playbackLoop.readyHead) playbackLoop.readyTail = NULL;
+            player->loopState = LOOP_RUNNING;
+            playbackLoop.stats.wakeups++;
+            pthread_mutex_unlock(&playbackLoop.mutex);
+            countMetric(METRIC_LOOP_WAKEUPS, 1);
+            servicePlayback(player);
+            pthread_mutex_lock(&playbackLoop.mutex);
+            int rerun = player->loopState == LOOP_RERUN;
+            player->loopState = LOOP_IDLE;
+            if (rerun) markReady(player);
+            pthread_cond_broadcast(&playbackLoop.serviced);
+            continue;
+        }
+
+        if (playbackLoop.timerCount == 0) {
+            pthread_cond_wait(&playbackLoop.wake, &playbackLoop.mutex);
+            continue;
+        }
+        player = playbackLoop.timers[0];
+        struct timespec now;
+        clock_gettime(MONITOR_CLOCK, &now);
+        if (timeBefore(&now, &player->wakeAt)) {
+            struct timespec wakeAt = player->wakeAt;
+            pthread_cond_timedwait(&playbackLoop.wake, &playbackLoop.mutex, &wakeAt);
+            continue;
+        }
+        double lateMs = elapsedMs(&player->wakeAt, &now);
+        playbackLoop.stats.timersFired++;
+        playbackLoop.stats.totalLatenessMs += lateMs;
+        if (lateMs > playbackLoop.stats.maxLatenessMs) playbackLoop.stats.maxLatenessMs = lateMs;
+        timerCancel(player);
+        markReady(player);
+        countMetric(METRIC_TIMERS_FIRED, 1);
+        observeMetricNs(METRIC_TIMER_LATENESS, (long long)(lateMs * 1e6));
+    }
+    pthread_mutex_unlock(&playbackLoop.mutex);
     return NULL;
 }
 
+// Register a new session with the loop, starting the loop threads with the
+// first one
+static void attachPlaybackLoop(MusicPlayer* player) {
+    pthread_mutex_lock(&playbackLoopStartMutex);
+    pthread_mutex_lock(&playbackLoop.mutex);
+    player->timerSlot = -1;
+    player->loopState = LOOP_IDLE;
+    player->nextReady = NULL;
+    player->sessionId = ++playbackLoop.nextSessionId;
+    int start = playbackLoop.sessions++ == 0;
+    pthread_mutex_unlock(&playbackLoop.mutex);
+
+    if (start) {
+        pthread_condattr_t condAttr;
+        pthread_condattr_init(&condAttr);
+#ifndef __APPLE__
+        pthread_condattr_setclock(&condAttr, MONITOR_CLOCK);
+#endif
+        pthread_cond_init(&playbackLoop.wake, &condAttr);
+        pthread_condattr_destroy(&condAttr);
+        pthread_cond_init(&playbackLoop.serviced, NULL);
+        playbackLoop.stopping = 0;
+        int threads = getWorkerCount();
+        if (threads > PLAYBACK_LOOP_MAX_THREADS) threads = PLAYBACK_LOOP_MAX_THREADS;
+        playbackLoop.threadCount = 0;
+        for (int i = 0; i < threads; i++) {
+            if (pthread_create(&playbackLoop.threads[playbackLoop.threadCount], NULL, playbackLoopThread, NULL) == 0)
+                playbackLoop.threadCount++;
+        }
+        if (playbackLoop.threadCount == 0) exit(1);
+    }
+    pthread_mutex_unlock(&playbackLoopStartMutex);
+}
+
+// Take a session off the loop, waiting out a pass in progress; the threads
+// stop with the last session. Caller holds no playback locks.
+static void detachPlaybackLoop(MusicPlayer* player) {
+    pthread_mutex_lock(&playbackLoopStartMutex);
+    pthread_mutex_lock(&playbackLoop.mutex);
+    while (player->loopState == LOOP_RUNNING || player->loopState == LOOP_RERUN)
+        pthread_cond_wait(&playbackLoop.serviced, &playbackLoop.mutex);
+    if (player->loopState == LOOP_READY) {
+        MusicPlayer** link = &playbackLoop.readyHead;
+        MusicPlayer* previous = NULL;
+        while (*link != player) {
+            previous = *link;
+            link = &(*link)->nextReady;
+        }
+        *link = player->nextReady;
+        if (playbackLoop.readyTail == player) playbackLoop.readyTail = previous;
+    }
+    player->loopState = LOOP_DETACHED;
+    timerCancel(player);
+    int stop = --playbackLoop.sessions == 0;
+    if (stop) {
+        playbackLoop.stopping = 1;
+        pthread_cond_broadcast(&playbackLoop.wake);
+    }
+    pthread_mutex_unlock(&playbackLoop.mutex);
+
+    if (stop) {
+        for (int i = 0; i < playbackLoop.threadCount; i++) pthread_join(playbackLoop.threads[i], NULL);
+        playbackLoop.threadCount = 0;
+        pthread_cond_destroy(&playbackLoop.wake);
+        pthread_cond_destroy(&playbackLoop.serviced);
+        free(playbackLoop.timers);
+        playbackLoop.timers = NULL;
+        playbackLoop.timerCapacity = 0;
+    }
+    pthread_mutex_unlock(&playbackLoopStartMutex);
+}
+
+// The thread count changes under playbackLoopStartMutex, the rest under the
+// loop's mutex
+void getPlaybackLoopStats(PlaybackLoopStats* stats) {
+    pthread_mutex_lock(&playbackLoopStartMutex);
+    pthread_mutex_lock(&playbackLoop.mutex);
+    *stats = playbackLoop.stats;
+    stats->sessions = playbackLoop.sessions;
+    stats->threads = playbackLoop.threadCount;
+    stats->timers = playbackLoop.timerCount;
+    pthread_mutex_unlock(&playbackLoop.mutex);
+    pthread_mutex_unlock(&playbackLoopStartMutex);
+}
+
 // ============================================================================
 // AUDIO PLAYBACK FUNCTIONS (Platform-Specific)
 // ============================================================================
 
+// Linear factor for a gain in decibels
+static double dbToGain(double db) {
+    return db == 0 ? 1.0 : pow(10.0, db / 20.0);
+}
+
+#ifndef _WIN32
+typedef struct PlayerWaiter {
+    MusicPlayer* player;
+    pid_t pid;
+} PlayerWaiter;
+
+// Reap the player and report a natural end if it is still the current one.
+// The exited player is left a zombie until its PID is cleared under the
+// lock, so a signal sent under the lock can never reach a reused PID.
+// freeMusicPlayer waits for every waiter before the session goes away.
+static void* waitForPlayerExit(void* arg) {
+    PlayerWaiter* waiter = (PlayerWaiter*)arg;
+    MusicPlayer* player = waiter->player;
+    pid_t pid = waiter->pid;
+    free(waiter);
+    siginfo_t info;
+    while (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR);
+
+    pthread_mutex_lock(&player->playerProcessMutex);
+    int current = pid == player->playerPid;
+    if (current) player->playerPid = 0;
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+    pthread_mutex_unlock(&player->playerProcessMutex);
+
+    if (current) {
+        lockPlayback(player);
+        player->playbackFinished = 1;
+        clock_gettime(MONITOR_CLOCK, &player->trackEndedAt);
+        player->trackEndedAtValid = 1;
+        wakePlayback(player);
+        pthread_mutex_unlock(&player->playbackMutex);
+    }
+
+    pthread_mutex_lock(&player->playerProcessMutex);
+    player->playerWaiters--;
+    pthread_cond_broadcast(&player->playerWaiterDone);
+    pthread_mutex_unlock(&player->playerProcessMutex);
+    return NULL;
+}
+
+// How a player program takes a loudness gain
+typedef enum PlayerGainOption {
+    PLAYER_GAIN_NONE,                // Plays at full level
+    PLAYER_GAIN_SCALE,               // mpg123 -f: output scale, 32768 = unity
+    PLAYER_GAIN_FILTER,              // ffplay -af volume=XdB
+    PLAYER_GAIN_VOLUME               // afplay -v: linear volume, 1 = unity
+} PlayerGainOption;
+
+// External player programs in order of preference
+typedef struct PlayerBackend {
+    const char* program;
+    const char* args[4];             // Options placed before the file path
+    PlayerGainOption gain;
+} PlayerBackend;
+
+#ifdef __APPLE__
+static const PlayerBackend playerBackends[] = {
+    { "afplay", { NULL }, PLAYER_GAIN_VOLUME },
+};
+#else
+static const PlayerBackend playerBackends[] = {
+    { "mpg123", { "-q", NULL }, PLAYER_GAIN_SCALE },
+    { "ffplay", { "-nodisp", "-autoexit", NULL }, PLAYER_GAIN_FILTER },
+    { "aplay", { NULL }, PLAYER_GAIN_NONE },
+};
+#endif
+
+static const PlayerBackend* audioBackend = NULL;     // NULL if none was found
+static char audioBackendPath[MAX_FILENAME];          // Resolved executable
+static pthread_once_t audioBackendOnce = PTHREAD_ONCE_INIT;
+
+// Search PATH for an executable without going through a shell
+static int findExecutable(const char* program, char* resolved, size_t size) {
+    const char* path = getenv("PATH");
+    if (!path) path = "/usr/bin:/bin";
+    while (*path) {
+        const char* end = strchr(path, ':');
+        size_t length = end ? (size_t)(end - path) : strlen(path);
+        if (length > 0 && (size_t)snprintf(resolved, size, "%.*s/%s", (int)length, path, program) < size &&
+            access(resolved, X_OK) == 0)
+            return 0;
+        path += length;
+        if (*path == ':') path++;
+    }
+    return -1;
+}
+
+static void detectAudioBackendOnce() {
+    for (size_t i = 0; i < sizeof(playerBackends) / sizeof(playerBackends[0]); i++) {
+        if (findExecutable(playerBackends[i].program, audioBackendPath, sizeof(audioBackendPath)) == 0) {
+            audioBackend = &playerBackends[i];
+            return;
+        }
+    }
+}
+
+// Pick the external player once; later calls return the cached choice
+const char* detectAudioBackend() {
+    pthread_once(&audioBackendOnce, detectAudioBackendOnce);
+    return audioBackend ? audioBackend->program : NULL;
+}
+
+// Last file action of every spawn: the child keeps its stdio and nothing
+// else, even a descriptor another thread opened without close-on-exec
+static void closeInheritedDescriptors(posix_spawn_file_actions_t* actions) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+    posix_spawn_file_actions_addclosefrom_np(actions, STDERR_FILENO + 1);
+#else
+    (void)actions;
+#endif
+}
+
+// A pipe that is close-on-exec from the start; set afterwards, another
+// thread's spawn could inherit it in between
+static int openCloexecPipe(int fds[2]) {
+#ifdef __linux__
+    return pipe2(fds, O_CLOEXEC);
+#else
+    if (pipe(fds) != 0) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+// Spawn the player directly on the file and watch it exit
+static int launchPlayerProcess(MusicPlayer* player, const char* filepath, double gainDb) {
+    if (!detectAudioBackend()) return -1;
+
+    const char* argv[10];
+    char gain[48];
+    int argc = 0;
+    argv[argc++] = audioBackend->program;
+    for (int i = 0; audioBackend->args[i]; i++) argv[argc++] = audioBackend->args[i];
+    if (gainDb != 0 && audioBackend->gain != PLAYER_GAIN_NONE) {
+        if (audioBackend->gain == PLAYER_GAIN_SCALE) {
+            argv[argc++] = "-f";
+            snprintf(gain, sizeof(gain), "%.0f", 32768.0 * dbToGain(gainDb));
+        } else if (audioBackend->gain == PLAYER_GAIN_FILTER) {
+            argv[argc++] = "-af";
+            snprintf(gain, sizeof(gain), "volume=%.2fdB", gainDb);
+        } else {
+            argv[argc++] = "-v";
+            snprintf(gain, sizeof(gain), "%.3f", dbToGain(gainDb));
+        }
+        argv[argc++] = gain;
+    }
+    argv[argc++] = filepath;
+    argv[argc] = NULL;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    closeInheritedDescriptors(&actions);
+    pid_t pid;
+    int failed = posix_spawn(&pid, audioBackendPath, &actions, NULL, (char* const*)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (failed) return -1;
+
+    PlayerWaiter* waiter = (PlayerWaiter*)malloc(sizeof(PlayerWaiter));
+    if (!waiter) exit(1);
+    waiter->player = player;
+    waiter->pid = pid;
+    pthread_mutex_lock(&player->playerProcessMutex);
+    player->playerPid = pid;
+    player->playerWaiters++;
+    pthread_mutex_unlock(&player->playerProcessMutex);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, waitForPlayerExit, waiter) == 0) {
+        pthread_detach(thread);
+    } else {
+        // No waiter: fall back to the duration deadline
+        free(waiter);
+        pthread_mutex_lock(&player->playerProcessMutex);
+        player->playerPid = 0;
+        player->playerWaiters--;
+        pthread_mutex_unlock(&player->playerProcessMutex);
+    }
+    return 0;
+}
+
+// Stop the session's own player, if any. The PID is forgotten first so its
+// exit is not mistaken for a natural end; a paused player is resumed so it
+// can act on the signal. Signals go out under the lock, before the waiter
+// can reap the process.
+static void killPlayerProcess(MusicPlayer* player) {
+    pthread_mutex_lock(&player->playerProcessMutex);
+    pid_t pid = player->playerPid;
+    player->playerPid = 0;
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        kill(pid, SIGCONT);
+    }
+    pthread_mutex_unlock(&player->playerProcessMutex);
+}
+
+static void signalPlayerProcess(MusicPlayer* player, int sig) {
+    pthread_mutex_lock(&player->playerProcessMutex);
+    if (player->playerPid > 0) kill(player->playerPid, sig);
+    pthread_mutex_unlock(&player->playerProcessMutex);
+}
+#endif
+
 #ifdef _WIN32
-void playAudioWindows(const char* filepath) {
-    char command[512];
-    mciSendString("close mp3", NULL, 0, NULL);
-    sprintf(command, "open \"%s\" type mpegvideo alias mp3", filepath);
+// Each session drives its own MCI device, named after the session
+static MCIERROR sendMciCommand(MusicPlayer* player, const char* verb, const char* rest, char* status, UINT size) {
+    char command[MAX_FILENAME + 96];
+    snprintf(command, sizeof(command), "%s audiora%d%s", verb, player->sessionId, rest ? rest : "");
+    return mciSendString(command, status, size, NULL);
+}
+
+int playAudioWindows(MusicPlayer* player, const char* filepath, double gainDb) {
+    char command[MAX_FILENAME + 96];
+    sendMciCommand(player, "close", NULL, NULL, 0);
+    snprintf(command, sizeof(command), "open \"%s\" type mpegvideo alias audiora%d", filepath, player->sessionId);
     if (mciSendString(command, NULL, 0, NULL) != 0) {
         printf("Error: Could not open audio file.\n");
-        return;
+        return -1;
+    }
+    if (gainDb < 0) {
+        // MCI volume runs 0..1000 and cannot boost, so only cuts apply
+        char volume[32];
+        snprintf(volume, sizeof(volume), " volume to %d", (int)(1000 * dbToGain(gainDb) + 0.5));
+        sendMciCommand(player, "setaudio", volume, NULL, 0);
     }
-    if (mciSendString("play mp3", NULL, 0, NULL) != 0) {
+    if (sendMciCommand(player, "play", NULL, NULL, 0) != 0) {
         printf("Error: Could not play audio file.\n");
-        mciSendString("close mp3", NULL, 0, NULL);
-        return;
+        sendMciCommand(player, "close", NULL, NULL, 0);
+        return -1;
     }
-    isPlaying = 1;
     printf("♪ Audio playback started!\n");
+    return 0;
 }
 
-void stopAudioWindows() {
-    mciSendString("stop mp3", NULL, 0, NULL);
-    mciSendString("close mp3", NULL, 0, NULL);
-    isPlaying = 0;
+void pauseAudioWindows(MusicPlayer* player) {
+    sendMciCommand(player, "pause", NULL, NULL, 0);
 }
 
-int isAudioPlayingWindows() {
-    char status[128];
-    mciSendString("status mp3 mode", status, sizeof(status), NULL);
-    return (strcmp(status, "playing") == 0);
+void resumeAudioWindows(MusicPlayer* player) {
+    sendMciCommand(player, "resume", NULL, NULL, 0);
 }
-#elif __APPLE__
-void playAudioMac(const char* filepath) {
-    char command[512];
-    sprintf(command, "afplay \"%s\" &", filepath);
-    system(command);
-    isPlaying = 1;
-    printf("♪ Audio playback started!\n");
+
+void stopAudioWindows(MusicPlayer* player) {
+    sendMciCommand(player, "stop", NULL, NULL, 0);
+    sendMciCommand(player, "close", NULL, NULL, 0);
 }
 
-void stopAudioMac() {
-    system("killall afplay 2>/dev/null");
-    isPlaying = 0;
+int isAudioPlayingWindows(MusicPlayer* player) {
+    char status[128] = "";
+    sendMciCommand(player, "status", " mode", status, sizeof(status));
+    return (strcmp(status, "playing") == 0);
 }
-#elif __linux__
-void playAudioLinux(const char* filepath) {
-    char command[512];
-    if (system("which mpg123 > /dev/null 2>&1") == 0)
-        sprintf(command, "mpg123 -q \"%s\" &", filepath);
-    else if (system("which ffplay > /dev/null 2>&1") == 0)
-        sprintf(command, "ffplay -nodisp -autoexit \"%s\" &", filepath);
-    else if (system("which aplay > /dev/null 2>&1") == 0)
-        sprintf(command, "aplay \"%s\" &", filepath);
-    else {
+#else
+// A session runs one player at a time: the one it replaces is stopped first
+int playAudioProcess(MusicPlayer* player, const char* filepath, double gainDb) {
+    if (!detectAudioBackend()) {
         printf("Error: No audio player found.\n");
-        return;
+        return -1;
+    }
+    killPlayerProcess(player);
+    if (launchPlayerProcess(player, filepath, gainDb) != 0) {
+        printf("Error: Could not start %s.\n", audioBackend->program);
+        return -1;
     }
-    system(command);
-    isPlaying = 1;
     printf("♪ Audio playback started!\n");
+    return 0;
 }
 
-void stopAudioLinux() {
-    system("killall mpg123 2>/dev/null");
-    system("killall ffplay 2>/dev/null");
-    system("killall aplay 2>/dev/null");
-    isPlaying = 0;
+void stopAudioProcess(MusicPlayer* player) {
+    killPlayerProcess(player);
 }
 #endif
 
 // ============================================================================
-// CROSS PLATFORM AUDIO INTERFACE
+// DSP KERNELS (SIMD WITH SCALAR FALLBACK)
 // ============================================================================
-void playAudioFile(const char* filepath) {
-#ifdef _WIN32
-    playAudioWindows(filepath);
-#elif __APPLE__
-    playAudioMac(filepath);
-#elif __linux__
-    playAudioLinux(filepath);
-#else
-    printf("Audio not supported.\n");
+// Sample conversion, gain, mixing and crossfading on interleaved PCM. Each
+// kernel has a scalar version and, on x86, SSE2 and AVX2 versions; the
+// widest one the CPU supports is picked once at runtime. AUDIORA_SIMD
+// ("scalar", "sse2" or "avx2") caps the choice.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define DSP_X86 1
+    #include <immintrin.h>
 #endif
+
+#define DSP_BLOCK_FRAMES 1024            // Scratch block size for float stages
+#define PCM_SCALE (1.0f / 32768.0f)
+
+typedef struct DspKernels {
+    const char* name;
+    void (*int16ToFloat)(const int16_t* src, float* dst, size_t count);
+    void (*floatToInt16)(const float* src, int16_t* dst, size_t count);
+    void (*gain)(int16_t* samples, size_t count, float gain);
+    void (*mix)(int16_t* dst, const int16_t* src, size_t count);
+    void (*blend)(float* dst, const float* a, const float* gainA, const float* b, const float* gainB, size_t count);
+} DspKernels;
+
+static int16_t saturate16(float value) {
+    if (value >= 32767.0f) return 32767;
+    if (value <= -32768.0f) return -32768;
+    return (int16_t)(value < 0 ? value - 0.5f : value + 0.5f);
 }
 
-void stopAudioFile() {
-#ifdef _WIN32
-    stopAudioWindows();
-#elif __APPLE__
-    stopAudioMac();
-#elif __linux__
-    stopAudioLinux();
-#endif
-    
-    // NEW: Reset auto-play tracking variables when stopping
-    isPlaying = 0;
-    songStartTime = 0;
-    currentSongDuration = 0;
+static void int16ToFloatScalar(const int16_t* src, float* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] = src[i] * PCM_SCALE;
 }
 
-int isAudioPlaying() {
-#ifdef _WIN32
-    return isAudioPlayingWindows();
-#else
-    return isPlaying;
-#endif
+static void floatToInt16Scalar(const float* src, int16_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] = saturate16(src[i] * 32768.0f);
 }
 
-// ============================================================================
-// INITIALIZATION AND CLEANUP
-// ============================================================================
-MusicPlayer* initMusicPlayer() {
-    MusicPlayer* player = (MusicPlayer*)malloc(sizeof(MusicPlayer));
-    if (!player) exit(1);
+static void gainScalar(int16_t* samples, size_t count, float gain) {
+    for (size_t i = 0; i < count; i++) samples[i] = saturate16(samples[i] * gain);
+}
 
-    player->playlist = NULL;
-    player->recentlyPlayed = NULL;
-    player->currentSong = NULL;
-    player->songCount = 0;
-    player->nextId = 1;
+static void mixScalar(int16_t* dst, const int16_t* src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int sum = dst[i] + src[i];
+        dst[i] = (int16_t)(sum > 32767 ? 32767 : (sum < -32768 ? -32768 : sum));
+    }
+}
 
-    player->upcomingQueue = (Queue*)malloc(sizeof(Queue));
-    player->upcomingQueue->front = player->upcomingQueue->rear = NULL;
-    player->upcomingQueue->count = 0;
+static void blendScalar(float* dst, const float* a, const float* gainA, const float* b, const float* gainB, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] = a[i] * gainA[i] + b[i] * gainB[i];
+}
 
-    // NEW: Set global player reference and start monitoring thread
-    globalPlayer = player;
-    stopPlaybackThread = 0;
-    pthread_create(&playbackThread, NULL, monitorPlaybackThread, player);
+static const DspKernels dspScalar = {
+    "scalar", int16ToFloatScalar, floatToInt16Scalar, gainScalar, mixScalar, blendScalar
+};
 
-    return player;
+#ifdef DSP_X86
+// SSE2: 8 samples per step. Tails fall through to the scalar loops.
+__attribute__((target("sse2")))
+static void int16ToFloatSse2(const int16_t* src, float* dst, size_t count) {
+    const __m128 scale = _mm_set1_ps(PCM_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i pcm = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(pcm, pcm), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(pcm, pcm), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    int16ToFloatScalar(src + i, dst + i, count - i);
 }
 
-void freeMusicPlayer(MusicPlayer* player) {
-    if (!player) return;
-    
-    // NEW: Stop the playback monitoring thread
-    stopPlaybackThread = 1;
-    pthread_join(playbackThread, NULL);
-    pthread_mutex_destroy(&playbackMutex);
+__attribute__((target("sse2")))
+static void floatToInt16Sse2(const float* src, int16_t* dst, size_t count) {
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+        __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(lo, hi)); // Saturates
+    }
+    floatToInt16Scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void gainSse2(int16_t* samples, size_t count, float gain) {
+    const __m128 factor = _mm_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i pcm = _mm_loadu_si128((const __m128i*)(samples + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(pcm, pcm), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(pcm, pcm), 16));
+        __m128i out = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(lo, factor)), _mm_cvtps_epi32(_mm_mul_ps(hi, factor)));
+        _mm_storeu_si128((__m128i*)(samples + i), out);
+    }
+    gainScalar(samples + i, count - i, gain);
+}
 
-    stopAudioFile();
+__attribute__((target("sse2")))
+static void mixSse2(int16_t* dst, const int16_t* src, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epi16(a, b));
+    }
+    mixScalar(dst + i, src + i, count - i);
+}
 
-    Song* current = player->playlist;
-    while (current) {
-        Song* temp = current;
-        current = current->next;
-        free(temp);
+__attribute__((target("sse2")))
+static void blendSse2(float* dst, const float* a, const float* gainA, const float* b, const float* gainB, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(gainA + i));
+        __m128 y = _mm_mul_ps(_mm_loadu_ps(b + i), _mm_loadu_ps(gainB + i));
+        _mm_storeu_ps(dst + i, _mm_add_ps(x, y));
+    }
+    blendScalar(dst + i, a + i, gainA + i, b + i, gainB + i, count - i);
+}
+
+static const DspKernels dspSse2 = {
+    "sse2", int16ToFloatSse2, floatToInt16Sse2, gainSse2, mixSse2, blendSse2
+};
+
+// AVX2: 16 samples per step. packs works per 128-bit lane, so its result
+// is put back in order with a cross-lane permute.
+__attribute__((target("avx2")))
+static void int16ToFloatAvx2(const int16_t* src, float* dst, size_t count) {
+    const __m256 scale = _mm256_set1_ps(PCM_SCALE);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i + 8)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+    }
+    int16ToFloatSse2(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void floatToInt16Avx2(const float* src, int16_t* dst, size_t count) {
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale));
+        __m256i hi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale));
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)(dst + i), packed);
+    }
+    floatToInt16Sse2(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void gainAvx2(int16_t* samples, size_t count, float gain) {
+    const __m256 factor = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(samples + i))));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(samples + i + 8))));
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(lo, factor)),
+                                            _mm256_cvtps_epi32(_mm256_mul_ps(hi, factor)));
+        _mm256_storeu_si256((__m256i*)(samples + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    gainSse2(samples + i, count - i, gain);
+}
+
+__attribute__((target("avx2")))
+static void mixAvx2(int16_t* dst, const int16_t* src, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_adds_epi16(a, b));
+    }
+    mixSse2(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void blendAvx2(float* dst, const float* a, const float* gainA, const float* b, const float* gainB, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(gainA + i));
+        __m256 y = _mm256_mul_ps(_mm256_loadu_ps(b + i), _mm256_loadu_ps(gainB + i));
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(x, y));
+    }
+    blendSse2(dst + i, a + i, gainA + i, b + i, gainB + i, count - i);
+}
+
+static const DspKernels dspAvx2 = {
+    "avx2", int16ToFloatAvx2, floatToInt16Avx2, gainAvx2, mixAvx2, blendAvx2
+};
+#endif
+
+static const DspKernels* dsp = &dspScalar;
+static pthread_once_t dspOnce = PTHREAD_ONCE_INIT;
+
+// Kernel sets this CPU can run, narrowest first
+static int availableDspKernels(const DspKernels** sets) {
+    int count = 0;
+    sets[count++] = &dspScalar;
+#ifdef DSP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) sets[count++] = &dspSse2;
+    if (__builtin_cpu_supports("avx2")) sets[count++] = &dspAvx2;
+#endif
+    return count;
+}
+
+static void selectDspKernels() {
+    const DspKernels* sets[3];
+    int count = availableDspKernels(sets);
+    const char* cap = getenv("AUDIORA_SIMD");
+    dsp = sets[count - 1];
+    for (int i = 0; cap && i < count; i++) {
+        if (strcmp(cap, sets[i]->name) == 0) dsp = sets[i];
+    }
+}
+
+static const DspKernels* dspKernels() {
+    pthread_once(&dspOnce, selectDspKernels);
+    return dsp;
+}
+
+const char* dspKernelName() {
+    return dspKernels()->name;
+}
+
+void dspInt16ToFloat(const int16_t* src, float* dst, size_t count) {
+    dspKernels()->int16ToFloat(src, dst, count);
+}
+
+void dspFloatToInt16(const float* src, int16_t* dst, size_t count) {
+    dspKernels()->floatToInt16(src, dst, count);
+}
+
+void dspApplyGain(int16_t* samples, size_t count, float gain) {
+    if (gain == 1.0f) return;
+    dspKernels()->gain(samples, count, gain);
+}
+
+void dspMix(int16_t* dst, const int16_t* src, size_t count) {
+    dspKernels()->mix(dst, src, count);
+}
+
+// Equal-power crossfade over frames interleaved frames: the outgoing track
+// follows cos and the incoming one sin of a quarter turn, so the summed
+// power stays constant. The curve is stepped by rotation, which needs no
+// libm: the per-frame angle is tiny, so its short Taylor series is exact
+// to double precision.
+static void crossfadeWith(const DspKernels* kernels, int16_t* dst, const int16_t* outgoing,
+                          const int16_t* incoming, size_t frames, int channels) {
+    float a[DSP_BLOCK_FRAMES * 2], b[DSP_BLOCK_FRAMES * 2];
+    float gainA[DSP_BLOCK_FRAMES * 2], gainB[DSP_BLOCK_FRAMES * 2];
+    double step = 1.5707963267948966 / (double)(frames ? frames : 1);
+    double stepCos = 1 - step * step / 2 + step * step * step * step / 24;
+    double stepSin = step - step * step * step / 6 + step * step * step * step * step / 120;
+    double c = 1, s = 0;
+    size_t blockFrames = channels <= 2 ? DSP_BLOCK_FRAMES : (size_t)DSP_BLOCK_FRAMES * 2 / channels;
+
+    for (size_t done = 0; done < frames; done += blockFrames) {
+        size_t n = frames - done < blockFrames ? frames - done : blockFrames;
+        size_t samples = n * channels;
+        for (size_t f = 0; f < n; f++) {
+            for (int ch = 0; ch < channels; ch++) {
+                gainA[f * channels + ch] = (float)c;
+                gainB[f * channels + ch] = (float)s;
+            }
+            double nc = c * stepCos - s * stepSin;
+            s = s * stepCos + c * stepSin;
+            c = nc;
+        }
+        kernels->int16ToFloat(outgoing + done * channels, a, samples);
+        kernels->int16ToFloat(incoming + done * channels, b, samples);
+        kernels->blend(a, a, gainA, b, gainB, samples);
+        kernels->floatToInt16(a, dst + done * channels, samples);
+    }
+}
+
+void dspCrossfade(int16_t* dst, const int16_t* outgoing, const int16_t* incoming, size_t frames, int channels) {
+    crossfadeWith(dspKernels(), dst, outgoing, incoming, frames, channels);
+}
+
+static double benchNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Throughput of every kernel set this CPU supports, in samples per second
+void benchmarkDspKernels() {
+    const size_t count = 1 << 16;        // One buffer, about 0.7 s of 44.1 kHz stereo
+    const int rounds = 200;
+    int16_t* pcm = (int16_t*)malloc(count * sizeof(int16_t));
+    int16_t* other = (int16_t*)malloc(count * sizeof(int16_t));
+    int16_t* out = (int16_t*)malloc(count * sizeof(int16_t));
+    float* floats = (float*)malloc(count * sizeof(float));
+    if (!pcm || !other || !out || !floats) exit(1);
+    for (size_t i = 0; i < count; i++) {
+        pcm[i] = (int16_t)((i * 7919) & 0xFFFF);
+        other[i] = (int16_t)((i * 104729) & 0xFFFF);
+    }
+
+    const DspKernels* sets[3];
+    int setCount = availableDspKernels(sets);
+    printf("\n%-8s %14s %14s %14s %14s %14s\n", "Kernels", "int16->float", "float->int16", "gain", "mix", "crossfade");
+    for (int k = 0; k < setCount; k++) {
+        const DspKernels* kernels = sets[k];
+        double rate[5];
+        for (int test = 0; test < 5; test++) {
+            double start = benchNow();
+            for (int r = 0; r < rounds; r++) {
+                switch (test) {
+                    case 0: kernels->int16ToFloat(pcm, floats, count); break;
+                    case 1: kernels->floatToInt16(floats, out, count); break;
+                    case 2: kernels->gain(out, count, 0.7f); break;
+                    case 3: kernels->mix(out, other, count); break;
+                    default: crossfadeWith(kernels, out, pcm, other, count / 2, 2); break;
+                }
+            }
+            double seconds = benchNow() - start;
+            rate[test] = seconds > 0 ? (double)count * rounds / seconds : 0;
+        }
+        printf("%-8s", kernels->name);
+        for (int test = 0; test < 5; test++) printf(" %12.1fM/s", rate[test] / 1e6);
+        printf("%s\n", kernels == dspKernels() ? "  (in use)" : "");
+    }
+
+    free(pcm);
+    free(other);
+    free(out);
+    free(floats);
+}
+
+// ============================================================================
+// IN-PROCESS AUDIO ENGINE
+// ============================================================================
+// PCM WAV files can be played without an external player. A decoder thread
+// fills a single-producer/single-consumer ring of interleaved 16-bit samples
+// and an output thread drains it into a sink: the sound device (through an
+// aplay pipe on Linux), a WAV file or nothing at all. When the monitor has
+// queued the next track, the decoder runs straight into it, so consecutive
+// tracks are joined at the sample boundary, or overlapped by the configured
+// crossfade. Every session has its own engine; where output goes (the sink)
+// and the crossfade are set for the whole process.
+#define ENGINE_RING_SECONDS 2            // Decoded audio buffered ahead
+#define MAX_CROSSFADE_SECONDS 10
+#define ENGINE_PERIOD_FRAMES 1024        // Frames handed to the sink at once
+#define ENGINE_NEXT_WAIT_MS 250          // Ring level at which the decoder stops waiting for a next track
+
+typedef struct PcmRingBuffer {
+    int16_t* samples;
+    size_t capacity;                 // Samples, power of two
+    atomic_size_t head;              // Total samples written (producer)
+    atomic_size_t tail;              // Total samples read (consumer)
+} PcmRingBuffer;
+
+typedef struct AudioSink {
+    AudioSinkType type;
+    int realtime;                    // Pace null/WAV sinks at the sample rate
+    FILE* file;                      // WAV sink output
+    uint32_t dataBytes;              // PCM bytes written to the WAV sink
+    int fd;                          // Device sink pipe
+#ifndef _WIN32
+    pid_t pid;                       // Device sink process
+#endif
+    struct timespec nextPeriod;      // Pacing deadline
+} AudioSink;
+
+typedef struct AudioEngine {
+    pthread_mutex_t controlMutex;    // Serialises start/stop/queue from any thread
+    atomic_int active;               // Threads started and not yet joined
+    WavInfo format;                  // Format of the running stream
+    PcmRingBuffer ring;
+    AudioSink sink;
+    pthread_t decoderThread;
+    pthread_t outputThread;
+    atomic_int stopRequested;
+    atomic_int paused;
+    atomic_int decoderDone;          // No more samples will be written
+    atomic_int outputDone;           // Output thread has drained the ring
+    atomic_int volumePermille;       // Output gain, 1000 = unity
+    atomic_llong framesPlayed;       // Frames handed to the sink
+    atomic_llong trackStartFrame;    // framesPlayed at the start of this track
+    atomic_llong underrunFrames;     // Silence inserted while starved
+    atomic_long seamlessTransitions; // Tracks joined inside the engine
+    struct timespec requestedAt;     // When the running stream was asked for
+
+    // Current decoder input
+    FILE* input;
+    uint32_t inputRemaining;         // PCM bytes left in the input file
+    float inputGain;                 // Loudness gain for its samples, 1 = none
+
+    // Next track handed over by the monitor (guarded by nextMutex)
+    pthread_mutex_t nextMutex;
+    int nextSongId;                  // 0 when nothing is queued
+    char* nextPath;
+    WavInfo nextFormat;
+    char* nextData;                  // Pre-buffered PCM
+    size_t nextSize;
+    float nextGain;
+
+    // Sample boundary between the playing and the queued track
+    atomic_llong boundaryFrame;
+    atomic_int boundarySongId;       // 0 when no boundary is pending
+
+    MusicPlayer* owner;              // Session told about track ends and switches
+} AudioEngine;
+
+static AudioSinkType engineSinkType = AUDIO_SINK_NONE;
+static char engineSinkPath[MAX_FILENAME];
+static int engineRealtime = 1;
+static atomic_int crossfadeMs; // Overlap between consecutive tracks, 0 for none
+
+static void recordFirstAudio(const struct timespec* requested);
+
+static void sleepMs(int ms) {
+    struct timespec delay = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&delay, NULL);
+}
+
+static int initRingBuffer(PcmRingBuffer* ring, size_t minSamples) {
+    size_t capacity = 1024;
+    while (capacity < minSamples) capacity *= 2;
+    ring->samples = (int16_t*)malloc(capacity * sizeof(int16_t));
+    if (!ring->samples) return -1;
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+static size_t ringFill(PcmRingBuffer* ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+// Producer side: copy up to count samples in, returns how many fit
+static size_t ringWrite(PcmRingBuffer* ring, const int16_t* src, size_t count) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t space = ring->capacity - (head - tail);
+    if (count > space) count = space;
+    size_t at = head & (ring->capacity - 1);
+    size_t first = count < ring->capacity - at ? count : ring->capacity - at;
+    memcpy(ring->samples + at, src, first * sizeof(int16_t));
+    memcpy(ring->samples, src + first, (count - first) * sizeof(int16_t));
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+// Consumer side: copy up to count samples out, returns how many were read
+static size_t ringRead(PcmRingBuffer* ring, int16_t* dst, size_t count) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (count > head - tail) count = head - tail;
+    size_t at = tail & (ring->capacity - 1);
+    size_t first = count < ring->capacity - at ? count : ring->capacity - at;
+    memcpy(dst, ring->samples + at, first * sizeof(int16_t));
+    memcpy(dst + first, ring->samples, (count - first) * sizeof(int16_t));
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return count;
+}
+
+static void writeWavHeader(FILE* file, const WavInfo* format, uint32_t dataBytes) {
+    unsigned char header[44];
+    uint32_t byteRate = format->sampleRate * format->frameSize;
+    memcpy(header, "RIFF", 4);
+    uint32_t values[] = { 36 + dataBytes, 16, format->sampleRate, byteRate, dataBytes };
+    memcpy(header + 8, "WAVEfmt ", 8);
+    memcpy(header + 36, "data", 4);
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (unsigned char)(values[0] >> (8 * i));
+        header[16 + i] = (unsigned char)(values[1] >> (8 * i));
+        header[24 + i] = (unsigned char)(values[2] >> (8 * i));
+        header[28 + i] = (unsigned char)(values[3] >> (8 * i));
+        header[40 + i] = (unsigned char)(values[4] >> (8 * i));
+    }
+    header[20] = WAV_FORMAT_PCM;
+    header[21] = 0;
+    header[22] = (unsigned char)format->channels;
+    header[23] = (unsigned char)(format->channels >> 8);
+    header[32] = (unsigned char)format->frameSize;
+    header[33] = (unsigned char)(format->frameSize >> 8);
+    header[34] = (unsigned char)format->bitsPerSample;
+    header[35] = (unsigned char)(format->bitsPerSample >> 8);
+    fwrite(header, 1, sizeof(header), file);
+}
+
+static int openAudioSink(AudioSink* sink, const WavInfo* format) {
+    memset(sink, 0, sizeof(AudioSink));
+    sink->type = engineSinkType;
+    sink->realtime = engineRealtime;
+    sink->fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &sink->nextPeriod);
+
+    if (sink->type == AUDIO_SINK_WAV) {
+        sink->file = fopen(engineSinkPath, "wb");
+        if (!sink->file) return -1;
+        writeWavHeader(sink->file, format, 0);
+    }
+#if !defined(_WIN32) && !defined(__APPLE__)
+    else if (sink->type == AUDIO_SINK_DEVICE) {
+        char aplay[MAX_FILENAME], rate[16], channels[16];
+        if (findExecutable("aplay", aplay, sizeof(aplay)) != 0) return -1;
+        snprintf(rate, sizeof(rate), "%u", format->sampleRate);
+        snprintf(channels, sizeof(channels), "%u", format->channels);
+        const char* argv[] = { "aplay", "-q", "-t", "raw", "-f", "S16_LE", "-r", rate, "-c", channels, "-", NULL };
+
+        // Close-on-exec, so players and decoders started meanwhile do not
+        // keep aplay's input open
+        int fds[2];
+        if (openCloexecPipe(fds) != 0) return -1;
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+        closeInheritedDescriptors(&actions);
+        int failed = posix_spawn(&sink->pid, aplay, &actions, NULL, (char* const*)argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[0]);
+        if (failed) {
+            close(fds[1]);
+            return -1;
+        }
+        sink->fd = fds[1];
+#ifdef F_SETPIPE_SZ
+        fcntl(sink->fd, F_SETPIPE_SZ, 4096); // Keep device latency (and position error) small
+#endif
+    }
+#endif
+    return 0;
+}
+
+#ifndef _WIN32
+// Close the aplay pipe and reap aplay; discard drops what the device holds
+static void closeDeviceSink(AudioSink* sink, int discard) {
+    if (sink->fd >= 0) {
+        close(sink->fd);
+        sink->fd = -1;
+    }
+    if (sink->pid > 0) {
+        if (discard) kill(sink->pid, SIGTERM);
+        while (waitpid(sink->pid, NULL, 0) < 0 && errno == EINTR);
+        sink->pid = 0;
+    }
+}
+#endif
+
+static void writeAudioSink(AudioSink* sink, const int16_t* samples, size_t frames, const WavInfo* format) {
+    size_t bytes = frames * format->frameSize;
+    if (sink->type == AUDIO_SINK_WAV && sink->file) {
+        fwrite(samples, 1, bytes, sink->file);
+        sink->dataBytes += (uint32_t)bytes;
+    }
+#if !defined(_WIN32) && !defined(__APPLE__)
+    else if (sink->type == AUDIO_SINK_DEVICE && sink->fd >= 0) {
+        // Blocks while the device is busy, which paces the output thread
+        const char* p = (const char*)samples;
+        while (bytes > 0) {
+            ssize_t written = write(sink->fd, p, bytes);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0 && errno == EPIPE) {
+                // aplay exited (device busy or gone). The SIGPIPE is blocked
+                // in this thread; take it off the pending set and carry on
+                // silently, paced by the clock below.
+                sigset_t pipeSignal;
+                sigemptyset(&pipeSignal);
+                sigaddset(&pipeSignal, SIGPIPE);
+                struct timespec noWait = { 0, 0 };
+                sigtimedwait(&pipeSignal, NULL, &noWait);
+                closeDeviceSink(sink, 0);
+                break;
+            }
+            if (written <= 0) break;
+            p += written;
+            bytes -= (size_t)written;
+        }
+        if (sink->fd >= 0) return;
+    }
+#endif
+
+    if (sink->realtime) {
+        long long ns = (long long)sink->nextPeriod.tv_nsec + (long long)frames * 1000000000LL / format->sampleRate;
+        sink->nextPeriod.tv_sec += (time_t)(ns / 1000000000LL);
+        sink->nextPeriod.tv_nsec = (long)(ns % 1000000000LL);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double aheadMs = elapsedMs(&now, &sink->nextPeriod);
+        if (aheadMs > 0) sleepMs((int)aheadMs);
+        else if (aheadMs < -100) sink->nextPeriod = now; // Fell behind; don't burst to catch up
+    }
+}
+
+static void closeAudioSink(AudioSink* sink, const WavInfo* format, int discard) {
+    if (sink->file) {
+        fseek(sink->file, 0, SEEK_SET);
+        writeWavHeader(sink->file, format, sink->dataBytes);
+        fclose(sink->file);
+        sink->file = NULL;
+    }
+#ifndef _WIN32
+    closeDeviceSink(sink, discard);
+#else
+    (void)discard;
+#endif
+}
+
+static int sameFormat(const WavInfo* a, const WavInfo* b) {
+    return a->channels == b->channels && a->sampleRate == b->sampleRate &&
+           a->bitsPerSample == b->bitsPerSample;
+}
+
+// Report a finished stream (songId 0) or a switch to the queued track to
+// the monitor. The pending boundary is cleared under playbackMutex too, so
+// the monitor always sees either the boundary or engineAdvancedTo and
+// never queues the same track twice or misses queueing the next one.
+// Never blocks on playbackMutex so audioEngineStop can join this thread
+// while holding it.
+static void notifyEngineEvent(AudioEngine* engine, int songId) {
+    MusicPlayer* player = engine->owner;
+    while (pthread_mutex_trylock(&player->playbackMutex) != 0) {
+        if (atomic_load(&engine->stopRequested)) return;
+        sleepMs(1);
+    }
+    player->playbackFinished = 1;
+    player->engineAdvancedTo = songId;
+    atomic_store(&engine->boundarySongId, 0);
+    clock_gettime(MONITOR_CLOCK, &player->trackEndedAt);
+    player->trackEndedAtValid = 1;
+    wakePlayback(player);
+    pthread_mutex_unlock(&player->playbackMutex);
+}
+
+// Switch the decoder to the queued track if there is one in the same
+// format; its pre-buffered frames are handed over in *carry. Returns the
+// track's song id, 0 if none was taken.
+static int takeQueuedTrack(AudioEngine* engine, int16_t** carry, size_t* carrySamples) {
+    pthread_mutex_lock(&engine->nextMutex);
+    if (!engine->nextSongId || !sameFormat(&engine->nextFormat, &engine->format)) {
+        pthread_mutex_unlock(&engine->nextMutex);
+        return 0;
+    }
+
+    // The file continues after the pre-buffered frames
+    FILE* next = fopen(engine->nextPath, "rb");
+    WavInfo info;
+    if (!next || readWavHeader(next, &info) != 0 || fseek(next, info.dataOffset + (long)engine->nextSize, SEEK_SET) != 0) {
+        if (next) fclose(next);
+        engine->nextSongId = 0;
+        pthread_mutex_unlock(&engine->nextMutex);
+        return 0;
+    }
+    if (engine->input) fclose(engine->input);
+    engine->input = next;
+    engine->inputRemaining = info.dataSize > engine->nextSize ? info.dataSize - (uint32_t)engine->nextSize : 0;
+
+    *carry = (int16_t*)engine->nextData;
+    *carrySamples = engine->nextSize / sizeof(int16_t);
+    engine->inputGain = engine->nextGain;
+    dspApplyGain(*carry, *carrySamples, engine->inputGain);
+    int songId = engine->nextSongId;
+
+    engine->nextSongId = 0;
+    engine->nextData = NULL;
+    free(engine->nextPath);
+    engine->nextPath = NULL;
+    pthread_mutex_unlock(&engine->nextMutex);
+    return songId;
+}
+
+static int hasQueuedTrack(AudioEngine* engine) {
+    pthread_mutex_lock(&engine->nextMutex);
+    int queued = engine->nextSongId && sameFormat(&engine->nextFormat, &engine->format);
+    pthread_mutex_unlock(&engine->nextMutex);
+    return queued;
+}
+
+// Mark where the next track starts, in frames written to the ring so far
+static void publishBoundary(AudioEngine* engine, int songId) {
+    atomic_store(&engine->boundaryFrame, (long long)(atomic_load(&engine->ring.head) / engine->format.channels));
+    atomic_store(&engine->boundarySongId, songId);
+}
+
+// Hand samples to the ring, waiting while it is full
+static void ringWriteAll(AudioEngine* engine, const int16_t* src, size_t count) {
+    size_t written = 0;
+    while (written < count && !atomic_load(&engine->stopRequested)) {
+        written += ringWrite(&engine->ring, src + written, count - written);
+        if (written < count) sleepMs(5);
+    }
+}
+
+// Overlap the rest of the playing track (its unplayed ready-buffer frames,
+// then the file) with the start of the queued one. The fade covers as much
+// of that tail as the incoming ready buffer allows; the mixed frames
+// replace the start of the new *carry. If nothing was queued after all the
+// tail is written out unchanged.
+static void crossfadeIntoQueued(AudioEngine* engine, int16_t** carry, size_t* carrySamples, size_t* carryPos) {
+    int channels = engine->format.channels;
+    size_t carried = *carrySamples - *carryPos;
+    size_t fileFrames = engine->inputRemaining / engine->format.frameSize;
+    int16_t* tail = (int16_t*)malloc(carried * sizeof(int16_t) + fileFrames * engine->format.frameSize + 1);
+    if (!tail) return;
+    if (carried > 0) memcpy(tail, *carry + *carryPos, carried * sizeof(int16_t));
+    size_t fileRead = fread(tail + carried, engine->format.frameSize, fileFrames, engine->input);
+    dspApplyGain(tail + carried, fileRead * channels, engine->inputGain); // Before the queued track's gain takes over
+    size_t tailFrames = carried / channels + fileRead;
+    engine->inputRemaining = 0;
+    free(*carry);
+    *carry = NULL;
+    *carrySamples = *carryPos = 0;
+
+    int songId = takeQueuedTrack(engine, carry, carrySamples);
+    size_t fadeFrames = songId ? *carrySamples / channels : 0;
+    if (fadeFrames > tailFrames) fadeFrames = tailFrames;
+    size_t leadFrames = tailFrames - fadeFrames;
+
+    ringWriteAll(engine, tail, leadFrames * channels);
+    if (songId) {
+        dspCrossfade(*carry, tail + leadFrames * channels, *carry, fadeFrames, channels);
+        publishBoundary(engine, songId);
+    }
+    free(tail);
+}
+
+static void* engineDecoderThread(void* arg) {
+    AudioEngine* engine = (AudioEngine*)arg;
+    int channels = engine->format.channels;
+    size_t chunkSamples = (size_t)ENGINE_PERIOD_FRAMES * channels;
+    size_t lowWater = (size_t)engine->format.sampleRate * channels * ENGINE_NEXT_WAIT_MS / 1000;
+    int16_t* chunk = (int16_t*)malloc(chunkSamples * sizeof(int16_t));
+    int16_t* carry = NULL;
+    size_t carrySamples = 0, carryPos = 0;
+    if (!chunk) {
+        atomic_store(&engine->decoderDone, 1);
+        return NULL;
+    }
+
+    while (!atomic_load(&engine->stopRequested)) {
+        // Start the crossfade once the rest of the track fits into it. As at
+        // the end of a track, wait for the next one while audio is buffered.
+        size_t fadeFrames = (size_t)atomic_load(&crossfadeMs) * engine->format.sampleRate / 1000;
+        size_t remainingFrames = (carrySamples - carryPos) / channels + engine->inputRemaining / engine->format.frameSize;
+        if (fadeFrames > 0 && remainingFrames > 0 && remainingFrames <= fadeFrames) {
+            if (atomic_load(&engine->boundarySongId) == 0 && hasQueuedTrack(engine)) {
+                crossfadeIntoQueued(engine, &carry, &carrySamples, &carryPos);
+                continue;
+            }
+            if (ringFill(&engine->ring) > lowWater) {
+                sleepMs(10);
+                continue;
+            }
+        }
+
+        // Stop the chunk where the crossfade would start
+        size_t limit = chunkSamples;
+        if (fadeFrames > 0 && remainingFrames > fadeFrames && (remainingFrames - fadeFrames) * channels < limit)
+            limit = (remainingFrames - fadeFrames) * channels;
+
+        size_t count;
+        const int16_t* src;
+        if (carryPos < carrySamples) {
+            src = carry + carryPos;
+            count = carrySamples - carryPos;
+            if (count > limit) count = limit;
+            carryPos += count;
+        } else {
+            size_t bytes = limit * sizeof(int16_t);
+            if (bytes > engine->inputRemaining) bytes = engine->inputRemaining;
+            count = fread(chunk, 1, bytes, engine->input) / sizeof(int16_t);
+            engine->inputRemaining -= (uint32_t)(count * sizeof(int16_t));
+            dspApplyGain(chunk, count, engine->inputGain);
+            src = chunk;
+        }
+
+        if (count == 0) {
+            // End of this track: run into the queued one, waiting for it
+            // until the buffered audio runs low
+            free(carry);
+            carry = NULL;
+            carrySamples = carryPos = 0;
+            if (atomic_load(&engine->boundarySongId) == 0) {
+                int songId = takeQueuedTrack(engine, &carry, &carrySamples);
+                if (songId) {
+                    publishBoundary(engine, songId);
+                    continue;
+                }
+            }
+            if (ringFill(&engine->ring) > lowWater) {
+                sleepMs(10);
+                continue;
+            }
+            break;
+        }
+
+        ringWriteAll(engine, src, count);
+    }
+
+    free(chunk);
+    free(carry);
+    atomic_store(&engine->decoderDone, 1);
+    return NULL;
+}
+
+static void* engineOutputThread(void* arg) {
+    AudioEngine* engine = (AudioEngine*)arg;
+    int channels = engine->format.channels;
+    size_t periodSamples = (size_t)ENGINE_PERIOD_FRAMES * channels;
+    int16_t* period = (int16_t*)malloc(periodSamples * sizeof(int16_t));
+    int started = 0;
+    if (!period) return NULL;
+#ifndef _WIN32
+    // Writing to an aplay that has exited must fail with EPIPE here rather
+    // than kill the whole player
+    sigset_t pipeSignal;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, NULL);
+#endif
+
+    while (!atomic_load(&engine->stopRequested)) {
+        if (atomic_load(&engine->paused)) {
+            sleepMs(10);
+            continue;
+        }
+
+        size_t available = ringFill(&engine->ring);
+        int done = atomic_load(&engine->decoderDone);
+        if (available == 0 && done) break;
+        if (available < periodSamples && !done && !started) {
+            sleepMs(1); // Let the decoder prime the ring before starting
+            continue;
+        }
+
+        size_t got = ringRead(&engine->ring, period, periodSamples);
+        size_t frames = got / channels;
+        if (got < periodSamples && !done) {
+            // Starved mid-stream: pad with silence and count it
+            memset(period + got, 0, (periodSamples - got) * sizeof(int16_t));
+            atomic_fetch_add(&engine->underrunFrames, (long long)(ENGINE_PERIOD_FRAMES - frames));
+            frames = ENGINE_PERIOD_FRAMES;
+        }
+        int first = !started;
+        started = 1;
+
+        dspApplyGain(period, frames * channels, atomic_load(&engine->volumePermille) / 1000.0f);
+        writeAudioSink(&engine->sink, period, frames, &engine->format);
+        if (first) recordFirstAudio(&engine->requestedAt);
+        long long played = atomic_fetch_add(&engine->framesPlayed, (long long)frames) + (long long)frames;
+
+        int boundarySong = atomic_load(&engine->boundarySongId);
+        if (boundarySong && played >= atomic_load(&engine->boundaryFrame)) {
+            atomic_store(&engine->trackStartFrame, atomic_load(&engine->boundaryFrame));
+            atomic_fetch_add(&engine->seamlessTransitions, 1);
+            notifyEngineEvent(engine, boundarySong);
+        }
+    }
+
+    free(period);
+    atomic_store(&engine->outputDone, 1);
+    if (!atomic_load(&engine->stopRequested)) notifyEngineEvent(engine, 0);
+    return NULL;
+}
+
+// Choose where engine output goes; AUDIO_SINK_NONE leaves every file to
+// the external players. realtime paces null and WAV sinks like a device.
+void audioEngineConfigure(AudioSinkType sink, const char* path, int realtime) {
+    engineSinkType = sink;
+    snprintf(engineSinkPath, sizeof(engineSinkPath), "%s", path ? path : "");
+    engineRealtime = realtime;
+}
+
+// Pick the sink from AUDIORA_SINK ("device", "null", "null:fast",
+// "wav:PATH", "wav-fast:PATH", "clock" or "off"); by default the device is
+// used when one is reachable. "clock" plays nothing at all: every track
+// just runs for its duration, which is enough to simulate or load-test
+// many sessions.
+void audioEngineConfigureFromEnvironment() {
+    const char* setting = getenv("AUDIORA_SINK");
+    if (!setting || strcmp(setting, "device") == 0) {
+#if !defined(_WIN32) && !defined(__APPLE__)
+        char aplay[MAX_FILENAME];
+        audioEngineConfigure(findExecutable("aplay", aplay, sizeof(aplay)) == 0 ? AUDIO_SINK_DEVICE : AUDIO_SINK_NONE, NULL, 1);
+#else
+        audioEngineConfigure(AUDIO_SINK_NONE, NULL, 1);
+#endif
+    } else if (strcmp(setting, "null") == 0) audioEngineConfigure(AUDIO_SINK_NULL, NULL, 1);
+    else if (strcmp(setting, "null:fast") == 0) audioEngineConfigure(AUDIO_SINK_NULL, NULL, 0);
+    else if (strncmp(setting, "wav:", 4) == 0) audioEngineConfigure(AUDIO_SINK_WAV, setting + 4, 1);
+    else if (strncmp(setting, "wav-fast:", 9) == 0) audioEngineConfigure(AUDIO_SINK_WAV, setting + 9, 0);
+    else if (strcmp(setting, "clock") == 0) audioEngineConfigure(AUDIO_SINK_CLOCK, NULL, 1);
+    else audioEngineConfigure(AUDIO_SINK_NONE, NULL, 1);
+
+    const char* crossfade = getenv("AUDIORA_CROSSFADE");
+    if (crossfade) setCrossfadeDuration(atof(crossfade));
+}
+
+// Whether a file can be played in-process (16-bit PCM WAV with a sink set)
+int audioEngineCanPlay(const char* filepath) {
+    if (engineSinkType == AUDIO_SINK_NONE || engineSinkType == AUDIO_SINK_CLOCK) return 0;
+    FILE* file = fopen(filepath, "rb");
+    if (!file) return 0;
+    WavInfo info;
+    int ok = readWavHeader(file, &info) == 0 && info.format == WAV_FORMAT_PCM && info.bitsPerSample == 16;
+    fclose(file);
+    return ok;
+}
+
+static void clearQueuedTrack(AudioEngine* engine) {
+    pthread_mutex_lock(&engine->nextMutex);
+    engine->nextSongId = 0;
+    free(engine->nextPath);
+    free(engine->nextData);
+    engine->nextPath = NULL;
+    engine->nextData = NULL;
+    pthread_mutex_unlock(&engine->nextMutex);
+}
+
+static void stopEngine(AudioEngine* engine) {
+    if (!engine->active) return;
+    atomic_store(&engine->stopRequested, 1);
+    pthread_join(engine->decoderThread, NULL);
+    pthread_join(engine->outputThread, NULL);
+    closeAudioSink(&engine->sink, &engine->format, 1);
+    if (engine->input) fclose(engine->input);
+    engine->input = NULL;
+    free(engine->ring.samples);
+    engine->ring.samples = NULL;
+    clearQueuedTrack(engine);
+    engine->active = 0;
+}
+
+// requestedAt is when playback of the file was asked for, the start of its
+// time to first audio (caller holds engine->controlMutex)
+static int startEngine(AudioEngine* engine, const char* filepath, double gainDb, const struct timespec* requestedAt) {
+    stopEngine(engine);
+
+    FILE* input = fopen(filepath, "rb");
+    if (!input) return -1;
+    if (readWavHeader(input, &engine->format) != 0 || engine->format.bitsPerSample != 16 ||
+        initRingBuffer(&engine->ring, (size_t)engine->format.sampleRate * engine->format.channels * ENGINE_RING_SECONDS) != 0) {
+        fclose(input);
+        return -1;
+    }
+    if (openAudioSink(&engine->sink, &engine->format) != 0) {
+        free(engine->ring.samples);
+        fclose(input);
+        return -1;
+    }
+
+    engine->input = input;
+    engine->inputRemaining = engine->format.dataSize;
+    engine->inputGain = (float)dbToGain(gainDb);
+    engine->requestedAt = *requestedAt;
+    atomic_store(&engine->stopRequested, 0);
+    atomic_store(&engine->paused, 0);
+    atomic_store(&engine->decoderDone, 0);
+    atomic_store(&engine->outputDone, 0);
+    atomic_store(&engine->framesPlayed, 0);
+    atomic_store(&engine->trackStartFrame, 0);
+    atomic_store(&engine->boundarySongId, 0);
+    clearQueuedTrack(engine);
+
+    if (pthread_create(&engine->decoderThread, NULL, engineDecoderThread, engine) != 0) {
+        closeAudioSink(&engine->sink, &engine->format, 1);
+        free(engine->ring.samples);
+        fclose(input);
+        return -1;
+    }
+    if (pthread_create(&engine->outputThread, NULL, engineOutputThread, engine) != 0) {
+        atomic_store(&engine->stopRequested, 1);
+        pthread_join(engine->decoderThread, NULL);
+        closeAudioSink(&engine->sink, &engine->format, 1);
+        free(engine->ring.samples);
+        fclose(input);
+        return -1;
+    }
+    engine->active = 1;
+    return 0;
+}
+
+static int startEngineAt(MusicPlayer* player, const char* filepath, double gainDb, const struct timespec* requestedAt) {
+    AudioEngine* engine = player->engine;
+    pthread_mutex_lock(&engine->controlMutex);
+    int result = startEngine(engine, filepath, gainDb, requestedAt);
+    pthread_mutex_unlock(&engine->controlMutex);
+    return result;
+}
+
+int audioEngineStart(MusicPlayer* player, const char* filepath, double gainDb) {
+    struct timespec now;
+    clock_gettime(MONITOR_CLOCK, &now);
+    return startEngineAt(player, filepath, gainDb, &now);
+}
+
+void audioEngineStop(MusicPlayer* player) {
+    AudioEngine* engine = player->engine;
+    pthread_mutex_lock(&engine->controlMutex);
+    stopEngine(engine);
+    pthread_mutex_unlock(&engine->controlMutex);
+}
+
+// Queue the track that follows the current one. data holds its first
+// pre-buffered PCM bytes; the engine keeps its own copy.
+int audioEngineQueueNext(MusicPlayer* player, int songId, const char* filepath, const WavInfo* format,
+                         const char* data, size_t size, double gainDb) {
+    AudioEngine* engine = player->engine;
+    pthread_mutex_lock(&engine->controlMutex);
+    if (!engine->active || !sameFormat(format, &engine->format) || format->bitsPerSample != 16) {
+        pthread_mutex_unlock(&engine->controlMutex);
+        return -1;
+    }
+    char* path = strdup(filepath);
+    char* copy = (char*)malloc(size ? size : 1);
+    if (!path || !copy) {
+        free(path);
+        free(copy);
+        pthread_mutex_unlock(&engine->controlMutex);
+        return -1;
+    }
+    memcpy(copy, data, size);
+
+    pthread_mutex_lock(&engine->nextMutex);
+    free(engine->nextPath);
+    free(engine->nextData);
+    engine->nextSongId = songId;
+    engine->nextPath = path;
+    engine->nextFormat = *format;
+    engine->nextData = copy;
+    engine->nextSize = size - size % format->frameSize;
+    engine->nextGain = (float)dbToGain(gainDb);
+    pthread_mutex_unlock(&engine->nextMutex);
+    pthread_mutex_unlock(&engine->controlMutex);
+    return 0;
+}
+
+// Drop the queued next track, e.g. when the play order changed
+void audioEngineClearNext(MusicPlayer* player) {
+    AudioEngine* engine = player->engine;
+    pthread_mutex_lock(&engine->controlMutex);
+    clearQueuedTrack(engine);
+    pthread_mutex_unlock(&engine->controlMutex);
+}
+
+// Whether the engine is running and has no next track queued or pending
+int audioEngineWantsNext(MusicPlayer* player) {
+    AudioEngine* engine = player->engine;
+    if (!engine->active || atomic_load(&engine->boundarySongId)) return 0;
+    pthread_mutex_lock(&engine->nextMutex);
+    int wants = engine->nextSongId == 0;
+    pthread_mutex_unlock(&engine->nextMutex);
+    return wants;
+}
+
+int audioEngineActive(MusicPlayer* player) {
+    AudioEngine* engine = player->engine;
+    return engine->active && !atomic_load(&engine->outputDone);
+}
+
+void audioEnginePause(MusicPlayer* player, int paused) {
+    atomic_store(&player->engine->paused, paused);
+}
+
+void audioEngineSetVolume(MusicPlayer* player, double volume) {
+    if (volume < 0) volume = 0;
+    atomic_store(&player->engine->volumePermille, (int)(volume * 1000 + 0.5));
+}
+
+// Overlap consecutive tracks by this many seconds (0 joins them gaplessly).
+// Applies to tracks the engine plays back to back.
+void setCrossfadeDuration(double seconds) {
+    if (seconds < 0) seconds = 0;
+    if (seconds > MAX_CROSSFADE_SECONDS) seconds = MAX_CROSSFADE_SECONDS;
+    atomic_store(&crossfadeMs, (int)(seconds * 1000 + 0.5));
+}
+
+double getCrossfadeDuration() {
+    return atomic_load(&crossfadeMs) / 1000.0;
+}
+
+// Seconds into the current track, from frames actually handed to the sink
+double audioEnginePosition(MusicPlayer* player) {
+    AudioEngine* engine = player->engine;
+    double position = -1;
+    pthread_mutex_lock(&engine->controlMutex);
+    if (audioEngineActive(player) && engine->format.sampleRate > 0) {
+        long long frames = atomic_load(&engine->framesPlayed) - atomic_load(&engine->trackStartFrame);
+        position = (double)frames / engine->format.sampleRate;
+    }
+    pthread_mutex_unlock(&engine->controlMutex);
+    return position;
+}
+
+void audioEngineStats(MusicPlayer* player, long* seamlessTransitions, long long* underrunFrames) {
+    *seamlessTransitions = atomic_load(&player->engine->seamlessTransitions);
+    *underrunFrames = atomic_load(&player->engine->underrunFrames);
+}
+
+// Each session has its own engine, idle (no threads) until a WAV plays
+static AudioEngine* createAudioEngine(MusicPlayer* owner) {
+    AudioEngine* engine = (AudioEngine*)calloc(1, sizeof(AudioEngine));
+    if (!engine) exit(1);
+    pthread_mutex_init(&engine->controlMutex, NULL);
+    pthread_mutex_init(&engine->nextMutex, NULL);
+    atomic_init(&engine->volumePermille, 1000);
+    engine->owner = owner;
+    return engine;
+}
+
+static void destroyAudioEngine(AudioEngine* engine) {
+    stopEngine(engine);
+    pthread_mutex_destroy(&engine->controlMutex);
+    pthread_mutex_destroy(&engine->nextMutex);
+    free(engine);
+}
+
+// ============================================================================
+// CROSS PLATFORM AUDIO INTERFACE
+// ============================================================================
+static void recordAudioLatency(long* count, double* totalMs, double* maxMs, const struct timespec* from) {
+    struct timespec now;
+    clock_gettime(MONITOR_CLOCK, &now);
+    double ms = elapsedMs(from, &now);
+    pthread_mutex_lock(&audioLatencyMutex);
+    (*count)++;
+    *totalMs += ms;
+    if (ms > *maxMs) *maxMs = ms;
+    pthread_mutex_unlock(&audioLatencyMutex);
+}
+
+static void recordPlayStart(const struct timespec* from) {
+    if (!metricsActive()) return;
+    struct timespec now;
+    clock_gettime(MONITOR_CLOCK, &now);
+    countMetric(METRIC_TRACKS_STARTED, 1);
+    observeMetricNs(METRIC_PLAY_START, (long long)(elapsedMs(from, &now) * 1e6));
+}
+
+// Time from asking for a track to its first samples reaching the sink; only
+// the audio engine can tell when that happens
+static void recordFirstAudio(const struct timespec* requested) {
+    recordAudioLatency(&audioLatency.firstAudioCount, &audioLatency.firstAudioTotalMs, &audioLatency.firstAudioMaxMs,
+                       requested);
+    if (!metricsActive()) return;
+    struct timespec now;
+    clock_gettime(MONITOR_CLOCK, &now);
+    observeMetricNs(METRIC_FIRST_AUDIO, (long long)(elapsedMs(requested, &now) * 1e6));
+}
+
+// Start filepath in place of whatever the session plays; returns 0 once it
+// is on its way. Touches only the output, so playNext can call it without
+// playbackMutex (caller holds outputMutex).
+static int startAudioOutput(MusicPlayer* player, const char* filepath, double gainDb) {
+    struct timespec started;
+    clock_gettime(MONITOR_CLOCK, &started);
+    if (engineSinkType == AUDIO_SINK_CLOCK) {
+        recordPlayStart(&started); // Nothing to start: the playback clock ends the track
+        return 0;
+    }
+    audioEngineStop(player); // Reap an engine stream that ended on its own
+    if (audioEngineCanPlay(filepath) && startEngineAt(player, filepath, gainDb, &started) == 0) {
+        printf("♪ Audio playback started!\n");
+        recordAudioLatency(&audioLatency.startCount, &audioLatency.startTotalMs, &audioLatency.startMaxMs, &started);
+        recordPlayStart(&started);
+        return 0;
+    }
+#ifdef _WIN32
+    int result = playAudioWindows(player, filepath, gainDb);
+#else
+    int result = playAudioProcess(player, filepath, gainDb);
+#endif
+    recordAudioLatency(&audioLatency.startCount, &audioLatency.startTotalMs, &audioLatency.startMaxMs, &started);
+    recordPlayStart(&started);
+    return result;
+}
+
+// Silence whatever the session plays (caller holds outputMutex)
+static void silenceAudioOutput(MusicPlayer* player) {
+    struct timespec started;
+    clock_gettime(MONITOR_CLOCK, &started);
+    audioEngineStop(player);
+#ifdef _WIN32
+    stopAudioWindows(player);
+#else
+    stopAudioProcess(player);
+#endif
+    recordAudioLatency(&audioLatency.stopCount, &audioLatency.stopTotalMs, &audioLatency.stopMaxMs, &started);
+}
+
+// gainDb is the song's loudness gain, 0 for none (caller holds playbackMutex)
+void playAudioFile(MusicPlayer* player, const char* filepath, double gainDb) {
+    pthread_mutex_lock(&player->outputMutex);
+    int result = startAudioOutput(player, filepath, gainDb);
+    player->outputGeneration = player->switchGeneration;
+    pthread_mutex_unlock(&player->outputMutex);
+    player->isPlaying = result == 0;
+}
+
+// Stop playback and reset the playback clock (caller holds playbackMutex)
+void stopAudioFile(MusicPlayer* player) {
+    player->switchGeneration++; // Supersedes a playNext still starting its track
+    pthread_mutex_lock(&player->outputMutex);
+    silenceAudioOutput(player);
+    player->outputGeneration = 0;
+    pthread_mutex_unlock(&player->outputMutex);
+    
+    // NEW: Reset auto-play tracking variables when stopping
+    player->isPlaying = 0;
+    player->isPaused = 0;
+    player->songStartTime = 0;
+    player->currentSongDuration = 0;
+    player->deadlineArmed = 0;
+    player->engineAdvancedTo = 0;
+}
+
+// Pause or resume the current track (caller holds playbackMutex). The
+// fallback deadline is suspended while paused.
+void pauseAudioFile(MusicPlayer* player) {
+    if (!player->isPlaying || player->isPaused) return;
+    audioEnginePause(player, 1);
+#ifdef _WIN32
+    pauseAudioWindows(player);
+#else
+    signalPlayerProcess(player, SIGSTOP);
+#endif
+    struct timespec now;
+    clock_gettime(MONITOR_CLOCK, &now);
+    player->pausedRemainingMs = player->deadlineArmed ? elapsedMs(&now, &player->songDeadline) : -1;
+    player->deadlineArmed = 0;
+    player->isPaused = 1;
+    wakePlayback(player);
+}
+
+void resumeAudioFile(MusicPlayer* player) {
+    if (!player->isPaused) return;
+    audioEnginePause(player, 0);
+#ifdef _WIN32
+    resumeAudioWindows(player);
+#else
+    signalPlayerProcess(player, SIGCONT);
+#endif
+    if (player->pausedRemainingMs >= 0) {
+        struct timespec* deadline = &player->songDeadline;
+        clock_gettime(MONITOR_CLOCK, deadline);
+        long long deadlineNs = (long long)deadline->tv_nsec + (long long)(player->pausedRemainingMs * 1e6);
+        deadline->tv_sec += (time_t)(deadlineNs / 1000000000LL);
+        deadline->tv_nsec = (long)(deadlineNs % 1000000000LL);
+        player->deadlineArmed = 1;
+    }
+    player->isPaused = 0;
+    wakePlayback(player);
+}
+
+int isAudioPlaying(MusicPlayer* player) {
+    if (audioEngineActive(player)) return 1;
+#ifdef _WIN32
+    return isAudioPlayingWindows(player);
+#else
+    return player->isPlaying;
+#endif
+}
+
+// ============================================================================
+// INITIALIZATION AND CLEANUP
+// ============================================================================
+// initMusicPlayer creates a session with a catalog of its own; openSession
+// adds a session that plays from the host's catalog. The catalog goes away
+// with the last session using it.
+static void releasePrebuffer(PrebufferedTrack* track);
+static void waitForCompaction(PlaylistJournal* journal);
+static void initReadAheadRefs(ReadAheadRefs* refs);
+static void freeReadAheadRefs(ReadAheadRefs* refs);
+static void configureReadAhead(ReadAhead* ahead, int tracks, long long budgetBytes);
+static void releaseReadAhead(MusicPlayer* player);
+
+static SongCatalog* createSongCatalog() {
+    SongCatalog* catalog = (SongCatalog*)malloc(sizeof(SongCatalog));
+    if (!catalog) exit(1);
+
+    catalog->playlist = NULL;
+    catalog->playlistTail = NULL;
+    initSongIndex(&catalog->index);
+    initStringPool(&catalog->strings);
+    initPlaylistColumns(&catalog->columns);
+    initSearchIndex(&catalog->search);
+    for (int key = 0; key < SORT_KEY_COUNT; key++) initSortedIndex(&catalog->sorted[key], (SortKey)key);
+    initNodePool(&catalog->songPool, sizeof(Song), SONG_POOL_SLAB);
+    catalog->songCount = 0;
+    catalog->nextId = 1;
+    // Playlist edits must not starve behind a steady stream of readers
+    pthread_rwlockattr_t lockAttr;
+    pthread_rwlockattr_init(&lockAttr);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&lockAttr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&catalog->playlistLock, &lockAttr);
+    pthread_rwlockattr_destroy(&lockAttr);
+    catalog->retiredSongs = NULL;
+    catalog->retiredCount = 0;
+    memset(&catalog->journal, 0, sizeof(catalog->journal));
+    catalog->journal.fd = -1; // Off until openPlaylistJournal
+    pthread_mutex_init(&catalog->journal.mutex, NULL);
+    catalog->sessions = NULL;
+    catalog->sessionCount = 0;
+    initReadAheadRefs(&catalog->readAheadRefs);
+    return catalog;
+}
+
+static void freeSongCatalog(SongCatalog* catalog) {
+    // Songs and strings all live in pools, released slab by slab
+    freeSongIndex(&catalog->index);
+    freeStringPool(&catalog->strings);
+    freePlaylistColumns(&catalog->columns);
+    freeSearchIndex(&catalog->search);
+    for (int key = 0; key < SORT_KEY_COUNT; key++) freeSortedIndex(&catalog->sorted[key]);
+    freeNodePool(&catalog->songPool);
+    pthread_rwlock_destroy(&catalog->playlistLock);
+    pthread_mutex_destroy(&catalog->journal.mutex);
+    freeReadAheadRefs(&catalog->readAheadRefs);
+    free(catalog);
+}
+
+static MusicPlayer* createSession(SongCatalog* catalog) {
+    MusicPlayer* player = (MusicPlayer*)calloc(1, sizeof(MusicPlayer));
+    if (!player) exit(1);
+
+    const char* historySetting = getenv("AUDIORA_HISTORY");
+    setHistoryCapacity(player, historySetting ? atoi(historySetting) : HISTORY_DEFAULT_CAPACITY);
+    // AUDIORA_READAHEAD is "TRACKS" or "TRACKS:MB"
+    const char* readAheadSetting = getenv("AUDIORA_READAHEAD");
+    const char* budgetSetting = readAheadSetting ? strchr(readAheadSetting, ':') : NULL;
+    configureReadAhead(&player->readAhead, readAheadSetting ? atoi(readAheadSetting) : READAHEAD_DEFAULT_TRACKS,
+                       (budgetSetting ? atoll(budgetSetting + 1) : READAHEAD_DEFAULT_BUDGET_MB) * 1024 * 1024);
+    player->upcomingQueue = (Queue*)calloc(1, sizeof(Queue));
+    if (!player->upcomingQueue) exit(1);
+
+    pthread_mutex_init(&player->playbackMutex, NULL);
+    pthread_mutex_init(&player->prebufferLoadMutex, NULL);
+    pthread_mutex_init(&player->outputMutex, NULL);
+    atomic_init(&player->autoPlayEnabled, 1);
+    atomic_init(&player->gaplessEnabled, 1);
+    atomic_init(&player->loudnessEnabled, 1);
+    player->pausedRemainingMs = -1;
+    player->engine = createAudioEngine(player);
+#ifndef _WIN32
+    pthread_mutex_init(&player->playerProcessMutex, NULL);
+    pthread_cond_init(&player->playerWaiterDone, NULL);
+#endif
+    attachPlaybackLoop(player);
+
+    pthread_rwlock_wrlock(&catalog->playlistLock);
+    player->catalog = catalog;
+    player->prevSession = NULL;
+    player->nextSession = catalog->sessions;
+    if (catalog->sessions) catalog->sessions->prevSession = player;
+    catalog->sessions = player;
+    catalog->sessionCount++;
+    pthread_rwlock_unlock(&catalog->playlistLock);
+    return player;
+}
+
+MusicPlayer* initMusicPlayer() {
+#ifndef _WIN32
+    detectAudioBackend(); // Look up the external player once, at startup
+#endif
+    audioEngineConfigureFromEnvironment();
+    const char* metrics = getenv("AUDIORA_METRICS");
+    if (metrics && *metrics && strcmp(metrics, "0") != 0) setMetricsEnabled(1);
+    return createSession(createSongCatalog());
+}
+
+// A new session (zone, user) playing from the host's song catalog. It has
+// its own current song, history, queue and playback settings.
+MusicPlayer* openSession(MusicPlayer* host) {
+    return createSession(host->catalog);
+}
+
+void freeMusicPlayer(MusicPlayer* player) {
+    if (!player) return;
+    SongCatalog* catalog = player->catalog;
+
+    lockPlayback(player);
+    player->manualStop = 1; // Nothing may start playing again
+    stopAudioFile(player);
+    pthread_mutex_unlock(&player->playbackMutex);
+#ifndef _WIN32
+    pthread_mutex_lock(&player->playerProcessMutex);
+    while (player->playerWaiters > 0) pthread_cond_wait(&player->playerWaiterDone, &player->playerProcessMutex);
+    pthread_mutex_unlock(&player->playerProcessMutex);
+#endif
+    detachPlaybackLoop(player);
+    waitForCompaction(&catalog->journal);
+    releaseReadAhead(player);
+
+    // Songs this session still held can be reclaimed once it is gone
+    pthread_rwlock_wrlock(&catalog->playlistLock);
+    if (player->prevSession) player->prevSession->nextSession = player->nextSession;
+    else catalog->sessions = player->nextSession;
+    if (player->nextSession) player->nextSession->prevSession = player->prevSession;
+    int last = --catalog->sessionCount == 0;
+    if (!last && catalog->retiredSongs) reclaimRetiredSongs(catalog->sessions);
+    pthread_rwlock_unlock(&catalog->playlistLock);
+    if (last) {
+        closePlaylistJournal(player);
+        freeSongCatalog(catalog);
+    }
+
+    destroyAudioEngine(player->engine);
+    releasePrebuffer(&player->prebuffer);
+    pthread_mutex_destroy(&player->playbackMutex);
+    pthread_mutex_destroy(&player->prebufferLoadMutex);
+    pthread_mutex_destroy(&player->outputMutex);
+#ifndef _WIN32
+    pthread_mutex_destroy(&player->playerProcessMutex);
+    pthread_cond_destroy(&player->playerWaiterDone);
+#endif
+    free(player->history.ids);
+    free(player->upcomingQueue->ids);
+    free(player->upcomingQueue);
+    free(player->shuffle.ids);
+    free(player);
+}
+
+// ============================================================================
+// SONG INDEX (HASH TABLE)
+// ============================================================================
+#define SONG_INDEX_INITIAL_CAPACITY 64
+
+// Fibonacci hashing spreads sequential IDs evenly across the buckets
+static unsigned int hashSongId(int songId, int capacity) {
+    return ((unsigned int)songId * 2654435769u) & (unsigned int)(capacity - 1);
+}
+
+void initSongIndex(SongIndex* index) {
+    index->slots = (Song**)calloc(SONG_INDEX_INITIAL_CAPACITY, sizeof(Song*));
+    if (!index->slots) exit(1);
+    index->capacity = SONG_INDEX_INITIAL_CAPACITY;
+    index->count = 0;
+}
+
+void freeSongIndex(SongIndex* index) {
+    free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
+
+// Double the bucket array and re-insert every song
+static void growSongIndex(SongIndex* index) {
+    Song** oldSlots = index->slots;
+    int oldCapacity = index->capacity;
+
+    index->slots = (Song**)calloc(oldCapacity * 2, sizeof(Song*));
+    if (!index->slots) exit(1);
+    index->capacity = oldCapacity * 2;
+    index->count = 0;
+
+    for (int i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i]) songIndexInsert(index, oldSlots[i]);
+    }
+    free(oldSlots);
+}
+
+void songIndexInsert(SongIndex* index, Song* song) {
+    // Keep load factor below 0.75 so probe sequences stay short
+    if ((index->count + 1) * 4 > index->capacity * 3) growSongIndex(index);
+
+    unsigned int mask = (unsigned int)(index->capacity - 1);
+    unsigned int i = hashSongId(song->id, index->capacity);
+    while (index->slots[i]) {
+        if (index->slots[i]->id == song->id) {
+            index->slots[i] = song; // Duplicate ID: newest entry wins
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    index->slots[i] = song;
+    index->count++;
+}
+
+Song* songIndexLookup(const SongIndex* index, int songId) {
+    unsigned int mask = (unsigned int)(index->capacity - 1);
+    unsigned int i = hashSongId(songId, index->capacity);
+    while (index->slots[i]) {
+        if (index->slots[i]->id == songId) return index->slots[i];
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+void songIndexRemove(SongIndex* index, int songId) {
+    unsigned int mask = (unsigned int)(index->capacity - 1);
+    unsigned int i = hashSongId(songId, index->capacity);
+    while (index->slots[i] && index->slots[i]->id != songId) i = (i + 1) & mask;
+    if (!index->slots[i]) return;
+
+    // Backward-shift deletion: pull later entries of the cluster into the
+    // hole so lookups never need tombstones
+    unsigned int hole = i;
+    unsigned int j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!index->slots[j]) break;
+        unsigned int home = hashSongId(index->slots[j]->id, index->capacity);
+        // Move entry j only if its home bucket is not in (hole, j]
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            index->slots[hole] = index->slots[j];
+            hole = j;
+        }
+    }
+    index->slots[hole] = NULL;
+    index->count--;
+}
+
+// ============================================================================
+// NODE POOLS (SLAB ALLOCATOR)
+// ============================================================================
+// Slab header size, rounded up so the objects after it stay aligned
+#define POOL_SLAB_HEADER ((sizeof(PoolSlab) + 15) & ~(size_t)15)
+
+void initNodePool(NodePool* pool, size_t objectSize, int objectsPerSlab) {
+    // Free objects store the free-list link in their first bytes
+    if (objectSize < sizeof(void*)) objectSize = sizeof(void*);
+    pool->objectSize = (objectSize + 15) & ~(size_t)15;
+    pool->objectsPerSlab = objectsPerSlab;
+    pool->freeList = NULL;
+    pool->slabs = NULL;
+    pool->slabCount = 0;
+    pool->allocations = 0;
+    pool->frees = 0;
+    pool->liveObjects = 0;
+    pool->peakObjects = 0;
+}
+
+// Carve a fresh slab into objects and push them all onto the free-list
+static void growNodePool(NodePool* pool) {
+    PoolSlab* slab = (PoolSlab*)malloc(POOL_SLAB_HEADER + pool->objectSize * (size_t)pool->objectsPerSlab);
+    if (!slab) exit(1);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slabCount++;
+    countMetric(METRIC_SLAB_ALLOCS, 1);
+
+    char* objects = (char*)slab + POOL_SLAB_HEADER;
+    for (int i = pool->objectsPerSlab - 1; i >= 0; i--) {
+        void* object = objects + (size_t)i * pool->objectSize;
+        *(void**)object = pool->freeList;
+        pool->freeList = object;
+    }
+}
+
+void* poolAlloc(NodePool* pool) {
+    if (!pool->freeList) growNodePool(pool);
+    void* object = pool->freeList;
+    pool->freeList = *(void**)object;
+    pool->allocations++;
+    countMetric(METRIC_POOL_ALLOCS, 1);
+    if (++pool->liveObjects > pool->peakObjects) pool->peakObjects = pool->liveObjects;
+    return object;
+}
+
+void poolFree(NodePool* pool, void* object) {
+    if (!object) return;
+    *(void**)object = pool->freeList;
+    pool->freeList = object;
+    pool->frees++;
+    pool->liveObjects--;
+}
+
+// Move every slab, free object and counter of src into dst, leaving src empty
+void poolMerge(NodePool* dst, NodePool* src) {
+    if (src->slabs) {
+        PoolSlab* last = src->slabs;
+        while (last->next) last = last->next;
+        last->next = dst->slabs;
+        dst->slabs = src->slabs;
+    }
+    if (src->freeList) {
+        void* last = src->freeList;
+        while (*(void**)last) last = *(void**)last;
+        *(void**)last = dst->freeList;
+        dst->freeList = src->freeList;
+    }
+    dst->slabCount += src->slabCount;
+    dst->allocations += src->allocations;
+    dst->frees += src->frees;
+    dst->liveObjects += src->liveObjects;
+    if (dst->liveObjects > dst->peakObjects) dst->peakObjects = dst->liveObjects;
+    initNodePool(src, src->objectSize, src->objectsPerSlab);
+}
+
+// Release every object in one pass, whether or not it was freed
+void freeNodePool(NodePool* pool) {
+    while (pool->slabs) {
+        PoolSlab* slab = pool->slabs;
+        pool->slabs = slab->next;
+        free(slab);
+    }
+    pool->freeList = NULL;
+    pool->slabCount = 0;
+    pool->liveObjects = 0;
+}
+
+void displayAllocationStats(MusicPlayer* player) {
+    const NodePool* pool = &player->catalog->songPool;
+
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    printf("\n%-10s %10s %10s %10s %10s %8s\n", "Pool", "Allocs", "Frees", "Live", "Peak", "Slabs");
+    printf("%-10s %10ld %10ld %10ld %10ld %8ld\n", "Song", pool->allocations, pool->frees, pool->liveObjects,
+           pool->peakObjects, pool->slabCount);
+    printf("Queue: %d of %d slots (%zu bytes)\n", player->upcomingQueue->count, player->upcomingQueue->capacity,
+           (size_t)player->upcomingQueue->capacity * sizeof(int));
+    printf("History: %d of %d entries (%zu bytes), %ld pushed\n", player->history.count,
+           player->history.capacity, (size_t)player->history.capacity * sizeof(int), player->history.pushes);
+    printf("%d deleted song(s) awaiting reclamation\n", player->catalog->retiredCount);
+    const StringPool* strings = &player->catalog->strings;
+    printf("Strings: %u interned, %u free handles, %zu of %zu bytes\n", strings->count - strings->freeCount,
+           strings->freeCount, strings->size, strings->capacity);
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+// ============================================================================
+// STRING POOL (INTERNED STRINGS)
+// ============================================================================
+#define STRING_POOL_INITIAL_BUCKETS 256
+#define STRING_POOL_COMPACT_MIN 4096   // Handles in use before a catalog pool is compacted
+
+// FNV-1a over the raw bytes
+static uint32_t hashString(const char* str, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void initStringPool(StringPool* pool) {
+    pool->data = NULL;
+    pool->size = 0;
+    pool->capacity = 0;
+    pool->offsets = NULL;
+    pool->hashes = NULL;
+    pool->count = 0;
+    pool->refCapacity = 0;
+    pool->freeRefs = EMPTY_STRING_REF;
+    pool->freeCount = 0;
+    pool->buckets = (uint32_t*)calloc(STRING_POOL_INITIAL_BUCKETS, sizeof(uint32_t));
+    if (!pool->buckets) exit(1);
+    pool->bucketCapacity = STRING_POOL_INITIAL_BUCKETS;
+    stringPoolIntern(pool, "", 0); // Reference 0 is always the empty string
+}
+
+void freeStringPool(StringPool* pool) {
+    free(pool->data);
+    free(pool->offsets);
+    free(pool->hashes);
+    free(pool->buckets);
+    memset(pool, 0, sizeof(StringPool));
+}
+
+// Double the bucket array; buckets hold ref + 1 so zero means empty. Free
+// handles are not in the table and stay out of it.
+static void growStringBuckets(StringPool* pool) {
+    uint32_t capacity = pool->bucketCapacity * 2;
+    uint32_t* buckets = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if (!buckets) exit(1);
+    for (uint32_t old = 0; old < pool->bucketCapacity; old++) {
+        if (!pool->buckets[old]) continue;
+        uint32_t i = pool->hashes[pool->buckets[old] - 1] & (capacity - 1);
+        while (buckets[i]) i = (i + 1) & (capacity - 1);
+        buckets[i] = pool->buckets[old];
+    }
+    free(pool->buckets);
+    pool->buckets = buckets;
+    pool->bucketCapacity = capacity;
+}
+
+// Intern with a precomputed hash (lets pools be merged without rehashing)
+static StrRef internHashed(StringPool* pool, const char* str, size_t length, uint32_t hash) {
+    uint32_t mask = pool->bucketCapacity - 1;
+    uint32_t i = hash & mask;
+    while (pool->buckets[i]) {
+        StrRef ref = pool->buckets[i] - 1;
+        if (pool->hashes[ref] == hash) {
+            const char* existing = pool->data + pool->offsets[ref];
+            if (strncmp(existing, str, length) == 0 && existing[length] == '\0') return ref;
+        }
+        i = (i + 1) & mask;
+    }
+
+    // New string: append its bytes and a fresh reference
+    if (pool->size + length + 1 > pool->capacity) {
+        size_t capacity = pool->capacity ? pool->capacity * 2 : 4096;
+        while (pool->size + length + 1 > capacity) capacity *= 2;
+        char* data = (char*)realloc(pool->data, capacity);
+        if (!data) exit(1);
+        pool->data = data;
+        pool->capacity = capacity;
+    }
+    if (pool->freeCount == 0 && pool->count == pool->refCapacity) {
+        uint32_t capacity = pool->refCapacity ? pool->refCapacity * 2 : 256;
+        uint32_t* offsets = (uint32_t*)realloc(pool->offsets, capacity * sizeof(uint32_t));
+        uint32_t* hashes = (uint32_t*)realloc(pool->hashes, capacity * sizeof(uint32_t));
+        if (!offsets || !hashes) exit(1);
+        pool->offsets = offsets;
+        pool->hashes = hashes;
+        pool->refCapacity = capacity;
+    }
+
+    StrRef ref;
+    if (pool->freeCount > 0) {
+        ref = pool->freeRefs;
+        pool->freeRefs = pool->offsets[ref];
+        pool->freeCount--;
+    } else {
+        ref = pool->count++;
+    }
+    pool->offsets[ref] = (uint32_t)pool->size;
+    pool->hashes[ref] = hash;
+    memcpy(pool->data + pool->size, str, length);
+    pool->data[pool->size + length] = '\0';
+    pool->size += length + 1;
+    pool->buckets[i] = ref + 1;
+
+    // Keep the load factor at or below one half
+    if ((pool->count - pool->freeCount) * 2 > pool->bucketCapacity) growStringBuckets(pool);
+    return ref;
+}
+
+StrRef stringPoolIntern(StringPool* pool, const char* str, size_t length) {
+    return internHashed(pool, str, length, hashString(str, length));
+}
+
+// Intern every string of src into dst; remap[srcRef] receives the dst handle.
+// src must never have been compacted, so its strings lie in handle order.
+void stringPoolMerge(StringPool* dst, const StringPool* src, StrRef* remap) {
+    for (StrRef ref = 0; ref < src->count; ref++) {
+        uint32_t begin = src->offsets[ref];
+        size_t end = ref + 1 < src->count ? src->offsets[ref + 1] : src->size;
+        remap[ref] = internHashed(dst, src->data + begin, end - begin - 1, src->hashes[ref]);
+    }
+}
+
+// Drop the strings whose handle is not marked in live (one byte per handle;
+// "" always stays). Kept strings keep their handles and are packed into a
+// new buffer; dropped handles are handed out again by later interns.
+void stringPoolCompact(StringPool* pool, const unsigned char* live) {
+    size_t size = 0;
+    for (StrRef ref = 0; ref < pool->count; ref++)
+        if (ref == EMPTY_STRING_REF || live[ref]) size += strlen(pool->data + pool->offsets[ref]) + 1;
+    size_t capacity = 4096;
+    while (capacity < size) capacity *= 2;
+    char* data = (char*)malloc(capacity);
+    if (!data) exit(1);
+
+    memset(pool->buckets, 0, pool->bucketCapacity * sizeof(uint32_t));
+    uint32_t mask = pool->bucketCapacity - 1;
+    pool->size = 0;
+    pool->freeRefs = EMPTY_STRING_REF;
+    pool->freeCount = 0;
+    for (StrRef ref = pool->count; ref-- > 0;) {
+        if (ref != EMPTY_STRING_REF && !live[ref]) {
+            pool->offsets[ref] = pool->freeRefs; // Lowest handles are reused first
+            pool->freeRefs = ref;
+            pool->freeCount++;
+            continue;
+        }
+        size_t length = strlen(pool->data + pool->offsets[ref]) + 1;
+        memcpy(data + pool->size, pool->data + pool->offsets[ref], length);
+        pool->offsets[ref] = (uint32_t)pool->size;
+        pool->size += length;
+        uint32_t i = pool->hashes[ref] & mask;
+        while (pool->buckets[i]) i = (i + 1) & mask;
+        pool->buckets[i] = ref + 1;
+    }
+    free(pool->data);
+    pool->data = data;
+    pool->capacity = capacity;
+}
+
+// Look up a string without adding it; returns 0 if found and stores the handle
+int stringPoolFind(const StringPool* pool, const char* str, StrRef* ref) {
+    size_t length = strlen(str);
+    uint32_t hash = hashString(str, length);
+    uint32_t mask = pool->bucketCapacity - 1;
+    for (uint32_t i = hash & mask; pool->buckets[i]; i = (i + 1) & mask) {
+        StrRef candidate = pool->buckets[i] - 1;
+        if (pool->hashes[candidate] == hash && strcmp(pool->data + pool->offsets[candidate], str) == 0) {
+            *ref = candidate;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* stringPoolGet(const StringPool* pool, StrRef ref) {
+    return pool->data + pool->offsets[ref];
+}
+
+const char* songTitle(const MusicPlayer* player, const Song* song) {
+    return stringPoolGet(&player->catalog->strings, song->title);
+}
+
+const char* songArtist(const MusicPlayer* player, const Song* song) {
+    return stringPoolGet(&player->catalog->strings, song->artist);
+}
+
+const char* songFilepath(const MusicPlayer* player, const Song* song) {
+    return stringPoolGet(&player->catalog->strings, song->filepath);
+}
+
+// ============================================================================
+// PLAYLIST COLUMNS (STRUCT OF ARRAYS)
+// ============================================================================
+// Songs occupy append-only slots; a deleted song leaves its slot dead (id 0)
+// until enough slots are dead that the columns are compacted in play order.
+#define COLUMNS_INITIAL_CAPACITY 256
+#define COLUMNS_COMPACT_MIN_DEAD 1024
+
+void initPlaylistColumns(PlaylistColumns* columns) {
+    memset(columns, 0, sizeof(PlaylistColumns));
+}
+
+void freePlaylistColumns(PlaylistColumns* columns) {
+    free(columns->ids);
+    free(columns->durations);
+    free(columns->titles);
+    free(columns->artists);
+    free(columns->rows);
+    free(columns->order);
+    memset(columns, 0, sizeof(PlaylistColumns));
+}
+
+static void* growColumn(void* column, int capacity, size_t elementSize) {
+    void* grown = realloc(column, (size_t)capacity * elementSize);
+    if (!grown) exit(1);
+    return grown;
+}
+
+static void reserveColumns(PlaylistColumns* columns, int slots) {
+    if (slots <= columns->slotCapacity) return;
+    int capacity = columns->slotCapacity ? columns->slotCapacity : COLUMNS_INITIAL_CAPACITY;
+    while (capacity < slots) capacity *= 2;
+    columns->ids = (int*)growColumn(columns->ids, capacity, sizeof(int));
+    columns->durations = (int*)growColumn(columns->durations, capacity, sizeof(int));
+    columns->titles = (StrRef*)growColumn(columns->titles, capacity, sizeof(StrRef));
+    columns->artists = (StrRef*)growColumn(columns->artists, capacity, sizeof(StrRef));
+    columns->rows = (Song**)growColumn(columns->rows, capacity, sizeof(Song*));
+    columns->order = (int*)growColumn(columns->order, capacity, sizeof(int));
+    columns->slotCapacity = capacity;
+}
+
+void columnsAppend(PlaylistColumns* columns, Song* song) {
+    reserveColumns(columns, columns->slotCount + 1);
+    int slot = columns->slotCount++;
+    columns->ids[slot] = song->id;
+    columns->durations[slot] = song->duration;
+    columns->titles[slot] = song->title;
+    columns->artists[slot] = song->artist;
+    columns->rows[slot] = song;
+    columns->order[columns->orderCount++] = slot;
+    song->slot = slot;
+}
+
+// Rewrite every column in play order, dropping dead slots
+static void compactColumns(PlaylistColumns* columns) {
+    PlaylistColumns compacted;
+    initPlaylistColumns(&compacted);
+    reserveColumns(&compacted, columns->slotCount - columns->deadCount);
+    for (int k = 0; k < columns->orderCount; k++) {
+        int slot = columns->order[k];
+        if (columns->ids[slot]) columnsAppend(&compacted, columns->rows[slot]);
+    }
+    freePlaylistColumns(columns);
+    *columns = compacted;
+}
+
+void columnsRemove(PlaylistColumns* columns, Song* song) {
+    columns->ids[song->slot] = 0;
+    columns->durations[song->slot] = 0;
+    columns->rows[song->slot] = NULL;
+    columns->deadCount++;
+    if (columns->deadCount >= COLUMNS_COMPACT_MIN_DEAD && columns->deadCount * 2 > columns->slotCount)
+        compactColumns(columns);
+}
+
+void displayPlaylist(MusicPlayer* player) {
+    const PlaylistColumns* columns = &player->catalog->columns;
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    for (int k = 0; k < columns->orderCount; k++) {
+        int slot = columns->order[k];
+        if (!columns->ids[slot]) continue;
+        printf("%d | %s - %s (%d sec) [%s]\n", columns->ids[slot],
+               stringPoolGet(&player->catalog->strings, columns->artists[slot]),
+               stringPoolGet(&player->catalog->strings, columns->titles[slot]), columns->durations[slot],
+               columns->rows[slot]->filepath != EMPTY_STRING_REF ? "Audio ✓" : "No File");
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+int getPlaylistSize(MusicPlayer* player) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    int count = player->catalog->songCount;
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return count;
+}
+
+// Dead slots have a zero duration, so the sum can skip the liveness check
+long getTotalDuration(MusicPlayer* player) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    const int* durations = player->catalog->columns.durations;
+    long total = 0;
+    for (int slot = 0; slot < player->catalog->columns.slotCount; slot++) total += durations[slot];
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return total;
+}
+
+// Collect up to maxIds song IDs by the given artist in play order; returns the
+// total number of matches
+int findSongsByArtist(MusicPlayer* player, const char* artist, int* outIds, int maxIds) {
+    StrRef ref;
+    int matches = 0;
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    if (stringPoolFind(&player->catalog->strings, artist, &ref) == 0) {
+        const PlaylistColumns* columns = &player->catalog->columns;
+        for (int k = 0; k < columns->orderCount; k++) {
+            int slot = columns->order[k];
+            if (columns->artists[slot] != ref || !columns->ids[slot]) continue;
+            if (matches < maxIds) outIds[matches] = columns->ids[slot];
+            matches++;
+        }
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return matches;
+}
+
+// Song* view of the n-th song in play order, or NULL past the end
+// Caller holds playlistLock for as long as it uses the song
+Song* playlistSongAt(MusicPlayer* player, int position) {
+    const PlaylistColumns* columns = &player->catalog->columns;
+    if (columns->deadCount == 0)
+        return position >= 0 && position < columns->orderCount ? columns->rows[columns->order[position]] : NULL;
+
+    for (int k = 0; k < columns->orderCount; k++) {
+        Song* song = columns->rows[columns->order[k]];
+        if (song && position-- == 0) return song;
+    }
+    return NULL;
+}
+
+// ============================================================================
+// SEARCH INDEX (TRIGRAM INVERTED INDEX)
+// ============================================================================
+// Every case-folded trigram of a song's title, artist and path maps to a
+// posting list of song IDs, stored ascending as varint-encoded deltas.
+// Deleted songs are left in the lists and filtered out when candidates are
+// verified; the index is rebuilt once stale postings outnumber live ones.
+#define SEARCH_INDEX_INITIAL_CAPACITY 4096
+#define SEARCH_REBUILD_MIN_STALE 65536
+#define TRIGRAM_OCCUPIED 0x80000000u     // Marks a used hash table entry
+#define POSTING_SKIP_INTERVAL 64          // Postings per skip pointer
+
+static unsigned char foldChar(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+static uint32_t packTrigram(const char* str) {
+    return ((uint32_t)foldChar((unsigned char)str[0]) << 16) |
+           ((uint32_t)foldChar((unsigned char)str[1]) << 8) |
+           (uint32_t)foldChar((unsigned char)str[2]);
+}
+
+static unsigned int hashTrigram(uint32_t trigram, int capacity) {
+    return (trigram * 2654435769u) & (unsigned int)(capacity - 1);
+}
+
+void initSearchIndex(SearchIndex* index) {
+    index->lists = NULL;
+    index->capacity = 0;
+    index->count = 0;
+    index->livePostings = 0;
+    index->stalePostings = 0;
+    index->built = 0;
+}
+
+void freeSearchIndex(SearchIndex* index) {
+    for (int i = 0; i < index->capacity; i++) {
+        free(index->lists[i].data);
+        free(index->lists[i].skips);
+    }
+    free(index->lists);
+    initSearchIndex(index);
+}
+
+static PostingList* findPostingList(const SearchIndex* index, uint32_t trigram) {
+    if (!index->capacity) return NULL;
+    unsigned int mask = (unsigned int)(index->capacity - 1);
+    for (unsigned int i = hashTrigram(trigram, index->capacity); index->lists[i].key; i = (i + 1) & mask) {
+        if (index->lists[i].key == (trigram | TRIGRAM_OCCUPIED)) return &index->lists[i];
+    }
+    return NULL;
+}
+
+static PostingList* getPostingList(SearchIndex* index, uint32_t trigram) {
+    if ((index->count + 1) * 2 > index->capacity) {
+        // Grow at half load; the lists themselves move by value
+        int oldCapacity = index->capacity;
+        PostingList* oldLists = index->lists;
+        index->capacity = oldCapacity ? oldCapacity * 2 : SEARCH_INDEX_INITIAL_CAPACITY;
+        index->lists = (PostingList*)calloc((size_t)index->capacity, sizeof(PostingList));
+        if (!index->lists) exit(1);
+        unsigned int mask = (unsigned int)(index->capacity - 1);
+        for (int i = 0; i < oldCapacity; i++) {
+            if (!oldLists[i].key) continue;
+            unsigned int j = hashTrigram(oldLists[i].key & ~TRIGRAM_OCCUPIED, index->capacity);
+            while (index->lists[j].key) j = (j + 1) & mask;
+            index->lists[j] = oldLists[i];
+        }
+        free(oldLists);
+    }
+
+    unsigned int mask = (unsigned int)(index->capacity - 1);
+    unsigned int i = hashTrigram(trigram, index->capacity);
+    while (index->lists[i].key) {
+        if (index->lists[i].key == (trigram | TRIGRAM_OCCUPIED)) return &index->lists[i];
+        i = (i + 1) & mask;
+    }
+    index->lists[i].key = trigram | TRIGRAM_OCCUPIED;
+    index->count++;
+    return &index->lists[i];
+}
+
+static void postingAppendVarint(PostingList* list, uint32_t value) {
+    if (list->size + 5 > list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 8;
+        uint8_t* data = (uint8_t*)realloc(list->data, capacity);
+        if (!data) exit(1);
+        list->data = data;
+        list->capacity = capacity;
+    }
+    while (value >= 0x80) {
+        list->data[list->size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    list->data[list->size++] = (uint8_t)value;
+}
+
+static uint32_t postingReadVarint(const uint8_t* data, uint32_t* pos) {
+    uint32_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = data[(*pos)++];
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+// Decode a whole list into an ID array the caller frees
+static int* decodePostingList(const PostingList* list) {
+    int* ids = (int*)malloc((size_t)(list->count ? list->count : 1) * sizeof(int));
+    if (!ids) exit(1);
+    uint32_t pos = 0;
+    int id = 0;
+    for (int i = 0; i < list->count; i++) {
+        id += (int)postingReadVarint(list->data, &pos);
+        ids[i] = id;
+    }
+    return ids;
+}
+
+// Append an ID above lastId, recording a skip pointer at block boundaries
+static void postingAppend(PostingList* list, int songId) {
+    if (list->count % POSTING_SKIP_INTERVAL == 0) {
+        int block = list->count / POSTING_SKIP_INTERVAL;
+        if (block == list->skipCapacity) {
+            int capacity = list->skipCapacity ? list->skipCapacity * 2 : 4;
+            PostingSkip* skips = (PostingSkip*)realloc(list->skips, (size_t)capacity * sizeof(PostingSkip));
+            if (!skips) exit(1);
+            list->skips = skips;
+            list->skipCapacity = capacity;
+        }
+        list->skips[block].firstId = songId;
+        list->skips[block].baseId = list->lastId;
+        list->skips[block].offset = list->size;
+    }
+    postingAppendVarint(list, (uint32_t)(songId - list->lastId));
+    list->lastId = songId;
+    list->count++;
+}
+
+// Add one ID; returns 0 if it was new. Appends are O(1); an out-of-order ID
+// (possible when loading a hand-edited playlist) re-encodes the list.
+static int postingAdd(PostingList* list, int songId) {
+    if (songId > list->lastId) {
+        postingAppend(list, songId);
+        return 0;
+    }
+
+    int* ids = decodePostingList(list);
+    int at = 0;
+    while (at < list->count && ids[at] < songId) at++;
+    if (at < list->count && ids[at] == songId) {
+        free(ids);
+        return -1;
+    }
+    int count = list->count;
+    list->size = 0;
+    list->count = 0;
+    list->lastId = 0;
+    for (int i = 0; i <= count; i++) postingAppend(list, i < at ? ids[i] : (i == at ? songId : ids[i - 1]));
+    free(ids);
+    return 0;
+}
+
+static int compareTrigrams(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Distinct trigrams of a song's searchable fields; caller frees the array
+static uint32_t* collectSongTrigrams(const StringPool* strings, const Song* song, int* count) {
+    const char* fields[3] = { stringPoolGet(strings, song->title), stringPoolGet(strings, song->artist),
+                              stringPoolGet(strings, song->filepath) };
+    size_t lengths[3];
+    size_t total = 0;
+    for (int f = 0; f < 3; f++) {
+        lengths[f] = strlen(fields[f]);
+        total += lengths[f] >= 3 ? lengths[f] - 2 : 0;
+    }
+
+    uint32_t* trigrams = (uint32_t*)malloc((total ? total : 1) * sizeof(uint32_t));
+    if (!trigrams) exit(1);
+    int n = 0;
+    for (int f = 0; f < 3; f++) {
+        for (size_t i = 0; i + 3 <= lengths[f]; i++) trigrams[n++] = packTrigram(fields[f] + i);
+    }
+    qsort(trigrams, (size_t)n, sizeof(uint32_t), compareTrigrams);
+
+    int unique = 0;
+    for (int i = 0; i < n; i++) {
+        if (unique == 0 || trigrams[unique - 1] != trigrams[i]) trigrams[unique++] = trigrams[i];
+    }
+    *count = unique;
+    return trigrams;
+}
+
+void searchIndexAdd(SearchIndex* index, const StringPool* strings, const Song* song) {
+    if (!index->built) return; // Built in full on the first query
+    int count;
+    uint32_t* trigrams = collectSongTrigrams(strings, song, &count);
+    for (int i = 0; i < count; i++) {
+        if (postingAdd(getPostingList(index, trigrams[i]), song->id) == 0) index->livePostings++;
+    }
+    free(trigrams);
+}
+
+void searchIndexRemove(SearchIndex* index, const StringPool* strings, const Song* song) {
+    if (!index->built) return;
+    int count;
+    free(collectSongTrigrams(strings, song, &count));
+    index->livePostings -= count;
+    index->stalePostings += count;
+}
+
+static void buildSearchIndex(MusicPlayer* player) {
+    SearchIndex* index = &player->catalog->search;
+    freeSearchIndex(index);
+    index->built = 1;
+    for (Song* song = player->catalog->playlist; song; song = song->next) searchIndexAdd(index, &player->catalog->strings, song);
+}
+
+// Case-insensitive match of a folded query against a field
+static int fieldMatches(const char* field, const char* query, size_t queryLength, SearchMode mode) {
+    for (size_t i = 0; field[i]; i++) {
+        // Prefix mode only accepts matches at the start of a word
+        if (mode == SEARCH_PREFIX && i > 0 && isalnum((unsigned char)field[i - 1])) continue;
+        size_t j = 0;
+        while (j < queryLength && field[i + j] && foldChar((unsigned char)field[i + j]) == (unsigned char)query[j]) j++;
+        if (j == queryLength) return 1;
+    }
+    return queryLength == 0;
+}
+
+static int songMatches(MusicPlayer* player, const Song* song, const char* query, size_t queryLength, SearchMode mode) {
+    return fieldMatches(songTitle(player, song), query, queryLength, mode) ||
+           fieldMatches(songArtist(player, song), query, queryLength, mode) ||
+           fieldMatches(songFilepath(player, song), query, queryLength, mode);
+}
+
+static int comparePostingSizes(const void* a, const void* b) {
+    const PostingList* x = *(const PostingList* const*)a;
+    const PostingList* y = *(const PostingList* const*)b;
+    return (x->count > y->count) - (x->count < y->count);
+}
+
+// Cursor over a posting list that can jump ahead through skip pointers
+typedef struct PostingCursor {
+    const PostingList* list;
+    uint32_t offset;                 // Byte offset of the next varint
+    int read;                        // Postings decoded so far
+    int id;                          // Last decoded ID
+} PostingCursor;
+
+// Advance to the first ID >= target; returns 0 if the list runs out
+static int postingSeek(PostingCursor* cursor, int target) {
+    const PostingList* list = cursor->list;
+    if (cursor->read > 0 && cursor->id >= target) return 1;
+
+    // Jump to the last block that starts at or before the target
+    int block = cursor->read / POSTING_SKIP_INTERVAL;
+    int blocks = (list->count + POSTING_SKIP_INTERVAL - 1) / POSTING_SKIP_INTERVAL;
+    int next = block + 1;
+    while (next < blocks && list->skips[next].firstId <= target) next++;
+    if (next - 1 > block || cursor->read == 0) {
+        block = next - 1;
+        cursor->offset = list->skips[block].offset;
+        cursor->id = list->skips[block].baseId;
+        cursor->read = block * POSTING_SKIP_INTERVAL;
+    }
+
+    while (cursor->read < list->count) {
+        cursor->id += (int)postingReadVarint(list->data, &cursor->offset);
+        cursor->read++;
+        if (cursor->id >= target) return 1;
+    }
+    return 0;
+}
+
+// Find songs whose title, artist or path contains the query (or has a word
+// starting with it in prefix mode). Stores up to maxIds matching IDs in
+// ascending order and returns how many were stored.
+static int searchIndexNeedsBuild(const SearchIndex* index) {
+    return !index->built || (index->stalePostings >= SEARCH_REBUILD_MIN_STALE &&
+                             index->stalePostings > index->livePostings);
+}
+
+// Caller holds playlistLock (a read lock is enough)
+static int querySearchIndex(MusicPlayer* player, const char* query, SearchMode mode, int* outIds, int maxIds) {
+    SearchIndex* index = &player->catalog->search;
+    size_t queryLength = strlen(query);
+    char* folded = (char*)malloc(queryLength + 1);
+    if (!folded) return 0;
+    for (size_t i = 0; i <= queryLength; i++) folded[i] = (char)foldChar((unsigned char)query[i]);
+
+    int matches = 0;
+    if (queryLength < 3) {
+        // Too short for trigrams: scan the playlist
+        for (Song* song = player->catalog->playlist; song && matches < maxIds; song = song->next) {
+            if (songMatches(player, song, folded, queryLength, mode)) outIds[matches++] = song->id;
+        }
+        free(folded);
+        return matches;
+    }
+
+    // Look up every trigram of the query; a missing one means no matches
+    int listCount = (int)queryLength - 2;
+    PostingList** lists = (PostingList**)malloc((size_t)listCount * sizeof(PostingList*));
+    if (!lists) exit(1);
+    for (int i = 0; i < listCount; i++) {
+        lists[i] = findPostingList(index, packTrigram(folded + i));
+        if (!lists[i]) {
+            free(lists);
+            free(folded);
+            return 0;
+        }
+    }
+    qsort(lists, (size_t)listCount, sizeof(PostingList*), comparePostingSizes);
+
+    // Walk the shortest list and seek every longer list to each candidate;
+    // skip pointers keep this proportional to the shortest list
+    PostingCursor* cursors = (PostingCursor*)calloc((size_t)listCount, sizeof(PostingCursor));
+    if (!cursors) exit(1);
+    for (int l = 0; l < listCount; l++) cursors[l].list = lists[l];
+
+    int target = 0;
+    while (matches < maxIds && postingSeek(&cursors[0], target)) {
+        int candidate = cursors[0].id;
+        int l = 1;
+        while (l < listCount && postingSeek(&cursors[l], candidate) && cursors[l].id == candidate) l++;
+        if (l < listCount) {
+            // Leapfrog to the larger ID, or stop once any list runs out
+            if (cursors[l].id < candidate) break;
+            target = cursors[l].id;
+            continue;
+        }
+
+        // Trigram hits are a superset: confirm each live candidate
+        Song* song = songIndexLookup(&player->catalog->index, candidate);
+        if (song && songMatches(player, song, folded, queryLength, mode)) outIds[matches++] = candidate;
+        target = candidate + 1;
+    }
+    free(cursors);
+    free(lists);
+    free(folded);
+    return matches;
+}
+
+int searchSongs(MusicPlayer* player, const char* query, SearchMode mode, int* outIds, int maxIds) {
+    // (Re)building the index is a write; queries share the read lock
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    while (searchIndexNeedsBuild(&player->catalog->search)) {
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        pthread_rwlock_wrlock(&player->catalog->playlistLock);
+        if (searchIndexNeedsBuild(&player->catalog->search)) buildSearchIndex(player);
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    }
+    int matches = querySearchIndex(player, query, mode, outIds, maxIds);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return matches;
+}
+
+// ============================================================================
+// SORTED INDEXES (INDEXABLE SKIP LISTS)
+// ============================================================================
+// One skip list per sort key keeps the playlist ordered by artist, title or
+// duration. Every link records how many songs it jumps over, so the n-th
+// song and the rank of any key are found in O(log n) like a lookup. Sorted
+// pages and range queries then cost O(log n + page size). An index is built
+// on its first query and maintained on every insert and delete after that.
+#define SORTED_LEVEL_P 4                 // A node reaches level k+1 with probability 1/4
+#define MENU_PAGE_SIZE 20                // Songs per page in sorted menu listings
+
+static uint64_t nextRandom(uint64_t* state);
+
+static int collateText(const StringPool* strings, StrRef a, StrRef b) {
+    if (a == b) return 0;
+    const char* x = stringPoolGet(strings, a);
+    const char* y = stringPoolGet(strings, b);
+    int order = strcasecmp(x, y);
+    return order ? order : strcmp(x, y);
+}
+
+// Total order of two songs under key; song IDs break ties
+static int compareSorted(SortKey key, const StringPool* strings, const Song* a, const Song* b) {
+    int order;
+    switch (key) {
+        case SORT_BY_ARTIST:
+            order = collateText(strings, a->artist, b->artist);
+            if (!order) order = collateText(strings, a->title, b->title);
+            break;
+        case SORT_BY_TITLE:
+            order = collateText(strings, a->title, b->title);
+            if (!order) order = collateText(strings, a->artist, b->artist);
+            break;
+        default:
+            order = (a->duration > b->duration) - (a->duration < b->duration);
+            break;
+    }
+    return order ? order : (a->id > b->id) - (a->id < b->id);
+}
+
+// Primary key as a number that orders like the full key: the first 8
+// case-folded bytes of the text, or the biased duration. Most comparisons
+// are decided by it without touching the strings.
+static uint64_t sortedPrefix(SortKey key, const char* text, int seconds) {
+    if (key == SORT_BY_DURATION) return (uint32_t)seconds ^ 0x80000000u;
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; i++) {
+        prefix <<= 8;
+        if (*text) prefix |= foldChar((unsigned char)*text++);
+    }
+    return prefix;
+}
+
+static uint64_t songSortedPrefix(SortKey key, const StringPool* strings, const Song* song) {
+    if (key == SORT_BY_DURATION) return sortedPrefix(key, NULL, song->duration);
+    return sortedPrefix(key, stringPoolGet(strings, key == SORT_BY_ARTIST ? song->artist : song->title), 0);
+}
+
+static int compareSortedNode(SortKey key, const StringPool* strings, const SortedNode* node, const Song* song, uint64_t prefix) {
+    if (node->prefix != prefix) return node->prefix < prefix ? -1 : 1;
+    return compareSorted(key, strings, node->song, song);
+}
+
+// A node's primary key against a probe: text for artist/title, seconds
+// for duration
+static int compareSortedKey(SortKey key, const StringPool* strings, const SortedNode* node, const char* text, int seconds,
+                            uint64_t prefix) {
+    if (node->prefix != prefix) return node->prefix < prefix ? -1 : 1;
+    const Song* song = node->song;
+    if (key == SORT_BY_DURATION) return (song->duration > seconds) - (song->duration < seconds);
+    const char* field = stringPoolGet(strings, key == SORT_BY_ARTIST ? song->artist : song->title);
+    int order = strcasecmp(field, text);
+    return order ? order : strcmp(field, text);
+}
+
+static SortedNode* newSortedNode(Song* song, uint64_t prefix, int level) {
+    SortedNode* node = (SortedNode*)malloc(sizeof(SortedNode) + (size_t)level * sizeof(SortedLink));
+    if (!node) exit(1);
+    node->song = song;
+    node->prefix = prefix;
+    node->level = level;
+    return node;
+}
+
+void initSortedIndex(SortedIndex* index, SortKey key) {
+    memset(index, 0, sizeof(*index));
+    index->key = key;
+    index->rng = 0x5DEECE66DULL + (uint64_t)key;
+}
+
+void freeSortedIndex(SortedIndex* index) {
+    if (index->head) {
+        SortedNode* node = index->head->links[0].next;
+        while (node) {
+            SortedNode* next = node->links[0].next;
+            free(node);
+            node = next;
+        }
+        free(index->head);
+    }
+    initSortedIndex(index, index->key);
+}
+
+static int randomSortedLevel(SortedIndex* index) {
+    uint64_t bits = nextRandom(&index->rng);
+    int level = 1;
+    while (level < SORTED_INDEX_MAX_LEVEL && (bits & (SORTED_LEVEL_P - 1)) == 0) {
+        level++;
+        bits >>= 2;
+    }
+    return level;
+}
+
+// Stable merge sort of songs under key (qsort has no context argument)
+static void sortSongs(SortKey key, const StringPool* strings, SortedNode* songs, SortedNode* scratch, int count) {
+    if (count < 2) return;
+    int half = count / 2;
+    sortSongs(key, strings, songs, scratch, half);
+    sortSongs(key, strings, songs + half, scratch, count - half);
+    if (compareSortedNode(key, strings, &songs[half - 1], songs[half].song, songs[half].prefix) <= 0) return;
+    memcpy(scratch, songs, (size_t)half * sizeof(SortedNode));
+    int i = 0, j = half, k = 0;
+    while (i < half && j < count) {
+        songs[k++] = compareSortedNode(key, strings, &scratch[i], songs[j].song, songs[j].prefix) > 0 ? songs[j++] : scratch[i++];
+    }
+    while (i < half) songs[k++] = scratch[i++];
+}
+
+// Songs of the playlist (only song and prefix set) sorted under key
+static SortedNode* sortPlaylist(MusicPlayer* player, SortKey key, int* count) {
+    int capacity = player->catalog->songCount;
+    SortedNode* songs = (SortedNode*)malloc((size_t)(capacity ? capacity : 1) * sizeof(SortedNode));
+    SortedNode* scratch = (SortedNode*)malloc((size_t)(capacity / 2 + 1) * sizeof(SortedNode));
+    if (!songs || !scratch) exit(1);
+    int n = 0;
+    for (Song* song = player->catalog->playlist; song && n < capacity; song = song->next) {
+        songs[n].song = song;
+        songs[n++].prefix = songSortedPrefix(key, &player->catalog->strings, song);
+    }
+    sortSongs(key, &player->catalog->strings, songs, scratch, n);
+    free(scratch);
+    *count = n;
+    return songs;
+}
+
+// Build from the whole playlist: sort once, then link the nodes in order
+static void buildSortedIndex(MusicPlayer* player, SortedIndex* index) {
+    freeSortedIndex(index);
+    index->head = newSortedNode(NULL, 0, SORTED_INDEX_MAX_LEVEL);
+    for (int i = 0; i < SORTED_INDEX_MAX_LEVEL; i++) {
+        index->head->links[i].next = NULL;
+        index->head->links[i].width = 0;
+    }
+    index->level = 1;
+    index->built = 1;
+
+    int n;
+    SortedNode* songs = sortPlaylist(player, index->key, &n);
+    SortedNode* last[SORTED_INDEX_MAX_LEVEL];
+    int lastRank[SORTED_INDEX_MAX_LEVEL];
+    for (int i = 0; i < SORTED_INDEX_MAX_LEVEL; i++) {
+        last[i] = index->head;
+        lastRank[i] = 0;
+    }
+    for (int rank = 1; rank <= n; rank++) {
+        int level = randomSortedLevel(index);
+        SortedNode* node = newSortedNode(songs[rank - 1].song, songs[rank - 1].prefix, level);
+        for (int i = 0; i < level; i++) {
+            last[i]->links[i].next = node;
+            last[i]->links[i].width = rank - lastRank[i];
+            last[i] = node;
+            lastRank[i] = rank;
+        }
+        if (level > index->level) index->level = level;
+    }
+    // Links that run off the end span the rest of the list
+    for (int i = 0; i < index->level; i++) {
+        last[i]->links[i].next = NULL;
+        last[i]->links[i].width = n - lastRank[i];
+    }
+    index->count = n;
+    free(songs);
+}
+
+void sortedIndexInsert(SortedIndex* index, const StringPool* strings, Song* song) {
+    if (!index->built) return;
+    SortedNode* update[SORTED_INDEX_MAX_LEVEL];
+    int rank[SORTED_INDEX_MAX_LEVEL];
+    uint64_t prefix = songSortedPrefix(index->key, strings, song);
+    SortedNode* node = index->head;
+    for (int i = index->level - 1; i >= 0; i--) {
+        rank[i] = i == index->level - 1 ? 0 : rank[i + 1];
+        while (node->links[i].next && compareSortedNode(index->key, strings, node->links[i].next, song, prefix) < 0) {
+            rank[i] += node->links[i].width;
+            node = node->links[i].next;
+        }
+        update[i] = node;
+    }
+
+    int level = randomSortedLevel(index);
+    for (int i = index->level; i < level; i++) {
+        rank[i] = 0;
+        update[i] = index->head;
+        update[i]->links[i].width = index->count;
+    }
+    if (level > index->level) index->level = level;
+
+    SortedNode* inserted = newSortedNode(song, prefix, level);
+    for (int i = 0; i < level; i++) {
+        inserted->links[i].next = update[i]->links[i].next;
+        inserted->links[i].width = update[i]->links[i].width - (rank[0] - rank[i]);
+        update[i]->links[i].next = inserted;
+        update[i]->links[i].width = rank[0] - rank[i] + 1;
+    }
+    for (int i = level; i < index->level; i++) update[i]->links[i].width++;
+    index->count++;
+}
+
+void sortedIndexRemove(SortedIndex* index, const StringPool* strings, const Song* song) {
+    if (!index->built) return;
+    SortedNode* update[SORTED_INDEX_MAX_LEVEL];
+    uint64_t prefix = songSortedPrefix(index->key, strings, song);
+    SortedNode* node = index->head;
+    for (int i = index->level - 1; i >= 0; i--) {
+        while (node->links[i].next && compareSortedNode(index->key, strings, node->links[i].next, song, prefix) < 0)
+            node = node->links[i].next;
+        update[i] = node;
+    }
+    SortedNode* removed = node->links[0].next;
+    if (!removed || removed->song != song) return;
+
+    for (int i = 0; i < index->level; i++) {
+        if (update[i]->links[i].next == removed) {
+            update[i]->links[i].width += removed->links[i].width - 1;
+            update[i]->links[i].next = removed->links[i].next;
+        } else {
+            update[i]->links[i].width--;
+        }
+    }
+    while (index->level > 1 && !index->head->links[index->level - 1].next) index->level--;
+    index->count--;
+    free(removed);
+}
+
+// Node at 1-based rank, or NULL past the end
+static SortedNode* sortedIndexAt(const SortedIndex* index, int rank) {
+    if (rank < 1 || rank > index->count) return NULL;
+    SortedNode* node = index->head;
+    int traversed = 0;
+    for (int i = index->level - 1; i >= 0; i--) {
+        while (node->links[i].next && traversed + node->links[i].width <= rank) {
+            traversed += node->links[i].width;
+            node = node->links[i].next;
+        }
+        if (traversed == rank) return node;
+    }
+    return NULL;
+}
+
+// Songs whose primary key sorts before the probe (or up to and including
+// it when inclusive is set)
+static int sortedIndexRank(const SortedIndex* index, const StringPool* strings, const char* text, int seconds, int inclusive) {
+    uint64_t prefix = sortedPrefix(index->key, text, seconds);
+    SortedNode* node = index->head;
+    int rank = 0;
+    for (int i = index->level - 1; i >= 0; i--) {
+        while (node->links[i].next) {
+            int order = compareSortedKey(index->key, strings, node->links[i].next, text, seconds, prefix);
+            if (order > 0 || (order == 0 && !inclusive)) break;
+            rank += node->links[i].width;
+            node = node->links[i].next;
+        }
+    }
+    return rank;
+}
+
+// Copy the IDs of ranks first+1 .. last (at most maxIds of them)
+static int collectSortedRange(const SortedIndex* index, int first, int last, int* outIds, int maxIds) {
+    int copied = 0;
+    for (SortedNode* node = sortedIndexAt(index, first + 1); node && first + copied < last && copied < maxIds;
+         node = node->links[0].next) {
+        outIds[copied++] = node->song->id;
+    }
+    return copied;
+}
+
+// Take the read lock with the index for key built
+static SortedIndex* lockSortedIndex(MusicPlayer* player, SortKey key) {
+    SortedIndex* index = &player->catalog->sorted[key];
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    while (!index->built) {
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        pthread_rwlock_wrlock(&player->catalog->playlistLock);
+        if (!index->built) buildSortedIndex(player, index);
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    }
+    return index;
+}
+
+// Songs in key order starting at offset; returns the playlist size
+int listSongsSorted(MusicPlayer* player, SortKey key, int offset, int* outIds, int maxIds, int* copied) {
+    SortedIndex* index = lockSortedIndex(player, key);
+    int total = index->count;
+    *copied = collectSortedRange(index, offset < 0 ? 0 : offset, total, outIds, maxIds);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return total;
+}
+
+// Songs minSeconds..maxSeconds long, shortest first, starting at offset;
+// returns the number in range
+int findSongsByDuration(MusicPlayer* player, int minSeconds, int maxSeconds, int offset, int* outIds, int maxIds, int* copied) {
+    SortedIndex* index = lockSortedIndex(player, SORT_BY_DURATION);
+    int first = sortedIndexRank(index, &player->catalog->strings, NULL, minSeconds, 0);
+    int last = maxSeconds >= minSeconds ? sortedIndexRank(index, &player->catalog->strings, NULL, maxSeconds, 1) : first;
+    *copied = collectSortedRange(index, first + (offset < 0 ? 0 : offset), last, outIds, maxIds);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return last - first;
+}
+
+// One artist's songs by title, starting at offset; returns the number by
+// that artist. Unlike findSongsByArtist this never walks the playlist.
+int listSongsByArtist(MusicPlayer* player, const char* artist, int offset, int* outIds, int maxIds, int* copied) {
+    SortedIndex* index = lockSortedIndex(player, SORT_BY_ARTIST);
+    int first = sortedIndexRank(index, &player->catalog->strings, artist, 0, 0);
+    int last = sortedIndexRank(index, &player->catalog->strings, artist, 0, 1);
+    *copied = collectSortedRange(index, first + (offset < 0 ? 0 : offset), last, outIds, maxIds);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return last - first;
+}
+
+// Print one page of songs and return how many were shown
+int displaySortedPage(MusicPlayer* player, const int* ids, int count) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    int shown = 0;
+    for (int i = 0; i < count; i++) {
+        Song* s = findSongById(player, ids[i]);
+        if (!s) continue;
+        printf("%d | %s - %s (%d:%02d)\n", s->id, songArtist(player, s), songTitle(player, s),
+               s->duration / 60, s->duration % 60);
+        shown++;
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return shown;
+}
+
+// Time the indexes against sorting a copy of the playlist for each query
+void benchmarkSortedIndexes(MusicPlayer* player) {
+    const int rounds = 20;
+    const int page = 20;
+    int ids[20];
+    int copied;
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    int count = player->catalog->songCount;
+    const char* artist = player->catalog->playlist ? songArtist(player, player->catalog->playlist) : "";
+    char artistName[MAX_ARTIST];
+    snprintf(artistName, sizeof(artistName), "%s", artist);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    if (count == 0) {
+        printf("\nThe playlist is empty.\n");
+        return;
+    }
+
+    double start = benchNow();
+    for (int key = 0; key < SORT_KEY_COUNT; key++) listSongsSorted(player, (SortKey)key, 0, ids, 1, &copied);
+    double buildMs = (benchNow() - start) * 1000;
+
+    // Index: middle page by title, 3-5 minute songs, one artist's first page
+    double indexed[3], naive[3];
+    for (int test = 0; test < 3; test++) {
+        start = benchNow();
+        for (int r = 0; r < rounds; r++) {
+            if (test == 0) listSongsSorted(player, SORT_BY_TITLE, count / 2, ids, page, &copied);
+            else if (test == 1) findSongsByDuration(player, 180, 300, 0, ids, page, &copied);
+            else listSongsByArtist(player, artistName, 0, ids, page, &copied);
+        }
+        indexed[test] = (benchNow() - start) * 1e6 / rounds;
+    }
+
+    // Baseline: copy, filter and sort on every query (fewer rounds: slow)
+    const int naiveRounds = 3;
+    SortedNode* songs = (SortedNode*)malloc((size_t)count * sizeof(SortedNode));
+    SortedNode* scratch = (SortedNode*)malloc((size_t)(count / 2 + 1) * sizeof(SortedNode));
+    if (!songs || !scratch) exit(1);
+    volatile int sink = 0;
+    for (int test = 0; test < 3; test++) {
+        SortKey key = test == 0 ? SORT_BY_TITLE : test == 1 ? SORT_BY_DURATION : SORT_BY_ARTIST;
+        start = benchNow();
+        for (int r = 0; r < naiveRounds; r++) {
+            pthread_rwlock_rdlock(&player->catalog->playlistLock);
+            StrRef artistRef = EMPTY_STRING_REF;
+            stringPoolFind(&player->catalog->strings, artistName, &artistRef);
+            int n = 0;
+            for (Song* song = player->catalog->playlist; song; song = song->next) {
+                if (test == 1 && (song->duration < 180 || song->duration > 300)) continue;
+                if (test == 2 && song->artist != artistRef) continue;
+                songs[n].song = song;
+                songs[n++].prefix = songSortedPrefix(key, &player->catalog->strings, song);
+            }
+            sortSongs(key, &player->catalog->strings, songs, scratch, n);
+            int from = test == 0 ? n / 2 : 0;
+            for (int i = from; i < n && i < from + page; i++) sink += songs[i].song->id;
+            pthread_rwlock_unlock(&player->catalog->playlistLock);
+        }
+        naive[test] = (benchNow() - start) * 1e6 / naiveRounds;
+    }
+    free(songs);
+    free(scratch);
+    (void)sink;
+
+    // Maintenance cost: remove and re-insert songs in all three indexes
+    pthread_rwlock_wrlock(&player->catalog->playlistLock);
+    int updates = count < 10000 ? count : 10000;
+    start = benchNow();
+    Song* song = player->catalog->playlist;
+    for (int i = 0; i < updates && song; i++, song = song->next) {
+        for (int key = 0; key < SORT_KEY_COUNT; key++) {
+            sortedIndexRemove(&player->catalog->sorted[key], &player->catalog->strings, song);
+            sortedIndexInsert(&player->catalog->sorted[key], &player->catalog->strings, song);
+        }
+    }
+    double updateUs = (benchNow() - start) * 1e6 / updates;
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+
+    static const char* names[3] = { "Title page (middle)", "Duration 3-5 min", "Artist page" };
+    printf("\n%d song(s); building all three indexes took %.1f ms\n", count, buildMs);
+    printf("%-22s %14s %14s %10s\n", "Query (20 rows)", "Index", "Sort each time", "Speedup");
+    for (int test = 0; test < 3; test++) {
+        printf("%-22s %12.1fus %12.1fus %9.0fx\n", names[test], indexed[test], naive[test],
+               indexed[test] > 0 ? naive[test] / indexed[test] : 0);
+    }
+    printf("Delete + insert in all indexes: %.2f us per song\n", updateUs);
+}
+
+// ============================================================================
+// PLAYLIST MANAGEMENT
+// ============================================================================
+// Deleted songs are unlinked at once but only reclaimed when nothing in the
+// playback state refers to them any more
+#define RETIRED_FREE 1                   // Retired, not referenced at the last check
+#define RETIRED_HELD 2                   // Retired and still referenced
+
+static void markHeldSongs(MusicPlayer* player);
+static void journalSongAdded(MusicPlayer* player, const Song* song);
+static void journalSongRemoved(MusicPlayer* player, int songId);
+
+// Append a song node to the end of the playlist and register it in the index
+static void appendSong(MusicPlayer* player, Song* newSong) {
+    newSong->retired = 0;
+    newSong->gainDb = 0;
+    newSong->next = NULL;
+    newSong->prev = player->catalog->playlistTail;
+
+    if (!player->catalog->playlist) player->catalog->playlist = newSong;
+    else player->catalog->playlistTail->next = newSong;
+    player->catalog->playlistTail = newSong;
+
+    songIndexInsert(&player->catalog->index, newSong);
+    columnsAppend(&player->catalog->columns, newSong);
+    searchIndexAdd(&player->catalog->search, &player->catalog->strings, newSong);
+    for (int key = 0; key < SORT_KEY_COUNT; key++) sortedIndexInsert(&player->catalog->sorted[key], &player->catalog->strings, newSong);
+    player->catalog->songCount++;
+}
+
+// Create a song and return its ID (caller holds the write lock)
+static int insertSong(MusicPlayer* player, const char* title, const char* artist, int duration, const char* filepath) {
+    Song* newSong = (Song*)poolAlloc(&player->catalog->songPool);
+
+    newSong->id = player->catalog->nextId++;
+    newSong->title = stringPoolIntern(&player->catalog->strings, title, strlen(title));
+    newSong->artist = stringPoolIntern(&player->catalog->strings, artist, strlen(artist));
+    newSong->duration = duration;
+    newSong->filepath = stringPoolIntern(&player->catalog->strings, filepath, strlen(filepath));
+
+    appendSong(player, newSong);
+    journalSongAdded(player, newSong);
+    return newSong->id;
+}
+
+void addSong(MusicPlayer* player, const char* title, const char* artist, int duration, const char* filepath) {
+    pthread_rwlock_wrlock(&player->catalog->playlistLock);
+    int id = insertSong(player, title, artist, duration, filepath);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    printf("\n✓ Song added successfully! (ID: %d)\n", id);
+}
+
+// Drop the strings only deleted songs used once the handles in use are more
+// than twice what the remaining songs could need, so a catalog with steady
+// turnover stays bounded. Song nodes are the only long-lived holders of
+// catalog handles, and theirs stay valid (caller holds the write lock).
+static void compactCatalogStrings(SongCatalog* catalog) {
+    StringPool* strings = &catalog->strings;
+    uint32_t inUse = strings->count - strings->freeCount;
+    uint32_t needed = 3 * (uint32_t)(catalog->songCount + catalog->retiredCount) + 1;
+    if (inUse < STRING_POOL_COMPACT_MIN || inUse <= 2 * needed) return;
+
+    unsigned char* live = (unsigned char*)calloc(strings->count, 1);
+    if (!live) exit(1);
+    Song* lists[2] = { catalog->playlist, catalog->retiredSongs };
+    for (int i = 0; i < 2; i++) {
+        for (Song* song = lists[i]; song; song = song->next) {
+            live[song->title] = 1;
+            live[song->artist] = 1;
+            live[song->filepath] = 1;
+        }
+    }
+    stringPoolCompact(strings, live);
+    free(live);
+}
+
+// Return retired songs to the pool once no session's playback state points
+// at them (caller holds the write lock, which keeps the session list still).
+// Songs still referenced stay retired: their fields remain readable and
+// findNextSong treats them as gone.
+void reclaimRetiredSongs(MusicPlayer* player) {
+    for (MusicPlayer* session = player->catalog->sessions; session; session = session->nextSession) {
+        lockPlayback(session);
+        markHeldSongs(session);
+        pthread_mutex_unlock(&session->playbackMutex);
+    }
+
+    Song** link = &player->catalog->retiredSongs;
+    while (*link) {
+        Song* song = *link;
+        if (song->retired == RETIRED_HELD) {
+            song->retired = RETIRED_FREE;
+            link = &song->next;
+            continue;
+        }
+        *link = song->next;
+        poolFree(&player->catalog->songPool, song);
+        player->catalog->retiredCount--;
+    }
+    compactCatalogStrings(player->catalog);
+}
+
+// Unlink and retire a song; returns -1 if the ID is unknown (caller holds
+// the write lock and reclaims retired songs when convenient)
+static int removeSong(MusicPlayer* player, int songId) {
+    Song* current = songIndexLookup(&player->catalog->index, songId);
+    if (!current) return -1;
+
+    if (current->prev) current->prev->next = current->next;
+    else player->catalog->playlist = current->next;
+    if (current->next) current->next->prev = current->prev;
+    else player->catalog->playlistTail = current->prev;
+
+    songIndexRemove(&player->catalog->index, songId);
+    columnsRemove(&player->catalog->columns, current);
+    searchIndexRemove(&player->catalog->search, &player->catalog->strings, current);
+    for (int key = 0; key < SORT_KEY_COUNT; key++) sortedIndexRemove(&player->catalog->sorted[key], &player->catalog->strings, current);
+    player->catalog->songCount--;
+
+    // Playback may still hold the node: retire it instead of freeing
+    current->retired = RETIRED_FREE;
+    current->prev = NULL;
+    current->next = player->catalog->retiredSongs;
+    player->catalog->retiredSongs = current;
+    player->catalog->retiredCount++;
+    journalSongRemoved(player, songId);
+    return 0;
+}
+
+void deleteSong(MusicPlayer* player, int songId) {
+    pthread_rwlock_wrlock(&player->catalog->playlistLock);
+    int removed = removeSong(player, songId) == 0;
+    if (removed) reclaimRetiredSongs(player);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    printf(removed ? "\n✓ Song deleted.\n" : "\n✗ Song ID not found.\n");
+}
+
+// Caller holds playlistLock for as long as it uses the song
+Song* findSongById(MusicPlayer* player, int songId) {
+    return songIndexLookup(&player->catalog->index, songId);
+}
+
+// NEW: Find the next song in playlist after current song (caller holds
+// playlistLock)
+Song* findNextSong(MusicPlayer* player, Song* currentSong) {
+    if (!currentSong || currentSong->retired || !player->catalog->playlist) return NULL;
+
+    // Only follow the link if the song is still part of the playlist
+    if (songIndexLookup(&player->catalog->index, currentSong->id) != currentSong) return NULL;
+    return currentSong->next;
+}
+
+static Song* peekUpcoming(MusicPlayer* player);
+static void advanceShuffle(MusicPlayer* player);
+static int* upcomingSlot(const Queue* queue, int index);
+
+// Where the song after the current one comes from
+typedef enum NextSource {
+    NEXT_FROM_QUEUE,
+    NEXT_FROM_SHUFFLE,
+    NEXT_FROM_PLAYLIST
+} NextSource;
+
+// The song playNext goes to: the upcoming queue first, then the shuffle or
+// playlist order (caller holds playlistLock and playbackMutex)
+static Song* peekNextSong(MusicPlayer* player, NextSource* source) {
+    Song* song = peekUpcoming(player);
+    if (song) {
+        *source = NEXT_FROM_QUEUE;
+        return song;
+    }
+    if (player->shuffleEnabled) {
+        *source = NEXT_FROM_SHUFFLE;
+        return nextShuffledSong(player);
+    }
+    *source = NEXT_FROM_PLAYLIST;
+    return player->currentSong ? findNextSong(player, player->currentSong) : NULL;
+}
+
+// Mark the peeked song as played in the order it came from
+static void consumeNextSong(MusicPlayer* player, NextSource source) {
+    if (source == NEXT_FROM_QUEUE) dequeueUpcoming(player);
+    else if (source == NEXT_FROM_SHUFFLE) advanceShuffle(player);
+}
+
+// ============================================================================
+// GAPLESS PLAYBACK (PRE-BUFFERING)
+// ============================================================================
+// While a track plays, the first seconds of the next one are loaded into a
+// ready buffer: decoded PCM for WAV files, the leading bytes of compressed
+// files (which also leaves them in the page cache for the external player).
+#define PREBUFFER_SECONDS 5
+#define PREBUFFER_COMPRESSED_BYTES (256 * 1024)
+
+static uint32_t readLE32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t readLE16(const unsigned char* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Parse a RIFF/WAVE header and leave the file positioned at the PCM data
+int readWavHeader(FILE* file, WavInfo* info) {
+    unsigned char header[12];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)) return -1;
+    if (memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) return -1;
+
+    int haveFormat = 0;
+    unsigned char chunk[8];
+    while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)) {
+        uint32_t chunkSize = readLE32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16) {
+            unsigned char format[16];
+            if (fread(format, 1, sizeof(format), file) != sizeof(format)) return -1;
+            info->format = readLE16(format);
+            info->channels = readLE16(format + 2);
+            info->sampleRate = readLE32(format + 4);
+            info->bitsPerSample = readLE16(format + 14);
+            haveFormat = 1;
+            if (fseek(file, (long)(chunkSize - 16 + (chunkSize & 1)), SEEK_CUR) != 0) return -1;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!haveFormat || info->channels == 0 || info->bitsPerSample == 0) return -1;
+            info->dataSize = chunkSize;
+            info->dataOffset = ftell(file);
+            info->frameSize = info->channels * (info->bitsPerSample / 8);
+            return 0;
+        } else if (fseek(file, (long)(chunkSize + (chunkSize & 1)), SEEK_CUR) != 0) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static void releasePrebuffer(PrebufferedTrack* track) {
+    free(track->data);
+    memset(track, 0, sizeof(PrebufferedTrack));
+}
+
+// Load the ready buffer for a file; returns 0 on success
+static int loadPrebuffer(const char* filepath, PrebufferedTrack* track) {
+    FILE* file = fopen(filepath, "rb");
+    if (!file) return -1;
+
+    size_t wanted = PREBUFFER_COMPRESSED_BYTES;
+    track->isWav = readWavHeader(file, &track->wav) == 0 && track->wav.format == WAV_FORMAT_PCM;
+    if (track->isWav) {
+        // The engine fades over at most the ready buffer, so a crossfade
+        // longer than the usual buffer needs all of its frames loaded
+        size_t milliseconds = (size_t)atomic_load(&crossfadeMs);
+        if (milliseconds < PREBUFFER_SECONDS * 1000) milliseconds = PREBUFFER_SECONDS * 1000;
+        wanted = (size_t)track->wav.sampleRate * milliseconds / 1000 * track->wav.frameSize;
+        if (wanted > track->wav.dataSize) wanted = track->wav.dataSize;
+    } else {
+        rewind(file);
+    }
+
+    track->data = (char*)malloc(wanted ? wanted : 1);
+    if (!track->data) {
+        fclose(file);
+        return -1;
+    }
+    track->size = fread(track->data, 1, wanted, file);
+    if (track->isWav) track->size -= track->size % track->wav.frameSize; // Whole frames only
+    fclose(file);
+    return 0;
+}
+
+// Gain a song is played at: its loudness gain unless the session turned
+// normalisation off (caller holds playlistLock)
+static double songGainDb(MusicPlayer* player, const Song* song) {
+    return player->loudnessEnabled ? song->gainDb : 0;
+}
+
+// Hand a ready WAV buffer to the audio engine so it can run straight into
+// the next track (caller holds playbackMutex). Skipped while a switch the
+// engine made is still being processed, when the engine already has a
+// track queued, and when auto-play would not continue anyway.
+static void queuePrebufferInEngine(MusicPlayer* player) {
+    const PrebufferedTrack* ready = &player->prebuffer;
+    if (!ready->song || !ready->isWav || player->engineAdvancedTo || !player->autoPlayEnabled || player->manualStop) return;
+    if (!audioEngineWantsNext(player)) return;
+    audioEngineQueueNext(player, ready->song->id, songFilepath(player, ready->song), &ready->wav, ready->data, ready->size,
+                         songGainDb(player, ready->song));
+}
+
+// Make sure the ready buffer holds the song playNext would pick; a buffer
+// for a song that is no longer next (skipped or reordered) is dropped
+void prebufferNextTrack(MusicPlayer* player) {
+    pthread_mutex_lock(&player->prebufferLoadMutex);
+
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    NextSource source;
+    Song* next = player->currentSong ? peekNextSong(player, &source) : NULL;
+    if (player->prebuffer.song && next != player->prebuffer.song) audioEngineClearNext(player); // Order changed
+    if (next == player->prebuffer.song || !next || next->filepath == EMPTY_STRING_REF) {
+        if (next != player->prebuffer.song) releasePrebuffer(&player->prebuffer);
+        else queuePrebufferInEngine(player);
+        pthread_mutex_unlock(&player->playbackMutex);
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        pthread_mutex_unlock(&player->prebufferLoadMutex);
+        return;
+    }
+    int nextId = next->id;
+    char* path = strdup(songFilepath(player, next));
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+
+    // Read without locks so neither playback control nor playlist edits
+    // wait on disk
+    PrebufferedTrack loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    int ok = path && loadPrebuffer(path, &loaded) == 0;
+    free(path);
+
+    // The song may have been deleted (and its node reused) meanwhile
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    releasePrebuffer(&player->prebuffer);
+    if (ok && songIndexLookup(&player->catalog->index, nextId) == next) {
+        loaded.song = next;
+        player->prebuffer = loaded;
+        queuePrebufferInEngine(player);
+    } else {
+        releasePrebuffer(&loaded);
+    }
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+
+    pthread_mutex_unlock(&player->prebufferLoadMutex);
+}
+
+// Record the gap between the end of the last track and now (caller holds
+// playbackMutex)
+static void recordTransitionGap(MusicPlayer* player, int prebuffered) {
+    if (!player->trackEndedAtValid) return;
+    struct timespec now;
+    clock_gettime(MONITOR_CLOCK, &now);
+    double gap = elapsedMs(&player->trackEndedAt, &now);
+    player->trackEndedAtValid = 0;
+
+    TransitionStats* stats = &player->transitionStats;
+    if (stats->count == 0 || gap < stats->minGapMs) stats->minGapMs = gap;
+    if (gap > stats->maxGapMs) stats->maxGapMs = gap;
+    stats->lastGapMs = gap;
+    stats->totalGapMs += gap;
+    stats->count++;
+    observeMetricNs(METRIC_TRANSITION_GAP, (long long)(gap * 1e6));
+    if (prebuffered) stats->prebufferHits++;
+}
+
+void toggleGapless(MusicPlayer* player) {
+    lockPlayback(player);
+    player->gaplessEnabled = !player->gaplessEnabled;
+    if (!player->gaplessEnabled) releasePrebuffer(&player->prebuffer);
+    pthread_mutex_unlock(&player->playbackMutex);
+    printf("\nGapless playback is now %s.\n", player->gaplessEnabled ? "ENABLED" : "DISABLED");
+}
+
+void displayTransitionStats(MusicPlayer* player) {
+    lockPlayback(player);
+    TransitionStats stats = player->transitionStats;
+    pthread_mutex_unlock(&player->playbackMutex);
+
+    pthread_mutex_lock(&audioLatencyMutex);
+    AudioLatencyStats latency = audioLatency;
+    pthread_mutex_unlock(&audioLatencyMutex);
+
+    printf("\nTrack transitions: %ld (%ld from a ready buffer)\n", stats.count, stats.prebufferHits);
+    if (stats.count > 0) {
+        printf("Gap (ms): last %.2f  min %.2f  avg %.2f  max %.2f\n", stats.lastGapMs,
+               stats.minGapMs, stats.totalGapMs / stats.count, stats.maxGapMs);
+    }
+    if (latency.startCount > 0)
+        printf("Play start (ms): avg %.2f  max %.2f over %ld\n", latency.startTotalMs / latency.startCount,
+               latency.startMaxMs, latency.startCount);
+    if (latency.stopCount > 0)
+        printf("Stop (ms): avg %.2f  max %.2f over %ld\n", latency.stopTotalMs / latency.stopCount,
+               latency.stopMaxMs, latency.stopCount);
+    if (latency.firstAudioCount > 0)
+        printf("First audio (ms): avg %.2f  max %.2f over %ld\n", latency.firstAudioTotalMs / latency.firstAudioCount,
+               latency.firstAudioMaxMs, latency.firstAudioCount);
+
+    long seamless;
+    long long underrunFrames;
+    audioEngineStats(player, &seamless, &underrunFrames);
+    printf("Audio engine: %ld seamless transition(s), %lld underrun frame(s)\n", seamless, underrunFrames);
+}
+
+// ============================================================================
+// PREDICTIVE READ-AHEAD (PAGE CACHE HINTS)
+// ============================================================================
+// On network or spinning storage the first read of a file can hold up the
+// start of a track for hundreds of milliseconds. While a track plays, the
+// songs playNext would go to after it (the upcoming queue, then the next
+// shuffle draw or the playlist order) are handed to the kernel with
+// posix_fadvise(WILLNEED), leading bytes first, within a byte budget. A
+// hinted song that leaves that window without being played was skipped:
+// its pages are dropped with DONTNEED, unless another session of the
+// catalog still reads it ahead or plays it. Without fadvise the bytes are
+// read instead and nothing is evicted.
+#define READAHEAD_READ_CHUNK (64 * 1024)
+#define READAHEAD_REFS_INITIAL_CAPACITY 64
+
+#ifdef _WIN32
+    #define READAHEAD_OPEN_FLAGS (O_RDONLY | O_BINARY)
+#else
+    #define READAHEAD_OPEN_FLAGS (O_RDONLY | O_CLOEXEC)
+#endif
+
+static void initReadAheadRefs(ReadAheadRefs* refs) {
+    pthread_mutex_init(&refs->mutex, NULL);
+    refs->slots = (ReadAheadHold*)calloc(READAHEAD_REFS_INITIAL_CAPACITY, sizeof(ReadAheadHold));
+    if (!refs->slots) exit(1);
+    refs->capacity = READAHEAD_REFS_INITIAL_CAPACITY;
+    refs->count = 0;
+}
+
+static void freeReadAheadRefs(ReadAheadRefs* refs) {
+    pthread_mutex_destroy(&refs->mutex);
+    free(refs->slots);
+    refs->slots = NULL;
+    refs->capacity = 0;
+    refs->count = 0;
+}
+
+static unsigned int findReadAheadHold(const ReadAheadRefs* refs, int songId) {
+    unsigned int mask = (unsigned int)(refs->capacity - 1);
+    unsigned int i = hashSongId(songId, refs->capacity);
+    while (refs->slots[i].songId && refs->slots[i].songId != songId) i = (i + 1) & mask;
+    return i;
+}
+
+static void growReadAheadRefs(ReadAheadRefs* refs) {
+    ReadAheadHold* oldSlots = refs->slots;
+    int oldCapacity = refs->capacity;
+    refs->slots = (ReadAheadHold*)calloc((size_t)oldCapacity * 2, sizeof(ReadAheadHold));
+    if (!refs->slots) exit(1);
+    refs->capacity = oldCapacity * 2;
+    for (int i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i].songId) refs->slots[findReadAheadHold(refs, oldSlots[i].songId)] = oldSlots[i];
+    }
+    free(oldSlots);
+}
+
+// Backward-shift deletion, as in the song index
+static void removeReadAheadHold(ReadAheadRefs* refs, unsigned int hole) {
+    unsigned int mask = (unsigned int)(refs->capacity - 1);
+    unsigned int j = hole;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!refs->slots[j].songId) break;
+        unsigned int home = hashSongId(refs->slots[j].songId, refs->capacity);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            refs->slots[hole] = refs->slots[j];
+            hole = j;
+        }
+    }
+    refs->slots[hole].songId = 0;
+    refs->slots[hole].refs = 0;
+    refs->count--;
+}
+
+// Take (delta 1) or drop (delta -1) a reference to a song's cached pages;
+// returns the references left across all sessions
+static int holdReadAhead(SongCatalog* catalog, int songId, int delta) {
+    ReadAheadRefs* refs = &catalog->readAheadRefs;
+    pthread_mutex_lock(&refs->mutex);
+    if (delta > 0 && (refs->count + 1) * 4 > refs->capacity * 3) growReadAheadRefs(refs);
+    unsigned int i = findReadAheadHold(refs, songId);
+    int left = 0;
+    if (refs->slots[i].songId) {
+        left = refs->slots[i].refs += delta;
+        if (left <= 0) {
+            removeReadAheadHold(refs, i);
+            left = 0;
+        }
+    } else if (delta > 0) {
+        refs->slots[i].songId = songId;
+        refs->slots[i].refs = left = delta;
+        refs->count++;
+    }
+    pthread_mutex_unlock(&refs->mutex);
+    return left;
+}
+
+// Start reading up to budget leading bytes of a file into the page cache;
+// returns the bytes covered, 0 if the file cannot be opened
+static long long adviseWillNeed(const char* path, long long budget) {
+    int fd = open(path, READAHEAD_OPEN_FLAGS);
+    if (fd < 0) return 0;
+    long long bytes = 0;
+    struct stat info;
+    if (fstat(fd, &info) == 0) {
+        bytes = (long long)info.st_size < budget ? (long long)info.st_size : budget;
+#ifdef POSIX_FADV_WILLNEED
+        if (bytes > 0 && posix_fadvise(fd, 0, (off_t)bytes, POSIX_FADV_WILLNEED) != 0) bytes = 0;
+#else
+        char* buffer = (char*)malloc(READAHEAD_READ_CHUNK);
+        if (!buffer) exit(1);
+        long long done = 0;
+        while (done < bytes) {
+            long long chunk = bytes - done < READAHEAD_READ_CHUNK ? bytes - done : READAHEAD_READ_CHUNK;
+            int got = (int)read(fd, buffer, (unsigned int)chunk);
+            if (got <= 0) break;
+            done += got;
+        }
+        free(buffer);
+        bytes = done;
+#endif
+    }
+    close(fd);
+    return bytes;
+}
+
+static void adviseDontNeed(const char* path, long long bytes) {
+#ifdef POSIX_FADV_DONTNEED
+    int fd = open(path, READAHEAD_OPEN_FLAGS);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, (off_t)bytes, POSIX_FADV_DONTNEED);
+    close(fd);
+#else
+    (void)path;
+    (void)bytes;
+#endif
+}
+
+static void configureReadAhead(ReadAhead* ahead, int tracks, long long budgetBytes) {
+    if (tracks < 0) tracks = 0;
+    if (tracks > READAHEAD_MAX_TRACKS) tracks = READAHEAD_MAX_TRACKS;
+    ahead->tracks = tracks;
+    ahead->budgetBytes = budgetBytes > 0 ? budgetBytes : 0;
+}
+
+// Look ahead tracks songs and advise at most budgetBytes of them; 0 tracks
+// turns read-ahead off and drops the current hints
+void setReadAhead(MusicPlayer* player, int tracks, long long budgetBytes) {
+    lockPlayback(player);
+    configureReadAhead(&player->readAhead, tracks, budgetBytes);
+    wakePlayback(player);
+    pthread_mutex_unlock(&player->playbackMutex);
+}
+
+static int hasReadAheadHint(const ReadAhead* ahead, int songId) {
+    for (int i = 0; i < ahead->hintCount; i++) {
+        if (ahead->hints[i].songId == songId) return 1;
+    }
+    return 0;
+}
+
+static void addUpcomingSong(Song** songs, int* count, Song* song, const Song* current) {
+    if (song == current || song->filepath == EMPTY_STRING_REF) return;
+    for (int i = 0; i < *count; i++) {
+        if (songs[i] == song) return;
+    }
+    songs[(*count)++] = song;
+}
+
+// The songs playNext would go to after the current one, in order: the
+// upcoming queue, then the next shuffle draw (later ones are not drawn yet)
+// or the playlist order after the last queued song (caller holds
+// playlistLock and playbackMutex)
+static int collectUpcomingSongs(MusicPlayer* player, Song** songs, int max) {
+    Song* current = player->currentSong;
+    Song* last = current;
+    int count = 0;
+    const Queue* queue = player->upcomingQueue;
+    for (int i = 0; i < queue->count && count < max; i++) {
+        Song* song = findSongById(player, *upcomingSlot(queue, i));
+        if (!song) continue;
+        addUpcomingSong(songs, &count, song, current);
+        last = song;
+    }
+    if (player->shuffleEnabled) {
+        Song* song = count < max ? nextShuffledSong(player) : NULL;
+        if (song) addUpcomingSong(songs, &count, song, current);
+        return count;
+    }
+    while (count < max && last && (last = findNextSong(player, last)) != NULL) addUpcomingSong(songs, &count, last, current);
+    return count;
+}
+
+// Bring the hints in line with what plays next. Only the session's loop
+// pass changes them, so they can be read without a lock in between.
+static void refreshReadAhead(MusicPlayer* player) {
+    if (engineSinkType == AUDIO_SINK_CLOCK) return; // Nothing reads the files
+    ReadAhead* ahead = &player->readAhead;
+    SongCatalog* catalog = player->catalog;
+
+    pthread_rwlock_rdlock(&catalog->playlistLock);
+    lockPlayback(player);
+    Song* current = player->isPlaying ? player->currentSong : NULL;
+    int tracks = ahead->tracks;
+    if (!current || (tracks == 0 && ahead->hintCount == 0 && ahead->playingId == 0)) {
+        pthread_mutex_unlock(&player->playbackMutex); // Hints stay while stopped
+        pthread_rwlock_unlock(&catalog->playlistLock);
+        return;
+    }
+
+    // The playing song is held too, so a skip in another session cannot
+    // evict it; a hint for it turns into that hold
+    int playingId = tracks > 0 ? current->id : 0;
+    if (playingId != ahead->playingId) {
+        if (ahead->playingId) holdReadAhead(catalog, ahead->playingId, -1);
+        int handed = 0;
+        for (int i = 0; i < ahead->hintCount && !handed; i++) {
+            if (ahead->hints[i].songId != playingId) continue;
+            free(ahead->hints[i].path);
+            ahead->hints[i] = ahead->hints[--ahead->hintCount];
+            handed = 1;
+        }
+        if (!handed && playingId) holdReadAhead(catalog, playingId, 1);
+        ahead->playingId = playingId;
+    }
+
+    Song* upcoming[READAHEAD_MAX_TRACKS];
+    int upcomingCount = tracks > 0 ? collectUpcomingSongs(player, upcoming, tracks) : 0;
+
+    // Hints for songs that no longer come up were skipped
+    ReadAheadHint dropped[READAHEAD_MAX_TRACKS];
+    int droppedCount = 0;
+    int kept = 0;
+    long long budget = ahead->budgetBytes;
+    for (int i = 0; i < ahead->hintCount; i++) {
+        ReadAheadHint* hint = &ahead->hints[i];
+        int stillUpcoming = 0;
+        for (int j = 0; j < upcomingCount && !stillUpcoming; j++) stillUpcoming = upcoming[j]->id == hint->songId;
+        if (stillUpcoming) {
+            budget -= hint->bytes;
+            ahead->hints[kept++] = *hint;
+        } else if (holdReadAhead(catalog, hint->songId, -1) == 0) {
+            dropped[droppedCount++] = *hint;
+        } else {
+            free(hint->path);
+        }
+    }
+    ahead->hintCount = kept;
+
+    // New songs are held from here on so no other session evicts them while
+    // they are being advised
+    ReadAheadHint wanted[READAHEAD_MAX_TRACKS];
+    int wantedCount = 0;
+    for (int j = 0; j < upcomingCount && budget > 0; j++) {
+        if (hasReadAheadHint(ahead, upcoming[j]->id)) continue;
+        ReadAheadHint* hint = &wanted[wantedCount++];
+        hint->songId = upcoming[j]->id;
+        hint->path = strdup(songFilepath(player, upcoming[j]));
+        if (!hint->path) exit(1);
+        hint->bytes = 0;
+        holdReadAhead(catalog, hint->songId, 1);
+    }
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&catalog->playlistLock);
+
+    // Disk work happens without locks
+    long long evictedBytes = 0;
+    for (int i = 0; i < droppedCount; i++) {
+        adviseDontNeed(dropped[i].path, dropped[i].bytes);
+        evictedBytes += dropped[i].bytes;
+        free(dropped[i].path);
+    }
+    long long advisedBytes = 0;
+    for (int i = 0; i < wantedCount && budget > 0; i++) {
+        wanted[i].bytes = adviseWillNeed(wanted[i].path, budget);
+        budget -= wanted[i].bytes;
+        advisedBytes += wanted[i].bytes;
+    }
+
+    lockPlayback(player);
+    for (int i = 0; i < wantedCount; i++) {
+        if (wanted[i].bytes > 0) {
+            ahead->hints[ahead->hintCount++] = wanted[i];
+        } else {
+            holdReadAhead(catalog, wanted[i].songId, -1);
+            free(wanted[i].path);
+        }
+    }
+    ahead->stats.hintedBytes += advisedBytes;
+    ahead->stats.evictions += droppedCount;
+    ahead->stats.evictedBytes += evictedBytes;
+    pthread_mutex_unlock(&player->playbackMutex);
+    countMetric(METRIC_READAHEAD_BYTES, advisedBytes);
+    countMetric(METRIC_READAHEAD_EVICTED_BYTES, evictedBytes);
+}
+
+// Count whether a track about to open its file was read ahead (caller
+// holds playbackMutex)
+static void noteReadAheadStart(MusicPlayer* player, const Song* song) {
+    const ReadAhead* ahead = &player->readAhead;
+    if (ahead->tracks == 0 || engineSinkType == AUDIO_SINK_CLOCK || song->filepath == EMPTY_STRING_REF) return;
+    if (hasReadAheadHint(ahead, song->id)) {
+        player->readAhead.stats.hits++;
+        countMetric(METRIC_READAHEAD_HITS, 1);
+    } else {
+        player->readAhead.stats.misses++;
+        countMetric(METRIC_READAHEAD_MISSES, 1);
+    }
+}
+
+// Give up every hold of a session that is going away; its pages are left
+// to age out of the cache
+static void releaseReadAhead(MusicPlayer* player) {
+    ReadAhead* ahead = &player->readAhead;
+    for (int i = 0; i < ahead->hintCount; i++) {
+        holdReadAhead(player->catalog, ahead->hints[i].songId, -1);
+        free(ahead->hints[i].path);
+    }
+    ahead->hintCount = 0;
+    if (ahead->playingId) holdReadAhead(player->catalog, ahead->playingId, -1);
+    ahead->playingId = 0;
+}
+
+void displayReadAheadStats(MusicPlayer* player) {
+    lockPlayback(player);
+    ReadAheadStats stats = player->readAhead.stats;
+    int tracks = player->readAhead.tracks;
+    long long budgetBytes = player->readAhead.budgetBytes;
+    int hintCount = player->readAhead.hintCount;
+    long long hintedBytes = 0;
+    for (int i = 0; i < hintCount; i++) hintedBytes += player->readAhead.hints[i].bytes;
+    pthread_mutex_unlock(&player->playbackMutex);
+
+    pthread_mutex_lock(&audioLatencyMutex);
+    AudioLatencyStats latency = audioLatency;
+    pthread_mutex_unlock(&audioLatencyMutex);
+
+    if (tracks > 0) printf("\nRead-ahead: next %d track(s), up to %.1f MB\n", tracks, budgetBytes / 1048576.0);
+    else printf("\nRead-ahead is OFF.\n");
+    printf("Hinted now: %d track(s), %.1f MB\n", hintCount, hintedBytes / 1048576.0);
+    printf("Track starts: %ld read ahead, %ld cold\n", stats.hits, stats.misses);
+    printf("Advised %.1f MB in total; %ld skipped track(s) evicted (%.1f MB)\n", stats.hintedBytes / 1048576.0,
+           stats.evictions, stats.evictedBytes / 1048576.0);
+    if (latency.firstAudioCount > 0)
+        printf("First audio (ms): avg %.2f  max %.2f over %ld\n", latency.firstAudioTotalMs / latency.firstAudioCount,
+               latency.firstAudioMaxMs, latency.firstAudioCount);
+}
+
+// ============================================================================
+// PLAYBACK OPERATIONS
+// ============================================================================
+// Switch playback to a song picked by the user; the song it replaces goes
+// into the history unless we are walking back through it (caller holds
+// playlistLock and playbackMutex)
+static void switchToSong(MusicPlayer* player, Song* song, int remember) {
+    player->switchGeneration++;
+    if (isAudioPlaying(player)) {
+        stopAudioFile(player);
+    }
+    if (player->currentSong && remember) {
+        pushToRecentlyPlayed(player, player->currentSong);
+    }
+    player->currentSong = song;
+    
+    // NEW: Reset manual stop flag when playing new song
+    player->manualStop = 0;
+    player->trackEndedAtValid = 0; // A manual pick is not a track transition
+    
+    printf("\nNow Playing: %s - %s (%d sec)\n", songArtist(player, song), songTitle(player, song), song->duration);
+    if (song->filepath != EMPTY_STRING_REF) {
+        noteReadAheadStart(player, song);
+        playAudioFile(player, songFilepath(player, song), songGainDb(player, song));
+    } else {
+        printf("(No audio file associated)\n");
+        player->isPlaying = 0;
+    }
+
+    // NEW: Record song start time and duration for auto-play tracking
+    startPlaybackClock(player, song->duration);
+}
+
+void playSong(MusicPlayer* player, int songId) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    Song* song = findSongById(player, songId);
+    if (!song) {
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        printf("\nSong not found!\n");
+        return;
+    }
+
+    lockPlayback(player);
+    switchToSong(player, song, 1);
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+// Go back to the most recently played song still in the playlist
+void playPrevious(MusicPlayer* player) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    Song* song = NULL;
+    int songId;
+    while (!song && (songId = popRecentlyPlayed(player)) > 0) song = findSongById(player, songId);
+    if (song) switchToSong(player, song, 0);
+    else printf("\nNo previous song.\n");
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+// NEW: Play the next song in the playlist (called by monitoring thread)
+// The read lock is held throughout, so the chosen song and its path stay
+// valid while the players are switched even if the UI deletes it
+void playNext(MusicPlayer* player) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    
+    // Queued songs can start playback; playlist order needs a current song
+    NextSource source;
+    Song* nextSong = peekNextSong(player, &source);
+    if (!player->currentSong && source != NEXT_FROM_QUEUE) {
+        printf("\nNo song currently playing.\n");
+        pthread_mutex_unlock(&player->playbackMutex);
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        return;
+    }
+    
+    // Both dead ends silence a track skipped from: nothing tracks it once
+    // isPlaying is clear, so no later switch would stop it
+    if (!nextSong) {
+        printf("\n♪ Playlist finished! No more songs to play.\n");
+        stopAudioFile(player);
+        pthread_mutex_unlock(&player->playbackMutex);
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        return;
+    }
+    consumeNextSong(player, source);
+    unsigned generation = ++player->switchGeneration;
+
+    printf("\n⏭  Auto-playing next: %s - %s (%d sec)\n", songArtist(player, nextSong), songTitle(player, nextSong), nextSong->duration);
+    
+    // NEW: Check if filepath exists before trying to play
+    if (nextSong->filepath == EMPTY_STRING_REF) {
+        printf("ERROR: Next song has no audio file!\n");
+        player->currentSong = nextSong;
+        stopAudioFile(player);
+        pthread_mutex_unlock(&player->playbackMutex);
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        return;
+    }
+    
+    // NEW: Update player state BEFORE releasing mutex
+    if (player->currentSong) {
+        pushToRecentlyPlayed(player, player->currentSong);
+    }
+    player->currentSong = nextSong;
+    int previousEnded = !player->isPlaying; // The monitor clears isPlaying on a natural end
+    int prebuffered = player->prebuffer.song == nextSong;
+    if (prebuffered) releasePrebuffer(&player->prebuffer); // Its job (warming the file) is done
+
+    // The engine already switched at the sample boundary: audio never
+    // stopped, so only the bookkeeping moves on
+    int engineContinued = player->engineAdvancedTo == nextSong->id;
+    player->engineAdvancedTo = 0;
+    if (engineContinued) {
+        player->isPlaying = 1;
+        clock_gettime(MONITOR_CLOCK, &player->trackEndedAt);
+        recordTransitionGap(player, 1);
+        startPlaybackClock(player, nextSong->duration);
+        pthread_mutex_unlock(&player->playbackMutex);
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        return;
+    }
+    
+    const char* nextPath = songFilepath(player, nextSong);
+    double gainDb = songGainDb(player, nextSong);
+    noteReadAheadStart(player, nextSong);
+
+    // NEW: Release mutex BEFORE calling audio functions
+    player->deadlineArmed = 0;
+    pthread_mutex_unlock(&player->playbackMutex);
+    
+    // NEW: Call these functions OUTSIDE of mutex lock. A pick or stop made in
+    // the meantime wins: once it has bumped the generation this track is not
+    // started. A player that already exited needs no stop, and stopping is
+    // synchronous so no settle delay
+    int started = 0;
+    pthread_mutex_lock(&player->outputMutex);
+    if (player->switchGeneration == generation) {
+        if (!previousEnded) silenceAudioOutput(player);
+        started = startAudioOutput(player, nextPath, gainDb) == 0;
+        player->outputGeneration = generation;
+    }
+    pthread_mutex_unlock(&player->outputMutex);
+
+    // Arm the fallback deadline only once the new track is actually running
+    lockPlayback(player);
+    if (player->switchGeneration != generation) {
+        // Superseded after the track started. A pick with an audio file or a
+        // stop has replaced it already; otherwise it is still ours to stop.
+        pthread_mutex_lock(&player->outputMutex);
+        if (started && player->outputGeneration == generation) {
+            silenceAudioOutput(player);
+            player->outputGeneration = 0;
+        }
+        pthread_mutex_unlock(&player->outputMutex);
+    } else {
+        player->isPlaying = started;
+        recordTransitionGap(player, prebuffered);
+        startPlaybackClock(player, nextSong->duration);
+    }
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+// Seconds into the current track: counted in frames by the audio engine,
+// estimated from the start time for external players; -1 when stopped
+double getPlaybackPosition(MusicPlayer* player) {
+    double position = audioEnginePosition(player);
+    if (position >= 0) return position;
+
+    lockPlayback(player);
+    if (player->isPlaying && player->songStartTime > 0) {
+        position = difftime(time(NULL), player->songStartTime);
+        if (player->isPaused && player->pausedRemainingMs >= 0) position = player->currentSongDuration - player->pausedRemainingMs / 1000.0;
+    }
+    pthread_mutex_unlock(&player->playbackMutex);
+    return position;
+}
+
+void displayCurrentSong(MusicPlayer* player) {
+    double position = getPlaybackPosition(player);
+
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    Song* song = player->currentSong;
+    if (!song) {
+        pthread_mutex_unlock(&player->playbackMutex);
+        pthread_rwlock_unlock(&player->catalog->playlistLock);
+        printf("\nNo song currently playing.\n");
+        return;
+    }
+    printf("\nNow Playing: %s - %s%s\n", songArtist(player, song), songTitle(player, song),
+           song->retired ? " (removed from playlist)" : "");
+    if (position >= 0) {
+        int seconds = (int)position;
+        printf("Position: %d:%02d / %d:%02d%s\n", seconds / 60, seconds % 60, song->duration / 60,
+               song->duration % 60, player->isPaused ? " (paused)" : "");
+    } else {
+        printf("Stopped.\n");
+    }
+    if (song->gainDb != 0)
+        printf("Loudness gain: %+.1f dB%s\n", song->gainDb, player->loudnessEnabled ? "" : " (normalisation off)");
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+// NEW: Toggle auto-play feature on/off
+void toggleAutoPlay(MusicPlayer* player) {
+    player->autoPlayEnabled = !player->autoPlayEnabled;
+    printf("\nAuto-play is now %s.\n", player->autoPlayEnabled ? "ENABLED" : "DISABLED");
+}
+
+// ============================================================================
+// PLAY HISTORY (RING BUFFER) & UPCOMING QUEUE (DEQUE)
+// ============================================================================
+// Both are playback state: callers hold playbackMutex. The history keeps
+// song IDs, not pointers, so deleting a song never leaves it dangling; IDs
+// of deleted songs are skipped when read back.
+void pushToRecentlyPlayed(MusicPlayer* player, Song* song) {
+    PlayHistory* history = &player->history;
+    if (history->capacity == 0) return;
+    history->ids[history->head] = song->id;
+    history->head = (history->head + 1) % history->capacity;
+    if (history->count < history->capacity) history->count++;
+    history->pushes++;
+}
+
+// Remove and return the newest entry, 0 when the history is empty
+int popRecentlyPlayed(MusicPlayer* player) {
+    PlayHistory* history = &player->history;
+    if (history->count == 0) return 0;
+    history->head = (history->head + history->capacity - 1) % history->capacity;
+    history->count--;
+    return history->ids[history->head];
+}
+
+// Newest first: index 0 is the song played last
+static int historyEntry(const PlayHistory* history, int index) {
+    return history->ids[(history->head + history->capacity - 1 - index) % history->capacity];
+}
+
+void clearRecentlyPlayed(MusicPlayer* player) {
+    player->history.head = 0;
+    player->history.count = 0;
+}
+
+// Resize the history, keeping the newest entries that still fit
+void setHistoryCapacity(MusicPlayer* player, int capacity) {
+    PlayHistory* history = &player->history;
+    if (capacity < 0) capacity = 0;
+    if (capacity > HISTORY_MAX_CAPACITY) capacity = HISTORY_MAX_CAPACITY;
+
+    int* ids = NULL;
+    if (capacity > 0) {
+        ids = (int*)malloc((size_t)capacity * sizeof(int));
+        if (!ids) exit(1);
+    }
+    int kept = history->count < capacity ? history->count : capacity;
+    for (int i = 0; i < kept; i++) ids[kept - 1 - i] = historyEntry(history, i);
+
+    free(history->ids);
+    history->ids = ids;
+    history->capacity = capacity;
+    history->count = kept;
+    history->head = capacity > 0 ? kept % capacity : 0;
+}
+
+void displayRecentlyPlayed(MusicPlayer* player) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    const PlayHistory* history = &player->history;
+    if (history->count == 0) printf("\nNo recently played songs.\n");
+    else printf("\nRecently played (newest first):\n");
+    for (int i = 0; i < history->count; i++) {
+        int songId = historyEntry(history, i);
+        Song* song = findSongById(player, songId);
+        if (song) printf("%d | %s - %s\n", song->id, songArtist(player, song), songTitle(player, song));
+        else printf("%d | (removed from playlist)\n", songId);
+    }
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+// The upcoming queue also keeps IDs. Edits wake the monitor so the
+// pre-buffered next track follows the new order.
+#define QUEUE_INITIAL_CAPACITY 16
+
+static void upcomingChanged(MusicPlayer* player) {
+    wakePlayback(player);
+}
+
+// Make room for extra more entries; the deque is unrolled to start at slot 0
+static void reserveUpcoming(Queue* queue, int extra) {
+    if (queue->count + extra <= queue->capacity) return;
+    int capacity = queue->capacity ? queue->capacity : QUEUE_INITIAL_CAPACITY;
+    while (capacity < queue->count + extra) capacity *= 2;
+    int* ids = (int*)malloc((size_t)capacity * sizeof(int));
+    if (!ids) exit(1);
+    for (int i = 0; i < queue->count; i++) ids[i] = queue->ids[(queue->head + i) & (queue->capacity - 1)];
+    free(queue->ids);
+    queue->ids = ids;
+    queue->capacity = capacity;
+    queue->head = 0;
+}
+
+static int* upcomingSlot(const Queue* queue, int index) {
+    return &queue->ids[(queue->head + index) & (queue->capacity - 1)];
+}
+
+void enqueueUpcoming(MusicPlayer* player, Song* song) {
+    Queue* queue = player->upcomingQueue;
+    reserveUpcoming(queue, 1);
+    *upcomingSlot(queue, queue->count) = song->id;
+    queue->count++;
+    upcomingChanged(player);
+}
+
+// "Play next": goes ahead of everything already queued
+void enqueueUpcomingFront(MusicPlayer* player, Song* song) {
+    Queue* queue = player->upcomingQueue;
+    reserveUpcoming(queue, 1);
+    queue->head = (queue->head - 1) & (queue->capacity - 1);
+    queue->ids[queue->head] = song->id;
+    queue->count++;
+    upcomingChanged(player);
+}
+
+// Append a batch, e.g. an artist or a search result; unknown IDs are
+// skipped. Returns the number queued (caller also holds playlistLock).
+int enqueueUpcomingIds(MusicPlayer* player, const int* ids, int count) {
+    Queue* queue = player->upcomingQueue;
+    reserveUpcoming(queue, count);
+    int added = 0;
+    for (int i = 0; i < count; i++) {
+        if (!findSongById(player, ids[i])) continue;
+        *upcomingSlot(queue, queue->count) = ids[i];
+        queue->count++;
+        added++;
+    }
+    if (added) upcomingChanged(player);
+    return added;
+}
+
+// Queue every song by an artist, in playlist order; returns how many. Takes
+// its own locks.
+int enqueueArtist(MusicPlayer* player, const char* artist) {
+    int stackIds[256];
+    int* ids = stackIds;
+    int matches = findSongsByArtist(player, artist, ids, 256);
+    if (matches > 256) {
+        int capacity = matches;
+        ids = (int*)malloc((size_t)capacity * sizeof(int));
+        if (!ids) exit(1);
+        matches = findSongsByArtist(player, artist, ids, capacity);
+        if (matches > capacity) matches = capacity; // Songs added in between
+    }
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    int added = enqueueUpcomingIds(player, ids, matches);
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    if (ids != stackIds) free(ids);
+    return added;
+}
+
+// Pop the front song, dropping entries deleted since they were queued
+// (caller also holds playlistLock)
+Song* dequeueUpcoming(MusicPlayer* player) {
+    Queue* queue = player->upcomingQueue;
+    while (queue->count > 0) {
+        int songId = queue->ids[queue->head];
+        queue->head = (queue->head + 1) & (queue->capacity - 1);
+        queue->count--;
+        Song* song = findSongById(player, songId);
+        if (song) return song;
+    }
+    return NULL;
+}
+
+// Front song without removing it; stale entries ahead of it are dropped
+static Song* peekUpcoming(MusicPlayer* player) {
+    Queue* queue = player->upcomingQueue;
+    while (queue->count > 0) {
+        Song* song = findSongById(player, queue->ids[queue->head]);
+        if (song) return song;
+        queue->head = (queue->head + 1) & (queue->capacity - 1);
+        queue->count--;
+    }
+    return NULL;
+}
+
+// Move the entry at position from to position to (0 = front)
+int moveUpcoming(MusicPlayer* player, int from, int to) {
+    Queue* queue = player->upcomingQueue;
+    if (from < 0 || from >= queue->count || to < 0 || to >= queue->count) return -1;
+    int songId = *upcomingSlot(queue, from);
+    for (; from < to; from++) *upcomingSlot(queue, from) = *upcomingSlot(queue, from + 1);
+    for (; from > to; from--) *upcomingSlot(queue, from) = *upcomingSlot(queue, from - 1);
+    *upcomingSlot(queue, to) = songId;
+    upcomingChanged(player);
+    return 0;
+}
+
+// splitmix64: one add and three multiply/xor-shift rounds per number
+static uint64_t nextRandom(uint64_t* state) {
+    if (*state == 0) *state = (uint64_t)time(NULL) ^ ((uint64_t)(uintptr_t)state << 16);
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Unbiased integer in [0, bound) (Lemire's multiply-shift with rejection)
+static uint32_t randomBelow(uint64_t* state, uint32_t bound) {
+    uint64_t product = (uint64_t)(uint32_t)nextRandom(state) * bound;
+    uint32_t low = (uint32_t)product;
+    if (low < bound) {
+        uint32_t threshold = (uint32_t)-bound % bound;
+        while (low < threshold) {
+            product = (uint64_t)(uint32_t)nextRandom(state) * bound;
+            low = (uint32_t)product;
+        }
+    }
+    return (uint32_t)(product >> 32);
+}
+
+// Fisher-Yates over the queue, in place
+void shuffleUpcoming(MusicPlayer* player) {
+    Queue* queue = player->upcomingQueue;
+    for (int i = queue->count - 1; i > 0; i--) {
+        int j = (int)randomBelow(&player->shuffle.rng, (uint32_t)i + 1);
+        int* a = upcomingSlot(queue, i);
+        int* b = upcomingSlot(queue, j);
+        int songId = *a;
+        *a = *b;
+        *b = songId;
+    }
+    upcomingChanged(player);
+}
+
+void displayUpcoming(MusicPlayer* player) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    Queue* queue = player->upcomingQueue;
+    if (queue->count == 0) printf("\nThe upcoming queue is empty.\n");
+    else printf("\nUp next:\n");
+    for (int i = 0; i < queue->count; i++) {
+        int songId = *upcomingSlot(queue, i);
+        Song* song = findSongById(player, songId);
+        if (song) printf("%d. %d | %s - %s\n", i + 1, song->id, songArtist(player, song), songTitle(player, song));
+        else printf("%d. %d | (removed from playlist)\n", i + 1, songId);
+    }
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+void clearUpcoming(MusicPlayer* player) {
+    player->upcomingQueue->head = 0;
+    player->upcomingQueue->count = 0;
+    upcomingChanged(player);
+}
+
+// ----------------------------------------------------------------------------
+// Shuffle play: each round draws every song of the playlist once, in random
+// order. The round starts from a copy of the playlist's IDs and runs an
+// inside-out Fisher-Yates one step per song played, so each step is O(1).
+// Songs added during a round join the next one; deleted ones are skipped.
+// The first draw of a round never repeats the song that is playing.
+// ----------------------------------------------------------------------------
+static void startShuffleRound(MusicPlayer* player) {
+    ShuffleOrder* shuffle = &player->shuffle;
+    const PlaylistColumns* columns = &player->catalog->columns;
+    if (columns->orderCount > shuffle->capacity) {
+        int* ids = (int*)realloc(shuffle->ids, (size_t)columns->orderCount * sizeof(int));
+        if (!ids) exit(1);
+        shuffle->ids = ids;
+        shuffle->capacity = columns->orderCount;
+    }
+    shuffle->count = 0;
+    for (int i = 0; i < columns->orderCount; i++) {
+        int songId = columns->ids[columns->order[i]];
+        if (songId) shuffle->ids[shuffle->count++] = songId;
+    }
+    shuffle->position = 0;
+    shuffle->drawn = 0;
+}
+
+// The song shuffle play goes to next; repeated calls return the same song
+// until it is played (caller holds playlistLock and playbackMutex)
+Song* nextShuffledSong(MusicPlayer* player) {
+    ShuffleOrder* shuffle = &player->shuffle;
+    for (int rounds = 0; rounds < 2;) {
+        if (shuffle->position >= shuffle->count) {
+            startShuffleRound(player);
+            rounds++;
+            if (shuffle->count == 0) return NULL;
+        }
+        if (!shuffle->drawn) {
+            int remaining = shuffle->count - shuffle->position;
+            if (shuffle->position == 0 && remaining > 1 && player->currentSong) {
+                // Park the playing song last and draw from the others
+                for (int i = 0; i < shuffle->count; i++) {
+                    if (shuffle->ids[i] != player->currentSong->id) continue;
+                    shuffle->ids[i] = shuffle->ids[shuffle->count - 1];
+                    shuffle->ids[shuffle->count - 1] = player->currentSong->id;
+                    remaining--;
+                    break;
+                }
+            }
+            int pick = shuffle->position + (int)randomBelow(&shuffle->rng, (uint32_t)remaining);
+            int songId = shuffle->ids[pick];
+            shuffle->ids[pick] = shuffle->ids[shuffle->position];
+            shuffle->ids[shuffle->position] = songId;
+            shuffle->drawn = 1;
+        }
+        Song* song = findSongById(player, shuffle->ids[shuffle->position]);
+        if (song) return song;
+        shuffle->position++; // Deleted since the round started
+        shuffle->drawn = 0;
+    }
+    return NULL;
+}
+
+static void advanceShuffle(MusicPlayer* player) {
+    player->shuffle.position++;
+    player->shuffle.drawn = 0;
+}
+
+void toggleShuffle(MusicPlayer* player) {
+    lockPlayback(player);
+    player->shuffleEnabled = !player->shuffleEnabled;
+    upcomingChanged(player);
+    pthread_mutex_unlock(&player->playbackMutex);
+    printf("\nShuffle play is now %s.\n", player->shuffleEnabled ? "ENABLED" : "DISABLED");
+}
+
+// Flag retired songs that playback state still points at (caller holds
+// playbackMutex and the playlist write lock)
+static void markHeldSongs(MusicPlayer* player) {
+    Song* held[] = { player->currentSong, player->prebuffer.song };
+    for (size_t i = 0; i < sizeof(held) / sizeof(held[0]); i++) {
+        if (held[i] && held[i]->retired) held[i]->retired = RETIRED_HELD;
+    }
+}
+
+// ============================================================================
+// FILE HANDLING
+// ============================================================================
+// Playlist files are never rewritten in place: a new copy is written next to
+// the old one, flushed to disk and renamed over it, so a crash leaves either
+// the old or the new file.
+static int syncFileDescriptor(int fd) {
+#ifdef _WIN32
+    return _commit(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+static FILE* openReplacementFile(const char* filename, char* tmpPath, size_t tmpSize, const char* mode) {
+    if ((size_t)snprintf(tmpPath, tmpSize, "%s.tmp", filename) >= tmpSize) return NULL;
+    return fopen(tmpPath, mode);
+}
+
+// Close the new copy and move it over filename; returns 0 on success
+static int commitReplacementFile(FILE* file, const char* tmpPath, const char* filename) {
+    int failed = ferror(file) || fflush(file) != 0 || syncFileDescriptor(fileno(file)) != 0;
+    failed |= fclose(file) != 0;
+    if (failed) {
+        remove(tmpPath);
+        return -1;
+    }
+#ifdef _WIN32
+    if (!MoveFileExA(tmpPath, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        remove(tmpPath);
+        return -1;
+    }
+#else
+    if (rename(tmpPath, filename) != 0) {
+        remove(tmpPath);
+        return -1;
+    }
+    // Persist the rename itself
+    char dir[MAX_FILENAME];
+    const char* slash = strrchr(filename, '/');
+    if (slash) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - filename) + 1, filename);
+    else strcpy(dir, ".");
+    int dirFd = open(dir, O_RDONLY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+#endif
+    return 0;
+}
+
+static int writePlaylistText(MusicPlayer* player, const char* filename) {
+    char tmpPath[MAX_FILENAME + 8];
+    FILE* file = openReplacementFile(filename, tmpPath, sizeof(tmpPath), "w");
+    if (!file) return -1;
+
+    fprintf(file, "%d\n", player->catalog->nextId);
+    Song* current = player->catalog->playlist;
+    while (current) {
+        fprintf(file, "%d|%s|%s|%d|%s\n",
+                current->id, songTitle(player, current), songArtist(player, current),
+                current->duration, songFilepath(player, current));
+        current = current->next;
+    }
+    return commitReplacementFile(file, tmpPath, filename);
+}
+
+// ----------------------------------------------------------------------------
+// Playlist loader: the file is memory-mapped, split into newline-aligned
+// chunks and parsed on several threads straight out of the mapping. Each
+// chunk keeps its songs in file order, so merging is a simple in-order append.
+// ----------------------------------------------------------------------------
+#define LOADER_MIN_CHUNK_BYTES (256 * 1024)  // Below this one thread is faster
+#define LOADER_MAX_THREADS 16
+
+typedef struct LoadError {
+    long line;                       // Line number relative to the chunk
+    const char* reason;              // Static description of the problem
+} LoadError;
+
+typedef struct LoadChunk {
+    const char* begin;               // First byte of the chunk (line start)
+    const char* end;                 // One past the last byte of the chunk
+    Song** songs;                    // Parsed songs in file order
+    long* songLines;                 // Chunk line each song came from
+    NodePool pool;                   // Chunk-local pool the songs live in
+    StringPool* strings;             // Pool the chunk interns into
+    StringPool localStrings;         // Private pool for worker chunks
+    int songCount;
+    int songCapacity;
+    LoadError* errors;               // Malformed lines found in this chunk
+    int errorCount;
+    int errorCapacity;
+    long lineCount;                  // Number of lines in the chunk
+} LoadChunk;
+
+// Map the whole file read-only; returns NULL for missing or empty files
+static char* mapPlaylistFile(const char* filename, size_t* size) {
+#ifdef _WIN32
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (length <= 0) {
+        fclose(file);
+        return NULL;
+    }
+    char* data = (char*)malloc((size_t)length);
+    if (!data || fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *size = (size_t)length;
+    return data;
+#else
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    char* data = (char*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    *size = (size_t)st.st_size;
+    return data;
+#endif
+}
+
+static void unmapPlaylistFile(char* data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+static int getWorkerCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+// Parse a decimal integer that must span the whole field
+static int parseIntField(const char* begin, const char* end, int* out) {
+    while (begin < end && (*begin == ' ' || *begin == '\t')) begin++;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) end--;
+
+    int negative = 0;
+    if (begin < end && (*begin == '-' || *begin == '+')) negative = (*begin++ == '-');
+    if (begin == end) return 0;
+
+    long value = 0;
+    for (; begin < end; begin++) {
+        if (*begin < '0' || *begin > '9') return 0;
+        value = value * 10 + (*begin - '0');
+        if (value > 2147483647L) return 0;
+    }
+    *out = negative ? (int)-value : (int)value;
+    return 1;
+}
+
+// Parse one "id|title|artist|duration|filepath" record. Returns NULL on
+// success or a description of what is wrong with the line.
+static const char* parseSongRecord(const char* line, const char* end, Song* song, StringPool* strings) {
+    const char* fields[5];
+    const char* fieldEnds[5];
+    const char* p = line;
+
+    // The file path is the last field and may itself contain '|'
+    for (int i = 0; i < 4; i++) {
+        const char* bar = (const char*)memchr(p, '|', (size_t)(end - p));
+        if (!bar) return "expected id|title|artist|duration|filepath";
+        fields[i] = p;
+        fieldEnds[i] = bar;
+        p = bar + 1;
+    }
+    fields[4] = p;
+    fieldEnds[4] = end;
+
+    if (!parseIntField(fields[0], fieldEnds[0], &song->id) || song->id <= 0)
+        return "invalid song id";
+    if (!parseIntField(fields[3], fieldEnds[3], &song->duration) || song->duration < 0)
+        return "invalid duration";
+    song->title = stringPoolIntern(strings, fields[1], (size_t)(fieldEnds[1] - fields[1]));
+    song->artist = stringPoolIntern(strings, fields[2], (size_t)(fieldEnds[2] - fields[2]));
+    song->filepath = stringPoolIntern(strings, fields[4], (size_t)(fieldEnds[4] - fields[4]));
+    return NULL;
+}
+
+static void recordLoadError(LoadChunk* chunk, long line, const char* reason) {
+    if (chunk->errorCount == chunk->errorCapacity) {
+        int capacity = chunk->errorCapacity ? chunk->errorCapacity * 2 : 16;
+        LoadError* errors = (LoadError*)realloc(chunk->errors, capacity * sizeof(LoadError));
+        if (!errors) return;
+        chunk->errors = errors;
+        chunk->errorCapacity = capacity;
+    }
+    chunk->errors[chunk->errorCount].line = line;
+    chunk->errors[chunk->errorCount].reason = reason;
+    chunk->errorCount++;
+}
+
+static void* parsePlaylistChunk(void* arg) {
+    LoadChunk* chunk = (LoadChunk*)arg;
+    const char* p = chunk->begin;
+
+    while (p < chunk->end) {
+        const char* newline = (const char*)memchr(p, '\n', (size_t)(chunk->end - p));
+        const char* lineEnd = newline ? newline : chunk->end;
+        const char* next = newline ? newline + 1 : chunk->end;
+        chunk->lineCount++;
+
+        if (lineEnd > p && lineEnd[-1] == '\r') lineEnd--;
+        if (lineEnd == p) {
+            p = next; // Blank lines are allowed and ignored
+            continue;
+        }
+
+        Song* song = (Song*)poolAlloc(&chunk->pool);
+        const char* error = parseSongRecord(p, lineEnd, song, chunk->strings);
+        if (error) {
+            recordLoadError(chunk, chunk->lineCount, error);
+            poolFree(&chunk->pool, song);
+        } else {
+            if (chunk->songCount == chunk->songCapacity) {
+                int capacity = chunk->songCapacity ? chunk->songCapacity * 2 : 1024;
+                Song** songs = (Song**)realloc(chunk->songs, capacity * sizeof(Song*));
+                if (songs) chunk->songs = songs;
+                long* lines = songs ? (long*)realloc(chunk->songLines, capacity * sizeof(long)) : NULL;
+                if (!lines) {
+                    poolFree(&chunk->pool, song);
+                    recordLoadError(chunk, chunk->lineCount, "out of memory");
+                    break;
+                }
+                chunk->songLines = lines;
+                chunk->songCapacity = capacity;
+            }
+            chunk->songLines[chunk->songCount] = chunk->lineCount;
+            chunk->songs[chunk->songCount++] = song;
+        }
+        p = next;
+    }
+    return NULL;
+}
+
+static void readPlaylistText(MusicPlayer* player, const char* filename) {
+    size_t size = 0;
+    char* data = mapPlaylistFile(filename, &size);
+    if (!data) return;
+    const char* end = data + size;
+
+    // Header line holds the next available song ID
+    const char* body = (const char*)memchr(data, '\n', size);
+    body = body ? body + 1 : end;
+    int nextId;
+    const char* headerEnd = body > data && body[-1] == '\n' ? body - 1 : body;
+    if (headerEnd > data && headerEnd[-1] == '\r') headerEnd--;
+    if (parseIntField(data, headerEnd, &nextId) && nextId > 0) player->catalog->nextId = nextId;
+    else fprintf(stderr, "%s:1: invalid next-id header\n", filename);
+
+    // Split the body into newline-aligned chunks, one per worker
+    int workers = getWorkerCount();
+    size_t bodySize = (size_t)(end - body);
+    if ((size_t)workers * LOADER_MIN_CHUNK_BYTES > bodySize)
+        workers = (int)(bodySize / LOADER_MIN_CHUNK_BYTES);
+    if (workers < 1) workers = 1;
+    if (workers > LOADER_MAX_THREADS) workers = LOADER_MAX_THREADS;
+
+    LoadChunk chunks[LOADER_MAX_THREADS];
+    pthread_t threads[LOADER_MAX_THREADS];
+    int threaded[LOADER_MAX_THREADS] = {0};
+    const char* chunkStart = body;
+    for (int i = 0; i < workers; i++) {
+        const char* chunkEnd = end;
+        if (i < workers - 1) {
+            chunkEnd = body + bodySize / workers * (i + 1);
+            if (chunkEnd < chunkStart) chunkEnd = chunkStart;
+            const char* newline = (const char*)memchr(chunkEnd, '\n', (size_t)(end - chunkEnd));
+            chunkEnd = newline ? newline + 1 : end;
+        }
+        memset(&chunks[i], 0, sizeof(LoadChunk));
+        initNodePool(&chunks[i].pool, sizeof(Song), SONG_POOL_SLAB);
+        // The first chunk is parsed on this thread and can intern directly
+        // into the player; worker chunks get private pools merged later
+        if (i == 0) chunks[i].strings = &player->catalog->strings;
+        else {
+            initStringPool(&chunks[i].localStrings);
+            chunks[i].strings = &chunks[i].localStrings;
+        }
+        chunks[i].begin = chunkStart;
+        chunks[i].end = chunkEnd;
+        chunkStart = chunkEnd;
+    }
+
+    for (int i = 1; i < workers; i++) {
+        threaded[i] = pthread_create(&threads[i], NULL, parsePlaylistChunk, &chunks[i]) == 0;
+        if (!threaded[i]) parsePlaylistChunk(&chunks[i]); // Fall back to parsing inline
+    }
+    parsePlaylistChunk(&chunks[0]);
+
+    // Merge in file order; chunk line counts turn local line numbers global
+    long firstLine = 2;
+    int badLines = 0;
+    for (int i = 0; i < workers; i++) {
+        if (threaded[i]) pthread_join(threads[i], NULL);
+
+        for (int j = 0; j < chunks[i].errorCount; j++) {
+            fprintf(stderr, "%s:%ld: %s\n", filename,
+                    firstLine + chunks[i].errors[j].line - 1, chunks[i].errors[j].reason);
+        }
+        badLines += chunks[i].errorCount;
+
+        // Re-intern a worker chunk's distinct strings once, then patch its songs
+        StrRef* remap = NULL;
+        if (i > 0) {
+            remap = (StrRef*)malloc(chunks[i].localStrings.count * sizeof(StrRef));
+            if (!remap) exit(1);
+            stringPoolMerge(&player->catalog->strings, &chunks[i].localStrings, remap);
+        }
+
+        for (int j = 0; j < chunks[i].songCount; j++) {
+            Song* song = chunks[i].songs[j];
+            // Keep the first song with an ID, as replaying the journal does
+            if (songIndexLookup(&player->catalog->index, song->id)) {
+                fprintf(stderr, "%s:%ld: duplicate song id %d\n", filename,
+                        firstLine + chunks[i].songLines[j] - 1, song->id);
+                poolFree(&chunks[i].pool, song);
+                badLines++;
+                continue;
+            }
+            if (remap) {
+                song->title = remap[song->title];
+                song->artist = remap[song->artist];
+                song->filepath = remap[song->filepath];
+            }
+            if (song->id >= player->catalog->nextId) player->catalog->nextId = song->id + 1;
+            appendSong(player, song);
+        }
+        firstLine += chunks[i].lineCount;
+        poolMerge(&player->catalog->songPool, &chunks[i].pool);
+        if (i > 0) freeStringPool(&chunks[i].localStrings);
+        free(remap);
+        free(chunks[i].songs);
+        free(chunks[i].songLines);
+        free(chunks[i].errors);
+    }
+
+    if (badLines > 0)
+        fprintf(stderr, "Warning: skipped %d malformed or duplicate line(s) in %s\n", badLines, filename);
+    unmapPlaylistFile(data, size);
+}
+
+// ----------------------------------------------------------------------------
+// Binary playlist format: a fixed header, a table of fixed-width records and a
+// pool of NUL-terminated strings the records point into. Each distinct string
+// is stored once. Loading maps the file and interns strings straight out of the
+// pool without any field parsing.
+// All integers are stored in host byte order.
+// ----------------------------------------------------------------------------
+#define PLAYLIST_BINARY_MAGIC "AUDB"
+#define PLAYLIST_BINARY_VERSION 2  // 2: 32-bit lengths, deduplicated pool
+
+typedef struct BinaryPlaylistHeader {
+    char magic[4];                   // "AUDB"
+    uint32_t version;                // PLAYLIST_BINARY_VERSION
+    uint32_t recordCount;            // Number of entries in the record table
+    int32_t nextId;                  // Next available song ID
+    uint64_t poolOffset;             // Byte offset of the string pool
+    uint64_t poolSize;               // Size of the string pool in bytes
+} BinaryPlaylistHeader;
+
+typedef struct BinaryPlaylistRecord {
+    int32_t id;
+    int32_t duration;
+    uint32_t titleOffset;            // Offsets are relative to the pool start
+    uint32_t artistOffset;
+    uint32_t filepathOffset;
+    uint32_t titleLength;            // Lengths exclude the terminating NUL
+    uint32_t artistLength;
+    uint32_t filepathLength;
+} BinaryPlaylistRecord;
+
+PlaylistFormat detectPlaylistFormat(const char* filename) {
+    char magic[4];
+    FILE* file = fopen(filename, "rb");
+    if (!file) return PLAYLIST_FORMAT_TEXT;
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    if (got == sizeof(magic) && memcmp(magic, PLAYLIST_BINARY_MAGIC, sizeof(magic)) == 0)
+        return PLAYLIST_FORMAT_BINARY;
+    return PLAYLIST_FORMAT_TEXT;
+}
+
+// Append a string to the file pool; returns its offset
+static uint32_t appendPoolString(char** pool, size_t* size, size_t* capacity, const char* str, size_t length) {
+    if (*size + length + 1 > *capacity) {
+        size_t newCapacity = *capacity ? *capacity : 4096;
+        while (*size + length + 1 > newCapacity) newCapacity *= 2;
+        char* grown = (char*)realloc(*pool, newCapacity);
+        if (!grown) exit(1);
+        *pool = grown;
+        *capacity = newCapacity;
+    }
+    uint32_t offset = (uint32_t)*size;
+    memcpy(*pool + *size, str, length);
+    (*pool)[*size + length] = '\0';
+    *size += length + 1;
+    return offset;
+}
+
+static int writePlaylistBinary(MusicPlayer* player, const char* filename) {
+    BinaryPlaylistRecord* records = NULL;
+    if (player->catalog->songCount > 0) {
+        records = (BinaryPlaylistRecord*)calloc((size_t)player->catalog->songCount, sizeof(BinaryPlaylistRecord));
+        if (!records) return -1;
+    }
+    char* pool = NULL;
+    size_t poolSize = 0, poolCapacity = 0;
+
+    // File pool offset of each interned string, written on first use
+    uint32_t* fileOffsets = (uint32_t*)malloc(player->catalog->strings.count * sizeof(uint32_t));
+    if (!fileOffsets) {
+        free(records);
+        return -1;
+    }
+    memset(fileOffsets, 0xff, player->catalog->strings.count * sizeof(uint32_t));
+
+    uint32_t count = 0;
+    for (Song* current = player->catalog->playlist; current; current = current->next, count++) {
+        BinaryPlaylistRecord* record = &records[count];
+        StrRef refs[3] = { current->title, current->artist, current->filepath };
+        uint32_t offsets[3], lengths[3];
+        for (int f = 0; f < 3; f++) {
+            const char* str = stringPoolGet(&player->catalog->strings, refs[f]);
+            lengths[f] = (uint32_t)strlen(str);
+            if (fileOffsets[refs[f]] == UINT32_MAX)
+                fileOffsets[refs[f]] = appendPoolString(&pool, &poolSize, &poolCapacity, str, lengths[f]);
+            offsets[f] = fileOffsets[refs[f]];
+        }
+        record->id = current->id;
+        record->duration = current->duration;
+        record->titleOffset = offsets[0];
+        record->artistOffset = offsets[1];
+        record->filepathOffset = offsets[2];
+        record->titleLength = lengths[0];
+        record->artistLength = lengths[1];
+        record->filepathLength = lengths[2];
+    }
+    free(fileOffsets);
+
+    BinaryPlaylistHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PLAYLIST_BINARY_MAGIC, sizeof(header.magic));
+    header.version = PLAYLIST_BINARY_VERSION;
+    header.recordCount = count;
+    header.nextId = player->catalog->nextId;
+    header.poolOffset = sizeof(header) + (uint64_t)count * sizeof(BinaryPlaylistRecord);
+    header.poolSize = poolSize;
+
+    char tmpPath[MAX_FILENAME + 8];
+    int result = -1;
+    FILE* file = openReplacementFile(filename, tmpPath, sizeof(tmpPath), "wb");
+    if (file) {
+        fwrite(&header, sizeof(header), 1, file);
+        if (count) fwrite(records, sizeof(BinaryPlaylistRecord), count, file);
+        if (poolSize) fwrite(pool, 1, poolSize, file);
+        result = commitReplacementFile(file, tmpPath, filename);
+    }
+    free(records);
+    free(pool);
+    return result;
+}
+
+// Check that a pool string lies inside the pool and is NUL-terminated
+static int validPoolString(uint64_t poolSize, const char* pool, uint32_t offset, uint32_t length) {
+    if ((uint64_t)offset + length >= poolSize) return 0;
+    return pool[offset + length] == '\0';
+}
+
+static void readPlaylistBinary(MusicPlayer* player, const char* filename) {
+    size_t size = 0;
+    char* data = mapPlaylistFile(filename, &size);
+    if (!data) return;
+
+    BinaryPlaylistHeader header;
+    if (size < sizeof(header)) {
+        fprintf(stderr, "%s: truncated binary playlist header\n", filename);
+        unmapPlaylistFile(data, size);
+        return;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, PLAYLIST_BINARY_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != PLAYLIST_BINARY_VERSION) {
+        fprintf(stderr, "%s: unsupported binary playlist version\n", filename);
+        unmapPlaylistFile(data, size);
+        return;
+    }
+    uint64_t tableEnd = sizeof(header) + (uint64_t)header.recordCount * sizeof(BinaryPlaylistRecord);
+    if (tableEnd > header.poolOffset || header.poolOffset > size || header.poolSize > size - header.poolOffset) {
+        fprintf(stderr, "%s: corrupt binary playlist layout\n", filename);
+        unmapPlaylistFile(data, size);
+        return;
+    }
+
+    const BinaryPlaylistRecord* records = (const BinaryPlaylistRecord*)(data + sizeof(header));
+    const char* pool = data + header.poolOffset;
+    if (header.nextId > 0) player->catalog->nextId = header.nextId;
+
+    int badRecords = 0;
+    for (uint32_t i = 0; i < header.recordCount; i++) {
+        const BinaryPlaylistRecord* record = &records[i];
+        if (record->id <= 0 || record->duration < 0 ||
+            !validPoolString(header.poolSize, pool, record->titleOffset, record->titleLength) ||
+            !validPoolString(header.poolSize, pool, record->artistOffset, record->artistLength) ||
+            !validPoolString(header.poolSize, pool, record->filepathOffset, record->filepathLength)) {
+            fprintf(stderr, "%s: record %u is corrupt\n", filename, i);
+            badRecords++;
+            continue;
+        }
+        if (songIndexLookup(&player->catalog->index, record->id)) {
+            fprintf(stderr, "%s: record %u has duplicate song id %d\n", filename, i, record->id);
+            badRecords++;
+            continue;
+        }
+
+        Song* song = (Song*)poolAlloc(&player->catalog->songPool);
+        song->id = record->id;
+        song->duration = record->duration;
+        song->title = stringPoolIntern(&player->catalog->strings, pool + record->titleOffset, record->titleLength);
+        song->artist = stringPoolIntern(&player->catalog->strings, pool + record->artistOffset, record->artistLength);
+        song->filepath = stringPoolIntern(&player->catalog->strings, pool + record->filepathOffset, record->filepathLength);
+        if (song->id >= player->catalog->nextId) player->catalog->nextId = song->id + 1;
+        appendSong(player, song);
+    }
+
+    if (badRecords > 0)
+        fprintf(stderr, "Warning: skipped %d corrupt or duplicate record(s) in %s\n", badRecords, filename);
+    unmapPlaylistFile(data, size);
+}
+
+// Load either format, chosen from the file header
+// Loading takes the write lock for its whole run, saving the read lock
+void savePlaylistToFile(MusicPlayer* player, const char* filename) {
+    long long started = metricStart();
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    writePlaylistText(player, filename);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    observeMetricSince(METRIC_PLAYLIST_SAVE, started);
+}
+
+void loadPlaylistFromFile(MusicPlayer* player, const char* filename) {
+    long long started = metricStart();
+    pthread_rwlock_wrlock(&player->catalog->playlistLock);
+    readPlaylistText(player, filename);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    observeMetricSince(METRIC_PLAYLIST_LOAD, started);
+}
+
+void savePlaylistBinary(MusicPlayer* player, const char* filename) {
+    long long started = metricStart();
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    writePlaylistBinary(player, filename);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    observeMetricSince(METRIC_PLAYLIST_SAVE, started);
+}
+
+void loadPlaylistBinary(MusicPlayer* player, const char* filename) {
+    long long started = metricStart();
+    pthread_rwlock_wrlock(&player->catalog->playlistLock);
+    readPlaylistBinary(player, filename);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    observeMetricSince(METRIC_PLAYLIST_LOAD, started);
+}
+
+PlaylistFormat loadPlaylist(MusicPlayer* player, const char* filename) {
+    PlaylistFormat format = detectPlaylistFormat(filename);
+    if (format == PLAYLIST_FORMAT_BINARY) loadPlaylistBinary(player, filename);
+    else loadPlaylistFromFile(player, filename);
+    return format;
+}
+
+void savePlaylist(MusicPlayer* player, const char* filename, PlaylistFormat format) {
+    if (format == PLAYLIST_FORMAT_BINARY) savePlaylistBinary(player, filename);
+    else savePlaylistToFile(player, filename);
+}
+
+// Recently played history: one ID per line, oldest first; returns 0 on success
+int saveRecentlyPlayed(MusicPlayer* player, const char* filename) {
+    char tmpPath[MAX_FILENAME + 8];
+    FILE* file = openReplacementFile(filename, tmpPath, sizeof(tmpPath), "w");
+    if (!file) return -1;
+    lockPlayback(player);
+    for (int i = player->history.count - 1; i >= 0; i--) fprintf(file, "%d\n", historyEntry(&player->history, i));
+    pthread_mutex_unlock(&player->playbackMutex);
+    return commitReplacementFile(file, tmpPath, filename);
+}
+
+void loadRecentlyPlayed(MusicPlayer* player, const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (!file) return;
+    char line[32];
+    Song entry;
+    lockPlayback(player);
+    while (fgets(line, sizeof(line), file)) {
+        entry.id = atoi(line);
+        if (entry.id > 0) pushToRecentlyPlayed(player, &entry);
+    }
+    pthread_mutex_unlock(&player->playbackMutex);
+    fclose(file);
+}
+
+// ----------------------------------------------------------------------------
+// Journal: every add and delete is appended to "<playlist>.journal" as one
+// line ("+id|title|artist|duration|filepath" or "-id"), so committing costs
+// only the edits made since the last commit. Once the journal outgrows the
+// snapshot, a background thread writes a fresh snapshot (via the replacement
+// file above) and empties the journal. Replay skips adds of IDs that already
+// exist and deletes of IDs that do not; since IDs are never reused, a crash
+// between the snapshot rename and the journal truncation is harmless.
+// ----------------------------------------------------------------------------
+#define JOURNAL_FLUSH_BYTES (64 * 1024)      // Write the buffer out beyond this
+#define JOURNAL_COMPACT_MIN_RECORDS 4096     // Never compact for fewer records
+
+static int writeAllBytes(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return -1;
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+// Caller holds journal->mutex
+static int flushJournalBuffer(PlaylistJournal* journal) {
+    if (journal->size == 0) return 0;
+    int result = writeAllBytes(journal->fd, journal->buffer, journal->size);
+    journal->size = 0;
+    return result;
+}
+
+static char* reserveJournalBytes(PlaylistJournal* journal, size_t length) {
+    if (journal->size + length > journal->capacity) {
+        size_t capacity = journal->capacity ? journal->capacity : JOURNAL_FLUSH_BYTES;
+        while (journal->size + length > capacity) capacity *= 2;
+        char* grown = (char*)realloc(journal->buffer, capacity);
+        if (!grown) exit(1);
+        journal->buffer = grown;
+        journal->capacity = capacity;
+    }
+    char* at = journal->buffer + journal->size;
+    journal->size += length;
+    return at;
+}
+
+static void appendJournalText(PlaylistJournal* journal, const char* text, size_t length) {
+    memcpy(reserveJournalBytes(journal, length), text, length);
+}
+
+static void appendJournalInt(PlaylistJournal* journal, int value) {
+    char digits[16];
+    int n = snprintf(digits, sizeof(digits), "%d", value);
+    appendJournalText(journal, digits, (size_t)n);
+}
+
+static void finishJournalRecord(PlaylistJournal* journal) {
+    appendJournalText(journal, "\n", 1);
+    journal->records++;
+    if (journal->size >= JOURNAL_FLUSH_BYTES) flushJournalBuffer(journal);
+}
+
+// Log a new song (caller holds the write lock)
+static void journalSongAdded(MusicPlayer* player, const Song* song) {
+    PlaylistJournal* journal = &player->catalog->journal;
+    pthread_mutex_lock(&journal->mutex);
+    if (journal->fd >= 0) {
+        const char* fields[3] = { songTitle(player, song), songArtist(player, song), songFilepath(player, song) };
+        appendJournalText(journal, "+", 1);
+        appendJournalInt(journal, song->id);
+        for (int i = 0; i < 2; i++) {
+            appendJournalText(journal, "|", 1);
+            appendJournalText(journal, fields[i], strlen(fields[i]));
+        }
+        appendJournalText(journal, "|", 1);
+        appendJournalInt(journal, song->duration);
+        appendJournalText(journal, "|", 1);
+        appendJournalText(journal, fields[2], strlen(fields[2]));
+        finishJournalRecord(journal);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+// Log a deletion (caller holds the write lock)
+static void journalSongRemoved(MusicPlayer* player, int songId) {
+    PlaylistJournal* journal = &player->catalog->journal;
+    pthread_mutex_lock(&journal->mutex);
+    if (journal->fd >= 0) {
+        appendJournalText(journal, "-", 1);
+        appendJournalInt(journal, songId);
+        finishJournalRecord(journal);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+// Apply journal records on top of the loaded snapshot (caller holds the
+// write lock). Returns the number of bytes holding complete records; a torn
+// last record is left out.
+static size_t replayJournal(MusicPlayer* player, const char* data, size_t size, long* records) {
+    PlaylistJournal* journal = &player->catalog->journal;
+    const char* p = data;
+    const char* end = data + size;
+    long line = 0;
+    int badLines = 0;
+
+    while (p < end) {
+        const char* newline = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (!newline) break;
+        const char* lineEnd = newline;
+        line++;
+        if (lineEnd > p && lineEnd[-1] == '\r') lineEnd--;
+
+        const char* error = NULL;
+        if (lineEnd - p > 1 && *p == '+') {
+            Song* song = (Song*)poolAlloc(&player->catalog->songPool);
+            error = parseSongRecord(p + 1, lineEnd, song, &player->catalog->strings);
+            if (error || songIndexLookup(&player->catalog->index, song->id)) {
+                poolFree(&player->catalog->songPool, song);
+            } else {
+                if (song->id >= player->catalog->nextId) player->catalog->nextId = song->id + 1;
+                appendSong(player, song);
+            }
+        } else if (lineEnd - p > 1 && *p == '-') {
+            int songId;
+            if (parseIntField(p + 1, lineEnd, &songId) && songId > 0) removeSong(player, songId);
+            else error = "invalid song id";
+        } else if (lineEnd != p) {
+            error = "unknown journal record";
+        }
+        if (error) {
+            fprintf(stderr, "%s:%ld: %s\n", journal->journalPath, line, error);
+            badLines++;
+        } else if (lineEnd != p) {
+            (*records)++;
+        }
+        p = newline + 1;
+    }
+
+    if (badLines > 0)
+        fprintf(stderr, "Warning: skipped %d malformed record(s) in %s\n", badLines, journal->journalPath);
+    if (p < end)
+        fprintf(stderr, "Warning: dropped an incomplete record at the end of %s\n", journal->journalPath);
+    return (size_t)(p - data);
+}
+
+// Replay the edits logged since the snapshot in filename was written, then
+// start logging new ones. Call after loading the snapshot.
+int openPlaylistJournal(MusicPlayer* player, const char* filename, PlaylistFormat format) {
+    PlaylistJournal* journal = &player->catalog->journal;
+    if ((size_t)snprintf(journal->snapshotPath, sizeof(journal->snapshotPath), "%s", filename) >= sizeof(journal->snapshotPath))
+        return -1;
+    snprintf(journal->journalPath, sizeof(journal->journalPath), "%s.journal", filename);
+    journal->format = format;
+
+    long records = 0;
+    size_t size = 0, valid = 0;
+    char* data = mapPlaylistFile(journal->journalPath, &size);
+    pthread_rwlock_wrlock(&player->catalog->playlistLock);
+    long snapshotSongs = player->catalog->songCount;
+    if (data) {
+        valid = replayJournal(player, data, size, &records);
+        unmapPlaylistFile(data, size);
+        reclaimRetiredSongs(player);
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+
+#ifdef _WIN32
+    int fd = open(journal->journalPath, O_WRONLY | O_CREAT | O_APPEND | O_BINARY | O_CLOEXEC, 0644);
+#else
+    int fd = open(journal->journalPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+    if (fd < 0) {
+        fprintf(stderr, "Warning: cannot open %s, edits are saved by full rewrites\n", journal->journalPath);
+        return -1;
+    }
+    // New records must not be glued onto a torn one
+#ifdef _WIN32
+    if (valid < size) _chsize(fd, (long)valid);
+#else
+    if (valid < size && ftruncate(fd, (off_t)valid) != 0)
+        fprintf(stderr, "Warning: cannot trim %s\n", journal->journalPath);
+#endif
+
+    pthread_mutex_lock(&journal->mutex);
+    journal->fd = fd;
+    journal->records = records;
+    journal->snapshotSongs = snapshotSongs;
+    pthread_mutex_unlock(&journal->mutex);
+    return 0;
+}
+
+// Write a snapshot of the whole playlist and empty the journal. Holding the
+// read lock keeps edits (and their journal records) out until it is done;
+// playback and searches carry on.
+static void* compactPlaylistThread(void* arg) {
+    MusicPlayer* player = (MusicPlayer*)arg;
+    PlaylistJournal* journal = &player->catalog->journal;
+
+    long long started = metricStart();
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    int written = journal->format == PLAYLIST_FORMAT_BINARY
+        ? writePlaylistBinary(player, journal->snapshotPath)
+        : writePlaylistText(player, journal->snapshotPath);
+    observeMetricSince(METRIC_PLAYLIST_SAVE, started);
+    pthread_mutex_lock(&journal->mutex);
+    if (written == 0) {
+        // Every logged edit is in the snapshot, buffered ones included
+        journal->size = 0;
+#ifdef _WIN32
+        _chsize(journal->fd, 0);
+#else
+        if (ftruncate(journal->fd, 0) != 0) fprintf(stderr, "Warning: cannot truncate %s\n", journal->journalPath);
+#endif
+        syncFileDescriptor(journal->fd);
+        journal->records = 0;
+        journal->snapshotSongs = player->catalog->songCount;
+    } else {
+        fprintf(stderr, "Warning: cannot write %s, keeping the journal\n", journal->snapshotPath);
+    }
+    journal->compacting = 0;
+    pthread_mutex_unlock(&journal->mutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return NULL;
+}
+
+// Make all edits so far durable; the cost follows the number of edits since
+// the last commit, not the size of the playlist. Starts a background
+// compaction once the journal holds more records than half the snapshot.
+// Returns -1 when no journal is open.
+int commitPlaylist(MusicPlayer* player) {
+    PlaylistJournal* journal = &player->catalog->journal;
+    pthread_mutex_lock(&journal->mutex);
+    if (journal->fd < 0) {
+        pthread_mutex_unlock(&journal->mutex);
+        return -1;
+    }
+    int result = flushJournalBuffer(journal) == 0 && syncFileDescriptor(journal->fd) == 0 ? 0 : -1;
+
+    if (!journal->compacting && journal->records >= JOURNAL_COMPACT_MIN_RECORDS &&
+        journal->records * 2 >= journal->snapshotSongs) {
+        if (journal->compactorStarted) pthread_join(journal->compactor, NULL); // Finished already
+        journal->compacting = 1;
+        journal->compactorStarted = pthread_create(&journal->compactor, NULL, compactPlaylistThread, player) == 0;
+        if (!journal->compactorStarted) journal->compacting = 0;
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return result;
+}
+
+// The compactor borrows the session that started it; a session waits for
+// it before going away
+static void waitForCompaction(PlaylistJournal* journal) {
+    pthread_mutex_lock(&journal->mutex);
+    int started = journal->compactorStarted;
+    journal->compactorStarted = 0;
+    pthread_mutex_unlock(&journal->mutex);
+    if (started) pthread_join(journal->compactor, NULL);
+}
+
+// Wait for a running compaction, write out buffered records and stop logging
+void closePlaylistJournal(MusicPlayer* player) {
+    PlaylistJournal* journal = &player->catalog->journal;
+    waitForCompaction(journal);
+
+    pthread_mutex_lock(&journal->mutex);
+    if (journal->fd >= 0) {
+        flushJournalBuffer(journal);
+        syncFileDescriptor(journal->fd);
+        close(journal->fd);
+        journal->fd = -1;
+    }
+    free(journal->buffer);
+    journal->buffer = NULL;
+    journal->size = journal->capacity = 0;
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+// ============================================================================
+// FILE CACHE (PATH -> MTIME, SIZE, RESULT)
+// ============================================================================
+// Remembers what was learned from a file so it can be skipped while its
+// mtime and size stay the same. The scanner keeps song IDs here and the
+// loudness analysis keeps loudness and peak. On disk: a magic line, then
+// "mtime|size|field...|path" per file.
+#define FILE_CACHE_MAX_FIELDS 2
+
+typedef struct FileCacheEntry {
+    long long mtime;
+    long long size;
+    double fields[FILE_CACHE_MAX_FIELDS]; // The caller's result for the file
+    int valid;
+} FileCacheEntry;
+
+typedef struct FileCache {
+    const char* magic;               // First line of the cache file
+    int fieldCount;                  // Fields stored per entry
+    StringPool paths;                // Path -> StrRef indexes entries
+    FileCacheEntry* entries;
+    uint32_t capacity;
+} FileCache;
+
+static void initFileCache(FileCache* cache, const char* magic, int fieldCount) {
+    cache->magic = magic;
+    cache->fieldCount = fieldCount;
+    initStringPool(&cache->paths);
+    cache->entries = NULL;
+    cache->capacity = 0;
+}
+
+static void freeFileCache(FileCache* cache) {
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->capacity = 0;
+    freeStringPool(&cache->paths);
+}
+
+static void setFileCacheEntry(FileCache* cache, const char* path, long long mtime, long long size, const double* fields) {
+    StrRef ref = stringPoolIntern(&cache->paths, path, strlen(path));
+    if (ref >= cache->capacity) {
+        uint32_t capacity = cache->capacity ? cache->capacity : 1024;
+        while (capacity <= ref) capacity *= 2;
+        FileCacheEntry* entries = (FileCacheEntry*)realloc(cache->entries, capacity * sizeof(FileCacheEntry));
+        if (!entries) exit(1);
+        memset(entries + cache->capacity, 0, (capacity - cache->capacity) * sizeof(FileCacheEntry));
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+    FileCacheEntry* entry = &cache->entries[ref];
+    entry->mtime = mtime;
+    entry->size = size;
+    for (int i = 0; i < cache->fieldCount; i++) entry->fields[i] = fields[i];
+    entry->valid = 1;
+}
+
+static void loadFileCache(FileCache* cache, const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (!file) return;
+    char line[MAX_FILENAME + 128];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, cache->magic, strlen(cache->magic)) != 0) {
+        fclose(file);
+        return;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* end;
+        long long mtime = strtoll(line, &end, 10);
+        if (*end != '|') continue;
+        long long size = strtoll(end + 1, &end, 10);
+        if (*end != '|') continue;
+        double fields[FILE_CACHE_MAX_FIELDS];
+        int i = 0;
+        for (; i < cache->fieldCount; i++) {
+            fields[i] = strtod(end + 1, &end);
+            if (*end != '|') break;
+        }
+        if (i == cache->fieldCount) setFileCacheEntry(cache, end + 1, mtime, size, fields);
+    }
+    fclose(file);
+}
+
+static void saveFileCache(const FileCache* cache, const char* filename) {
+    char tmpPath[MAX_FILENAME + 8];
+    FILE* file = openReplacementFile(filename, tmpPath, sizeof(tmpPath), "w");
+    if (!file) return;
+    fprintf(file, "%s\n", cache->magic);
+    for (StrRef ref = 1; ref < cache->paths.count; ref++) {
+        const FileCacheEntry* entry = &cache->entries[ref];
+        if (!entry->valid) continue;
+        fprintf(file, "%lld|%lld|", entry->mtime, entry->size);
+        for (int i = 0; i < cache->fieldCount; i++) fprintf(file, "%.10g|", entry->fields[i]);
+        fprintf(file, "%s\n", stringPoolGet(&cache->paths, ref));
+    }
+    if (commitReplacementFile(file, tmpPath, filename) != 0)
+        fprintf(stderr, "Warning: cannot write %s\n", filename);
+}
+
+// Callers compare mtime and size: a stale entry may still be of use
+static const FileCacheEntry* findFileCacheEntry(const FileCache* cache, const char* path) {
+    StrRef ref;
+    if (stringPoolFind(&cache->paths, path, &ref) != 0 || ref >= cache->capacity || !cache->entries[ref].valid) return NULL;
+    return &cache->entries[ref];
+}
+
+// ============================================================================
+// MEDIA SCANNER (PARALLEL DIRECTORY IMPORT)
+// ============================================================================
+// Worker threads share a stack of directories: each lists one, pushes the
+// subdirectories it finds and reads the headers of the audio files in it.
+// Only the bytes holding duration and tags are read; large metadata such as
+// cover art is skipped with a seek. Results are inserted in batches under
+// one write lock each.
+//
+// A cache of path -> (mtime, size, song ID) from the previous scan lets
+// unchanged files be skipped after a single stat(). It is read-only while
+// workers run and updated once they are done.
+#define SCAN_MAX_THREADS 32
+#define SCAN_BATCH_SIZE 512             // Results inserted per write lock
+#define SCAN_TAG_FRAME_LIMIT (64 * 1024)  // Larger tag fields are skipped
+#define SCAN_OGG_WINDOW (64 * 1024)     // Bytes read at each end of an Ogg file
+#define SCAN_CACHE_MAGIC "AUDIORA-SCAN 1"
+
+#ifdef _WIN32
+    #define lstat stat
+    #define S_ISLNK(mode) 0
+#endif
+
+// Metadata read from one file
+typedef struct MediaInfo {
+    char title[MAX_TITLE];
+    char artist[MAX_ARTIST];
+    double seconds;
+    long long bytesRead;
+} MediaInfo;
+
+typedef struct ScanResult {
+    char* path;
+    char* title;
+    char* artist;
+    int duration;
+    long long mtime;
+    long long size;
+    int cachedId;                    // Song the file had at the last scan, 0 if new
+} ScanResult;
+
+typedef struct ScanJob {
+    MusicPlayer* player;
+    const FileCache* cache;          // Field 0 is the song ID
+    pthread_mutex_t mutex;           // Guards the directory stack and stats
+    pthread_cond_t wake;
+    char** directories;              // Directories waiting to be listed
+    int directoryCount;
+    int directoryCapacity;
+    int pending;                     // Directories queued or being listed
+    int* idByPath;                   // player->catalog->strings ref -> song ID at scan start
+    uint32_t idByPathCount;
+    ScanResult* updates;             // Cache changes, applied after the scan
+    int updateCount;
+    int updateCapacity;
+    ScanStats stats;
+} ScanJob;
+
+static uint32_t readBE32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static size_t readCounted(FILE* file, void* buffer, size_t size, MediaInfo* info) {
+    size_t got = fread(buffer, 1, size, file);
+    info->bytesRead += (long long)got;
+    return got;
+}
+
+static void appendUtf8(char* dst, size_t capacity, size_t* length, uint32_t codepoint) {
+    char bytes[4];
+    size_t n;
+    if (codepoint < 0x80) {
+        bytes[0] = (char)codepoint;
+        n = 1;
+    } else if (codepoint < 0x800) {
+        bytes[0] = (char)(0xC0 | codepoint >> 6);
+        bytes[1] = (char)(0x80 | (codepoint & 0x3F));
+        n = 2;
+    } else if (codepoint < 0x10000) {
+        bytes[0] = (char)(0xE0 | codepoint >> 12);
+        bytes[1] = (char)(0x80 | (codepoint >> 6 & 0x3F));
+        bytes[2] = (char)(0x80 | (codepoint & 0x3F));
+        n = 3;
+    } else {
+        bytes[0] = (char)(0xF0 | codepoint >> 18);
+        bytes[1] = (char)(0x80 | (codepoint >> 12 & 0x3F));
+        bytes[2] = (char)(0x80 | (codepoint >> 6 & 0x3F));
+        bytes[3] = (char)(0x80 | (codepoint & 0x3F));
+        n = 4;
+    }
+    if (*length + n >= capacity) return;
+    memcpy(dst + *length, bytes, n);
+    *length += n;
+}
+
+// Store tag text as UTF-8. encoding follows ID3v2: 0 = Latin-1, 1 = UTF-16
+// with BOM, 2 = UTF-16BE, 3 = UTF-8. Stops at the first NUL; '|' and line
+// breaks, which the playlist formats cannot hold, become spaces.
+static void copyTagText(char* dst, size_t capacity, const unsigned char* src, size_t length, int encoding) {
+    size_t out = 0;
+    if (encoding == 1 || encoding == 2) {
+        int bigEndian = encoding == 2;
+        if (length >= 2 && ((src[0] == 0xFF && src[1] == 0xFE) || (src[0] == 0xFE && src[1] == 0xFF))) {
+            bigEndian = src[0] == 0xFE;
+            src += 2;
+            length -= 2;
+        }
+        for (size_t i = 0; i + 1 < length; i += 2) {
+            uint32_t unit = bigEndian ? (uint32_t)(src[i] << 8 | src[i + 1]) : (uint32_t)(src[i + 1] << 8 | src[i]);
+            if (unit == 0) break;
+            if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < length) {
+                uint32_t low = bigEndian ? (uint32_t)(src[i + 2] << 8 | src[i + 3]) : (uint32_t)(src[i + 3] << 8 | src[i + 2]);
+                if (low >= 0xDC00 && low < 0xE000) {
+                    unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                    i += 2;
+                }
+            }
+            appendUtf8(dst, capacity, &out, unit);
+        }
+    } else {
+        for (size_t i = 0; i < length && src[i]; i++) {
+            if (encoding == 3 || src[i] < 0x80) {
+                if (out + 1 >= capacity) break;
+                dst[out++] = (char)src[i];
+            } else {
+                appendUtf8(dst, capacity, &out, src[i]);
+            }
+        }
+    }
+    while (out > 0 && (dst[out - 1] == ' ' || dst[out - 1] == '\0')) out--;
+    dst[out] = '\0';
+    for (char* p = dst; *p; p++) {
+        if (*p == '|' || *p == '\n' || *p == '\r') *p = ' ';
+    }
+}
+
+// "KEY=value" comments shared by FLAC and Ogg (little-endian lengths)
+static void parseVorbisComments(const unsigned char* data, size_t size, MediaInfo* info) {
+    if (size < 8) return;
+    size_t pos = 4 + (size_t)readLE32(data); // Skip the vendor string
+    if (pos + 4 > size) return;
+    uint32_t count = readLE32(data + pos);
+    pos += 4;
+    for (uint32_t i = 0; i < count && pos + 4 <= size; i++) {
+        size_t length = readLE32(data + pos);
+        pos += 4;
+        if (length > size - pos) break;
+        const char* comment = (const char*)data + pos;
+        if (length > 6 && strncasecmp(comment, "TITLE=", 6) == 0 && !info->title[0])
+            copyTagText(info->title, sizeof(info->title), data + pos + 6, length - 6, 3);
+        else if (length > 7 && strncasecmp(comment, "ARTIST=", 7) == 0 && !info->artist[0])
+            copyTagText(info->artist, sizeof(info->artist), data + pos + 7, length - 7, 3);
+        pos += length;
+    }
+}
+
+// RIFF/WAVE: duration from fmt + data, tags from LIST/INFO
+static int scanWav(FILE* file, MediaInfo* info) {
+    unsigned char header[12], chunk[8], fmt[16];
+    if (readCounted(file, header, 12, info) != 12) return -1;
+    uint32_t byteRate = 0, dataSize = 0;
+    int haveData = 0;
+    while (readCounted(file, chunk, 8, info) == 8) {
+        uint32_t size = readLE32(chunk + 4);
+        long next = ftell(file) + (long)size + (long)(size & 1);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            if (readCounted(file, fmt, 16, info) != 16) return -1;
+            byteRate = readLE32(fmt + 8);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            dataSize = size;
+            haveData = 1;
+        } else if (memcmp(chunk, "LIST", 4) == 0 && size >= 4 && size <= SCAN_TAG_FRAME_LIMIT) {
+            unsigned char* list = (unsigned char*)malloc(size);
+            if (list && readCounted(file, list, size, info) == size && memcmp(list, "INFO", 4) == 0) {
+                for (uint32_t pos = 4; pos + 8 <= size;) {
+                    uint32_t length = readLE32(list + pos + 4);
+                    if (length > size - pos - 8) break;
+                    if (memcmp(list + pos, "INAM", 4) == 0)
+                        copyTagText(info->title, sizeof(info->title), list + pos + 8, length, 0);
+                    else if (memcmp(list + pos, "IART", 4) == 0)
+                        copyTagText(info->artist, sizeof(info->artist), list + pos + 8, length, 0);
+                    pos += 8 + length + (length & 1);
+                }
+            }
+            free(list);
+        }
+        if (fseek(file, next, SEEK_SET) != 0) break;
+    }
+    if (!haveData || byteRate == 0) return -1;
+    info->seconds = (double)dataSize / byteRate;
+    return 0;
+}
+
+// Read the ID3v2 title/artist frames; returns the tag size (0 if none)
+static long scanId3v2(FILE* file, MediaInfo* info) {
+    unsigned char header[10];
+    if (readCounted(file, header, 10, info) != 10 || memcmp(header, "ID3", 3) != 0) return 0;
+    int version = header[3];
+    long tagSize = (long)(header[6] & 0x7F) << 21 | (long)(header[7] & 0x7F) << 14 |
+                   (long)(header[8] & 0x7F) << 7 | (header[9] & 0x7F);
+    long end = 10 + tagSize;
+    int frameHeaderSize = version == 2 ? 6 : 10;
+    int idLength = version == 2 ? 3 : 4;
+
+    long pos = 10;
+    if (version == 3 && (header[5] & 0x40)) { // Extended header
+        unsigned char ext[4];
+        if (readCounted(file, ext, 4, info) != 4) return end;
+        pos += 4 + (long)readBE32(ext);
+        fseek(file, pos, SEEK_SET);
+    }
+    unsigned char frame[10];
+    while (pos + frameHeaderSize <= end && (!info->title[0] || !info->artist[0])) {
+        if (readCounted(file, frame, (size_t)frameHeaderSize, info) != (size_t)frameHeaderSize || frame[0] == 0) break;
+        long size;
+        if (version == 2) size = (long)frame[3] << 16 | (long)frame[4] << 8 | frame[5];
+        else if (version == 4) size = (long)(frame[4] & 0x7F) << 21 | (long)(frame[5] & 0x7F) << 14 |
+                                      (long)(frame[6] & 0x7F) << 7 | (frame[7] & 0x7F);
+        else size = (long)readBE32(frame + 4);
+        pos += frameHeaderSize;
+        if (size <= 0 || pos + size > end) break;
+
+        int isTitle = memcmp(frame, version == 2 ? "TT2" : "TIT2", (size_t)idLength) == 0;
+        int isArtist = memcmp(frame, version == 2 ? "TP1" : "TPE1", (size_t)idLength) == 0;
+        if ((isTitle || isArtist) && size <= SCAN_TAG_FRAME_LIMIT) {
+            unsigned char* text = (unsigned char*)malloc((size_t)size);
+            if (text && readCounted(file, text, (size_t)size, info) == (size_t)size) {
+                if (isTitle) copyTagText(info->title, sizeof(info->title), text + 1, (size_t)size - 1, text[0]);
+                else copyTagText(info->artist, sizeof(info->artist), text + 1, (size_t)size - 1, text[0]);
+            }
+            free(text);
+        }
+        pos += size;
+        if (fseek(file, pos, SEEK_SET) != 0) break;
+    }
+    if (header[5] & 0x10) end += 10; // Footer
+    return end;
+}
+
+static const short mp3Bitrates[2][3][15] = {
+    { // MPEG-1: layer I, II, III
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    },
+    { // MPEG-2 and 2.5
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+    },
+};
+
+// MP3: tags from ID3v2 (or ID3v1), duration from a Xing/Info or VBRI frame
+// count, else from the first frame's bitrate
+static int scanMp3(FILE* file, long long fileSize, MediaInfo* info) {
+    long audioStart = scanId3v2(file, info);
+    if (fseek(file, audioStart, SEEK_SET) != 0) return -1;
+
+    unsigned char buffer[4096];
+    size_t got = readCounted(file, buffer, sizeof(buffer), info);
+    for (size_t i = 0; i + 4 <= got; i++) {
+        if (buffer[i] != 0xFF || (buffer[i + 1] & 0xE0) != 0xE0) continue;
+        int versionBits = buffer[i + 1] >> 3 & 3;   // 3 = MPEG-1, 2 = MPEG-2, 0 = MPEG-2.5
+        int layerBits = buffer[i + 1] >> 1 & 3;     // 3 = layer I, 2 = II, 1 = III
+        int bitrateIndex = buffer[i + 2] >> 4;
+        int rateIndex = buffer[i + 2] >> 2 & 3;
+        if (versionBits == 1 || layerBits == 0 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3) continue;
+
+        int mpeg1 = versionBits == 3;
+        int layer = 4 - layerBits;
+        static const int rates[3] = { 44100, 48000, 32000 };
+        int sampleRate = rates[rateIndex] >> (mpeg1 ? 0 : versionBits == 2 ? 1 : 2);
+        int samplesPerFrame = layer == 1 ? 384 : (layer == 3 && !mpeg1) ? 576 : 1152;
+        int mono = (buffer[i + 3] >> 6) == 3;
+        int bitrate = mp3Bitrates[mpeg1 ? 0 : 1][layer - 1][bitrateIndex];
+
+        // A Xing/Info header sits after the side information, VBRI at a fixed offset
+        size_t xing = i + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+        uint32_t frames = 0;
+        if (xing + 12 <= got && (memcmp(buffer + xing, "Xing", 4) == 0 || memcmp(buffer + xing, "Info", 4) == 0) &&
+            (readBE32(buffer + xing + 4) & 1))
+            frames = readBE32(buffer + xing + 8);
+        else if (i + 36 + 18 <= got && memcmp(buffer + i + 36, "VBRI", 4) == 0)
+            frames = readBE32(buffer + i + 36 + 14);
+
+        if (frames > 0) info->seconds = (double)frames * samplesPerFrame / sampleRate;
+        else info->seconds = (double)(fileSize - audioStart - (long)i) * 8 / (bitrate * 1000.0);
+        break;
+    }
+
+    if (!info->title[0] && fileSize >= 128 && fseek(file, -128, SEEK_END) == 0) {
+        unsigned char v1[128];
+        if (readCounted(file, v1, 128, info) == 128 && memcmp(v1, "TAG", 3) == 0) {
+            copyTagText(info->title, sizeof(info->title), v1 + 3, 30, 0);
+            if (!info->artist[0]) copyTagText(info->artist, sizeof(info->artist), v1 + 33, 30, 0);
+        }
+    }
+    return info->seconds > 0 ? 0 : -1;
+}
+
+// FLAC: STREAMINFO holds rate and sample count; VORBIS_COMMENT the tags
+static int scanFlac(FILE* file, MediaInfo* info) {
+    unsigned char header[4];
+    if (readCounted(file, header, 4, info) != 4 || memcmp(header, "fLaC", 4) != 0) return -1;
+    int last = 0;
+    while (!last && readCounted(file, header, 4, info) == 4) {
+        last = header[0] & 0x80;
+        int type = header[0] & 0x7F;
+        uint32_t length = (uint32_t)header[1] << 16 | (uint32_t)header[2] << 8 | header[3];
+        long next = ftell(file) + (long)length;
+        if (type == 0 && length >= 18) {
+            unsigned char streamInfo[18];
+            if (readCounted(file, streamInfo, 18, info) != 18) return -1;
+            uint32_t sampleRate = (uint32_t)streamInfo[10] << 12 | (uint32_t)streamInfo[11] << 4 | streamInfo[12] >> 4;
+            uint64_t samples = (uint64_t)(streamInfo[13] & 0x0F) << 32 | readBE32(streamInfo + 14);
+            if (sampleRate) info->seconds = (double)samples / sampleRate;
+        } else if (type == 4 && length <= SCAN_TAG_FRAME_LIMIT) {
+            unsigned char* comments = (unsigned char*)malloc(length ? length : 1);
+            if (comments && readCounted(file, comments, length, info) == length) parseVorbisComments(comments, length, info);
+            free(comments);
+        }
+        if (fseek(file, next, SEEK_SET) != 0) break;
+    }
+    return info->seconds > 0 ? 0 : -1;
+}
+
+// Ogg Vorbis/Opus: the first two packets carry the stream setup and the
+// comments; the last page's granule position gives the length
+static int scanOgg(FILE* file, long long fileSize, MediaInfo* info) {
+    unsigned char* window = (unsigned char*)malloc(SCAN_OGG_WINDOW);
+    unsigned char* packet = (unsigned char*)malloc(SCAN_OGG_WINDOW);
+    if (!window || !packet) {
+        free(window);
+        free(packet);
+        return -1;
+    }
+    size_t got = readCounted(file, window, SCAN_OGG_WINDOW, info);
+
+    uint32_t serial = 0;
+    uint32_t sampleRate = 0;
+    uint64_t preSkip = 0;
+    size_t packetSize = 0;
+    int packetIndex = 0;
+    for (size_t pos = 0; packetIndex < 2 && pos + 27 <= got && memcmp(window + pos, "OggS", 4) == 0;) {
+        int segments = window[pos + 26];
+        if (pos == 0) serial = readLE32(window + pos + 14);
+        size_t body = pos + 27 + (size_t)segments;
+        if (body > got) break;
+        int ours = readLE32(window + pos + 14) == serial;
+        for (int s = 0; s < segments && packetIndex < 2; s++) {
+            size_t lace = window[pos + 27 + s];
+            if (body + lace > got) break;
+            if (ours && packetSize + lace <= SCAN_OGG_WINDOW) {
+                memcpy(packet + packetSize, window + body, lace);
+                packetSize += lace;
+            }
+            body += lace;
+            if (lace == 255 || !ours) continue;
+
+            // A packet ends here
+            if (packetIndex == 0) {
+                if (packetSize >= 16 && memcmp(packet, "\x01vorbis", 7) == 0) sampleRate = readLE32(packet + 12);
+                else if (packetSize >= 12 && memcmp(packet, "OpusHead", 8) == 0) {
+                    sampleRate = 48000; // Opus granules always count 48 kHz samples
+                    preSkip = (uint64_t)packet[10] | (uint64_t)packet[11] << 8;
+                }
+            } else if (packetSize > 7 && memcmp(packet, "\x03vorbis", 7) == 0) {
+                parseVorbisComments(packet + 7, packetSize - 7, info);
+            } else if (packetSize > 8 && memcmp(packet, "OpusTags", 8) == 0) {
+                parseVorbisComments(packet + 8, packetSize - 8, info);
+            }
+            packetIndex++;
+            packetSize = 0;
+        }
+        pos = body;
+    }
+
+    // Last page of our stream: search the tail backwards
+    if (sampleRate > 0) {
+        long long tailStart = fileSize > SCAN_OGG_WINDOW ? fileSize - SCAN_OGG_WINDOW : 0;
+        size_t tail = got;
+        if (tailStart > 0) {
+            tail = fseek(file, (long)tailStart, SEEK_SET) == 0 ? readCounted(file, window, SCAN_OGG_WINDOW, info) : 0;
+        }
+        for (size_t pos = tail >= 27 ? tail - 27 : 0; tail >= 27; pos--) {
+            if (memcmp(window + pos, "OggS", 4) == 0 && readLE32(window + pos + 14) == serial) {
+                uint64_t granule = (uint64_t)readLE32(window + pos + 6) | (uint64_t)readLE32(window + pos + 10) << 32;
+                if (granule > preSkip) info->seconds = (double)(granule - preSkip) / sampleRate;
+                break;
+            }
+            if (pos == 0) break;
+        }
+    }
+    free(window);
+    free(packet);
+    return info->seconds > 0 ? 0 : -1;
+}
+
+static int hasAudioExtension(const char* name) {
+    static const char* extensions[] = { ".wav", ".mp3", ".flac", ".ogg", ".oga", ".opus" };
+    const char* dot = strrchr(name, '.');
+    if (!dot) return 0;
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strcasecmp(dot, extensions[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Read duration and tags; the container is recognised by its magic bytes
+static int readMediaInfo(const char* path, long long fileSize, MediaInfo* info) {
+    memset(info, 0, sizeof(*info));
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+    unsigned char magic[12];
+    size_t got = readCounted(file, magic, sizeof(magic), info);
+    rewind(file);
+
+    int result = -1;
+    if (got >= 12 && memcmp(magic, "RIFF", 4) == 0 && memcmp(magic + 8, "WAVE", 4) == 0) result = scanWav(file, info);
+    else if (got >= 4 && memcmp(magic, "fLaC", 4) == 0) result = scanFlac(file, info);
+    else if (got >= 4 && memcmp(magic, "OggS", 4) == 0) result = scanOgg(file, fileSize, info);
+    else if (got >= 3 && (memcmp(magic, "ID3", 3) == 0 || (magic[0] == 0xFF && (magic[1] & 0xE0) == 0xE0)))
+        result = scanMp3(file, fileSize, info);
+    fclose(file);
+
+    // Untagged files fall back to their file name
+    if (result == 0 && !info->title[0]) {
+        const char* name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+        const char* dot = strrchr(name, '.');
+        size_t length = dot && dot > name ? (size_t)(dot - name) : strlen(name);
+        copyTagText(info->title, sizeof(info->title), (const unsigned char*)name, length, 3);
+    }
+    if (result == 0 && !info->artist[0]) strcpy(info->artist, "Unknown Artist");
+    return result;
+}
+
+static void pushScanDirectory(ScanJob* job, char* path) {
+    pthread_mutex_lock(&job->mutex);
+    if (job->directoryCount == job->directoryCapacity) {
+        int capacity = job->directoryCapacity ? job->directoryCapacity * 2 : 64;
+        char** directories = (char**)realloc(job->directories, (size_t)capacity * sizeof(char*));
+        if (!directories) exit(1);
+        job->directories = directories;
+        job->directoryCapacity = capacity;
+    }
+    job->directories[job->directoryCount++] = path;
+    job->pending++;
+    pthread_cond_signal(&job->wake);
+    pthread_mutex_unlock(&job->mutex);
+}
+
+static void recordScanUpdate(ScanJob* job, ScanResult* result, int songId) {
+    if (job->updateCount == job->updateCapacity) {
+        int capacity = job->updateCapacity ? job->updateCapacity * 2 : 256;
+        ScanResult* updates = (ScanResult*)realloc(job->updates, (size_t)capacity * sizeof(ScanResult));
+        if (!updates) exit(1);
+        job->updates = updates;
+        job->updateCapacity = capacity;
+    }
+    ScanResult* update = &job->updates[job->updateCount++];
+    *update = *result;
+    update->cachedId = songId;
+    free(result->title);
+    free(result->artist);
+    update->title = update->artist = NULL;
+}
+
+// Insert a batch of scanned files under one write lock. Writers are
+// serialised by the lock, which therefore also guards job->updates.
+static void mergeScanResults(ScanJob* job, ScanResult* results, int count, ScanStats* stats) {
+    MusicPlayer* player = job->player;
+    int removed = 0;
+    pthread_rwlock_wrlock(&player->catalog->playlistLock);
+    for (int i = 0; i < count; i++) {
+        ScanResult* result = &results[i];
+        if (result->cachedId) {
+            // Changed since the last scan: replace the old entry
+            if (removeSong(player, result->cachedId) == 0) removed++;
+            stats->updated++;
+        } else {
+            // Added by hand before: start tracking it instead of duplicating it
+            StrRef ref;
+            if (stringPoolFind(&player->catalog->strings, result->path, &ref) == 0 && ref < job->idByPathCount &&
+                job->idByPath[ref] && songIndexLookup(&player->catalog->index, job->idByPath[ref])) {
+                recordScanUpdate(job, result, job->idByPath[ref]);
+                stats->adopted++;
+                continue;
+            }
+            stats->added++;
+        }
+        int songId = insertSong(player, result->title, result->artist, result->duration, result->path);
+        recordScanUpdate(job, result, songId);
+    }
+    if (removed) reclaimRetiredSongs(player);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+static void scanDirectory(ScanJob* job, const char* directory, ScanResult* batch, int* batchCount, ScanStats* stats) {
+    DIR* dir = opendir(directory);
+    if (!dir) {
+        stats->failed++;
+        return;
+    }
+    stats->directories++;
+    size_t dirLength = strlen(directory);
+    int separator = dirLength > 0 && directory[dirLength - 1] != '/';
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue; // ".", ".." and hidden files
+        size_t pathLength = dirLength + (size_t)separator + strlen(entry->d_name);
+        if (pathLength >= MAX_FILENAME) continue;
+        char* path = (char*)malloc(pathLength + 1);
+        if (!path) exit(1);
+        snprintf(path, pathLength + 1, "%s%s%s", directory, separator ? "/" : "", entry->d_name);
+
+        // Directories are found without touching the files themselves
+        struct stat st;
+        if (lstat(path, &st) != 0) {
+            free(path);
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            pushScanDirectory(job, path); // Symlinked directories are not followed
+            continue;
+        }
+        if (!hasAudioExtension(entry->d_name) || (S_ISLNK(st.st_mode) && stat(path, &st) != 0) || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        stats->audioFiles++;
+
+        const FileCacheEntry* cached = findFileCacheEntry(job->cache, path);
+        if (cached && cached->mtime == (long long)st.st_mtime && cached->size == (long long)st.st_size) {
+            stats->unchanged++;
+            free(path);
+            continue;
+        }
+        MediaInfo info;
+        int ok = readMediaInfo(path, (long long)st.st_size, &info) == 0;
+        stats->bytesRead += info.bytesRead;
+        if (!ok) {
+            stats->failed++;
+            free(path);
+            continue;
+        }
+
+        ScanResult* result = &batch[(*batchCount)++];
+        result->path = path;
+        result->title = strdup(info.title);
+        result->artist = strdup(info.artist);
+        if (!result->title || !result->artist) exit(1);
+        result->duration = (int)(info.seconds + 0.5);
+        result->mtime = (long long)st.st_mtime;
+        result->size = (long long)st.st_size;
+        result->cachedId = cached ? (int)cached->fields[0] : 0;
+        if (*batchCount == SCAN_BATCH_SIZE) {
+            mergeScanResults(job, batch, *batchCount, stats);
+            *batchCount = 0;
+        }
+    }
+    closedir(dir);
+}
+
+static void* scanWorkerThread(void* arg) {
+    ScanJob* job = (ScanJob*)arg;
+    ScanResult* batch = (ScanResult*)malloc(SCAN_BATCH_SIZE * sizeof(ScanResult));
+    if (!batch) exit(1);
+    int batchCount = 0;
+    ScanStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_lock(&job->mutex);
+    for (;;) {
+        while (job->directoryCount == 0 && job->pending > 0) pthread_cond_wait(&job->wake, &job->mutex);
+        if (job->directoryCount == 0) break; // Nothing queued or being listed: done
+        char* directory = job->directories[--job->directoryCount];
+        pthread_mutex_unlock(&job->mutex);
+
+        scanDirectory(job, directory, batch, &batchCount, &stats);
+        free(directory);
+
+        pthread_mutex_lock(&job->mutex);
+        if (--job->pending == 0) pthread_cond_broadcast(&job->wake);
+    }
+    pthread_mutex_unlock(&job->mutex);
+
+    if (batchCount > 0) mergeScanResults(job, batch, batchCount, &stats);
+    free(batch);
+
+    pthread_mutex_lock(&job->mutex);
+    job->stats.directories += stats.directories;
+    job->stats.audioFiles += stats.audioFiles;
+    job->stats.unchanged += stats.unchanged;
+    job->stats.added += stats.added;
+    job->stats.updated += stats.updated;
+    job->stats.adopted += stats.adopted;
+    job->stats.failed += stats.failed;
+    job->stats.bytesRead += stats.bytesRead;
+    pthread_mutex_unlock(&job->mutex);
+    return NULL;
+}
+
+// Import every audio file under root. Files whose mtime and size match
+// cacheFile (may be NULL) are skipped; the cache is rewritten afterwards.
+int scanMediaLibrary(MusicPlayer* player, const char* root, const char* cacheFile, ScanStats* stats) {
+    static pthread_mutex_t scanMutex = PTHREAD_MUTEX_INITIALIZER; // One scan at a time
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) return -1;
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    pthread_mutex_lock(&scanMutex);
+    FileCache cache;
+    initFileCache(&cache, SCAN_CACHE_MAGIC, 1);
+    if (cacheFile) loadFileCache(&cache, cacheFile);
+
+    ScanJob job;
+    memset(&job, 0, sizeof(job));
+    job.player = player;
+    job.cache = &cache;
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.wake, NULL);
+
+    // Songs already in the playlist, by path, so hand-added ones are adopted
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    job.idByPathCount = player->catalog->strings.count;
+    job.idByPath = (int*)calloc(job.idByPathCount ? job.idByPathCount : 1, sizeof(int));
+    if (!job.idByPath) exit(1);
+    for (Song* song = player->catalog->playlist; song; song = song->next) job.idByPath[song->filepath] = song->id;
+
+    // A cached file whose song was deleted since is imported again, not
+    // counted as unchanged
+    for (StrRef ref = 1; ref < cache.paths.count; ref++) {
+        FileCacheEntry* entry = &cache.entries[ref];
+        StrRef songRef;
+        if (entry->valid &&
+            (stringPoolFind(&player->catalog->strings, stringPoolGet(&cache.paths, ref), &songRef) != 0 ||
+             songRef >= job.idByPathCount || job.idByPath[songRef] != (int)entry->fields[0]))
+            entry->valid = 0;
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+
+    char* start = strdup(root);
+    if (!start) exit(1);
+    pushScanDirectory(&job, start);
+
+    // Header reads are small and latency-bound: use more threads than cores
+    int workers = getWorkerCount() * 2;
+    if (workers > SCAN_MAX_THREADS) workers = SCAN_MAX_THREADS;
+    pthread_t threads[SCAN_MAX_THREADS];
+    int running = 0;
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, scanWorkerThread, &job) != 0) break;
+        running++;
+    }
+    if (running == 0) scanWorkerThread(&job);
+    for (int i = 0; i < running; i++) pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < job.updateCount; i++) {
+        ScanResult* update = &job.updates[i];
+        double songId = update->cachedId;
+        setFileCacheEntry(&cache, update->path, update->mtime, update->size, &songId);
+        free(update->path);
+    }
+    if (cacheFile && job.updateCount > 0) saveFileCache(&cache, cacheFile);
+
+    free(job.updates);
+    free(job.directories);
+    free(job.idByPath);
+    freeFileCache(&cache);
+    pthread_cond_destroy(&job.wake);
+    pthread_mutex_destroy(&job.mutex);
+    pthread_mutex_unlock(&scanMutex);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    job.stats.elapsedMs = elapsedMs(&started, &finished);
+    if (stats) *stats = job.stats;
+    return 0;
+}
+
+void displayScanStats(const ScanStats* stats) {
+    printf("\nScanned %ld folder(s), %ld audio file(s) in %.0f ms\n", stats->directories, stats->audioFiles, stats->elapsedMs);
+    printf("Added %ld, updated %ld, unchanged %ld, already listed %ld, unreadable %ld\n",
+           stats->added, stats->updated, stats->unchanged, stats->adopted, stats->failed);
+    printf("Header bytes read: %lld\n", stats->bytesRead);
+}
+
+// ============================================================================
+// LOUDNESS ANALYSIS (EBU R128 METER, PARALLEL)
+// ============================================================================
+// Integrated loudness per ITU-R BS.1770 / EBU R128: K-weighting (a high
+// shelf, then a high-pass), mean square over 400 ms blocks every 100 ms, an
+// absolute gate at -70 LUFS and a relative gate 10 LU under the ungated
+// level. The peak is the highest sample (no oversampling, so not true peak).
+// PCM WAV is read directly; anything else is decoded by ffmpeg when it is
+// installed. Workers take songs from a shared counter, so long and short
+// tracks even out across threads. Results are cached by path, mtime and
+// size like the scanner's, so a repeat run only stats each file.
+#define LOUDNESS_MAX_THREADS 64
+#define LOUDNESS_MAX_CHANNELS 8
+#define LOUDNESS_READ_FRAMES 4096
+#define LOUDNESS_TARGET_LUFS -18.0    // Level songs are brought to
+#define LOUDNESS_MAX_BOOST_DB 12.0
+#define LOUDNESS_GATE_LUFS -70.0
+#define LOUDNESS_DECODE_RATE 48000    // ffmpeg output: stereo float at this rate
+#define LOUDNESS_CACHE_MAGIC "AUDIORA-LOUDNESS 1"
+#define WAV_FORMAT_FLOAT 3
+
+#ifndef M_PI
+    #define M_PI 3.14159265358979323846
+#endif
+
+// Outcome of measuring one file
+#define LOUDNESS_OK 0
+#define LOUDNESS_UNREADABLE -1
+#define LOUDNESS_UNSUPPORTED -2
+
+typedef struct Biquad {
+    double b0, b1, b2, a1, a2;
+} Biquad;
+
+typedef struct LoudnessMeter {
+    int channels;
+    double weights[LOUDNESS_MAX_CHANNELS];
+    Biquad shelf;
+    Biquad highPass;
+    double state[LOUDNESS_MAX_CHANNELS][4]; // Transposed direct form II, two per filter
+    double sums[LOUDNESS_MAX_CHANNELS];     // Squares in the current 100 ms step
+    long stepFrames;
+    long stepFill;
+    double steps[3];                        // Weighted mean squares of the last three steps
+    int stepCount;
+    double* blocks;                         // Weighted mean square of every 400 ms block
+    size_t blockCount;
+    size_t blockCapacity;
+    double peak;
+} LoudnessMeter;
+
+// K-weighting for any sample rate, from the analogue prototypes of BS.1770
+static void initLoudnessMeter(LoudnessMeter* meter, uint32_t sampleRate, int channels) {
+    memset(meter, 0, sizeof(LoudnessMeter));
+    meter->channels = channels;
+    for (int c = 0; c < channels; c++) meter->weights[c] = 1.0;
+    if (channels == 6) {                    // 5.1: no LFE, surrounds +1.5 dB
+        meter->weights[3] = 0.0;
+        meter->weights[4] = meter->weights[5] = 1.41;
+    }
+
+    double k = tan(M_PI * 1681.974450955533 / sampleRate);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    meter->shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    meter->shelf.b1 = 2.0 * (k * k - vh) / a0;
+    meter->shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    meter->shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    meter->shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+    k = tan(M_PI * 38.13547087602444 / sampleRate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+    meter->highPass.b0 = 1.0;
+    meter->highPass.b1 = -2.0;
+    meter->highPass.b2 = 1.0;
+    meter->highPass.a1 = 2.0 * (k * k - 1.0) / a0;
+    meter->highPass.a2 = (1.0 - k / q + k * k) / a0;
+
+    meter->stepFrames = (long)((sampleRate + 5) / 10);
+}
+
+static void closeLoudnessStep(LoudnessMeter* meter) {
+    double energy = 0;
+    for (int c = 0; c < meter->channels; c++) {
+        energy += meter->weights[c] * meter->sums[c] / meter->stepFrames;
+        meter->sums[c] = 0;
+    }
+    meter->stepFill = 0;
+    if (meter->stepCount == 3) {
+        // Four steps make a block; blocks overlap by three steps
+        if (meter->blockCount == meter->blockCapacity) {
+            size_t capacity = meter->blockCapacity ? meter->blockCapacity * 2 : 1024;
+            double* blocks = (double*)realloc(meter->blocks, capacity * sizeof(double));
+            if (!blocks) exit(1);
+            meter->blocks = blocks;
+            meter->blockCapacity = capacity;
+        }
+        meter->blocks[meter->blockCount++] = (meter->steps[0] + meter->steps[1] + meter->steps[2] + energy) / 4;
+        meter->steps[0] = meter->steps[1];
+        meter->steps[1] = meter->steps[2];
+        meter->steps[2] = energy;
+    } else {
+        meter->steps[meter->stepCount++] = energy;
+    }
+}
+
+// Feed interleaved samples scaled to [-1, 1]
+static void addLoudnessFrames(LoudnessMeter* meter, const float* samples, size_t frames) {
+    const Biquad* shelf = &meter->shelf;
+    const Biquad* highPass = &meter->highPass;
+    int channels = meter->channels;
+    for (size_t f = 0; f < frames; f++) {
+        for (int c = 0; c < channels; c++) {
+            double x = samples[f * channels + c];
+            double magnitude = fabs(x);
+            if (magnitude > meter->peak) meter->peak = magnitude;
+            double* z = meter->state[c];
+            double y = shelf->b0 * x + z[0];
+            z[0] = shelf->b1 * x - shelf->a1 * y + z[1];
+            z[1] = shelf->b2 * x - shelf->a2 * y;
+            x = y;
+            y = highPass->b0 * x + z[2];
+            z[2] = highPass->b1 * x - highPass->a1 * y + z[3];
+            z[3] = highPass->b2 * x - highPass->a2 * y;
+            meter->sums[c] += y * y;
+        }
+        if (++meter->stepFill == meter->stepFrames) closeLoudnessStep(meter);
+    }
+}
+
+static double energyToLufs(double energy) {
+    return -0.691 + 10.0 * log10(energy);
+}
+
+// Gated integrated loudness; LOUDNESS_GATE_LUFS for silence or clips
+// shorter than one block
+static double integratedLoudness(const LoudnessMeter* meter) {
+    double absoluteGate = pow(10.0, (LOUDNESS_GATE_LUFS + 0.691) / 10.0);
+    double sum = 0;
+    long count = 0;
+    for (size_t i = 0; i < meter->blockCount; i++) {
+        if (meter->blocks[i] > absoluteGate) {
+            sum += meter->blocks[i];
+            count++;
+        }
+    }
+    if (count == 0) return LOUDNESS_GATE_LUFS;
+
+    double relativeGate = sum / count * 0.1; // -10 LU
+    sum = 0;
+    count = 0;
+    for (size_t i = 0; i < meter->blockCount; i++) {
+        if (meter->blocks[i] > absoluteGate && meter->blocks[i] > relativeGate) {
+            sum += meter->blocks[i];
+            count++;
+        }
+    }
+    return count ? energyToLufs(sum / count) : LOUDNESS_GATE_LUFS;
+}
+
+// Integer or float PCM to floats in [-1, 1]
+static void pcmToFloat(const unsigned char* data, size_t samples, const WavInfo* format, float* out) {
+    for (size_t i = 0; i < samples; i++) {
+        switch (format->bitsPerSample) {
+            case 8:
+                out[i] = (data[i] - 128) / 128.0f;
+                break;
+            case 16:
+                out[i] = (int16_t)readLE16(data + i * 2) / 32768.0f;
+                break;
+            case 24: {
+                const unsigned char* p = data + i * 3;
+                int32_t value = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+                out[i] = value / 8388608.0f;
+                break;
+            }
+            default: {
+                uint32_t bits = readLE32(data + i * 4);
+                if (format->format == WAV_FORMAT_FLOAT) memcpy(&out[i], &bits, sizeof(float));
+                else out[i] = (float)((int32_t)bits / 2147483648.0);
+                break;
+            }
+        }
+    }
+}
+
+static int measureWav(FILE* file, const WavInfo* format, LoudnessMeter* meter, long long* bytesDecoded) {
+    if (format->channels == 0 || format->channels > LOUDNESS_MAX_CHANNELS || format->sampleRate == 0) return LOUDNESS_UNSUPPORTED;
+    int integer = format->format == WAV_FORMAT_PCM &&
+                  (format->bitsPerSample == 8 || format->bitsPerSample == 16 ||
+                   format->bitsPerSample == 24 || format->bitsPerSample == 32);
+    int floating = format->format == WAV_FORMAT_FLOAT && format->bitsPerSample == 32;
+    if (!integer && !floating) return LOUDNESS_UNSUPPORTED;
+    if (fseek(file, format->dataOffset, SEEK_SET) != 0) return LOUDNESS_UNREADABLE;
+
+    initLoudnessMeter(meter, format->sampleRate, format->channels);
+    size_t frameSize = format->frameSize;
+    unsigned char* raw = (unsigned char*)malloc(LOUDNESS_READ_FRAMES * frameSize);
+    float* samples = (float*)malloc(LOUDNESS_READ_FRAMES * format->channels * sizeof(float));
+    if (!raw || !samples) exit(1);
+    uint32_t remaining = format->dataSize;
+    while (remaining >= frameSize) {
+        size_t wanted = remaining / frameSize;
+        if (wanted > LOUDNESS_READ_FRAMES) wanted = LOUDNESS_READ_FRAMES;
+        size_t frames = fread(raw, frameSize, wanted, file);
+        if (frames == 0) break;
+        pcmToFloat(raw, frames * format->channels, format, samples);
+        addLoudnessFrames(meter, samples, frames);
+        remaining -= (uint32_t)(frames * frameSize);
+        *bytesDecoded += (long long)(frames * frameSize);
+    }
+    free(raw);
+    free(samples);
+    return LOUDNESS_OK;
+}
+
+#ifndef _WIN32
+static char loudnessDecoderPath[MAX_FILENAME];
+static int loudnessDecoderFound;
+static pthread_once_t loudnessDecoderOnce = PTHREAD_ONCE_INIT;
+
+static void findLoudnessDecoder() {
+    loudnessDecoderFound = findExecutable("ffmpeg", loudnessDecoderPath, sizeof(loudnessDecoderPath)) == 0;
+}
+
+// Decode through ffmpeg to stereo floats; any format it reads can be measured
+static int measureDecoded(const char* filepath, LoudnessMeter* meter, long long* bytesDecoded) {
+    pthread_once(&loudnessDecoderOnce, findLoudnessDecoder);
+    if (!loudnessDecoderFound) return LOUDNESS_UNSUPPORTED;
+
+    char rate[16];
+    snprintf(rate, sizeof(rate), "%d", LOUDNESS_DECODE_RATE);
+    const char* argv[] = { "ffmpeg", "-nostdin", "-v", "quiet", "-i", filepath, "-vn",
+                           "-ac", "2", "-ar", rate, "-f", "f32le", "-", NULL };
+    // Other workers spawn decoders at the same time: keep this pipe out of
+    // their children or its reader would never see end of file
+    int fds[2];
+    if (openCloexecPipe(fds) != 0) return LOUDNESS_UNREADABLE;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    closeInheritedDescriptors(&actions);
+    pid_t pid;
+    int failed = posix_spawn(&pid, loudnessDecoderPath, &actions, NULL, (char* const*)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (failed) {
+        close(fds[0]);
+        return LOUDNESS_UNSUPPORTED;
+    }
+
+    initLoudnessMeter(meter, LOUDNESS_DECODE_RATE, 2);
+    size_t frameSize = 2 * sizeof(float);
+    float* samples = (float*)malloc(LOUDNESS_READ_FRAMES * frameSize);
+    if (!samples) exit(1);
+    size_t filled = 0; // Bytes of a partial frame carried to the next read
+    for (;;) {
+        ssize_t got = read(fds[0], (char*)samples + filled, LOUDNESS_READ_FRAMES * frameSize - filled);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        filled += (size_t)got;
+        size_t frames = filled / frameSize;
+        addLoudnessFrames(meter, samples, frames);
+        *bytesDecoded += (long long)(frames * frameSize);
+        filled -= frames * frameSize;
+        memmove(samples, (char*)samples + frames * frameSize, filled);
+    }
+    free(samples);
+    close(fds[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return LOUDNESS_UNSUPPORTED;
+    return LOUDNESS_OK;
+}
+#endif
+
+// Measure one file: integrated loudness in LUFS and sample peak (1.0 = full
+// scale). Returns LOUDNESS_OK, LOUDNESS_UNREADABLE or LOUDNESS_UNSUPPORTED.
+int measureLoudness(const char* filepath, double* loudnessLufs, double* peak, long long* bytesDecoded) {
+    FILE* file = fopen(filepath, "rb");
+    if (!file) return LOUDNESS_UNREADABLE;
+    LoudnessMeter meter;
+    memset(&meter, 0, sizeof(meter));
+    long long decoded = 0;
+    WavInfo format;
+    int result;
+    if (readWavHeader(file, &format) == 0 && (format.format == WAV_FORMAT_PCM || format.format == WAV_FORMAT_FLOAT)) {
+        result = measureWav(file, &format, &meter, &decoded);
+        fclose(file);
+    } else {
+        fclose(file);
+#ifdef _WIN32
+        result = LOUDNESS_UNSUPPORTED;
+#else
+        result = measureDecoded(filepath, &meter, &decoded);
+#endif
+    }
+    if (result == LOUDNESS_OK) {
+        *loudnessLufs = integratedLoudness(&meter);
+        *peak = meter.peak;
+    }
+    if (bytesDecoded) *bytesDecoded = decoded;
+    free(meter.blocks);
+    return result;
+}
+
+// Gain that brings a track to the target level without pushing its peak
+// over full scale; 0 for silence
+double loudnessGainDb(double loudnessLufs, double peak) {
+    if (loudnessLufs <= LOUDNESS_GATE_LUFS) return 0;
+    double gain = LOUDNESS_TARGET_LUFS - loudnessLufs;
+    if (peak > 0) {
+        double headroom = -20.0 * log10(peak);
+        if (gain > headroom) gain = headroom;
+    }
+    if (gain > LOUDNESS_MAX_BOOST_DB) gain = LOUDNESS_MAX_BOOST_DB;
+    return gain;
+}
+
+// One song's share of the analysis
+typedef struct LoudnessTask {
+    int songId;
+    char* path;
+    long long mtime;
+    long long size;
+    double loudness;
+    double peak;
+    long long bytesDecoded;
+    int status;                      // LOUDNESS_OK, _UNREADABLE or _UNSUPPORTED
+    int cached;
+} LoudnessTask;
+
+typedef struct LoudnessJob {
+    LoudnessTask* tasks;
+    int taskCount;
+    atomic_int next;                 // First task nobody has taken
+    const FileCache* cache;          // Fields: loudness, peak
+} LoudnessJob;
+
+static void runLoudnessTask(const LoudnessJob* job, LoudnessTask* task) {
+    struct stat st;
+    if (stat(task->path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        task->status = LOUDNESS_UNREADABLE;
+        return;
+    }
+    task->mtime = (long long)st.st_mtime;
+    task->size = (long long)st.st_size;
+    const FileCacheEntry* cached = findFileCacheEntry(job->cache, task->path);
+    if (cached && cached->mtime == task->mtime && cached->size == task->size) {
+        task->loudness = cached->fields[0];
+        task->peak = cached->fields[1];
+        task->status = LOUDNESS_OK;
+        task->cached = 1;
+        return;
+    }
+    task->status = measureLoudness(task->path, &task->loudness, &task->peak, &task->bytesDecoded);
+}
+
+static void* loudnessWorkerThread(void* arg) {
+    LoudnessJob* job = (LoudnessJob*)arg;
+    for (;;) {
+        int i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->taskCount) break;
+        runLoudnessTask(job, &job->tasks[i]);
+    }
+    return NULL;
+}
+
+// Measure every song with an audio file and set its playback gain. threads
+// is the worker count, 0 for one per core. Songs whose file matches
+// cacheFile (may be NULL) are not decoded; the cache is rewritten after.
+int analyzeLoudness(MusicPlayer* player, const char* cacheFile, int threads, LoudnessStats* stats) {
+    static pthread_mutex_t analysisMutex = PTHREAD_MUTEX_INITIALIZER; // One pass at a time
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    pthread_mutex_lock(&analysisMutex);
+
+    FileCache cache;
+    initFileCache(&cache, LOUDNESS_CACHE_MAGIC, 2);
+    if (cacheFile) loadFileCache(&cache, cacheFile);
+
+    // Work on copies of the paths so the playlist stays open to edits
+    LoudnessJob job;
+    memset(&job, 0, sizeof(job));
+    job.cache = &cache;
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    job.tasks = (LoudnessTask*)calloc(player->catalog->songCount ? player->catalog->songCount : 1, sizeof(LoudnessTask));
+    if (!job.tasks) exit(1);
+    for (Song* song = player->catalog->playlist; song; song = song->next) {
+        if (song->filepath == EMPTY_STRING_REF) continue;
+        LoudnessTask* task = &job.tasks[job.taskCount++];
+        task->songId = song->id;
+        task->path = strdup(songFilepath(player, song));
+        if (!task->path) exit(1);
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+
+    // Decoding is CPU-bound: one worker per core unless told otherwise
+    if (threads <= 0) threads = getWorkerCount();
+    if (threads > LOUDNESS_MAX_THREADS) threads = LOUDNESS_MAX_THREADS;
+    if (threads > job.taskCount) threads = job.taskCount > 0 ? job.taskCount : 1;
+    pthread_t workers[LOUDNESS_MAX_THREADS];
+    int running = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, loudnessWorkerThread, &job) != 0) break;
+        running++;
+    }
+    if (running == 0) loudnessWorkerThread(&job);
+    for (int i = 0; i < running; i++) pthread_join(workers[i], NULL);
+
+    LoudnessStats result;
+    memset(&result, 0, sizeof(result));
+    result.tracks = job.taskCount;
+    result.threads = running ? running : 1;
+    int cacheChanged = 0;
+    pthread_rwlock_wrlock(&player->catalog->playlistLock);
+    for (int i = 0; i < job.taskCount; i++) {
+        LoudnessTask* task = &job.tasks[i];
+        if (task->status == LOUDNESS_UNREADABLE) result.failed++;
+        else if (task->status == LOUDNESS_UNSUPPORTED) result.unsupported++;
+        else if (task->cached) result.cached++;
+        else result.analysed++;
+        result.bytesDecoded += task->bytesDecoded;
+        if (task->status != LOUDNESS_OK) continue;
+
+        // The song may have been deleted while it was measured
+        Song* song = songIndexLookup(&player->catalog->index, task->songId);
+        if (song && !song->retired) song->gainDb = (float)loudnessGainDb(task->loudness, task->peak);
+        if (!task->cached) {
+            double fields[2] = { task->loudness, task->peak };
+            setFileCacheEntry(&cache, task->path, task->mtime, task->size, fields);
+            cacheChanged = 1;
+        }
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    if (cacheFile && cacheChanged) saveFileCache(&cache, cacheFile);
+
+    for (int i = 0; i < job.taskCount; i++) free(job.tasks[i].path);
+    free(job.tasks);
+    freeFileCache(&cache);
+    pthread_mutex_unlock(&analysisMutex);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    result.elapsedMs = elapsedMs(&started, &finished);
+    if (stats) *stats = result;
+    return 0;
+}
+
+void displayLoudnessStats(const LoudnessStats* stats) {
+    printf("\nLoudness of %ld track(s) in %.0f ms on %d thread(s)\n", stats->tracks, stats->elapsedMs, stats->threads);
+    printf("Measured %ld, cached %ld, unsupported format %ld, unreadable %ld\n",
+           stats->analysed, stats->cached, stats->unsupported, stats->failed);
+    if (stats->bytesDecoded > 0 && stats->elapsedMs > 0)
+        printf("Decoded %.1f MB at %.1f MB/s\n", stats->bytesDecoded / 1e6, stats->bytesDecoded / 1e3 / stats->elapsedMs);
+}
+
+void toggleLoudnessNormalization(MusicPlayer* player) {
+    player->loudnessEnabled = !player->loudnessEnabled;
+    printf("\nLoudness normalisation is now %s (from the next track).\n", player->loudnessEnabled ? "ENABLED" : "DISABLED");
+}
+
+// ============================================================================
+// COMMAND PIPELINE (BATCH AND DAEMON MODE)
+// ============================================================================
+// Headless control: one command per line, one response line per command.
+//   add TITLE|ARTIST|DURATION|FILEPATH   -> ok ID
+//   delete ID | play ID | enqueue ID      -> ok
+//   enqueue-next ID | move FROM TO        -> ok
+//   enqueue-artist NAME | enqueue-search Q -> ok COUNT
+//   shuffle-queue | clear-queue | shuffle on|off -> ok
+//   next | previous | stop | count | ping -> ok [VALUE]
+//   search QUERY                          -> ok COUNT ID...
+//   sorted artist|title|duration [OFFSET] -> ok TOTAL ID... (50 from OFFSET)
+//   length MIN MAX [OFFSET]               -> ok TOTAL ID... (shortest first)
+//   artist NAME[|OFFSET]                  -> ok TOTAL ID... (by title)
+//   save [PATH]                           -> ok (committed once, at the end)
+//   metrics on|off | metrics-export PATH  -> ok
+//   scan FOLDER                           -> ok ADDED UPDATED UNCHANGED FAILED
+//   analyze                               -> ok MEASURED CACHED UNSUPPORTED FAILED
+//   readahead [TRACKS [MB]]               -> ok HITS MISSES ADVISED_BYTES EVICTED_BYTES
+//   shutdown                              -> ok (daemon: stop accepting)
+// Failures answer "error MESSAGE". Input is consumed in blocks; runs of
+// add/delete inside a block share one write lock and one reclamation pass.
+#define COMMAND_READ_BYTES (256 * 1024)
+#define COMMAND_SEARCH_LIMIT 50
+
+typedef struct CommandSession {
+    MusicPlayer* player;
+    int inFd;
+    int outFd;
+    int outSocket;                   // outFd is a client socket
+    char* out;                       // Pending responses
+    size_t outSize;
+    size_t outCapacity;
+    int writeLocked;                 // Holding playlistLock for a run of edits
+    int removed;                     // Songs retired during this run
+    int saveRequested;
+    char savePath[MAX_FILENAME];     // Export target, empty to commit the playlist
+    const char* playlistFile;        // Fallback when no journal is open
+    PlaylistFormat saveFormat;
+    long commands;
+    long errors;
+} CommandSession;
+
+static atomic_int serverShutdown;
+static pthread_mutex_t commandSaveMutex = PTHREAD_MUTEX_INITIALIZER; // One writer per playlist file
+
+static void respond(CommandSession* session, const char* format, ...) {
+    va_list args;
+    for (;;) {
+        size_t space = session->outCapacity - session->outSize;
+        va_start(args, format);
+        int length = vsnprintf(session->out + session->outSize, space, format, args);
+        va_end(args);
+        if (length < 0) return;
+        if ((size_t)length < space) {
+            session->outSize += (size_t)length;
+            return;
+        }
+        session->outCapacity = session->outCapacity * 2 + (size_t)length;
+        session->out = (char*)realloc(session->out, session->outCapacity);
+        if (!session->out) exit(1);
+    }
+}
+
+// Send the pending responses; -1 once the reader has gone away. A client
+// that hangs up early must not raise SIGPIPE and take the daemon down.
+static int flushResponses(CommandSession* session) {
+    size_t done = 0;
+    while (done < session->outSize) {
+        ssize_t written;
+#if !defined(_WIN32) && defined(MSG_NOSIGNAL)
+        if (session->outSocket) written = send(session->outFd, session->out + done, session->outSize - done, MSG_NOSIGNAL);
+        else
+#endif
+            written = write(session->outFd, session->out + done, session->outSize - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return -1; // EPIPE: the client is gone
+        done += (size_t)written;
+    }
+    session->outSize = 0;
+    return 0;
+}
+
+static void beginEdits(CommandSession* session) {
+    if (session->writeLocked) return;
+    pthread_rwlock_wrlock(&session->player->catalog->playlistLock);
+    session->writeLocked = 1;
+}
+
+// Close a run of edits: reclaim what was deleted and let readers in
+static void endEdits(CommandSession* session) {
+    if (!session->writeLocked) return;
+    if (session->removed) reclaimRetiredSongs(session->player);
+    session->removed = 0;
+    session->writeLocked = 0;
+    pthread_rwlock_unlock(&session->player->catalog->playlistLock);
+}
+
+static int parseCommandId(const char* args, int* id) {
+    return parseIntField(args, args + strlen(args), id) && *id > 0;
+}
+
+static void commandAdd(CommandSession* session, char* args) {
+    char* fields[4];
+    char* p = args;
+    for (int i = 0; i < 3; i++) {
+        char* bar = strchr(p, '|');
+        if (!bar) {
+            respond(session, "error expected TITLE|ARTIST|DURATION|FILEPATH\n");
+            session->errors++;
+            return;
+        }
+        *bar = '\0';
+        fields[i] = p;
+        p = bar + 1;
+    }
+    fields[3] = p; // The path is last and may itself contain '|'
+
+    int duration;
+    if (!parseIntField(fields[2], fields[2] + strlen(fields[2]), &duration) || duration < 0) {
+        respond(session, "error invalid duration\n");
+        session->errors++;
+        return;
+    }
+    beginEdits(session);
+    respond(session, "ok %d\n", insertSong(session->player, fields[0], fields[1], duration, fields[3]));
+}
+
+static void commandDelete(CommandSession* session, const char* args) {
+    int id;
+    if (!parseCommandId(args, &id)) {
+        respond(session, "error invalid song id\n");
+        session->errors++;
+        return;
+    }
+    beginEdits(session);
+    if (removeSong(session->player, id) != 0) {
+        respond(session, "error song not found\n");
+        session->errors++;
+        return;
+    }
+    session->removed++;
+    respond(session, "ok\n");
+}
+
+static int songExists(MusicPlayer* player, int id) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    int exists = findSongById(player, id) != NULL;
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return exists;
+}
+
+// enqueue ID, enqueue-next ID
+static void commandEnqueueSong(CommandSession* session, const char* args, int front) {
+    MusicPlayer* player = session->player;
+    int id;
+    if (!parseCommandId(args, &id)) {
+        respond(session, "error invalid song id\n");
+        session->errors++;
+        return;
+    }
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    Song* song = findSongById(player, id);
+    if (song) {
+        lockPlayback(player);
+        if (front) enqueueUpcomingFront(player, song);
+        else enqueueUpcoming(player, song);
+        pthread_mutex_unlock(&player->playbackMutex);
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    if (song) respond(session, "ok\n");
+    else {
+        respond(session, "error song not found\n");
+        session->errors++;
+    }
+}
+
+// enqueue-search QUERY: queue every match, in playlist order
+static void commandEnqueueSearch(CommandSession* session, const char* query) {
+    MusicPlayer* player = session->player;
+    int capacity = getPlaylistSize(player);
+    int* ids = (int*)malloc((size_t)(capacity > 0 ? capacity : 1) * sizeof(int));
+    if (!ids) exit(1);
+    int matches = searchSongs(player, query, SEARCH_SUBSTRING, ids, capacity);
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    lockPlayback(player);
+    int added = enqueueUpcomingIds(player, ids, matches);
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    free(ids);
+    respond(session, "ok %d\n", added);
+}
+
+static void commandMove(CommandSession* session, const char* args) {
+    int from, to;
+    const char* space = strchr(args, ' ');
+    if (!space || !parseIntField(args, space, &from) || !parseIntField(space + 1, space + 1 + strlen(space + 1), &to)) {
+        respond(session, "error expected FROM TO\n");
+        session->errors++;
+        return;
+    }
+    MusicPlayer* player = session->player;
+    lockPlayback(player);
+    int result = moveUpcoming(player, from - 1, to - 1);
+    pthread_mutex_unlock(&player->playbackMutex);
+    if (result == 0) respond(session, "ok\n");
+    else {
+        respond(session, "error no such queue position\n");
+        session->errors++;
     }
+}
 
-    clearRecentlyPlayed(player);
-    clearUpcoming(player);
-    free(player->upcomingQueue);
-    free(player);
-    globalPlayer = NULL;
+static void commandSearch(CommandSession* session, const char* query) {
+    int ids[COMMAND_SEARCH_LIMIT];
+    int matches = searchSongs(session->player, query, SEARCH_SUBSTRING, ids, COMMAND_SEARCH_LIMIT);
+    respond(session, "ok %d", matches);
+    for (int i = 0; i < matches; i++) respond(session, " %d", ids[i]);
+    respond(session, "\n");
 }
 
-// ============================================================================
-// PLAYLIST MANAGEMENT
-// ============================================================================
-void addSong(MusicPlayer* player, const char* title, const char* artist, int duration, const char* filepath) {
-    Song* newSong = (Song*)malloc(sizeof(Song));
-    if (!newSong) return;
+// Parse up to count space-separated integers; returns how many were read,
+// or -1 if a token is not a number
+static int parseCommandInts(const char* args, int* values, int count) {
+    int parsed = 0;
+    while (*args && parsed < count) {
+        const char* end = strchr(args, ' ');
+        if (!end) end = args + strlen(args);
+        if (end > args && !parseIntField(args, end, &values[parsed++])) return -1;
+        args = *end ? end + 1 : end;
+    }
+    return *args ? -1 : parsed;
+}
 
-    newSong->id = player->nextId++;
-    strncpy(newSong->title, title, MAX_TITLE);
-    strncpy(newSong->artist, artist, MAX_ARTIST);
-    newSong->duration = duration;
-    strncpy(newSong->filepath, filepath, MAX_FILENAME);
-    newSong->next = NULL;
+static void respondIds(CommandSession* session, int total, const int* ids, int count) {
+    respond(session, "ok %d", total);
+    for (int i = 0; i < count; i++) respond(session, " %d", ids[i]);
+    respond(session, "\n");
+}
 
-    if (!player->playlist) player->playlist = newSong;
-    else {
-        Song* current = player->playlist;
-        while (current->next) current = current->next;
-        current->next = newSong;
+// "sorted artist|title|duration [OFFSET]"
+static void commandSorted(CommandSession* session, char* args) {
+    static const char* keys[SORT_KEY_COUNT] = { "artist", "title", "duration" };
+    char* rest = strchr(args, ' ');
+    if (rest) *rest++ = '\0';
+    int key = 0;
+    while (key < SORT_KEY_COUNT && strcmp(args, keys[key]) != 0) key++;
+    int offset = 0;
+    if (key == SORT_KEY_COUNT || (rest && parseCommandInts(rest, &offset, 1) < 0)) {
+        respond(session, "error expected artist|title|duration [OFFSET]\n");
+        session->errors++;
+        return;
     }
-
-    player->songCount++;
-    printf("\n✓ Song added successfully! (ID: %d)\n", newSong->id);`
+    int ids[COMMAND_SEARCH_LIMIT];
+    int copied;
+    int total = listSongsSorted(session->player, (SortKey)key, offset, ids, COMMAND_SEARCH_LIMIT, &copied);
+    respondIds(session, total, ids, copied);
 }
 
-void deleteSong(MusicPlayer* player, int songId) {
-    if (!player->playlist) return;
-    Song* current = player->playlist;
-    Song* prev = NULL;
+// "length MIN MAX [OFFSET]", in seconds
+static void commandLength(CommandSession* session, const char* args) {
+    int values[3] = { 0, 0, 0 };
+    if (parseCommandInts(args, values, 3) < 2) {
+        respond(session, "error expected MIN MAX [OFFSET]\n");
+        session->errors++;
+        return;
+    }
+    int ids[COMMAND_SEARCH_LIMIT];
+    int copied;
+    int total = findSongsByDuration(session->player, values[0], values[1], values[2], ids, COMMAND_SEARCH_LIMIT, &copied);
+    respondIds(session, total, ids, copied);
+}
 
-    while (current) {
-        if (current->id == songId) {
-            if (prev) prev->next = current->next;
-            else player->playlist = current->next;
-            free(current);
-            player->songCount--;
-            printf("\n✓ Song deleted.\n");
+// "artist NAME[|OFFSET]"
+static void commandArtist(CommandSession* session, char* args) {
+    int offset = 0;
+    char* bar = strchr(args, '|');
+    if (bar) {
+        *bar = '\0';
+        if (parseCommandInts(bar + 1, &offset, 1) < 0) {
+            respond(session, "error expected NAME[|OFFSET]\n");
+            session->errors++;
             return;
         }
-        prev = current;
-        current = current->next;
     }
-    printf("\n✗ Song ID not found.\n");
+    int ids[COMMAND_SEARCH_LIMIT];
+    int copied;
+    int total = listSongsByArtist(session->player, args, offset, ids, COMMAND_SEARCH_LIMIT, &copied);
+    respondIds(session, total, ids, copied);
 }
 
-Song* findSongById(MusicPlayer* player, int songId) {
-    Song* current = player->playlist;
-    while (current) {
-        if (current->id == songId) return current;
-        current = current->next;
+// Import a folder; the scan cache sits next to the playlist file
+static void commandScan(CommandSession* session, const char* root) {
+    char cacheFile[MAX_FILENAME + 16];
+    snprintf(cacheFile, sizeof(cacheFile), "%s.scan", session->playlistFile);
+    ScanStats stats;
+    if (*root == '\0' || scanMediaLibrary(session->player, root, cacheFile, &stats) != 0) {
+        respond(session, "error cannot scan folder\n");
+        session->errors++;
+        return;
     }
-    return NULL;
+    respond(session, "ok %ld %ld %ld %ld\n", stats.added, stats.updated, stats.unchanged, stats.failed);
 }
 
-// NEW: Find the next song in playlist after current song
-Song* findNextSong(MusicPlayer* player, Song* currentSong) {
-    if (!currentSong || !player->playlist) return NULL;
-    
-    Song* current = player->playlist;
-    while (current) {
-        if (current == currentSong && current->next) {
-            return current->next;
+static void commandAnalyze(CommandSession* session) {
+    char cacheFile[MAX_FILENAME + 16];
+    snprintf(cacheFile, sizeof(cacheFile), "%s.loudness", session->playlistFile);
+    LoudnessStats stats;
+    analyzeLoudness(session->player, cacheFile, 0, &stats);
+    respond(session, "ok %ld %ld %ld %ld\n", stats.analysed, stats.cached, stats.unsupported, stats.failed);
+}
+
+// Optionally change the read-ahead window, then report its counters
+static void commandReadAhead(CommandSession* session, const char* args) {
+    MusicPlayer* player = session->player;
+    if (*args) {
+        int tracks;
+        int megabytes = READAHEAD_DEFAULT_BUDGET_MB;
+        const char* space = strchr(args, ' ');
+        const char* end = space ? space : args + strlen(args);
+        if (!parseIntField(args, end, &tracks) || (space && !parseIntField(space + 1, space + 1 + strlen(space + 1), &megabytes))) {
+            respond(session, "error expected TRACKS [MB]\n");
+            session->errors++;
+            return;
         }
-        current = current->next;
+        setReadAhead(player, tracks, (long long)megabytes * 1024 * 1024);
     }
-    return NULL;
+    lockPlayback(player);
+    ReadAheadStats stats = player->readAhead.stats;
+    pthread_mutex_unlock(&player->playbackMutex);
+    respond(session, "ok %ld %ld %lld %lld\n", stats.hits, stats.misses, stats.hintedBytes, stats.evictedBytes);
 }
 
-// ============================================================================
-// PLAYBACK OPERATIONS
-// ============================================================================
-void playSong(MusicPlayer* player, int songId) {
-    Song* song = findSongById(player, songId);
-    if (!song) {
-        printf("\nSong not found!\n");
+// Run one command line (NUL-terminated, without the newline)
+static void executeCommand(CommandSession* session, char* line) {
+    size_t length = strlen(line);
+    if (length > 0 && line[length - 1] == '\r') line[--length] = '\0';
+    while (*line == ' ' || *line == '\t') line++;
+    if (*line == '\0' || *line == '#') return;
+
+    char* args = line;
+    while (*args && *args != ' ' && *args != '\t') args++;
+    if (*args) *args++ = '\0';
+    while (*args == ' ' || *args == '\t') args++;
+    session->commands++;
+
+    // Runs of edits keep the write lock; anything else releases it first
+    if (strcmp(line, "add") == 0) {
+        commandAdd(session, args);
         return;
     }
+    if (strcmp(line, "delete") == 0) {
+        commandDelete(session, args);
+        return;
+    }
+    endEdits(session);
 
-    pthread_mutex_lock(&playbackMutex);
-    
-    if (isAudioPlaying()) {
-        stopAudioFile();
+    MusicPlayer* player = session->player;
+    int id;
+    if (strcmp(line, "play") == 0) {
+        if (!parseCommandId(args, &id) || !songExists(player, id)) {
+            respond(session, "error song not found\n");
+            session->errors++;
+            return;
+        }
+        playSong(player, id);
+        respond(session, "ok\n");
+    } else if (strcmp(line, "enqueue") == 0 || strcmp(line, "enqueue-next") == 0) {
+        commandEnqueueSong(session, args, strcmp(line, "enqueue-next") == 0);
+    } else if (strcmp(line, "enqueue-artist") == 0) {
+        respond(session, "ok %d\n", enqueueArtist(player, args));
+    } else if (strcmp(line, "enqueue-search") == 0) {
+        commandEnqueueSearch(session, args);
+    } else if (strcmp(line, "move") == 0) {
+        commandMove(session, args);
+    } else if (strcmp(line, "shuffle-queue") == 0 || strcmp(line, "clear-queue") == 0) {
+        lockPlayback(player);
+        if (strcmp(line, "shuffle-queue") == 0) shuffleUpcoming(player);
+        else clearUpcoming(player);
+        pthread_mutex_unlock(&player->playbackMutex);
+        respond(session, "ok\n");
+    } else if (strcmp(line, "shuffle") == 0 && (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)) {
+        lockPlayback(player);
+        player->shuffleEnabled = strcmp(args, "on") == 0;
+        wakePlayback(player);
+        pthread_mutex_unlock(&player->playbackMutex);
+        respond(session, "ok\n");
+    } else if (strcmp(line, "next") == 0) {
+        playNext(player);
+        respond(session, "ok\n");
+    } else if (strcmp(line, "previous") == 0) {
+        playPrevious(player);
+        respond(session, "ok\n");
+    } else if (strcmp(line, "stop") == 0) {
+        lockPlayback(player);
+        player->manualStop = 1;
+        stopAudioFile(player);
+        wakePlayback(player);
+        pthread_mutex_unlock(&player->playbackMutex);
+        respond(session, "ok\n");
+    } else if (strcmp(line, "sorted") == 0) {
+        commandSorted(session, args);
+    } else if (strcmp(line, "length") == 0) {
+        commandLength(session, args);
+    } else if (strcmp(line, "artist") == 0) {
+        commandArtist(session, args);
+    } else if (strcmp(line, "scan") == 0) {
+        commandScan(session, args);
+    } else if (strcmp(line, "analyze") == 0) {
+        commandAnalyze(session);
+    } else if (strcmp(line, "readahead") == 0) {
+        commandReadAhead(session, args);
+    } else if (strcmp(line, "search") == 0) {
+        commandSearch(session, args);
+    } else if (strcmp(line, "count") == 0) {
+        respond(session, "ok %d\n", getPlaylistSize(player));
+    } else if (strcmp(line, "save") == 0) {
+        if (*args) snprintf(session->savePath, sizeof(session->savePath), "%s", args);
+        session->saveRequested = 1;
+        respond(session, "ok\n");
+    } else if (strcmp(line, "metrics") == 0 && (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)) {
+        setMetricsEnabled(strcmp(args, "on") == 0);
+        respond(session, "ok\n");
+    } else if (strcmp(line, "metrics-export") == 0 && *args) {
+        if (exportMetrics(args) == 0) respond(session, "ok\n");
+        else {
+            respond(session, "error cannot write %s\n", args);
+            session->errors++;
+        }
+    } else if (strcmp(line, "ping") == 0) {
+        respond(session, "ok\n");
+    } else if (strcmp(line, "shutdown") == 0) {
+        serverShutdown = 1;
+        respond(session, "ok\n");
+    } else {
+        respond(session, "error unknown command\n");
+        session->errors++;
     }
-    if (player->currentSong) {
-        pushToRecentlyPlayed(player, player->currentSong);
+}
+
+// Read commands until end of input (or shutdown) and answer each one.
+// Responses go out once per block read; a requested save happens once,
+// after the last command.
+static void runCommandSession(CommandSession* session, const char* playlistFile, PlaylistFormat format) {
+    session->playlistFile = playlistFile;
+    session->saveFormat = format;
+    session->outCapacity = 64 * 1024;
+    session->out = (char*)malloc(session->outCapacity);
+    char* buffer = (char*)malloc(COMMAND_READ_BYTES + 1);
+    if (!session->out || !buffer) exit(1);
+
+    size_t pending = 0; // Bytes of an unfinished line kept from the last read
+    int outputOk = 1;
+    while (outputOk && !serverShutdown) {
+        ssize_t got = read(session->inFd, buffer + pending, COMMAND_READ_BYTES - pending);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        size_t filled = pending + (size_t)got;
+
+        char* line = buffer;
+        char* end = buffer + filled;
+        char* newline;
+        while ((newline = (char*)memchr(line, '\n', (size_t)(end - line))) != NULL) {
+            *newline = '\0';
+            executeCommand(session, line);
+            line = newline + 1;
+        }
+        endEdits(session);
+        outputOk = flushResponses(session) == 0;
+
+        pending = (size_t)(end - line);
+        if (pending == COMMAND_READ_BYTES) {
+            // A single line filled the buffer: reject it and drop the rest of it
+            respond(session, "error line too long\n");
+            session->errors++;
+            pending = 0;
+            while ((got = read(session->inFd, buffer, COMMAND_READ_BYTES)) > 0) {
+                char* rest = (char*)memchr(buffer, '\n', (size_t)got);
+                if (rest) {
+                    pending = (size_t)(buffer + got - (rest + 1));
+                    memmove(buffer, rest + 1, pending);
+                    break;
+                }
+            }
+        } else {
+            memmove(buffer, line, pending);
+        }
     }
-    player->currentSong = song;
-    
-    // NEW: Reset manual stop flag when playing new song
-    manualStop = 0;
-    
-    // NEW: Record song start time and duration for auto-play tracking
-    songStartTime = time(NULL);
-    currentSongDuration = song->duration;
+    if (pending > 0 && !serverShutdown) {
+        buffer[pending] = '\0'; // Last line without a newline
+        executeCommand(session, buffer);
+    }
+    endEdits(session);
 
-    printf("\nNow Playing: %s - %s (%d sec)\n", song->artist, song->title, song->duration);
-    if (strlen(song->filepath) > 0) {
-        playAudioFile(song->filepath);
-    } else {
-        printf("(No audio file associated)\n");
-        isPlaying = 0;
+    if (session->saveRequested) {
+        pthread_mutex_lock(&commandSaveMutex);
+        if (session->savePath[0] || commitPlaylist(session->player) != 0) {
+            const char* path = session->savePath[0] ? session->savePath : session->playlistFile;
+            savePlaylist(session->player, path, session->saveFormat);
+        }
+        pthread_mutex_unlock(&commandSaveMutex);
     }
+    flushResponses(session);
+    free(buffer);
+    free(session->out);
+    session->out = NULL;
+}
+
+// Batch mode: run the commands in a file ("-" for stdin). Responses go to
+// stdout; the player's own messages are moved to stderr so they cannot
+// mix with them.
+int runCommandBatch(MusicPlayer* player, const char* commandFile, const char* playlistFile, PlaylistFormat format) {
+    CommandSession session;
+    memset(&session, 0, sizeof(session));
+    session.player = player;
+    session.inFd = strcmp(commandFile, "-") == 0 ? STDIN_FILENO : open(commandFile, O_RDONLY | O_CLOEXEC);
+    if (session.inFd < 0) {
+        fprintf(stderr, "Error: cannot open %s\n", commandFile);
+        return -1;
+    }
+    fflush(stdout);
+    session.outFd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    runCommandSession(&session, playlistFile, format);
 
-    pthread_mutex_unlock(&playbackMutex);
+    if (session.inFd != STDIN_FILENO) close(session.inFd);
+    close(session.outFd);
+    fprintf(stderr, "%ld command(s), %ld error(s)\n", session.commands, session.errors);
+    return session.errors > 0 ? 1 : 0;
 }
 
-// NEW: Play the next song in the playlist (called by monitoring thread)
-void playNext(MusicPlayer* player) {
-    pthread_mutex_lock(&playbackMutex);
-    
-    if (!player->currentSong) {
-        printf("\nNo song currently playing.\n");b
-        pthread_mutex_unlock(&playbackMutex);
-        return;
+#ifndef _WIN32
+typedef struct CommandClient {
+    MusicPlayer* player;
+    int fd;
+    const char* playlistFile;
+    PlaylistFormat format;
+    struct CommandClient* next;
+} CommandClient;
+
+static pthread_mutex_t serverMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t serverIdle = PTHREAD_COND_INITIALIZER;
+static CommandClient* serverClients = NULL; // Connected clients (serverMutex)
+static int serverListenFd = -1;
+
+// Sockets are close-on-exec: a player spawned meanwhile must not keep a
+// client connected after the daemon has hung up on it
+static int openStreamSocket() {
+#ifdef SOCK_CLOEXEC
+    return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+#endif
+}
+
+static int acceptConnection(int listenFd) {
+#ifdef __linux__
+    return accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+#else
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd >= 0) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+#endif
+}
+
+// Clear a socket left behind by an earlier run before binding the path.
+// Anything else there is kept and the path refused.
+static int removeStaleSocket(const char* path) {
+    struct stat info;
+    if (lstat(path, &info) != 0) return errno == ENOENT ? 0 : -1;
+    if (!S_ISSOCK(info.st_mode)) {
+        fprintf(stderr, "Error: %s exists and is not a socket\n", path);
+        return -1;
     }
+    return unlink(path) == 0 || errno == ENOENT ? 0 : -1;
+}
 
-    Song* nextSong = findNextSong(player, player->currentSong);
-    
-    if (!nextSong) {
-        printf("\n♪ Playlist finished! No more songs to play.\n");
-        isPlaying = 0;
-        pthread_mutex_unlock(&playbackMutex);
-        return;
+static void* serveCommandClient(void* arg) {
+    CommandClient* client = (CommandClient*)arg;
+    CommandSession session;
+    memset(&session, 0, sizeof(session));
+    session.player = client->player;
+    session.inFd = session.outFd = client->fd;
+    session.outSocket = 1;
+    runCommandSession(&session, client->playlistFile, client->format);
+
+    // Unlisted before the close, so a shutdown never touches a reused fd
+    pthread_mutex_lock(&serverMutex);
+    CommandClient** link = &serverClients;
+    while (*link != client) link = &(*link)->next;
+    *link = client->next;
+    pthread_cond_signal(&serverIdle);
+    pthread_mutex_unlock(&serverMutex);
+    close(client->fd);
+
+    // A shutdown request also wakes the accept loop
+    if (serverShutdown) shutdown(serverListenFd, SHUT_RDWR);
+    free(client);
+    return NULL;
+}
+
+// Daemon mode: serve clients on a Unix domain socket, each on its own
+// thread, until one sends "shutdown"
+int runCommandServer(MusicPlayer* player, const char* socketPath, const char* playlistFile, PlaylistFormat format) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: socket path too long\n");
+        return -1;
     }
+    strcpy(address.sun_path, socketPath);
 
-    printf("\n⏭  Auto-playing next: %s - %s (%d sec)\n", nextSong->artist, nextSong->title, nextSong->duration);
-    
-    // NEW: Check if filepath exists before trying to play
-    if (strlen(nextSong->filepath) == 0) {
-        printf("ERROR: Next song has no audio file!\n");
-        player->currentSong = nextSong;
-        isPlaying = 0;
-        pthread_mutex_unlock(&playbackMutex);
-        return;
+    serverListenFd = openStreamSocket();
+    if (serverListenFd < 0) return -1;
+    if (removeStaleSocket(socketPath) != 0 || bind(serverListenFd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(serverListenFd, 16) != 0) {
+        fprintf(stderr, "Error: cannot listen on %s\n", socketPath);
+        close(serverListenFd);
+        return -1;
     }
-    
-    // NEW: Update player state BEFORE releasing mutex
-    if (player->currentSong) {
-        pushToRecentlyPlayed(player, player->currentSong);
+    fprintf(stderr, "Listening on %s\n", socketPath);
+
+    while (!serverShutdown) {
+        int fd = acceptConnection(serverListenFd);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        CommandClient* client = (CommandClient*)malloc(sizeof(CommandClient));
+        if (!client) exit(1);
+        client->player = player;
+        client->fd = fd;
+        client->playlistFile = playlistFile;
+        client->format = format;
+
+        pthread_mutex_lock(&serverMutex);
+        client->next = serverClients;
+        serverClients = client;
+        pthread_mutex_unlock(&serverMutex);
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serveCommandClient, client) == 0) pthread_detach(thread);
+        else serveCommandClient(client);
     }
-    player->currentSong = nextSong;
-    songStartTime = time(NULL);
-    currentSongDuration = nextSong->duration;
-    
-    printf("[DEBUG] About to call playAudioFile for: %s\n", nextSong->filepath);
-    
-    // NEW: Release mutex BEFORE calling audio functions
-    pthread_mutex_unlock(&playbackMutex);
-    
-    // NEW: Call these functions OUTSIDE of mutex lock
-    stopAudioFile();
-    sleep(1); // NEW: Small delay to ensure clean stop
-    playAudioFile(nextSong->filepath);
-    printf("[DEBUG] playAudioFile completed, isPlaying = %d\n", isPlaying);
-}
 
-// NEW: Toggle auto-play feature on/off
-void toggleAutoPlay(MusicPlayer* player) {
-    autoPlayEnabled = !autoPlayEnabled;
-    printf("\nAuto-play is now %s.\n", autoPlayEnabled ? "ENABLED" : "DISABLED");
+    // Let connected clients finish the input already sent; one that is idle
+    // would otherwise keep its thread in read() forever
+    pthread_mutex_lock(&serverMutex);
+    for (CommandClient* client = serverClients; client; client = client->next) shutdown(client->fd, SHUT_RD);
+    while (serverClients) pthread_cond_wait(&serverIdle, &serverMutex);
+    pthread_mutex_unlock(&serverMutex);
+    close(serverListenFd);
+    unlink(socketPath);
+    return 0;
 }
+#endif
 
 // ============================================================================
-// STACK & QUEUE (Simple Versions)
+// METRICS EXPORT (PROMETHEUS TEXT FORMAT)
 // ============================================================================
-void pushToRecentlyPlayed(MusicPlayer* player, Song* song) {
-    StackNode* node = (StackNode*)malloc(sizeof(StackNode));
-    node->song = song;
-    node->next = player->recentlyPlayed;
-    player->recentlyPlayed = node;
-}
+// The same text goes to a file (replaced atomically, like playlists) or to
+// anyone connecting to the metrics socket: `socat - UNIX-CONNECT:PATH`.
+// Histograms are in seconds with cumulative power-of-two buckets.
+static const char* const counterNames[METRIC_COUNTER_COUNT][2] = {
+    { "audiora_loop_wakeups_total", "Session passes run by the playback event loop" },
+    { "audiora_timers_fired_total", "Track deadlines that came due" },
+    { "audiora_tracks_started_total", "Tracks handed to an audio backend" },
+    { "audiora_playback_lock_acquires_total", "playbackMutex acquisitions" },
+    { "audiora_playback_lock_contended_total", "playbackMutex acquisitions that had to wait" },
+    { "audiora_pool_allocations_total", "Objects taken from node pools" },
+    { "audiora_slab_allocations_total", "Slabs allocated by node pools" },
+    { "audiora_readahead_hits_total", "Tracks started from a file that was read ahead" },
+    { "audiora_readahead_misses_total", "Tracks started from a file that was not read ahead" },
+    { "audiora_readahead_bytes_total", "Bytes advised into the page cache ahead of playback" },
+    { "audiora_readahead_evicted_bytes_total", "Read-ahead bytes dropped again for skipped tracks" },
+};
 
-void clearRecentlyPlayed(MusicPlayer* player) {
-    StackNode* temp;
-    while (player->recentlyPlayed) {
-        temp = player->recentlyPlayed;
-        player->recentlyPlayed = player->recentlyPlayed->next;
-        free(temp);
+static const char* const histogramNames[METRIC_HISTOGRAM_COUNT][2] = {
+    { "audiora_play_start_seconds", "Time to start a track on the audio backend" },
+    { "audiora_transition_gap_seconds", "Silence between the end of one track and the start of the next" },
+    { "audiora_timer_lateness_seconds", "How late the event loop handled a track deadline" },
+    { "audiora_playback_lock_wait_seconds", "Time spent waiting for a contended playbackMutex" },
+    { "audiora_playlist_load_seconds", "Time to load a playlist file" },
+    { "audiora_playlist_save_seconds", "Time to write a playlist file or snapshot" },
+    { "audiora_first_audio_seconds", "Time from starting a track to its first samples reaching the sink" },
+};
+
+typedef struct MetricsText {
+    char* data;
+    size_t size;
+    size_t capacity;
+} MetricsText;
+
+static void appendMetricsText(MetricsText* text, const char* format, ...) {
+    va_list args;
+    for (;;) {
+        size_t space = text->capacity - text->size;
+        va_start(args, format);
+        int length = vsnprintf(text->data + text->size, space, format, args);
+        va_end(args);
+        if (length < 0) return;
+        if ((size_t)length < space) {
+            text->size += (size_t)length;
+            return;
+        }
+        text->capacity = text->capacity * 2 + (size_t)length + 1;
+        text->data = (char*)realloc(text->data, text->capacity);
+        if (!text->data) exit(1);
     }
 }
 
-void enqueueUpcoming(MusicPlayer* player, Song* song) {
-    QueueNode* node = (QueueNode*)malloc(sizeof(QueueNode));
-    node->song = song;
-    node->next = NULL;
+static void renderMetrics(MetricsText* text) {
+    MetricsSnapshot snapshot;
+    getMetricsSnapshot(&snapshot);
+    PlaybackLoopStats loop;
+    getPlaybackLoopStats(&loop);
 
-    if (!player->upcomingQueue->rear)
-        player->upcomingQueue->front = player->upcomingQueue->rear = node;
-    else {
-        player->upcomingQueue->rear->next = node;
-        player->upcomingQueue->rear = node;
+    appendMetricsText(text, "# HELP audiora_metrics_enabled Whether hot paths are being recorded\n"
+                            "# TYPE audiora_metrics_enabled gauge\naudiora_metrics_enabled %d\n", metricsActive());
+    appendMetricsText(text, "# HELP audiora_sessions Playback sessions attached to the event loop\n"
+                            "# TYPE audiora_sessions gauge\naudiora_sessions %d\n", loop.sessions);
+    appendMetricsText(text, "# HELP audiora_loop_threads Playback event loop threads running\n"
+                            "# TYPE audiora_loop_threads gauge\naudiora_loop_threads %d\n", loop.threads);
+    appendMetricsText(text, "# HELP audiora_timers Track deadlines currently armed\n"
+                            "# TYPE audiora_timers gauge\naudiora_timers %d\n", loop.timers);
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        appendMetricsText(text, "# HELP %s %s\n# TYPE %s counter\n%s %lld\n", counterNames[i][0], counterNames[i][1],
+                          counterNames[i][0], counterNames[i][0], snapshot.counters[i]);
+    }
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const char* name = histogramNames[h][0];
+        const MetricHistogramData* histogram = &snapshot.histograms[h];
+        appendMetricsText(text, "# HELP %s %s\n# TYPE %s histogram\n", name, histogramNames[h][1], name);
+        long long cumulative = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += histogram->buckets[b];
+            appendMetricsText(text, "%s_bucket{le=\"%g\"} %lld\n", name, (double)(1LL << b) / 1e6, cumulative);
+        }
+        cumulative += histogram->buckets[METRIC_BUCKETS];
+        appendMetricsText(text, "%s_bucket{le=\"+Inf\"} %lld\n%s_sum %.9f\n%s_count %lld\n", name, cumulative,
+                          name, (double)histogram->sumNs / 1e9, name, cumulative);
     }
-    player->upcomingQueue->count++;
 }
 
-Song* dequeueUpcoming(MusicPlayer* player) {
-    if (!player->upcomingQueue->front) return NULL;
-    QueueNode* temp = player->upcomingQueue->front;
-    Song* song = temp->song;
-    player->upcomingQueue->front = temp->next;
-    if (!player->upcomingQueue->front) player->upcomingQueue->rear = NULL;
-    free(temp);
-    player->upcomingQueue->count--;
-    return song;
+void writeMetrics(FILE* out) {
+    MetricsText text = { NULL, 0, 0 };
+    renderMetrics(&text);
+    fwrite(text.data, 1, text.size, out);
+    free(text.data);
 }
 
-void clearUpcoming(MusicPlayer* player) {
-    while (dequeueUpcoming(player));
+// Replace filename with the current metrics; returns 0 on success
+int exportMetrics(const char* filename) {
+    char tmpPath[MAX_FILENAME + 8];
+    FILE* file = openReplacementFile(filename, tmpPath, sizeof(tmpPath), "w");
+    if (!file) return -1;
+    writeMetrics(file);
+    return commitReplacementFile(file, tmpPath, filename);
 }
 
-// ============================================================================
-// FILE HANDLING
-// ============================================================================
-void savePlaylistToFile(MusicPlayer* player, const char* filename) {
-    FILE* file = fopen(filename, "w");
-    if (!file) return;
+#ifndef _WIN32
+static int metricsListenFd = -1;
+static pthread_t metricsServerThread;
+static char metricsSocketPath[MAX_FILENAME];
 
-    fprintf(file, "%d\n", player->nextId);
-    Song* current = player->playlist;
-    while (current) {
-        fprintf(file, "%d|%s|%s|%d|%s\n",
-                current->id, current->title, current->artist,
-                current->duration, current->filepath);
-        current = current->next;
+// Answer each connection with one dump and hang up
+static void* serveMetrics(void* arg) {
+    (void)arg;
+    for (;;) {
+        int fd = acceptConnection(metricsListenFd);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break; // Closed by stopMetricsServer
+        }
+        MetricsText text = { NULL, 0, 0 };
+        renderMetrics(&text);
+        size_t sent = 0;
+        while (sent < text.size) {
+#ifdef MSG_NOSIGNAL
+            ssize_t written = send(fd, text.data + sent, text.size - sent, MSG_NOSIGNAL);
+#else
+            ssize_t written = send(fd, text.data + sent, text.size - sent, 0);
+#endif
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) break;
+            sent += (size_t)written;
+        }
+        free(text.data);
+        close(fd);
     }
-    fclose(file);
+    return NULL;
 }
+#endif
 
-void loadPlaylistFromFile(MusicPlayer* player, const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (!file) return;
-    fscanf(file, "%d\n", &player->nextId);
+// Serve metrics on a Unix domain socket from a background thread; also
+// turns metrics on. Returns 0 on success.
+int startMetricsServer(const char* socketPath) {
+#ifdef _WIN32
+    (void)socketPath;
+    fprintf(stderr, "Error: the metrics socket is not supported on Windows\n");
+    return -1;
+#else
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (metricsListenFd >= 0 || strlen(socketPath) >= sizeof(address.sun_path) ||
+        strlen(socketPath) >= sizeof(metricsSocketPath)) {
+        fprintf(stderr, "Error: cannot serve metrics on %s\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
 
-    char line[512];
-    while (fgets(line, sizeof(line), file)) {
-        Song* newSong = (Song*)malloc(sizeof(Song));
-        sscanf(line, "%d|%99[^|]|%99[^|]|%d|%149[^\n]",
-               &newSong->id, newSong->title, newSong->artist,
-               &newSong->duration, newSong->filepath);
-        newSong->next = NULL;
+    int fd = openStreamSocket();
+    if (fd < 0) return -1;
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    if (removeStaleSocket(socketPath) != 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "Error: cannot listen on %s\n", socketPath);
+        close(fd);
+        return -1;
+    }
+    metricsListenFd = fd;
+    strcpy(metricsSocketPath, socketPath);
+    if (pthread_create(&metricsServerThread, NULL, serveMetrics, NULL) != 0) {
+        close(fd);
+        unlink(socketPath);
+        metricsListenFd = -1;
+        return -1;
+    }
+    setMetricsEnabled(1);
+    return 0;
+#endif
+}
 
-        if (!player->playlist) player->playlist = newSong;
-        else {
-            Song* curr = player->playlist;
-            while (curr->next) curr = curr->next;
-            curr->next = newSong;
+void stopMetricsServer() {
+#ifndef _WIN32
+    if (metricsListenFd < 0) return;
+    shutdown(metricsListenFd, SHUT_RDWR); // Wakes the blocked accept
+    pthread_join(metricsServerThread, NULL);
+    close(metricsListenFd);
+    metricsListenFd = -1;
+    unlink(metricsSocketPath);
+#endif
+}
+
+void displayMetricsSummary() {
+    MetricsSnapshot snapshot;
+    getMetricsSnapshot(&snapshot);
+    static const char* const labels[METRIC_HISTOGRAM_COUNT] = {
+        "Play start", "Transition gap", "Timer lateness", "Lock wait", "Playlist load", "Playlist save", "First audio"
+    };
+
+    printf("\nMetrics are %s.\n", metricsActive() ? "ON" : "OFF");
+    printf("Loop wakeups %lld, deadlines fired %lld, tracks started %lld\n", snapshot.counters[METRIC_LOOP_WAKEUPS],
+           snapshot.counters[METRIC_TIMERS_FIRED], snapshot.counters[METRIC_TRACKS_STARTED]);
+    printf("playbackMutex: %lld acquired, %lld contended\n", snapshot.counters[METRIC_LOCK_ACQUIRES],
+           snapshot.counters[METRIC_LOCK_CONTENDED]);
+    printf("Node pools: %lld allocations, %lld slabs\n", snapshot.counters[METRIC_POOL_ALLOCS],
+           snapshot.counters[METRIC_SLAB_ALLOCS]);
+    printf("Read-ahead: %lld hits, %lld misses, %lld bytes advised, %lld evicted\n",
+           snapshot.counters[METRIC_READAHEAD_HITS], snapshot.counters[METRIC_READAHEAD_MISSES],
+           snapshot.counters[METRIC_READAHEAD_BYTES], snapshot.counters[METRIC_READAHEAD_EVICTED_BYTES]);
+    printf("\n%-16s %10s %10s %10s %10s %10s\n", "Latency (ms)", "Count", "Avg", "p50", "p99", "p99.9");
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const MetricHistogramData* histogram = &snapshot.histograms[h];
+        if (histogram->count == 0) {
+            printf("%-16s %10d %10s %10s %10s %10s\n", labels[h], 0, "-", "-", "-", "-");
+            continue;
         }
-        player->songCount++;
+        printf("%-16s %10lld %10.3f %10.3f %10.3f %10.3f\n", labels[h], histogram->count,
+               (double)histogram->sumNs / 1e6 / (double)histogram->count, metricPercentileMs(histogram, 50),
+               metricPercentileMs(histogram, 99), metricPercentileMs(histogram, 99.9));
     }
-    fclose(file);
+    printf("Percentiles are bucket upper bounds (powers of two microseconds).\n");
 }
 
 // ============================================================================
@@ -478,10 +7972,19 @@ void clearScreen() {
 #ifdef _WIN32
     system("cls");
 #else
-    system("clear");
+    // ANSI clear + home; no shell per menu redraw
+    fputs("\033[2J\033[H", stdout);
+    fflush(stdout);
 #endif
 }
 
+// Ask whether to show another page; anything but "q" continues
+int askNextPage() {
+    char answer[16];
+    getStringInput("Enter = next page, q = done: ", answer, sizeof(answer));
+    return answer[0] != 'q' && answer[0] != 'Q';
+}
+
 void pauseScreen() {
     printf("\nPress Enter to continue...");
     getchar();
@@ -504,18 +8007,82 @@ void getStringInput(const char* prompt, char* buffer, int maxLen) {
 // ============================================================================
 // MAIN FUNCTION
 // ============================================================================
-int main() {
-    MusicPlayer* player = initMusicPlayer();
-    char filename[] = "playlist_audio.txt";
+// Built with -DAUDIORA_NO_MAIN the file is a library for other programs,
+// such as the benchmark in music_player_bench.c
+#ifndef AUDIORA_NO_MAIN
+// Write the final metrics file, if one was asked for, and close the socket
+static void finishMetrics(const char* metricsFile) {
+    if (metricsFile && exportMetrics(metricsFile) != 0)
+        fprintf(stderr, "Warning: cannot write metrics to %s\n", metricsFile);
+    stopMetricsServer();
+}
+
+// Usage: audiora [--batch FILE|-] [--socket PATH] [--playlist FILE]
+//                [--metrics FILE] [--metrics-socket PATH]
+int main(int argc, char* argv[]) {
+    const char* filename = "playlist_audio.txt";
+    const char* batchFile = NULL;
+    const char* socketPath = NULL;
+    const char* metricsFile = NULL;
+    const char* metricsSocket = NULL;
     int choice;
 
-    loadPlaylistFromFile(player, filename);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batchFile = argv[++i];
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) socketPath = argv[++i];
+        else if (strcmp(argv[i], "--playlist") == 0 && i + 1 < argc) filename = argv[++i];
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) metricsFile = argv[++i];
+        else if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc) metricsSocket = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s [--batch FILE|-] [--socket PATH] [--playlist FILE] "
+                            "[--metrics FILE] [--metrics-socket PATH]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (metricsFile) setMetricsEnabled(1);
+    if (metricsSocket && startMetricsServer(metricsSocket) != 0) return 2;
+
+    MusicPlayer* player = initMusicPlayer();
+    PlaylistFormat format = loadPlaylist(player, filename);
+    openPlaylistJournal(player, filename, format);
+    char historyFile[MAX_FILENAME + 16];
+    snprintf(historyFile, sizeof(historyFile), "%s.history", filename);
+    loadRecentlyPlayed(player, historyFile);
+    char scanFile[MAX_FILENAME + 16];
+    snprintf(scanFile, sizeof(scanFile), "%s.scan", filename);
+    char loudnessFile[MAX_FILENAME + 16];
+    snprintf(loudnessFile, sizeof(loudnessFile), "%s.loudness", filename);
+
+    if (batchFile) {
+        int status = runCommandBatch(player, batchFile, filename, format);
+        freeMusicPlayer(player);
+        finishMetrics(metricsFile);
+        return status < 0 ? 2 : status;
+    }
+    if (socketPath) {
+#ifdef _WIN32
+        fprintf(stderr, "Error: --socket is not supported on Windows\n");
+        int status = -1;
+#else
+        int status = runCommandServer(player, socketPath, filename, format);
+#endif
+        freeMusicPlayer(player);
+        finishMetrics(metricsFile);
+        return status < 0 ? 2 : 0;
+    }
 
     while (1) {
         clearScreen();
         printf("\n=== AUDIORA MUSIC PLAYER ===\n");
         printf("1. Add Song\n2. Delete Song\n3. Display Playlist\n4. Play Song\n");
         printf("5. Stop Playback\n6. Toggle Auto-Play\n7. Save Playlist\n8. Exit\n");
+        printf("9. Export Playlist\n10. Allocation Stats\n11. Songs by Artist\n12. Search Songs\n");
+        printf("13. Toggle Gapless Playback\n14. Transition Stats\n15. Pause/Resume\n16. Now Playing\n");
+        printf("17. Set Crossfade\n18. DSP Benchmark\n19. Recently Played\n20. Previous Song\n");
+        printf("21. Set History Size\n22. Queue Song\n23. Queue Artist\n24. Upcoming Queue\n");
+        printf("25. Shuffle Queue\n26. Toggle Shuffle Play\n27. Scan Music Folder\n28. Songs by Length\n");
+        printf("29. Sorted Index Benchmark\n30. Metrics Summary\n31. Toggle Metrics\n32. Analyze Loudness\n");
+        printf("33. Toggle Loudness Normalization\n34. Read-Ahead Settings\n");
 
         choice = getIntInput("Enter your choice: ");
         switch (choice) {
@@ -537,12 +8104,23 @@ int main() {
                 break;
             }
             case 3: {
-                Song* s = player->playlist;
-                while (s) {
-                    printf("%d | %s - %s (%d sec) [%s]\n", s->id, s->artist, s->title, s->duration,
-                           strlen(s->filepath) ? "Audio ✓" : "No File");
-                    s = s->next;
+                int order = getIntInput("Order (1 = Playlist, 2 = Artist, 3 = Title, 4 = Length): ");
+                if (order >= 2 && order <= 4) {
+                    int ids[MENU_PAGE_SIZE];
+                    int offset = 0, copied, total;
+                    do {
+                        total = listSongsSorted(player, (SortKey)(order - 2), offset, ids, MENU_PAGE_SIZE, &copied);
+                        displaySortedPage(player, ids, copied);
+                        offset += copied;
+                        printf("\nShowing %d of %d\n", offset, total);
+                    } while (copied > 0 && offset < total && askNextPage());
+                    pauseScreen();
+                    break;
                 }
+                displayPlaylist(player);
+                long total = getTotalDuration(player);
+                printf("\n%d song(s), total %ld:%02ld:%02ld\n", getPlaylistSize(player),
+                       total / 3600, total / 60 % 60, total % 60);
                 pauseScreen();
                 break;
             }
@@ -553,30 +8131,225 @@ int main() {
                 break;
             }
             case 5:
-                pthread_mutex_lock(&playbackMutex);
-                manualStop = 1; // NEW: Set flag to prevent auto-play
-                stopAudioFile();
+                lockPlayback(player);
+                player->manualStop = 1; // NEW: Set flag to prevent auto-play
+                stopAudioFile(player);
+                wakePlayback(player);
                 printf("\nPlayback stopped.\n");
-                pthread_mutex_unlock(&playbackMutex);
+                pthread_mutex_unlock(&player->playbackMutex);
                 pauseScreen();
                 break;
             case 6:
                 toggleAutoPlay(player);
                 pauseScreen();
                 break;
+            case 13:
+                toggleGapless(player);
+                pauseScreen();
+                break;
+            case 14:
+                displayTransitionStats(player);
+                pauseScreen();
+                break;
+            case 15:
+                lockPlayback(player);
+                if (player->isPaused) resumeAudioFile(player);
+                else pauseAudioFile(player);
+                printf("\nPlayback %s.\n", player->isPaused ? "paused" : (player->isPlaying ? "resumed" : "is not running"));
+                pthread_mutex_unlock(&player->playbackMutex);
+                pauseScreen();
+                break;
+            case 16:
+                displayCurrentSong(player);
+                pauseScreen();
+                break;
+            case 17: {
+                printf("\nCrossfade is %.1f sec.\n", getCrossfadeDuration());
+                int seconds = getIntInput("New crossfade (sec, 0 = gapless): ");
+                setCrossfadeDuration(seconds);
+                printf("Crossfade set to %.1f sec.\n", getCrossfadeDuration());
+                pauseScreen();
+                break;
+            }
+            case 18:
+                printf("\nDSP kernels in use: %s\n", dspKernelName());
+                benchmarkDspKernels();
+                pauseScreen();
+                break;
+            case 19:
+                displayRecentlyPlayed(player);
+                pauseScreen();
+                break;
+            case 20:
+                playPrevious(player);
+                pauseScreen();
+                break;
+            case 21: {
+                int entries = getIntInput("Songs to remember (0 = off): ");
+                lockPlayback(player);
+                setHistoryCapacity(player, entries);
+                printf("\nHistory keeps up to %d song(s).\n", player->history.capacity);
+                pthread_mutex_unlock(&player->playbackMutex);
+                pauseScreen();
+                break;
+            }
+            case 22: {
+                int id = getIntInput("Enter Song ID: ");
+                int front = getIntInput("Position (1 = Play Next, 2 = End of Queue): ") == 1;
+                pthread_rwlock_rdlock(&player->catalog->playlistLock);
+                lockPlayback(player);
+                Song* song = findSongById(player, id);
+                if (song && front) enqueueUpcomingFront(player, song);
+                else if (song) enqueueUpcoming(player, song);
+                printf(song ? "\n✓ Song queued.\n" : "\n✗ Song ID not found.\n");
+                pthread_mutex_unlock(&player->playbackMutex);
+                pthread_rwlock_unlock(&player->catalog->playlistLock);
+                pauseScreen();
+                break;
+            }
+            case 23: {
+                char artist[MAX_ARTIST];
+                getStringInput("Artist: ", artist, MAX_ARTIST);
+                printf("\n%d song(s) queued.\n", enqueueArtist(player, artist));
+                pauseScreen();
+                break;
+            }
+            case 24:
+                displayUpcoming(player);
+                pauseScreen();
+                break;
+            case 25:
+                lockPlayback(player);
+                shuffleUpcoming(player);
+                pthread_mutex_unlock(&player->playbackMutex);
+                displayUpcoming(player);
+                pauseScreen();
+                break;
+            case 26:
+                toggleShuffle(player);
+                pauseScreen();
+                break;
+            case 28: {
+                int ids[MENU_PAGE_SIZE];
+                int offset = 0, copied, total;
+                int shortest = getIntInput("Shortest (sec): ");
+                int longest = getIntInput("Longest (sec): ");
+                do {
+                    total = findSongsByDuration(player, shortest, longest, offset, ids, MENU_PAGE_SIZE, &copied);
+                    displaySortedPage(player, ids, copied);
+                    offset += copied;
+                    printf("\n%d of %d song(s) between %d:%02d and %d:%02d\n", offset, total,
+                           shortest / 60, shortest % 60, longest / 60, longest % 60);
+                } while (copied > 0 && offset < total && askNextPage());
+                pauseScreen();
+                break;
+            }
+            case 29:
+                benchmarkSortedIndexes(player);
+                pauseScreen();
+                break;
+            case 30:
+                displayMetricsSummary();
+                if (metricsFile) {
+                    if (exportMetrics(metricsFile) == 0) printf("✓ Written to %s\n", metricsFile);
+                    else printf("✗ Cannot write %s\n", metricsFile);
+                }
+                pauseScreen();
+                break;
+            case 31:
+                setMetricsEnabled(!getMetricsEnabled());
+                printf("\nMetrics are now %s.\n", getMetricsEnabled() ? "ON" : "OFF");
+                pauseScreen();
+                break;
+            case 32: {
+                LoudnessStats stats;
+                printf("\nMeasuring loudness...\n");
+                analyzeLoudness(player, loudnessFile, 0, &stats);
+                displayLoudnessStats(&stats);
+                pauseScreen();
+                break;
+            }
+            case 33:
+                toggleLoudnessNormalization(player);
+                pauseScreen();
+                break;
+            case 34: {
+                displayReadAheadStats(player);
+                int tracks = getIntInput("Tracks to read ahead (0 = off): ");
+                int megabytes = tracks > 0 ? getIntInput("Budget (MB): ") : 0;
+                setReadAhead(player, tracks, (long long)megabytes * 1024 * 1024);
+                displayReadAheadStats(player);
+                pauseScreen();
+                break;
+            }
+            case 27: {
+                char folder[MAX_FILENAME];
+                ScanStats stats;
+                getStringInput("Music Folder: ", folder, MAX_FILENAME);
+                if (scanMediaLibrary(player, folder, scanFile, &stats) == 0) displayScanStats(&stats);
+                else printf("\n✗ Cannot open folder.\n");
+                pauseScreen();
+                break;
+            }
             case 7:
-                savePlaylistToFile(player, filename);
+                if (commitPlaylist(player) != 0) savePlaylist(player, filename, format);
                 printf("\nPlaylist saved.\n");
                 pauseScreen();
                 break;
             case 8:
-                savePlaylistToFile(player, filename);
+                if (commitPlaylist(player) != 0) savePlaylist(player, filename, format);
+                saveRecentlyPlayed(player, historyFile);
                 freeMusicPlayer(player);
+                finishMetrics(metricsFile);
                 printf("\nThanks For Using Audiora\n");
                 return 0;
+            case 9: {
+                char exportPath[MAX_FILENAME];
+                getStringInput("Export File Path: ", exportPath, MAX_FILENAME);
+                int binary = getIntInput("Format (1 = Text, 2 = Binary): ") == 2;
+                savePlaylist(player, exportPath, binary ? PLAYLIST_FORMAT_BINARY : PLAYLIST_FORMAT_TEXT);
+                printf("\nPlaylist exported.\n");
+                pauseScreen();
+                break;
+            }
+            case 10:
+                displayAllocationStats(player);
+                pauseScreen();
+                break;
+            case 11: {
+                char artist[MAX_ARTIST];
+                int ids[MENU_PAGE_SIZE];
+                int offset = 0, copied, total;
+                getStringInput("Artist: ", artist, MAX_ARTIST);
+                do {
+                    total = listSongsByArtist(player, artist, offset, ids, MENU_PAGE_SIZE, &copied);
+                    displaySortedPage(player, ids, copied);
+                    offset += copied;
+                    printf("\n%d of %d song(s) by %s\n", offset, total, artist);
+                } while (copied > 0 && offset < total && askNextPage());
+                pauseScreen();
+                break;
+            }
+            case 12: {
+                char query[MAX_TITLE];
+                int ids[50];
+                getStringInput("Search: ", query, MAX_TITLE);
+                int prefix = getIntInput("Match (1 = Anywhere, 2 = Word Prefix): ") == 2;
+                int matches = searchSongs(player, query, prefix ? SEARCH_PREFIX : SEARCH_SUBSTRING, ids, 50);
+                pthread_rwlock_rdlock(&player->catalog->playlistLock);
+                for (int i = 0; i < matches; i++) {
+                    Song* s = findSongById(player, ids[i]);
+                    if (s) printf("%d | %s - %s (%d sec)\n", s->id, songArtist(player, s), songTitle(player, s), s->duration);
+                }
+                pthread_rwlock_unlock(&player->catalog->playlistLock);
+                printf("\n%d match(es)%s\n", matches, matches == 50 ? " (showing first 50)" : "");
+                pauseScreen();
+                break;
+            }
             default:
                 printf("Invalid choice.\n");
                 pauseScreen();
         }
     }
-}
\ No newline at end of file
+}
+#endif // AUDIORA_NO_MAIN
\ No newline at end of file
@@ -1,59 +1,472 @@
 #ifndef MUSIC_PLAYER_H
 #define MUSIC_PLAYER_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 #include <time.h>
 
-// Maximum string lengths for song attributes
-#define MAX_TITLE 100
-#define MAX_ARTIST 100
-#define MAX_FILENAME 150
+// Input buffer sizes for interactive prompts (stored strings are unbounded)
+#define MAX_TITLE 256
+#define MAX_ARTIST 256
+#define MAX_FILENAME 4096
+
+// Handle to an interned string in a StringPool
+typedef uint32_t StrRef;
+#define EMPTY_STRING_REF 0           // Always refers to ""
+
+// Structure for interned string storage (Append-Only Buffer + Hash Table)
+typedef struct StringPool {
+    char* data;                      // NUL-terminated strings back to back
+    size_t size;                     // Bytes used in data
+    size_t capacity;                 // Bytes allocated for data
+    uint32_t* offsets;               // StrRef -> offset into data
+    uint32_t* hashes;                // StrRef -> cached hash
+    uint32_t count;                  // Handles handed out, free ones included
+    uint32_t refCapacity;            // Allocated entries in offsets/hashes
+    uint32_t* buckets;               // Hash table of StrRef + 1, 0 = empty
+    uint32_t bucketCapacity;         // Number of buckets (power of two)
+    StrRef freeRefs;                 // Handles released by compaction, chained through offsets; 0 = none
+    uint32_t freeCount;              // Handles on that list
+} StringPool;
 
 // Structure for a song node in the playlist (Linked List)
 typedef struct Song {
     int id;                          // Unique song identifier
-    char title[MAX_TITLE];           // Song title
-    char artist[MAX_ARTIST];         // Artist name
+    StrRef title;                    // Song title
+    StrRef artist;                   // Artist name
     int duration;                    // Duration in seconds
-    char filepath[MAX_FILENAME];     // Path to audio file
+    StrRef filepath;                 // Path to audio file
+    int slot;                        // Row in the playlist columns
+    int retired;                     // Deleted, awaiting reclamation
+    float gainDb;                    // Loudness normalisation gain, 0 until analysed
     struct Song* next;               // Pointer to next song in playlist
+    struct Song* prev;               // Pointer to previous song in playlist
 } Song;
 
-// Structure for stack node (Recently Played)
-typedef struct StackNode {
-    Song* song;                      // Pointer to song
-    struct StackNode* next;          // Pointer to next stack node
-} StackNode;
+// Structure for the song ID index (Hash Table, open addressing)
+typedef struct SongIndex {
+    Song** slots;                    // Bucket array, NULL = empty slot
+    int capacity;                    // Number of buckets (power of two)
+    int count;                       // Number of indexed songs
+} SongIndex;
+
+// Structure for the columnar playlist store (Struct of Arrays)
+typedef struct PlaylistColumns {
+    int* ids;                        // slot -> song ID, 0 = dead slot
+    int* durations;                  // slot -> duration, 0 for dead slots
+    StrRef* titles;                  // slot -> title handle
+    StrRef* artists;                 // slot -> artist handle
+    Song** rows;                     // slot -> Song node, NULL for dead slots
+    int slotCount;                   // Slots in use (live + dead)
+    int slotCapacity;                // Allocated slots per column
+    int* order;                      // Playlist order as slot numbers
+    int orderCount;                  // Entries in order
+    int deadCount;                   // Dead slots awaiting compaction
+} PlaylistColumns;
+
+// Orders kept by the sorted indexes
+typedef enum SortKey {
+    SORT_BY_ARTIST,                  // Artist, then title
+    SORT_BY_TITLE,                   // Title, then artist
+    SORT_BY_DURATION,                // Duration, then ID (insertion order)
+    SORT_KEY_COUNT
+} SortKey;
+
+#define SORTED_INDEX_MAX_LEVEL 16    // Plenty for 4^16 songs
+
+// Forward link of a skip list node
+typedef struct SortedLink {
+    struct SortedNode* next;
+    int width;                       // Songs passed by following this link
+} SortedLink;
+
+typedef struct SortedNode {
+    Song* song;
+    uint64_t prefix;                 // Key prefix that decides most comparisons
+    int level;                       // Number of links
+    SortedLink links[];              // links[0] is the plain sorted list
+} SortedNode;
+
+// Structure for one sort order (Indexable Skip List)
+typedef struct SortedIndex {
+    SortKey key;
+    SortedNode* head;                // Sentinel with every level
+    int level;                       // Levels in use
+    int count;                       // Songs in the index
+    uint64_t rng;                    // Node level generator
+    int built;                       // Built lazily on the first query
+} SortedIndex;
+
+// Skip pointer to the start of a block of postings
+typedef struct PostingSkip {
+    int firstId;                     // First ID in the block
+    int baseId;                      // ID preceding the block (delta base)
+    uint32_t offset;                 // Byte offset of the block's first varint
+} PostingSkip;
 
-// Structure for queue node (Upcoming Songs)
-typedef struct QueueNode {
-    Song* song;                      // Pointer to song
-    struct QueueNode* next;          // Pointer to next queue node
-} QueueNode;
+// Structure for one trigram's posting list (Delta + Varint Compressed)
+typedef struct PostingList {
+    uint32_t key;                    // Packed trigram | occupied bit, 0 = empty
+    int count;                       // Song IDs in the list (live and stale)
+    int lastId;                      // Largest ID, base for the next delta
+    uint32_t size;                   // Encoded bytes used
+    uint32_t capacity;               // Encoded bytes allocated
+    uint8_t* data;                   // Ascending IDs as varint deltas
+    PostingSkip* skips;              // One skip pointer per block of postings
+    int skipCapacity;                // Allocated skip pointers
+} PostingList;
 
-// Structure for the queue (Upcoming Songs)
+// Structure for the full-text search index (Trigram Inverted Index)
+typedef struct SearchIndex {
+    PostingList* lists;              // Hash table of posting lists by trigram
+    int capacity;                    // Number of buckets (power of two)
+    int count;                       // Distinct trigrams
+    long livePostings;               // Postings of songs still in the playlist
+    long stalePostings;              // Postings left behind by deleted songs
+    int built;                       // Built lazily on the first search
+} SearchIndex;
+
+// Search matching modes
+typedef enum SearchMode {
+    SEARCH_SUBSTRING,                // Query appears anywhere in a field
+    SEARCH_PREFIX                    // A word in a field starts with the query
+} SearchMode;
+
+// Header at the start of every slab in a node pool
+typedef struct PoolSlab {
+    struct PoolSlab* next;           // Next slab owned by the same pool
+} PoolSlab;
+
+// Structure for a fixed-size object pool (Slab Allocator + Free-List)
+typedef struct NodePool {
+    size_t objectSize;               // Bytes per object, rounded for alignment
+    int objectsPerSlab;              // Objects carved from each slab
+    void* freeList;                  // Singly linked list of free objects
+    PoolSlab* slabs;                 // Every slab, released in bulk
+    long slabCount;                  // Slabs allocated from the system
+    long allocations;                // poolAlloc calls
+    long frees;                      // poolFree calls
+    long liveObjects;                // Objects currently handed out
+    long peakObjects;                // Highest liveObjects seen
+} NodePool;
+
+#define SONG_POOL_SLAB 1024          // Songs per slab
+
+#define HISTORY_DEFAULT_CAPACITY 100 // Recently played entries kept
+#define HISTORY_MAX_CAPACITY 1000000
+
+// Structure for the recently played history (Ring Buffer of Song IDs)
+typedef struct PlayHistory {
+    int* ids;                        // Song IDs; the oldest entry is overwritten first
+    int capacity;                    // Maximum entries kept, 0 disables history
+    int head;                        // Slot the next push goes to
+    int count;                       // Entries currently held
+    long pushes;                     // Entries pushed over the whole session
+} PlayHistory;
+
+// Structure for the queue of upcoming songs (Growable Circular-Array Deque)
 typedef struct Queue {
-    QueueNode* front;                // Front of queue
-    QueueNode* rear;                 // Rear of queue
+    int* ids;                        // Song IDs in play order, wrapping around
+    int capacity;                    // Allocated slots, a power of two (or 0)
+    int head;                        // Slot of the front entry
     int count;                       // Number of songs in queue
 } Queue;
 
-// Structure for the music player system
-typedef struct MusicPlayer {
+// Structure for shuffled playback (Lazy Fisher-Yates over the playlist)
+typedef struct ShuffleOrder {
+    int* ids;                        // This round's songs, permuted as they are drawn
+    int count;                       // Songs in this round
+    int capacity;
+    int position;                    // Songs already played this round
+    int drawn;                       // ids[position] is picked but not yet played
+    uint64_t rng;                    // PRNG state, shared with queue shuffles
+} ShuffleOrder;
+
+// On-disk playlist formats
+typedef enum PlaylistFormat {
+    PLAYLIST_FORMAT_TEXT,            // id|title|artist|duration|filepath lines
+    PLAYLIST_FORMAT_BINARY           // Header + record table + string pool
+} PlaylistFormat;
+
+// Append-only log of playlist edits made since the last snapshot
+typedef struct PlaylistJournal {
+    int fd;                          // Journal file, -1 while journaling is off
+    char* buffer;                    // Records not yet written to the file
+    size_t size;
+    size_t capacity;
+    long records;                    // Records logged since the last snapshot
+    long snapshotSongs;              // Songs in the last snapshot
+    char snapshotPath[MAX_FILENAME];
+    char journalPath[MAX_FILENAME + 16];
+    PlaylistFormat format;           // Format snapshots are written in
+    pthread_mutex_t mutex;           // Guards the fields above and below
+    pthread_t compactor;             // Background snapshot writer
+    int compactorStarted;            // compactor has not been joined yet
+    int compacting;                  // compactor is still running
+} PlaylistJournal;
+
+// Songs whose cached pages some session still wants, counted per song
+// (open addressing on the song ID, guarded by its own mutex)
+typedef struct ReadAheadHold {
+    int songId;                      // 0 = empty slot
+    int refs;
+} ReadAheadHold;
+
+typedef struct ReadAheadRefs {
+    pthread_mutex_t mutex;
+    ReadAheadHold* slots;
+    int capacity;                    // Power of two
+    int count;
+} ReadAheadRefs;
+
+// Song data shared by every session that plays from it: the playlist, its
+// indexes and its journal. Sessions read it under the read lock; edits take
+// the write lock, and deleted songs stay retired until no session holds them.
+typedef struct SongCatalog {
     Song* playlist;                  // Head of playlist linked list
-    StackNode* recentlyPlayed;       // Top of recently played stack
-    Queue* upcomingQueue;            // Queue for upcoming songs
-    Song* currentSong;               // Currently playing song
+    Song* playlistTail;              // Last song in playlist (O(1) append)
+    SongIndex index;                 // ID -> Song lookup table
+    StringPool strings;              // Titles, artists and paths of all songs
+    PlaylistColumns columns;         // Scan-friendly copy of hot song fields
+    SearchIndex search;              // Trigram index over titles/artists/paths
+    SortedIndex sorted[SORT_KEY_COUNT]; // Artist, title and duration orders
     int songCount;                   // Total songs in playlist
     int nextId;                      // Next available song ID
+    NodePool songPool;               // Storage for every Song node
+    pthread_rwlock_t playlistLock;   // Guards the playlist, its indexes, strings, songPool and sessions
+    Song* retiredSongs;              // Deleted songs still referenced by playback state
+    int retiredCount;
+    PlaylistJournal journal;         // Edits since the last snapshot
+    struct MusicPlayer* sessions;    // Sessions playing from this catalog
+    int sessionCount;
+    ReadAheadRefs readAheadRefs;     // Sessions reading ahead or playing each song
+} SongCatalog;
+
+// Format of a RIFF/WAVE file
+#define WAV_FORMAT_PCM 1
+typedef struct WavInfo {
+    uint16_t format;                 // WAV_FORMAT_PCM for integer PCM
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint16_t bitsPerSample;
+    uint32_t frameSize;              // Bytes per frame (all channels)
+    uint32_t dataSize;               // Bytes of PCM data
+    long dataOffset;                 // File offset of the PCM data
+} WavInfo;
+
+// Gap measurements between consecutive tracks
+typedef struct TransitionStats {
+    long count;                      // Transitions measured
+    long prebufferHits;              // Transitions whose next track was ready
+    double lastGapMs;
+    double minGapMs;
+    double maxGapMs;
+    double totalGapMs;
+} TransitionStats;
+
+// First seconds of the next track, loaded while the current one plays
+typedef struct PrebufferedTrack {
+    Song* song;                      // Song the buffer belongs to
+    WavInfo wav;                     // Format, when the file is a PCM WAV
+    int isWav;
+    char* data;                      // PCM frames or leading file bytes
+    size_t size;
+} PrebufferedTrack;
+
+// Upcoming tracks whose leading bytes were handed to the page cache
+#define READAHEAD_DEFAULT_TRACKS 3
+#define READAHEAD_DEFAULT_BUDGET_MB 64
+#define READAHEAD_MAX_TRACKS 16
+
+typedef struct ReadAheadHint {
+    int songId;
+    char* path;                      // Copied so it outlives playlist edits
+    long long bytes;                 // Leading bytes advised
+} ReadAheadHint;
+
+typedef struct ReadAheadStats {
+    long hits;                       // Tracks started from a file read ahead
+    long misses;                     // Tracks started cold
+    long long hintedBytes;           // Bytes advised in total
+    long evictions;                  // Hints dropped for skipped tracks
+    long long evictedBytes;
+} ReadAheadStats;
+
+typedef struct ReadAhead {
+    int tracks;                      // Upcoming songs to read ahead, 0 = off
+    long long budgetBytes;           // Most bytes advised at once
+    ReadAheadHint hints[READAHEAD_MAX_TRACKS]; // Changed only by the session's loop pass
+    int hintCount;
+    int playingId;                   // Song held while it plays, 0 if none
+    ReadAheadStats stats;
+} ReadAhead;
+
+// Structure for one playback session (a zone or a user). Several sessions
+// can share one catalog; all of them are driven by a single event loop.
+typedef struct MusicPlayer {
+    SongCatalog* catalog;            // Songs, possibly shared with other sessions
+    struct MusicPlayer* prevSession; // Neighbours among the catalog's sessions
+    struct MusicPlayer* nextSession;
+    int sessionId;                   // Unique within the process
+    PlayHistory history;             // Recently played song IDs
+    Queue* upcomingQueue;            // Queue for upcoming songs
+    ShuffleOrder shuffle;            // Play order while shuffle is on
+    Song* currentSong;               // Currently playing song
+
+    // Playback state. catalog->playlistLock is taken before playbackMutex,
+    // which guards currentSong, the history, the queue, the shuffle order
+    // and the fields below. Flags read without either lock are atomic.
+    pthread_mutex_t playbackMutex;
+    atomic_int isPlaying;            // A track is running (paused or not)
+    atomic_int isPaused;             // Current track is paused
+    atomic_int autoPlayEnabled;      // Continue with the next song when a track ends
+    atomic_int manualStop;           // User stopped playback; don't auto-play
+    atomic_int gaplessEnabled;       // Pre-buffer the next track and switch without pauses
+    atomic_int shuffleEnabled;       // Continue in shuffled order instead of playlist order
+    atomic_int loudnessEnabled;      // Apply each song's loudness gain
+    time_t songStartTime;            // When the current song started
+    int currentSongDuration;
+    int playbackFinished;            // Set when the player reports its own end
+    int deadlineArmed;               // Whether songDeadline is the fallback end time
+    struct timespec songDeadline;    // Start time + duration on the monitor clock
+    double pausedRemainingMs;        // Deadline time left when paused, -1 if none
+    struct timespec trackEndedAt;    // When the last track ended (monitor clock)
+    int trackEndedAtValid;           // Whether trackEndedAt belongs to a pending switch
+    int engineAdvancedTo;            // Song the audio engine moved on to by itself, 0 if none
+    atomic_uint switchGeneration;    // Bumped by every track switch and stop
+    pthread_mutex_t outputMutex;     // Serialises starting and stopping the output
+    unsigned outputGeneration;       // Switch the running output belongs to (outputMutex)
+    TransitionStats transitionStats; // Gap between a track ending and the next starting
+    PrebufferedTrack prebuffer;      // Ready buffer for the next track
+    ReadAhead readAhead;             // Page-cache hints for the tracks after it
+    pthread_mutex_t prebufferLoadMutex; // One load at a time
+    struct AudioEngine* engine;      // In-process output for WAV files
+#ifndef _WIN32
+    pthread_mutex_t playerProcessMutex; // Guards the two fields below
+    pthread_cond_t playerWaiterDone;
+    pid_t playerPid;                 // Player child process, 0 when none is running
+    int playerWaiters;               // Threads still reaping player processes
+#endif
+
+    // Event loop bookkeeping, guarded by the loop's mutex
+    struct timespec wakeAt;          // Timer, valid while timerSlot >= 0
+    int timerSlot;                   // Position in the timer heap, -1 if none
+    int loopState;                   // Idle, ready, being serviced or detached
+    struct MusicPlayer* nextReady;   // Next session in the ready list
 } MusicPlayer;
 
+// Time spent launching and stopping the audio backend
+typedef struct AudioLatencyStats {
+    long startCount;
+    double startTotalMs;
+    double startMaxMs;
+    long stopCount;
+    double stopTotalMs;
+    double stopMaxMs;
+    long firstAudioCount;            // Engine tracks that reached the sink
+    double firstAudioTotalMs;        // Request to first samples written
+    double firstAudioMaxMs;
+} AudioLatencyStats;
+
+// Activity of the playback event loop shared by all sessions
+typedef struct PlaybackLoopStats {
+    int sessions;                    // Sessions attached
+    int threads;                     // Loop threads running
+    int timers;                      // Deadlines currently armed
+    long wakeups;                    // Session passes run
+    long timersFired;                // Deadlines that came due
+    double totalLatenessMs;          // How late deadlines were handled, summed
+    double maxLatenessMs;
+} PlaybackLoopStats;
+
+// Event counters kept by the metrics layer
+typedef enum MetricCounter {
+    METRIC_LOOP_WAKEUPS,             // Session passes run by the event loop
+    METRIC_TIMERS_FIRED,             // Track deadlines that came due
+    METRIC_TRACKS_STARTED,           // Tracks handed to an audio backend
+    METRIC_LOCK_ACQUIRES,            // playbackMutex acquisitions
+    METRIC_LOCK_CONTENDED,           // ... that had to wait
+    METRIC_POOL_ALLOCS,              // Objects taken from node pools
+    METRIC_SLAB_ALLOCS,              // Slabs malloc'd by node pools
+    METRIC_READAHEAD_HITS,           // Tracks started from a file read ahead
+    METRIC_READAHEAD_MISSES,         // Tracks started cold
+    METRIC_READAHEAD_BYTES,          // Bytes advised into the page cache
+    METRIC_READAHEAD_EVICTED_BYTES,  // Bytes dropped again for skipped tracks
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+// Latency distributions kept by the metrics layer
+typedef enum MetricHistogram {
+    METRIC_PLAY_START,               // Starting a track on the audio backend
+    METRIC_TRANSITION_GAP,           // End of one track to start of the next
+    METRIC_TIMER_LATENESS,           // How late the loop handled a deadline
+    METRIC_LOCK_WAIT,                // Waiting for a contended playbackMutex
+    METRIC_PLAYLIST_LOAD,            // Loading a playlist file
+    METRIC_PLAYLIST_SAVE,            // Writing a playlist file or snapshot
+    METRIC_FIRST_AUDIO,              // Track request to first samples at the sink
+    METRIC_HISTOGRAM_COUNT
+} MetricHistogram;
+
+// Histogram bucket i counts samples of at most 2^i microseconds; the last
+// bucket takes everything longer
+#define METRIC_BUCKETS 25
+
+typedef struct MetricHistogramData {
+    long long buckets[METRIC_BUCKETS + 1];
+    long long count;
+    long long sumNs;
+} MetricHistogramData;
+
+// Every thread's metrics added together
+typedef struct MetricsSnapshot {
+    long long counters[METRIC_COUNTER_COUNT];
+    MetricHistogramData histograms[METRIC_HISTOGRAM_COUNT];
+} MetricsSnapshot;
+
+// Outcome of a media library scan
+typedef struct ScanStats {
+    long directories;                // Folders listed
+    long audioFiles;                 // Files with an audio extension
+    long unchanged;                  // Skipped: same mtime and size as last scan
+    long added;                      // New songs
+    long updated;                    // Songs replaced because the file changed
+    long adopted;                    // Already in the playlist, now tracked
+    long failed;                     // Unreadable folders and files
+    long long bytesRead;             // Header bytes read from audio files
+    double elapsedMs;
+} ScanStats;
+
+// Outcome of a loudness analysis pass
+typedef struct LoudnessStats {
+    long tracks;                     // Songs with an audio file
+    long analysed;                   // Decoded and measured
+    long cached;                     // Same mtime and size as last time: not decoded
+    long unsupported;                // No decoder for the format
+    long failed;                     // Missing or unreadable files
+    long long bytesDecoded;          // PCM bytes run through the meter
+    int threads;
+    double elapsedMs;
+} LoudnessStats;
+
+// Destinations for the in-process audio engine
+typedef enum AudioSinkType {
+    AUDIO_SINK_NONE,                 // Engine off, external players only
+    AUDIO_SINK_NULL,                 // Discard samples (headless runs)
+    AUDIO_SINK_WAV,                  // Write the mixed stream to a WAV file
+    AUDIO_SINK_DEVICE,               // Sound device through an aplay pipe
+    AUDIO_SINK_CLOCK                 // No audio: tracks end on the playback clock
+} AudioSinkType;
+
 // Function Prototypes
 
 // Initialization and Cleanup
 MusicPlayer* initMusicPlayer();
+MusicPlayer* openSession(MusicPlayer* host);
 void freeMusicPlayer(MusicPlayer* player);
 
 // Playlist Management (Linked List Operations)
@@ -62,31 +475,187 @@ void deleteSong(MusicPlayer* player, int songId);
 void displayPlaylist(MusicPlayer* player);
 Song* findSongById(MusicPlayer* player, int songId);
 int getPlaylistSize(MusicPlayer* player);
+Song* findNextSong(MusicPlayer* player, Song* currentSong);
+long getTotalDuration(MusicPlayer* player);
+int findSongsByArtist(MusicPlayer* player, const char* artist, int* outIds, int maxIds);
+Song* playlistSongAt(MusicPlayer* player, int position);
+
+// Playlist Columns (Struct of Arrays)
+void initPlaylistColumns(PlaylistColumns* columns);
+void freePlaylistColumns(PlaylistColumns* columns);
+void columnsAppend(PlaylistColumns* columns, Song* song);
+void columnsRemove(PlaylistColumns* columns, Song* song);
+
+// Song Index (Hash Table Operations)
+void initSongIndex(SongIndex* index);
+void freeSongIndex(SongIndex* index);
+void songIndexInsert(SongIndex* index, Song* song);
+void songIndexRemove(SongIndex* index, int songId);
+Song* songIndexLookup(const SongIndex* index, int songId);
+
+// String Pool (Interned Strings)
+void initStringPool(StringPool* pool);
+void freeStringPool(StringPool* pool);
+StrRef stringPoolIntern(StringPool* pool, const char* str, size_t length);
+const char* stringPoolGet(const StringPool* pool, StrRef ref);
+int stringPoolFind(const StringPool* pool, const char* str, StrRef* ref);
+void stringPoolMerge(StringPool* dst, const StringPool* src, StrRef* remap);
+void stringPoolCompact(StringPool* pool, const unsigned char* live);
+const char* songTitle(const MusicPlayer* player, const Song* song);
+const char* songArtist(const MusicPlayer* player, const Song* song);
+const char* songFilepath(const MusicPlayer* player, const Song* song);
+
+// Search Index (Trigram Inverted Index)
+void initSearchIndex(SearchIndex* index);
+void freeSearchIndex(SearchIndex* index);
+void searchIndexAdd(SearchIndex* index, const StringPool* strings, const Song* song);
+void searchIndexRemove(SearchIndex* index, const StringPool* strings, const Song* song);
+int searchSongs(MusicPlayer* player, const char* query, SearchMode mode, int* outIds, int maxIds);
+
+// Sorted Indexes (Indexable Skip Lists)
+void initSortedIndex(SortedIndex* index, SortKey key);
+void freeSortedIndex(SortedIndex* index);
+void sortedIndexInsert(SortedIndex* index, const StringPool* strings, Song* song);
+void sortedIndexRemove(SortedIndex* index, const StringPool* strings, const Song* song);
+int listSongsSorted(MusicPlayer* player, SortKey key, int offset, int* outIds, int maxIds, int* copied);
+int findSongsByDuration(MusicPlayer* player, int minSeconds, int maxSeconds, int offset, int* outIds, int maxIds, int* copied);
+int listSongsByArtist(MusicPlayer* player, const char* artist, int offset, int* outIds, int maxIds, int* copied);
+int displaySortedPage(MusicPlayer* player, const int* ids, int count);
+void benchmarkSortedIndexes(MusicPlayer* player);
+
+// Node Pools (Slab Allocator)
+void initNodePool(NodePool* pool, size_t objectSize, int objectsPerSlab);
+void freeNodePool(NodePool* pool);
+void* poolAlloc(NodePool* pool);
+void poolFree(NodePool* pool, void* object);
+void poolMerge(NodePool* dst, NodePool* src);
+void displayAllocationStats(MusicPlayer* player);
+
+// Concurrency (Reader-Writer Lock + Deferred Reclamation)
+void reclaimRetiredSongs(MusicPlayer* player);
 
 // Playback Operations
 void playSong(MusicPlayer* player, int songId);
 void playNext(MusicPlayer* player);
+void playPrevious(MusicPlayer* player);
 void displayCurrentSong(MusicPlayer* player);
+double getPlaybackPosition(MusicPlayer* player);
+
+// Playback Event Loop (Shared Timer Heap)
+void getPlaybackLoopStats(PlaybackLoopStats* stats);
+
+// Audio Backend
+void playAudioFile(MusicPlayer* player, const char* filepath, double gainDb);
+void stopAudioFile(MusicPlayer* player);
+void pauseAudioFile(MusicPlayer* player);
+void resumeAudioFile(MusicPlayer* player);
+int isAudioPlaying(MusicPlayer* player);
+const char* detectAudioBackend();
+
+// Audio Engine (Decoder + Output Threads, SPSC Ring Buffer)
+void audioEngineConfigure(AudioSinkType sink, const char* path, int realtime);
+void audioEngineConfigureFromEnvironment();
+int audioEngineCanPlay(const char* filepath);
+int audioEngineStart(MusicPlayer* player, const char* filepath, double gainDb);
+void audioEngineStop(MusicPlayer* player);
+int audioEngineQueueNext(MusicPlayer* player, int songId, const char* filepath, const WavInfo* format, const char* data, size_t size,
+                         double gainDb);
+int audioEngineWantsNext(MusicPlayer* player);
+void audioEngineClearNext(MusicPlayer* player);
+int audioEngineActive(MusicPlayer* player);
+void audioEnginePause(MusicPlayer* player, int paused);
+void audioEngineSetVolume(MusicPlayer* player, double volume);
+double audioEnginePosition(MusicPlayer* player);
+void audioEngineStats(MusicPlayer* player, long* seamlessTransitions, long long* underrunFrames);
+void setCrossfadeDuration(double seconds);
+double getCrossfadeDuration();
 
-// Stack Operations (Recently Played)
+// DSP Kernels (SSE2/AVX2 with Scalar Fallback)
+const char* dspKernelName();
+void dspInt16ToFloat(const int16_t* src, float* dst, size_t count);
+void dspFloatToInt16(const float* src, int16_t* dst, size_t count);
+void dspApplyGain(int16_t* samples, size_t count, float gain);
+void dspMix(int16_t* dst, const int16_t* src, size_t count);
+void dspCrossfade(int16_t* dst, const int16_t* outgoing, const int16_t* incoming, size_t frames, int channels);
+void benchmarkDspKernels();
+
+// Gapless Playback
+int readWavHeader(FILE* file, WavInfo* info);
+void prebufferNextTrack(MusicPlayer* player);
+void toggleGapless(MusicPlayer* player);
+void displayTransitionStats(MusicPlayer* player);
+void setReadAhead(MusicPlayer* player, int tracks, long long budgetBytes);
+void displayReadAheadStats(MusicPlayer* player);
+
+// Play History (Ring Buffer of Song IDs)
 void pushToRecentlyPlayed(MusicPlayer* player, Song* song);
+int popRecentlyPlayed(MusicPlayer* player);
 void displayRecentlyPlayed(MusicPlayer* player);
 void clearRecentlyPlayed(MusicPlayer* player);
+void setHistoryCapacity(MusicPlayer* player, int capacity);
+int saveRecentlyPlayed(MusicPlayer* player, const char* filename);
+void loadRecentlyPlayed(MusicPlayer* player, const char* filename);
 
 // Queue Operations (Upcoming Songs)
 void enqueueUpcoming(MusicPlayer* player, Song* song);
+void enqueueUpcomingFront(MusicPlayer* player, Song* song);
+int enqueueUpcomingIds(MusicPlayer* player, const int* ids, int count);
+int enqueueArtist(MusicPlayer* player, const char* artist);
 Song* dequeueUpcoming(MusicPlayer* player);
+int moveUpcoming(MusicPlayer* player, int from, int to);
+void shuffleUpcoming(MusicPlayer* player);
 void displayUpcoming(MusicPlayer* player);
 void clearUpcoming(MusicPlayer* player);
 
+// Shuffle Play (Shuffle Without Repeats)
+void toggleShuffle(MusicPlayer* player);
+Song* nextShuffledSong(MusicPlayer* player);
+
 // File Handling (Persistence)
 void savePlaylistToFile(MusicPlayer* player, const char* filename);
 void loadPlaylistFromFile(MusicPlayer* player, const char* filename);
+void savePlaylistBinary(MusicPlayer* player, const char* filename);
+void loadPlaylistBinary(MusicPlayer* player, const char* filename);
+PlaylistFormat detectPlaylistFormat(const char* filename);
+PlaylistFormat loadPlaylist(MusicPlayer* player, const char* filename);
+void savePlaylist(MusicPlayer* player, const char* filename, PlaylistFormat format);
+
+// Journal (Append-Only Log + Background Compaction)
+int openPlaylistJournal(MusicPlayer* player, const char* filename, PlaylistFormat format);
+int commitPlaylist(MusicPlayer* player);
+void closePlaylistJournal(MusicPlayer* player);
+
+// Media Scanner (Parallel Directory Walk + Header Parsing)
+int scanMediaLibrary(MusicPlayer* player, const char* root, const char* cacheFile, ScanStats* stats);
+void displayScanStats(const ScanStats* stats);
+
+// Loudness Analysis (EBU R128 Meter + Worker Pool + Cache)
+int measureLoudness(const char* filepath, double* loudnessLufs, double* peak, long long* bytesDecoded);
+double loudnessGainDb(double loudnessLufs, double peak);
+int analyzeLoudness(MusicPlayer* player, const char* cacheFile, int threads, LoudnessStats* stats);
+void displayLoudnessStats(const LoudnessStats* stats);
+void toggleLoudnessNormalization(MusicPlayer* player);
+
+// Command Pipeline (Batch / Daemon Mode)
+int runCommandBatch(MusicPlayer* player, const char* commandFile, const char* playlistFile, PlaylistFormat format);
+int runCommandServer(MusicPlayer* player, const char* socketPath, const char* playlistFile, PlaylistFormat format);
+
+// Metrics (Per-Thread Counters + Histograms, Prometheus Export)
+void setMetricsEnabled(int enabled);
+int getMetricsEnabled();
+void getMetricsSnapshot(MetricsSnapshot* snapshot);
+double metricPercentileMs(const MetricHistogramData* histogram, double percentile);
+void writeMetrics(FILE* out);
+int exportMetrics(const char* filename);
+int startMetricsServer(const char* socketPath);
+void stopMetricsServer();
+void displayMetricsSummary();
 
 // Utility Functions
 void clearScreen();
 void displayMenu();
 void pauseScreen();
+int askNextPage();
 int getIntInput(const char* prompt);
 void getStringInput(const char* prompt, char* buffer, int maxLen);
 
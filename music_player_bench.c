@@ -0,0 +1,617 @@
+// Benchmark and load generator for the Audiora library.
+//
+// Builds a synthetic playlist of the requested size and times the public
+// playlist, history, queue and persistence functions one call at a time.
+// Latencies are printed as JSON percentiles so runs can be compared. With
+// --sessions it instead measures what each playback session costs in
+// memory and CPU when many of them share one catalog.
+//
+//   gcc -O2 -DAUDIORA_NO_MAIN -o audiora_bench music_player_bench.c music_player.c -lpthread -lm
+//   ./audiora_bench --songs 100000 --out results.json
+//   ./audiora_bench --songs 1000000 --generate big_playlist.txt
+//   ./audiora_bench --songs 10000 --sessions 10000 --seconds 5
+#include "music_player.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <windows.h>
+    #define dup _dup
+    #define dup2 _dup2
+    #define NULL_DEVICE "NUL"
+#else
+    #include <fcntl.h>
+    #include <sys/resource.h>
+    #include <unistd.h>
+    #define NULL_DEVICE "/dev/null"
+#endif
+
+#define BENCH_MAX_RESULTS 32
+#define BENCH_MAX_LEVELS 16              // Session counts tried in one scaling run
+
+typedef struct BenchOptions {
+    int songs;                       // Synthetic library size
+    int rounds;                      // Repetitions of whole-file operations
+    int lookups;                     // findSongById calls
+    uint64_t seed;
+    const char* outFile;             // JSON destination, NULL for stdout
+    const char* workDir;             // Where playlist files are written
+    const char* generateFile;        // Only write a library to this file
+    int binary;                      // Generated library format
+    int sessions;                    // Largest session count for the scaling run, 0 for none
+    int seconds;                     // How long each session count plays
+    int trackSeconds;                // Fixed song length, 0 for varied lengths
+} BenchOptions;
+
+// Latencies of one operation, in nanoseconds
+typedef struct BenchSeries {
+    const char* name;
+    uint64_t* samples;
+    int count;
+    int capacity;
+} BenchSeries;
+
+typedef struct BenchReport {
+    BenchSeries series[BENCH_MAX_RESULTS];
+    int count;
+    NodePool catalogPool;            // Counters of the library's Song pool
+    NodePool benchPool;              // Counters of the pool timed against malloc
+} BenchReport;
+
+static uint64_t benchClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// splitmix64: the same library for the same seed on every platform
+static uint64_t benchRandom(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static BenchSeries* newSeries(BenchReport* report, const char* name, int expected) {
+    if (report->count == BENCH_MAX_RESULTS) exit(1);
+    BenchSeries* series = &report->series[report->count++];
+    series->name = name;
+    series->count = 0;
+    series->capacity = expected > 0 ? expected : 1;
+    series->samples = (uint64_t*)malloc((size_t)series->capacity * sizeof(uint64_t));
+    if (!series->samples) exit(1);
+    return series;
+}
+
+static void addSample(BenchSeries* series, uint64_t nanoseconds) {
+    if (series->count == series->capacity) {
+        series->capacity *= 2;
+        series->samples = (uint64_t*)realloc(series->samples, (size_t)series->capacity * sizeof(uint64_t));
+        if (!series->samples) exit(1);
+    }
+    series->samples[series->count++] = nanoseconds;
+}
+
+static int compareSamples(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static uint64_t percentile(const BenchSeries* series, double p) {
+    int rank = (int)(p / 100.0 * series->count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > series->count) rank = series->count;
+    return series->samples[rank - 1];
+}
+
+// The library prints a line per add/delete; keep it out of the timings
+static int silenceStdout() {
+    fflush(stdout);
+    int saved = dup(1);
+    FILE* sink = fopen(NULL_DEVICE, "w");
+    if (saved < 0 || !sink) exit(1);
+    dup2(fileno(sink), 1);
+    fclose(sink);
+    return saved;
+}
+
+static void restoreStdout(int saved) {
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+}
+
+// Song fields for the i-th synthetic track: about 50 tracks per artist
+static void syntheticSong(uint64_t* rng, int i, int songs, char* title, char* artist, int* duration, char* path) {
+    static const char* words[] = { "Midnight", "Echo", "River", "Golden", "Static", "Summer", "Neon", "Paper",
+                                   "Hollow", "Signal", "Velvet", "Northern", "Glass", "Wild", "Silent", "Fire" };
+    int artistCount = songs / 50 + 1;
+    int artistId = (int)(benchRandom(rng) % (uint64_t)artistCount);
+    uint64_t bits = benchRandom(rng);
+    snprintf(title, MAX_TITLE, "%s %s %d", words[bits & 15], words[(bits >> 4) & 15], i);
+    snprintf(artist, MAX_ARTIST, "Artist %05d", artistId);
+    *duration = 60 + (int)((bits >> 8) % 540);
+    snprintf(path, MAX_FILENAME, "/music/artist%05d/track%07d.mp3", artistId, i);
+}
+
+static MusicPlayer* buildLibrary(const BenchOptions* options, BenchSeries* adds) {
+    MusicPlayer* player = initMusicPlayer();
+    uint64_t rng = options->seed;
+    char title[MAX_TITLE], artist[MAX_ARTIST], path[MAX_FILENAME];
+    int duration;
+    for (int i = 0; i < options->songs; i++) {
+        syntheticSong(&rng, i, options->songs, title, artist, &duration, path);
+        if (options->trackSeconds > 0) duration = options->trackSeconds;
+        uint64_t start = benchClock();
+        addSong(player, title, artist, duration, path);
+        if (adds) addSample(adds, benchClock() - start);
+    }
+    return player;
+}
+
+static void benchLookups(MusicPlayer* player, const BenchOptions* options, BenchReport* report) {
+    BenchSeries* series = newSeries(report, "find_song_by_id", options->lookups);
+    uint64_t rng = options->seed ^ 0x1F;
+    volatile int sink = 0;
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    for (int i = 0; i < options->lookups; i++) {
+        int id = 1 + (int)(benchRandom(&rng) % (uint64_t)options->songs);
+        uint64_t start = benchClock();
+        Song* song = findSongById(player, id);
+        addSample(series, benchClock() - start);
+        if (song) sink += song->duration;
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    (void)sink;
+}
+
+// Queue and history calls need the session's playbackMutex, as they do in
+// the player
+static void benchQueue(MusicPlayer* player, const BenchOptions* options, BenchReport* report) {
+    int operations = options->songs < 100000 ? options->songs : 100000;
+    BenchSeries* enqueues = newSeries(report, "enqueue_upcoming", operations);
+    BenchSeries* dequeues = newSeries(report, "dequeue_upcoming", operations);
+    BenchSeries* pushes = newSeries(report, "push_recently_played", operations);
+    BenchSeries* pops = newSeries(report, "pop_recently_played", operations);
+
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    pthread_mutex_lock(&player->playbackMutex);
+    Song* song = player->catalog->playlist;
+    for (int i = 0; i < operations && song; i++, song = song->next) {
+        uint64_t start = benchClock();
+        enqueueUpcoming(player, song);
+        addSample(enqueues, benchClock() - start);
+        start = benchClock();
+        pushToRecentlyPlayed(player, song);
+        addSample(pushes, benchClock() - start);
+    }
+    for (int i = 0; i < operations; i++) {
+        uint64_t start = benchClock();
+        Song* next = dequeueUpcoming(player);
+        addSample(dequeues, benchClock() - start);
+        start = benchClock();
+        int previous = popRecentlyPlayed(player);
+        addSample(pops, benchClock() - start);
+        if (!next && !previous) break;
+    }
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+}
+
+static void benchQueries(MusicPlayer* player, const BenchOptions* options, BenchReport* report) {
+    const int queries = 1000;
+    int ids[50];
+    int copied;
+    uint64_t rng = options->seed ^ 0x2F;
+    // Both indexes are built by their first query; time that separately
+    uint64_t start = benchClock();
+    searchSongs(player, "Echo", SEARCH_SUBSTRING, ids, 50);
+    addSample(newSeries(report, "build_search_index", 1), benchClock() - start);
+    start = benchClock();
+    listSongsSorted(player, SORT_BY_TITLE, 0, ids, 20, &copied);
+    addSample(newSeries(report, "build_sorted_index", 1), benchClock() - start);
+
+    BenchSeries* searches = newSeries(report, "search_songs", queries);
+    BenchSeries* pages = newSeries(report, "sorted_page", queries);
+    for (int i = 0; i < queries; i++) {
+        char query[32];
+        snprintf(query, sizeof(query), "%d", (int)(benchRandom(&rng) % (uint64_t)options->songs));
+        start = benchClock();
+        searchSongs(player, query, SEARCH_SUBSTRING, ids, 50);
+        addSample(searches, benchClock() - start);
+        int offset = (int)(benchRandom(&rng) % (uint64_t)options->songs);
+        start = benchClock();
+        listSongsSorted(player, SORT_BY_TITLE, offset, ids, 20, &copied);
+        addSample(pages, benchClock() - start);
+    }
+}
+
+// Delete a tenth of the songs, each ID once, in random order
+static void benchDeletes(MusicPlayer* player, const BenchOptions* options, BenchReport* report) {
+    int deletes = options->songs / 10 > 0 ? options->songs / 10 : 1;
+    int* ids = (int*)malloc((size_t)options->songs * sizeof(int));
+    if (!ids) exit(1);
+    for (int i = 0; i < options->songs; i++) ids[i] = i + 1;
+    BenchSeries* series = newSeries(report, "delete_song", deletes);
+    uint64_t rng = options->seed ^ 0x3F;
+    for (int i = 0; i < deletes; i++) {
+        int j = i + (int)(benchRandom(&rng) % (uint64_t)(options->songs - i));
+        int id = ids[j];
+        ids[j] = ids[i];
+        uint64_t start = benchClock();
+        deleteSong(player, id);
+        addSample(series, benchClock() - start);
+    }
+    free(ids);
+}
+
+// Allocate and free Song-sized nodes with malloc and with a NodePool, in the
+// same random free order, twice over so the second round reuses freed memory
+static void benchAllocator(const BenchOptions* options, BenchReport* report) {
+    int nodes = options->songs < 100000 ? options->songs : 100000;
+    void** objects = (void**)malloc((size_t)nodes * sizeof(void*));
+    int* order = (int*)malloc((size_t)nodes * sizeof(int));
+    if (!objects || !order) exit(1);
+    for (int i = 0; i < nodes; i++) order[i] = i;
+    uint64_t rng = options->seed ^ 0x4F;
+    for (int i = nodes - 1; i > 0; i--) {
+        int j = (int)(benchRandom(&rng) % (uint64_t)(i + 1));
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+
+    BenchSeries* mallocs = newSeries(report, "malloc_song", 2 * nodes);
+    BenchSeries* frees = newSeries(report, "free_song", 2 * nodes);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < nodes; i++) {
+            uint64_t start = benchClock();
+            objects[i] = malloc(sizeof(Song));
+            addSample(mallocs, benchClock() - start);
+            if (!objects[i]) exit(1);
+            memset(objects[i], 0, sizeof(Song));
+        }
+        for (int i = 0; i < nodes; i++) {
+            uint64_t start = benchClock();
+            free(objects[order[i]]);
+            addSample(frees, benchClock() - start);
+        }
+    }
+
+    BenchSeries* poolAllocs = newSeries(report, "pool_alloc_song", 2 * nodes);
+    BenchSeries* poolFrees = newSeries(report, "pool_free_song", 2 * nodes);
+    NodePool pool;
+    initNodePool(&pool, sizeof(Song), SONG_POOL_SLAB);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < nodes; i++) {
+            uint64_t start = benchClock();
+            objects[i] = poolAlloc(&pool);
+            addSample(poolAllocs, benchClock() - start);
+            memset(objects[i], 0, sizeof(Song));
+        }
+        for (int i = 0; i < nodes; i++) {
+            uint64_t start = benchClock();
+            poolFree(&pool, objects[order[i]]);
+            addSample(poolFrees, benchClock() - start);
+        }
+    }
+    report->benchPool = pool;
+    freeNodePool(&pool);
+    free(objects);
+    free(order);
+}
+
+// Save the library in both formats each round, then time loading each file
+// into a fresh player
+static void benchPersistence(MusicPlayer** player, const BenchOptions* options, BenchReport* report) {
+    char textFile[MAX_FILENAME], binaryFile[MAX_FILENAME];
+    snprintf(textFile, sizeof(textFile), "%s/audiora_bench.txt", options->workDir);
+    snprintf(binaryFile, sizeof(binaryFile), "%s/audiora_bench.bin", options->workDir);
+
+    BenchSeries* saveText = newSeries(report, "save_playlist_text", options->rounds);
+    BenchSeries* saveBinary = newSeries(report, "save_playlist_binary", options->rounds);
+    for (int r = 0; r < options->rounds; r++) {
+        uint64_t start = benchClock();
+        savePlaylistToFile(*player, textFile);
+        addSample(saveText, benchClock() - start);
+        start = benchClock();
+        savePlaylistBinary(*player, binaryFile);
+        addSample(saveBinary, benchClock() - start);
+    }
+    freeMusicPlayer(*player);
+
+    BenchSeries* loadText = newSeries(report, "load_playlist_text", options->rounds);
+    BenchSeries* loadBinary = newSeries(report, "load_playlist_binary", options->rounds);
+    for (int r = 0; r < options->rounds; r++) {
+        MusicPlayer* fresh = initMusicPlayer();
+        uint64_t start = benchClock();
+        loadPlaylistFromFile(fresh, textFile);
+        addSample(loadText, benchClock() - start);
+        freeMusicPlayer(fresh);
+
+        fresh = initMusicPlayer();
+        start = benchClock();
+        loadPlaylistBinary(fresh, binaryFile);
+        addSample(loadBinary, benchClock() - start);
+        if (r + 1 < options->rounds) freeMusicPlayer(fresh);
+        else *player = fresh;
+    }
+    remove(textFile);
+    remove(binaryFile);
+}
+
+// ----------------------------------------------------------------------------
+// Session scaling: sessions share the library's catalog and play it through
+// on the playback clock (no audio), so the figures are what the sessions and
+// the shared event loop cost, not what decoding does.
+// ----------------------------------------------------------------------------
+typedef struct ScalingLevel {
+    int sessions;
+    double setupUsPerSession;        // openSession + playSong
+    double teardownUsPerSession;     // freeMusicPlayer
+    long long residentBytes;         // Resident set growth while the sessions run
+    double cpuSeconds;               // User + system time while playing
+    double wallSeconds;
+    long transitions;                // Tracks the sessions moved on to
+    long expectedTransitions;
+    long timersFired;
+    double avgLatenessMs;            // Deadline to handling, per fired timer
+    double maxLatenessMs;
+    int loopThreads;
+} ScalingLevel;
+
+static double cpuSeconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    ULARGE_INTEGER k = { { kernel.dwLowDateTime, kernel.dwHighDateTime } };
+    ULARGE_INTEGER u = { { user.dwLowDateTime, user.dwHighDateTime } };
+    return (double)(k.QuadPart + u.QuadPart) / 1e7;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           (double)usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+// Current resident set size, -1 where it cannot be read
+static long long residentBytes() {
+    long long pages = -1;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        long long size;
+        if (fscanf(statm, "%lld %lld", &size, &pages) != 2) pages = -1;
+        fclose(statm);
+    }
+#ifdef _WIN32
+    return pages;
+#else
+    return pages < 0 ? -1 : pages * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static void sleepSeconds(int seconds) {
+#ifdef _WIN32
+    Sleep((DWORD)seconds * 1000);
+#else
+    struct timespec delay = { seconds, 0 };
+    while (nanosleep(&delay, &delay) != 0);
+#endif
+}
+
+static long countTransitions(MusicPlayer** sessions, int count) {
+    long transitions = 0;
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&sessions[i]->playbackMutex);
+        transitions += sessions[i]->transitionStats.count;
+        pthread_mutex_unlock(&sessions[i]->playbackMutex);
+    }
+    return transitions;
+}
+
+static void runScalingLevel(MusicPlayer* host, const BenchOptions* options, int count, ScalingLevel* level) {
+    MusicPlayer** sessions = (MusicPlayer**)malloc((size_t)count * sizeof(MusicPlayer*));
+    if (!sessions) exit(1);
+    uint64_t rng = options->seed ^ (uint64_t)count;
+    memset(level, 0, sizeof(ScalingLevel));
+    level->sessions = count;
+
+    long long baseline = residentBytes();
+    PlaybackLoopStats before, after;
+    uint64_t start = benchClock();
+    for (int i = 0; i < count; i++) {
+        sessions[i] = openSession(host);
+        sessions[i]->gaplessEnabled = 0; // Nothing to read ahead without audio
+        playSong(sessions[i], 1 + (int)(benchRandom(&rng) % (uint64_t)options->songs));
+    }
+    level->setupUsPerSession = (double)(benchClock() - start) / 1e3 / count;
+
+    getPlaybackLoopStats(&before);
+    long transitionsBefore = countTransitions(sessions, count);
+    double cpuBefore = cpuSeconds();
+    start = benchClock();
+    sleepSeconds(options->seconds);
+    level->wallSeconds = (double)(benchClock() - start) / 1e9;
+    level->cpuSeconds = cpuSeconds() - cpuBefore;
+    getPlaybackLoopStats(&after);
+    long long resident = residentBytes();
+    level->residentBytes = baseline < 0 || resident < 0 ? -1 : resident - baseline;
+
+    level->transitions = countTransitions(sessions, count) - transitionsBefore;
+    level->expectedTransitions = (long)count * (long)(level->wallSeconds / options->trackSeconds);
+    level->timersFired = after.timersFired - before.timersFired;
+    if (level->timersFired > 0)
+        level->avgLatenessMs = (after.totalLatenessMs - before.totalLatenessMs) / level->timersFired;
+    level->maxLatenessMs = after.maxLatenessMs;
+    level->loopThreads = after.threads;
+
+    start = benchClock();
+    for (int i = 0; i < count; i++) freeMusicPlayer(sessions[i]);
+    level->teardownUsPerSession = (double)(benchClock() - start) / 1e3 / count;
+    free(sessions);
+}
+
+// Try 1, 10, 100, ... sessions up to the requested count
+static int runScalingBenchmark(const BenchOptions* options, ScalingLevel* levels) {
+    MusicPlayer* host = buildLibrary(options, NULL);
+    audioEngineConfigure(AUDIO_SINK_CLOCK, NULL, 1);
+    int count = 0;
+    for (int sessions = 1; count < BENCH_MAX_LEVELS; sessions *= 10) {
+        if (sessions > options->sessions) sessions = options->sessions;
+        runScalingLevel(host, options, sessions, &levels[count++]);
+        if (sessions == options->sessions) break;
+    }
+    freeMusicPlayer(host);
+    return count;
+}
+
+static void writeScalingReport(FILE* out, const BenchOptions* options, const ScalingLevel* levels, int count) {
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(out, "{\n  \"benchmark\": \"audiora-sessions\",\n  \"timestamp\": \"%s\",\n", stamp);
+    fprintf(out, "  \"songs\": %d,\n  \"track_seconds\": %d,\n  \"seconds\": %d,\n  \"seed\": %llu,\n  \"results\": [\n",
+            options->songs, options->trackSeconds, options->seconds, (unsigned long long)options->seed);
+    for (int i = 0; i < count; i++) {
+        const ScalingLevel* level = &levels[i];
+        double cpuPerSession = level->cpuSeconds / level->wallSeconds / level->sessions;
+        fprintf(out, "    {\"sessions\": %d, \"loop_threads\": %d, \"resident_bytes_per_session\": %lld, "
+                     "\"setup_us_per_session\": %.2f, \"teardown_us_per_session\": %.2f, "
+                     "\"cpu_percent\": %.2f, \"cpu_us_per_session_second\": %.3f, "
+                     "\"transitions\": %ld, \"expected_transitions\": %ld, \"timers_fired\": %ld, "
+                     "\"avg_lateness_ms\": %.3f, \"max_lateness_ms\": %.3f}%s\n",
+                level->sessions, level->loopThreads,
+                level->residentBytes < 0 ? -1 : level->residentBytes / level->sessions,
+                level->setupUsPerSession, level->teardownUsPerSession,
+                level->cpuSeconds / level->wallSeconds * 100.0, cpuPerSession * 1e6,
+                level->transitions, level->expectedTransitions, level->timersFired,
+                level->avgLatenessMs, level->maxLatenessMs, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void writePoolCounters(FILE* out, const char* name, const NodePool* pool, const char* separator) {
+    fprintf(out, "    \"%s\": {\"object_bytes\": %zu, \"allocations\": %ld, \"frees\": %ld, \"live\": %ld, "
+                 "\"peak\": %ld, \"slabs\": %ld}%s\n",
+            name, pool->objectSize, pool->allocations, pool->frees, pool->liveObjects, pool->peakObjects,
+            pool->slabCount, separator);
+}
+
+static void writeReport(FILE* out, const BenchOptions* options, BenchReport* report) {
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(out, "{\n  \"benchmark\": \"audiora\",\n  \"timestamp\": \"%s\",\n", stamp);
+    fprintf(out, "  \"songs\": %d,\n  \"rounds\": %d,\n  \"seed\": %llu,\n  \"unit\": \"ns\",\n  \"results\": [\n",
+            options->songs, options->rounds, (unsigned long long)options->seed);
+    int last = report->count - 1;
+    while (last >= 0 && report->series[last].count == 0) last--;
+    for (int i = 0; i <= last; i++) {
+        BenchSeries* series = &report->series[i];
+        if (series->count == 0) continue;
+        qsort(series->samples, (size_t)series->count, sizeof(uint64_t), compareSamples);
+        double total = 0;
+        for (int s = 0; s < series->count; s++) total += (double)series->samples[s];
+        double mean = total / series->count;
+        fprintf(out, "    {\"name\": \"%s\", \"samples\": %d, \"mean\": %.0f, \"min\": %llu, \"p50\": %llu, "
+                     "\"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu, \"ops_per_sec\": %.0f}%s\n",
+                series->name, series->count, mean, (unsigned long long)series->samples[0],
+                (unsigned long long)percentile(series, 50), (unsigned long long)percentile(series, 90),
+                (unsigned long long)percentile(series, 99), (unsigned long long)percentile(series, 99.9),
+                (unsigned long long)series->samples[series->count - 1], mean > 0 ? 1e9 / mean : 0,
+                i < last ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"pools\": {\n");
+    writePoolCounters(out, "catalog_song", &report->catalogPool, ",");
+    writePoolCounters(out, "bench_song", &report->benchPool, "");
+    fprintf(out, "  }\n}\n");
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [--songs N] [--rounds N] [--lookups N] [--seed N] [--dir DIR] [--out FILE]\n"
+            "       %s --songs N --generate FILE [--binary]\n"
+            "       %s --sessions N [--seconds N] [--track-seconds N] [--songs N] [--out FILE]\n",
+            program, program, program);
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options = { 100000, 5, 1000000, 42, NULL, ".", NULL, 0, 0, 5, 0 };
+    for (int i = 1; i < argc; i++) {
+        int hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--songs") == 0 && hasValue) options.songs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rounds") == 0 && hasValue) options.rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--lookups") == 0 && hasValue) options.lookups = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue) options.seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--dir") == 0 && hasValue) options.workDir = argv[++i];
+        else if (strcmp(argv[i], "--out") == 0 && hasValue) options.outFile = argv[++i];
+        else if (strcmp(argv[i], "--generate") == 0 && hasValue) options.generateFile = argv[++i];
+        else if (strcmp(argv[i], "--binary") == 0) options.binary = 1;
+        else if (strcmp(argv[i], "--sessions") == 0 && hasValue) options.sessions = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue) options.seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--track-seconds") == 0 && hasValue) options.trackSeconds = atoi(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (options.songs < 1 || options.rounds < 1 || options.lookups < 1 || options.sessions < 0 ||
+        options.seconds < 1 || options.trackSeconds < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Load generation: write a library for the player or other tools
+    if (options.generateFile) {
+        int saved = silenceStdout();
+        MusicPlayer* player = buildLibrary(&options, NULL);
+        savePlaylist(player, options.generateFile, options.binary ? PLAYLIST_FORMAT_BINARY : PLAYLIST_FORMAT_TEXT);
+        freeMusicPlayer(player);
+        restoreStdout(saved);
+        fprintf(stderr, "Wrote %d songs to %s\n", options.songs, options.generateFile);
+        return 0;
+    }
+
+    FILE* out = options.outFile ? fopen(options.outFile, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: cannot write %s\n", options.outFile);
+        return 1;
+    }
+
+    // Scaling run: one-second tracks unless told otherwise
+    if (options.sessions > 0) {
+        if (options.trackSeconds == 0) options.trackSeconds = 1;
+        ScalingLevel levels[BENCH_MAX_LEVELS];
+        int saved = silenceStdout();
+        int count = runScalingBenchmark(&options, levels);
+        restoreStdout(saved);
+        writeScalingReport(out, &options, levels, count);
+        if (out != stdout) fclose(out);
+        return 0;
+    }
+
+    BenchReport report;
+    report.count = 0;
+    int saved = silenceStdout();
+    MusicPlayer* player = buildLibrary(&options, newSeries(&report, "add_song", options.songs));
+    benchLookups(player, &options, &report);
+    benchQueue(player, &options, &report);
+    benchQueries(player, &options, &report);
+    benchPersistence(&player, &options, &report);
+    benchDeletes(player, &options, &report);
+    benchAllocator(&options, &report);
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    report.catalogPool = player->catalog->songPool;
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    freeMusicPlayer(player);
+    restoreStdout(saved);
+
+    writeReport(out, &options, &report);
+    if (out != stdout) fclose(out);
+    for (int i = 0; i < report.count; i++) free(report.series[i].samples);
+    return 0;
+}
@@ -0,0 +1,558 @@
+// Multi-threaded stress test for the Audiora library.
+//
+// One writer adds and deletes songs while readers search, page through the
+// sorted indexes and walk the playlist, and a controller per session plays,
+// skips, pauses and queues songs. Two sessions share the catalog, so the
+// event loop pre-buffers, reads ahead and switches tracks for both at the
+// same time, and a scraper reads the metrics throughout. Tracks are short
+// WAV files played through the null sink. On Linux a second phase races
+// playNext against picks and stops on external players: a stand-in mpg123
+// that never ends is put first on PATH, and afterwards the session must own
+// exactly the player process of its current song. Build it with
+// ThreadSanitizer to check the locking; any report is a bug.
+//
+//   gcc -g -O1 -fsanitize=thread -DAUDIORA_NO_MAIN -o audiora_stress music_player_stress.c music_player.c -lpthread -lm
+//   ./audiora_stress --seconds 10 --dir /tmp
+//
+// Exits with 1 if the playlist and its indexes disagree afterwards, or if a
+// player process was left behind or plays the wrong song.
+#include "music_player.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <windows.h>
+    #define dup2 _dup2
+    #define NULL_DEVICE "NUL"
+#else
+    #include <dirent.h>
+    #include <signal.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define NULL_DEVICE "/dev/null"
+#endif
+
+#define STRESS_FILES 4                   // Distinct WAV files the songs point at
+#define STRESS_SESSIONS 2
+#define STRESS_READERS 2
+#define STRESS_TRACK_MS 300              // Length of each WAV file
+#define STRESS_SWITCH_SONGS 16           // Songs for the external player phase
+#define STRESS_PLAYER "mpg123"           // Name of the stand-in player
+
+typedef struct StressOptions {
+    int seconds;
+    int songs;                       // Songs in the playlist at the start
+    const char* dir;                 // Where the WAV files are written
+} StressOptions;
+
+typedef struct StressWorker {
+    MusicPlayer* player;
+    uint64_t seed;
+    long operations;
+} StressWorker;
+
+static atomic_int stopping;
+static char stressFiles[STRESS_FILES][512];
+static char standInPlayer[512];
+static const char* const stressArtists[] = { "Alpha", "Beta", "Gamma", "Delta", "Epsilon" };
+static const char* const stressQueries[] = { "al", "song 1", "eta", "ps", "zz", "a" };
+#define STRESS_ARTISTS (int)(sizeof(stressArtists) / sizeof(stressArtists[0]))
+#define STRESS_QUERIES (int)(sizeof(stressQueries) / sizeof(stressQueries[0]))
+
+// splitmix64, one state per thread
+static uint64_t stressRandom(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int stressBelow(uint64_t* state, int bound) {
+    return bound > 0 ? (int)(stressRandom(state) % (uint64_t)bound) : 0;
+}
+
+static void writeLE(FILE* file, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) fputc((int)((value >> (8 * i)) & 0xFF), file);
+}
+
+// A short 16-bit stereo tone the audio engine can play
+static int writeStressWav(const char* path, int pitch) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return -1;
+    uint32_t frames = 48000u * STRESS_TRACK_MS / 1000u;
+    uint32_t dataBytes = frames * 4;
+    fwrite("RIFF", 1, 4, file);
+    writeLE(file, 36 + dataBytes, 4);
+    fwrite("WAVEfmt ", 1, 8, file);
+    writeLE(file, 16, 4);
+    writeLE(file, 1, 2);
+    writeLE(file, 2, 2);
+    writeLE(file, 48000, 4);
+    writeLE(file, 48000 * 4, 4);
+    writeLE(file, 4, 2);
+    writeLE(file, 16, 2);
+    fwrite("data", 1, 4, file);
+    writeLE(file, dataBytes, 4);
+    for (uint32_t i = 0; i < frames; i++) {
+        int16_t sample = (int16_t)(((i * (uint32_t)pitch) & 0xFF) * 16 - 2048);
+        writeLE(file, (uint16_t)sample, 2);
+        writeLE(file, (uint16_t)sample, 2);
+    }
+    return fclose(file);
+}
+
+static void addStressSong(MusicPlayer* player, uint64_t* seed, int number) {
+    char title[64];
+    snprintf(title, sizeof(title), "Song %d", number);
+    int file = stressBelow(seed, STRESS_FILES + 1);
+    addSong(player, title, stressArtists[stressBelow(seed, STRESS_ARTISTS)], 1 + stressBelow(seed, 2),
+            file < STRESS_FILES ? stressFiles[file] : "");
+}
+
+// ID of a random song in the playlist, or -1 if it is empty
+static int pickSongId(MusicPlayer* player, uint64_t* seed) {
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    int size = player->catalog->songCount;
+    Song* song = size > 0 ? playlistSongAt(player, stressBelow(seed, size)) : NULL;
+    int id = song ? song->id : -1;
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return id;
+}
+
+// Adds and deletes songs, so readers and playback see songs retired under them
+static void* writerThread(void* arg) {
+    StressWorker* worker = (StressWorker*)arg;
+    int added = 0;
+    while (!atomic_load(&stopping)) {
+        addStressSong(worker->player, &worker->seed, 100000 + added++);
+        int id = pickSongId(worker->player, &worker->seed);
+        if (id >= 0) deleteSong(worker->player, id);
+        worker->operations += 2;
+    }
+    return NULL;
+}
+
+static void* readerThread(void* arg) {
+    StressWorker* worker = (StressWorker*)arg;
+    MusicPlayer* player = worker->player;
+    int ids[64];
+    int copied;
+    while (!atomic_load(&stopping)) {
+        switch (stressBelow(&worker->seed, 5)) {
+            case 0:
+                searchSongs(player, stressQueries[stressBelow(&worker->seed, STRESS_QUERIES)],
+                            stressBelow(&worker->seed, 2) ? SEARCH_PREFIX : SEARCH_SUBSTRING, ids, 64);
+                break;
+            case 1:
+                listSongsSorted(player, (SortKey)stressBelow(&worker->seed, SORT_KEY_COUNT), stressBelow(&worker->seed, 100),
+                                ids, 64, &copied);
+                break;
+            case 2:
+                findSongsByDuration(player, 1, 2, 0, ids, 64, &copied);
+                break;
+            case 3:
+                listSongsByArtist(player, stressArtists[stressBelow(&worker->seed, STRESS_ARTISTS)], 0, ids, 64, &copied);
+                break;
+            default:
+                getTotalDuration(player);
+                findSongsByArtist(player, stressArtists[stressBelow(&worker->seed, STRESS_ARTISTS)], ids, 64);
+                break;
+        }
+        worker->operations++;
+    }
+    return NULL;
+}
+
+// Drives one session the way the menu and the command pipeline do
+static void* controllerThread(void* arg) {
+    StressWorker* worker = (StressWorker*)arg;
+    MusicPlayer* player = worker->player;
+    while (!atomic_load(&stopping)) {
+        switch (stressBelow(&worker->seed, 9)) {
+            case 0:
+            case 1: {
+                int id = pickSongId(player, &worker->seed);
+                if (id >= 0) playSong(player, id);
+                break;
+            }
+            case 2:
+                playNext(player);
+                break;
+            case 3:
+                playPrevious(player);
+                break;
+            case 4:
+                pthread_mutex_lock(&player->playbackMutex);
+                if (player->isPaused) resumeAudioFile(player);
+                else pauseAudioFile(player);
+                pthread_mutex_unlock(&player->playbackMutex);
+                break;
+            case 5:
+                enqueueArtist(player, stressArtists[stressBelow(&worker->seed, STRESS_ARTISTS)]);
+                break;
+            case 6:
+                pthread_mutex_lock(&player->playbackMutex);
+                if (stressBelow(&worker->seed, 2)) shuffleUpcoming(player);
+                else clearUpcoming(player);
+                pthread_mutex_unlock(&player->playbackMutex);
+                break;
+            case 7:
+                if (stressBelow(&worker->seed, 4) == 0) toggleShuffle(player);
+                else prebufferNextTrack(player);
+                break;
+            default:
+                displayCurrentSong(player);
+                setReadAhead(player, stressBelow(&worker->seed, 4), 1024 * 1024);
+                break;
+        }
+        worker->operations++;
+        // Now and then let a track run out, so the loop advances on its own
+        long sleepMs = stressBelow(&worker->seed, 16) == 0 ? 2 * STRESS_TRACK_MS : 2;
+        struct timespec pause = { sleepMs / 1000, (sleepMs % 1000) * 1000000L };
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+static void* scraperThread(void* arg) {
+    StressWorker* worker = (StressWorker*)arg;
+    FILE* sink = fopen(NULL_DEVICE, "w");
+    if (!sink) return NULL;
+    while (!atomic_load(&stopping)) {
+        MetricsSnapshot snapshot;
+        getMetricsSnapshot(&snapshot);
+        writeMetrics(sink);
+        PlaybackLoopStats loop;
+        getPlaybackLoopStats(&loop);
+        worker->operations++;
+        struct timespec pause = { 0, 5000000L };
+        nanosleep(&pause, NULL);
+    }
+    fclose(sink);
+    return NULL;
+}
+
+// Every index must hold exactly the songs in the playlist
+static int checkConsistency(MusicPlayer* player) {
+    int size = getPlaylistSize(player);
+    int failures = 0;
+    int ids[1];
+    int copied;
+    for (int key = 0; key < SORT_KEY_COUNT; key++) {
+        int total = listSongsSorted(player, (SortKey)key, 0, ids, 1, &copied);
+        if (total != size) {
+            fprintf(stderr, "sorted index %d holds %d songs, playlist %d\n", key, total, size);
+            failures++;
+        }
+    }
+    int byDuration = findSongsByDuration(player, 0, 1000000, 0, ids, 1, &copied);
+    if (byDuration != size) {
+        fprintf(stderr, "duration range holds %d songs, playlist %d\n", byDuration, size);
+        failures++;
+    }
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    for (int position = 0; position < size; position++) {
+        Song* song = playlistSongAt(player, position);
+        if (!song || findSongById(player, song->id) != song) {
+            fprintf(stderr, "playlist position %d is not in the ID index\n", position);
+            failures++;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    return failures;
+}
+
+#ifdef __linux__
+// ----------------------------------------------------------------------------
+// Track switches on external players. The event loop's playNext starts its
+// track without playbackMutex, so a pick or a stop from another thread can
+// land in between; whichever comes last must win and no player may be
+// orphaned. The stand-in player loops forever, so every process a session
+// starts stays visible in /proc until it is killed.
+// ----------------------------------------------------------------------------
+static int installStandInPlayer(const char* dir) {
+    char binDir[480];
+    snprintf(binDir, sizeof(binDir), "%s/audiora_stress_bin", dir);
+    mkdir(binDir, 0755);
+    snprintf(standInPlayer, sizeof(standInPlayer), "%s/%s", binDir, STRESS_PLAYER);
+    FILE* script = fopen(standInPlayer, "w");
+    if (!script) return -1;
+    fprintf(script, "#!/bin/sh\nwhile :; do sleep 0.2; done\n");
+    fclose(script);
+    chmod(standInPlayer, 0755);
+
+    const char* path = getenv("PATH");
+    char* newPath = (char*)malloc(strlen(binDir) + (path ? strlen(path) : 0) + 2);
+    if (!newPath) exit(1);
+    sprintf(newPath, "%s:%s", binDir, path ? path : "");
+    setenv("PATH", newPath, 1);
+    free(newPath);
+    return 0;
+}
+
+static void removeStandInPlayer() {
+    remove(standInPlayer);
+    char* slash = strrchr(standInPlayer, '/');
+    if (slash) *slash = '\0';
+    rmdir(standInPlayer);
+}
+
+// Live stand-in players started by this process; the file the last one
+// seen plays goes to lastFile. A non-zero signal is sent to each of them.
+static int countStandInPlayers(int signal, pid_t* lastPid, char* lastFile, size_t size) {
+    DIR* proc = opendir("/proc");
+    if (!proc) return -1;
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(proc))) {
+        char path[300], stat[512];
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+        FILE* file = fopen(path, "r");
+        if (!file) continue;
+        size_t length = fread(stat, 1, sizeof(stat) - 1, file);
+        fclose(file);
+        stat[length] = '\0';
+        char* close = strrchr(stat, ')');
+        char state;
+        int parent;
+        if (!close || strncmp(stat, entry->d_name, strlen(entry->d_name)) != 0 ||
+            strstr(stat, "(" STRESS_PLAYER ")") == NULL || sscanf(close + 1, " %c %d", &state, &parent) != 2 ||
+            parent != getpid() || state == 'Z')
+            continue;
+        count++;
+        if (signal) kill((pid_t)atoi(entry->d_name), signal);
+        if (lastPid) *lastPid = (pid_t)atoi(entry->d_name);
+        if (lastFile) {
+            // cmdline is "/bin/sh\0script\0-q\0FILE\0": the file comes last
+            char cmdline[600];
+            snprintf(path, sizeof(path), "/proc/%s/cmdline", entry->d_name);
+            file = fopen(path, "r");
+            length = file ? fread(cmdline, 1, sizeof(cmdline) - 1, file) : 0;
+            if (file) fclose(file);
+            cmdline[length] = '\0';
+            while (length > 0 && cmdline[length - 1] == '\0') length--;
+            while (length > 0 && cmdline[length - 1] != '\0') length--;
+            snprintf(lastFile, size, "%s", cmdline + length);
+        }
+    }
+    closedir(proc);
+    return count;
+}
+
+// Players die asynchronously once signalled; give them a moment
+static int settleStandInPlayers(int expected, pid_t* lastPid, char* lastFile, size_t size) {
+    int count = -1;
+    for (int attempt = 0; attempt < 200; attempt++) {
+        count = countStandInPlayers(0, lastPid, lastFile, size);
+        if (count == expected) break;
+        struct timespec pause = { 0, 10000000L };
+        nanosleep(&pause, NULL);
+    }
+    return count;
+}
+
+static void* skipperThread(void* arg) {
+    StressWorker* worker = (StressWorker*)arg;
+    while (!atomic_load(&stopping)) {
+        playNext(worker->player);
+        worker->operations++;
+        struct timespec pause = { 0, (long)stressBelow(&worker->seed, 2000) * 1000L };
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+static void* pickerThread(void* arg) {
+    StressWorker* worker = (StressWorker*)arg;
+    MusicPlayer* player = worker->player;
+    while (!atomic_load(&stopping)) {
+        int action = stressBelow(&worker->seed, 10);
+        if (action < 7) {
+            int id = pickSongId(player, &worker->seed);
+            if (id >= 0) playSong(player, id);
+        } else if (action < 9) {
+            playPrevious(player);
+        } else {
+            pthread_mutex_lock(&player->playbackMutex);
+            stopAudioFile(player);
+            pthread_mutex_unlock(&player->playbackMutex);
+        }
+        worker->operations++;
+        struct timespec pause = { 0, (long)stressBelow(&worker->seed, 2000) * 1000L };
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+// Returns the number of problems found; *switches gets the calls made
+static int runSwitchPhase(const StressOptions* options, long* switches) {
+    MusicPlayer* player = initMusicPlayer();
+    audioEngineConfigure(AUDIO_SINK_NONE, NULL, 1); // Every track goes to the external player
+    for (int i = 0; i < STRESS_SWITCH_SONGS; i++) {
+        char title[32], path[600];
+        snprintf(title, sizeof(title), "Switch %d", i);
+        snprintf(path, sizeof(path), "%s/audiora_switch_%d.mp3", options->dir, i);
+        addSong(player, title, stressArtists[i % STRESS_ARTISTS], 600, i % 8 == 7 ? "" : path);
+    }
+    playSong(player, 1);
+
+    atomic_store(&stopping, 0);
+    StressWorker skipper = { player, 30, 0 };
+    StressWorker picker = { player, 31, 0 };
+    pthread_t skipperId, pickerId;
+    pthread_create(&skipperId, NULL, skipperThread, &skipper);
+    pthread_create(&pickerId, NULL, pickerThread, &picker);
+    struct timespec duration = { options->seconds > 1 ? options->seconds / 2 : 1, 0 };
+    nanosleep(&duration, NULL);
+    atomic_store(&stopping, 1);
+    pthread_join(skipperId, NULL);
+    pthread_join(pickerId, NULL);
+    *switches = skipper.operations + picker.operations;
+
+    // The current song, if it has a file and is playing, must be the one
+    // process left, and it must be the session's own
+    char expected[600] = "";
+    pthread_rwlock_rdlock(&player->catalog->playlistLock);
+    pthread_mutex_lock(&player->playbackMutex);
+    Song* song = player->currentSong;
+    if (song && player->isPlaying && song->filepath != EMPTY_STRING_REF)
+        snprintf(expected, sizeof(expected), "%s", songFilepath(player, song));
+    pthread_mutex_unlock(&player->playbackMutex);
+    pthread_rwlock_unlock(&player->catalog->playlistLock);
+    pthread_mutex_lock(&player->playerProcessMutex);
+    pid_t ownPid = player->playerPid;
+    pthread_mutex_unlock(&player->playerProcessMutex);
+
+    int failures = 0;
+    pid_t livePid = 0;
+    char liveFile[600] = "";
+    int live = settleStandInPlayers(expected[0] ? 1 : 0, &livePid, liveFile, sizeof(liveFile));
+    if (live != (expected[0] ? 1 : 0)) {
+        fprintf(stderr, "%d player process(es) running, expected %d\n", live, expected[0] ? 1 : 0);
+        failures++;
+    } else if (expected[0] && (livePid != ownPid || strcmp(liveFile, expected) != 0)) {
+        fprintf(stderr, "player %d plays %s; session tracks %d playing %s\n", (int)livePid, liveFile, (int)ownPid,
+                expected);
+        failures++;
+    }
+    // Orphans would keep freeMusicPlayer waiting for them to exit
+    if (failures) countStandInPlayers(SIGKILL, NULL, NULL, 0);
+
+    freeMusicPlayer(player);
+    live = settleStandInPlayers(0, NULL, NULL, 0);
+    if (live != 0) {
+        fprintf(stderr, "%d player process(es) outlived their session\n", live);
+        failures++;
+    }
+    return failures;
+}
+#endif
+
+static int parseOptions(int argc, char** argv, StressOptions* options) {
+    options->seconds = 5;
+    options->songs = 200;
+    options->dir = ".";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) options->seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--songs") == 0 && i + 1 < argc) options->songs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) options->dir = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s [--seconds N] [--songs N] [--dir PATH]\n", argv[0]);
+            return -1;
+        }
+    }
+    return options->seconds > 0 && options->songs >= 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    StressOptions options;
+    if (parseOptions(argc, argv, &options) != 0) return 2;
+    for (int i = 0; i < STRESS_FILES; i++) {
+        snprintf(stressFiles[i], sizeof(stressFiles[i]), "%s/audiora_stress_%d.wav", options.dir, i);
+        if (writeStressWav(stressFiles[i], 3 + i * 2) != 0) {
+            fprintf(stderr, "Error: cannot write %s\n", stressFiles[i]);
+            return 2;
+        }
+    }
+
+#ifdef __linux__
+    // Before the first session: the external player is looked up only once
+    if (installStandInPlayer(options.dir) != 0) {
+        fprintf(stderr, "Error: cannot write %s\n", standInPlayer);
+        return 2;
+    }
+#endif
+
+    // The library reports every action on stdout; keep the summary readable
+    fflush(stdout);
+    int savedStdout = dup(1);
+    FILE* quiet = fopen(NULL_DEVICE, "w");
+    if (quiet) dup2(fileno(quiet), 1);
+
+    MusicPlayer* sessions[STRESS_SESSIONS];
+    sessions[0] = initMusicPlayer();
+    audioEngineConfigure(AUDIO_SINK_NULL, NULL, 1);
+    for (int s = 1; s < STRESS_SESSIONS; s++) sessions[s] = openSession(sessions[0]);
+    setMetricsEnabled(1);
+    setCrossfadeDuration(0.1);
+    uint64_t seed = 42;
+    for (int i = 0; i < options.songs; i++) addStressSong(sessions[0], &seed, i);
+
+    StressWorker writer = { sessions[0], 1, 0 };
+    StressWorker readers[STRESS_READERS];
+    StressWorker controllers[STRESS_SESSIONS];
+    StressWorker scraper = { sessions[0], 2, 0 };
+    pthread_t writerId, scraperId, readerIds[STRESS_READERS], controllerIds[STRESS_SESSIONS];
+    pthread_create(&writerId, NULL, writerThread, &writer);
+    for (int i = 0; i < STRESS_READERS; i++) {
+        readers[i] = (StressWorker){ sessions[i % STRESS_SESSIONS], 10 + (uint64_t)i, 0 };
+        pthread_create(&readerIds[i], NULL, readerThread, &readers[i]);
+    }
+    for (int s = 0; s < STRESS_SESSIONS; s++) {
+        controllers[s] = (StressWorker){ sessions[s], 20 + (uint64_t)s, 0 };
+        pthread_create(&controllerIds[s], NULL, controllerThread, &controllers[s]);
+    }
+    pthread_create(&scraperId, NULL, scraperThread, &scraper);
+
+    struct timespec duration = { options.seconds, 0 };
+    nanosleep(&duration, NULL);
+    atomic_store(&stopping, 1);
+    pthread_join(writerId, NULL);
+    for (int i = 0; i < STRESS_READERS; i++) pthread_join(readerIds[i], NULL);
+    for (int s = 0; s < STRESS_SESSIONS; s++) pthread_join(controllerIds[s], NULL);
+    pthread_join(scraperId, NULL);
+
+    int failures = 0;
+    for (int s = 0; s < STRESS_SESSIONS; s++) failures += checkConsistency(sessions[s]);
+    long long transitions = 0;
+    for (int s = 0; s < STRESS_SESSIONS; s++) {
+        pthread_mutex_lock(&sessions[s]->playbackMutex);
+        transitions += sessions[s]->transitionStats.count;
+        pthread_mutex_unlock(&sessions[s]->playbackMutex);
+    }
+    int songsLeft = getPlaylistSize(sessions[0]);
+    for (int s = STRESS_SESSIONS - 1; s >= 0; s--) freeMusicPlayer(sessions[s]);
+    long switches = 0;
+#ifdef __linux__
+    failures += runSwitchPhase(&options, &switches);
+    removeStandInPlayer();
+#endif
+
+    fflush(stdout);
+    if (savedStdout >= 0) dup2(savedStdout, 1);
+    if (quiet) fclose(quiet);
+    long readerOps = 0, controllerOps = 0;
+    for (int i = 0; i < STRESS_READERS; i++) readerOps += readers[i].operations;
+    for (int s = 0; s < STRESS_SESSIONS; s++) controllerOps += controllers[s].operations;
+    printf("writer %ld, readers %ld, controllers %ld, scrapes %ld operations; %lld transitions; %d songs left\n",
+           writer.operations, readerOps, controllerOps, scraper.operations, transitions, songsLeft);
+    if (switches > 0) printf("%ld track switches on external players\n", switches);
+    for (int i = 0; i < STRESS_FILES; i++) remove(stressFiles[i]);
+    printf("%s\n", failures == 0 ? "consistent" : "INCONSISTENT");
+    return failures == 0 ? 0 : 1;
+}